@@ -0,0 +1,431 @@
+#ifndef __COAX_CONTROL__
+#define __COAX_CONTROL__
+
+#include <string>
+
+#include "coax_dynamics/CoaXKernels.h"
+
+// Position and heading controller of coax_ros_control and its reference
+// trajectories, shared with the batch simulation of coax_simulator.
+
+#define TRAJECTORY_SPIRAL 0
+#define TRAJECTORY_ROTINPLACE 1
+#define TRAJECTORY_VERTOSCIL 2
+#define TRAJECTORY_LYINGCIRCLE 3
+#define TRAJECTORY_STANDINGCIRCLE 4
+#define TRAJECTORY_YAWOSCIL 5
+#define TRAJECTORY_HORZLINE 6
+#define TRAJECTORY_STEP 7
+#define TRAJECTORY_TABLE 8 // reference table of coax_trajectory, param trajectory/table
+
+// elements of a reference: x y z xdot ydot zdot xddot yddot zddot yaw
+// yaw_rate
+#define REFERENCE_DIMENSION 11
+
+typedef struct
+{
+  double Kp_Fx;
+  double Kp_Fy;
+  double Kp_Fz;
+  double Kd_Fx;
+  double Kd_Fy;
+  double Kd_Fz;
+  double Kp_Mz;
+  double Kd_Mz;
+  double Kpq_roll;
+  double Kpq_pitch;
+} control_params_t;
+
+// world force x y z of the position loop, heading and yaw rate
+#define SETPOINT_DIMENSION 5
+
+// Gains of the inner loop, AttitudeControlLaw: rate damping, heading and
+// yaw rate, and the rotor speed feedback (0: open loop, as ControlLaw)
+typedef struct
+{
+  double Kpq_roll;
+  double Kpq_pitch;
+  double Kp_Mz;
+  double Kd_Mz;
+  double K_Omega;
+} attitude_params_t;
+
+// Servo offsets that level the swash plate of one airframe, added to the
+// servo commands on take off
+typedef struct
+{
+  double roll;
+  double pitch;
+} servo_trim_t;
+
+// Gains under prefix, named as in
+// coax_ros_control/config/coax_control_params.yaml and defaulting to its
+// values. NodeHandle is a ros::NodeHandle, a template so that this package
+// does not depend on roscpp.
+template <class NodeHandle>
+inline void LoadControlParams(NodeHandle &n, const std::string &prefix, control_params_t &control_params)
+{
+  n.param(prefix + "lateral/proportional/x", control_params.Kp_Fx, 0.7);
+  n.param(prefix + "lateral/proportional/y", control_params.Kp_Fy, 0.7);
+  n.param(prefix + "lateral/differential/x", control_params.Kd_Fx, 0.4);
+  n.param(prefix + "lateral/differential/y", control_params.Kd_Fy, 0.4);
+  n.param(prefix + "heave_yaw/force/proportional", control_params.Kp_Fz, 6.04);
+  n.param(prefix + "heave_yaw/force/differential", control_params.Kd_Fz, 3.02);
+  n.param(prefix + "heave_yaw/moment/proportional", control_params.Kp_Mz, 0.013893);
+  n.param(prefix + "heave_yaw/moment/differential", control_params.Kd_Mz, 0.00166716);
+  n.param(prefix + "pq_damping/roll", control_params.Kpq_roll, -0.04);
+  n.param(prefix + "pq_damping/pitch", control_params.Kpq_pitch, 0.04);
+}
+
+// Gains of the inner loop under prefix, named as under inner_loop/ in
+// coax_ros_control/config/coax_control_params.yaml and defaulting to its
+// values.
+template <class NodeHandle>
+inline void LoadAttitudeParams(NodeHandle &n, const std::string &prefix, attitude_params_t &attitude_params)
+{
+  n.param(prefix + "rate_damping/roll", attitude_params.Kpq_roll, -0.04);
+  n.param(prefix + "rate_damping/pitch", attitude_params.Kpq_pitch, 0.04);
+  n.param(prefix + "yaw/proportional", attitude_params.Kp_Mz, 0.013893);
+  n.param(prefix + "yaw/differential", attitude_params.Kd_Mz, 0.00166716);
+  n.param(prefix + "rotor_speed/gain", attitude_params.K_Omega, 1.0);
+}
+
+// Servo trims under prefix, named as under servo_trim/ in
+// coax_ros_control/config/coax_parameters.yaml, 0 if not set.
+template <class NodeHandle>
+inline void LoadServoTrim(NodeHandle &n, const std::string &prefix, servo_trim_t &servo_trim)
+{
+  n.param(prefix + "servo_trim/roll", servo_trim.roll, 0.0);
+  n.param(prefix + "servo_trim/pitch", servo_trim.pitch, 0.0);
+}
+
+// Outer loop, at the rate of the position measurement: the world force
+// the position and velocity errors ask for, without the rate damping, and
+// the heading reference. Reads x y z xdot ydot zdot of coax_state.
+template <class T>
+inline void PositionControlLaw(const T* coax_state, const T* trajectory,
+                               const coax_params_t &model_params, const control_params_t &control_params,
+                               T* setpoint)
+{
+  T m = model_params.mass;
+  T kpxy[2] = {T(control_params.Kp_Fx), T(control_params.Kp_Fy)};
+  T kdxy[2] = {T(control_params.Kd_Fx), T(control_params.Kd_Fy)};
+
+  for (int i = 0; i < 2; i++){
+    T pos_error = coax_state[i] - trajectory[i];
+    T vel_error = coax_state[3+i] - trajectory[3+i];
+    setpoint[i] = -kpxy[i]*pos_error - kdxy[i]*vel_error + m*trajectory[6+i];
+  }
+
+  setpoint[2] = -T(control_params.Kp_Fz)*(coax_state[2] - trajectory[2]) -
+    T(control_params.Kd_Fz)*(coax_state[5] - trajectory[5]) + m*trajectory[8];
+  setpoint[3] = trajectory[9];
+  setpoint[4] = trajectory[10];
+}
+
+// Inner loop, at the rate of the gyro: motor commands and servos, not
+// limited, for the setpoint of PositionControlLaw. The body rates damp the
+// lateral force, the thrust directions, servos and rotor speeds follow the
+// attitude, heading and yaw rate, and the rotor speed estimates. With
+// K_Omega > 0 the rotor speeds are closed on the estimates in
+// coax_state, which shortens the motor lag by 1 + K_Omega as long as the
+// commands are not limited. Reads roll pitch yaw p q r Omega_up Omega_lo
+// z_bar of coax_state and Rb2w.
+template <class T>
+inline void AttitudeControlLaw(const T* coax_state, const T Rb2w[3][3], const T* setpoint,
+                               const coax_params_t &model_params, const attitude_params_t &attitude_params,
+                               T* control)
+{
+  using coax_math::atan2;
+  using coax_math::sqrt;
+
+  T p = coax_state[9];
+  T q = coax_state[10];
+  T r = coax_state[11];
+
+  // rotor speeds
+  T Omega_up = coax_state[12];
+  T Omega_lo = coax_state[13];
+
+  // stabilizer bar direction
+  T z_bar[3] = {coax_state[14], coax_state[15], coax_state[16]};
+
+  // Parameters
+  T g = 9.81;
+  T m = model_params.mass;
+  T l_up = model_params.l_up;
+  T l_lo = model_params.l_lo;
+  T k_Tup = model_params.k_Tup;
+  T k_Tlo = model_params.k_Tlo;
+  T k_Mup = model_params.k_Mup;
+  T k_Mlo = model_params.k_Mlo;
+  T rs_mup = model_params.rs_mup;
+  T rs_bup = model_params.rs_bup;
+  T rs_mlo = model_params.rs_mlo;
+  T rs_blo = model_params.rs_blo;
+  T zeta_mup = model_params.zeta_mup;
+  T zeta_bup = model_params.zeta_bup;
+  T zeta_mlo = model_params.zeta_mlo;
+  T zeta_blo = model_params.zeta_blo;
+  T max_SPangle = model_params.max_SPangle;
+
+  // Desired Forces
+  T kpq[2] = {T(attitude_params.Kpq_pitch), T(attitude_params.Kpq_roll)};
+  T pq_error[2] = {q, p};
+
+  T Fxy_des[2];
+  for (int i = 0; i < 2; i++)
+    Fxy_des[i] = setpoint[i] - (Rb2w[i][0]*kpq[0]*pq_error[0] + Rb2w[i][1]*kpq[1]*pq_error[1]);
+
+  // Upper thrust vector direction
+  T z_Tup[3];
+  UpperThrustDirection(z_bar, l_up, zeta_mup*Omega_up + zeta_bup, z_Tup);
+
+  // Lower thrust vector direction
+  T z_Tlo[3];
+  if (Omega_lo < 10){
+    z_Tlo[0] = 0;
+    z_Tlo[1] = 0;
+    z_Tlo[2] = 1;
+  }else{
+    z_Tlo[0] = 1/(k_Tlo*Omega_lo*Omega_lo)*(Rb2w[0][0]*Fxy_des[0] + Rb2w[1][0]*Fxy_des[1]);
+    z_Tlo[1] = 1/(k_Tlo*Omega_lo*Omega_lo)*(Rb2w[0][1]*Fxy_des[0] + Rb2w[1][1]*Fxy_des[1]);
+    z_Tlo[2] = sqrt(1 - z_Tlo[0]*z_Tlo[0] - z_Tlo[1]*z_Tlo[1]);
+  }
+
+  // servos for that direction, corrected for the phase lag
+  LowerThrustServos(z_Tlo, l_lo, zeta_mlo*Omega_lo + zeta_blo, max_SPangle, &control[2]);
+
+  // Heave-yaw control
+  T Fz_des = setpoint[2];
+  T ori_error = atan2(Rb2w[1][0], Rb2w[0][0]) - setpoint[3];
+  while (ori_error > T(M_PI))
+    ori_error = ori_error - T(2*M_PI);
+  while (ori_error < -T(M_PI))
+    ori_error = ori_error + T(2*M_PI);
+  T Mz_des = -T(attitude_params.Kp_Mz)*ori_error - T(attitude_params.Kd_Mz)*(r - setpoint[4]);
+
+  T up_z = Rb2w[2][0]*z_Tup[0] + Rb2w[2][1]*z_Tup[1] + Rb2w[2][2]*z_Tup[2];
+  T lo_z = Rb2w[2][0]*z_Tlo[0] + Rb2w[2][1]*z_Tlo[1] + Rb2w[2][2]*z_Tlo[2];
+  T A = k_Tup/k_Mup*Mz_des*up_z;
+  T B = k_Tup/k_Mup*k_Mlo*up_z + k_Tlo*lo_z;
+
+  T Omega_lo_des = sqrt((m*g + A + Fz_des)/B);
+  T Omega_up_des = sqrt((k_Mlo*Omega_lo_des*Omega_lo_des - Mz_des)/k_Mup);
+  if (attitude_params.K_Omega > 0){
+    Omega_up_des = Omega_up_des + T(attitude_params.K_Omega)*(Omega_up_des - Omega_up);
+    Omega_lo_des = Omega_lo_des + T(attitude_params.K_Omega)*(Omega_lo_des - Omega_lo);
+  }
+  control[0] = (Omega_up_des - rs_bup)/rs_mup;
+  control[1] = (Omega_lo_des - rs_blo)/rs_mlo;
+}
+
+// Motor commands and servos, not limited, that track the reference
+// trajectory: lateral forces from the position and velocity errors tilt
+// the lower thrust through the swash plate, heave and yaw set the rotor
+// speeds. coax_state is the public model state (x y z xdot ydot zdot roll
+// pitch yaw p q r Omega_up Omega_lo z_bar), Rb2w its attitude. The
+// position loop and the attitude loop below at the same rate, with the
+// rate damping and yaw gains of control_params.
+template <class T>
+inline void ControlLaw(const T* coax_state, const T Rb2w[3][3], const T* trajectory,
+                       const coax_params_t &model_params, const control_params_t &control_params,
+                       T* control)
+{
+  T setpoint[SETPOINT_DIMENSION];
+  PositionControlLaw(coax_state, trajectory, model_params, control_params, setpoint);
+
+  attitude_params_t attitude_params;
+  attitude_params.Kpq_roll = control_params.Kpq_roll;
+  attitude_params.Kpq_pitch = control_params.Kpq_pitch;
+  attitude_params.Kp_Mz = control_params.Kp_Mz;
+  attitude_params.Kd_Mz = control_params.Kd_Mz;
+  attitude_params.K_Omega = 0;
+  AttitudeControlLaw(coax_state, Rb2w, setpoint, model_params, attitude_params, control);
+}
+
+// Reference of the TRAJECTORY_* type at time since its start, and the pose
+// x y z yaw it starts from in init_traj_pose. TRAJECTORY_TABLE and unknown
+// types hover at 1 m.
+inline void ReferenceTrajectory(double time, int type, double* trajectory, double* init_traj_pose)
+{
+  using std::sin;
+  using std::cos;
+
+  double radius;
+  double omega;
+  double omega_vert;
+  double amplitude;
+  double vert_amp;
+  double length;
+  double vel;
+
+  for (int i = 0; i < REFERENCE_DIMENSION; i++)
+    trajectory[i] = 0;
+
+  switch (type)
+    {
+    case TRAJECTORY_SPIRAL:
+      radius = 1;
+      omega = 2*M_PI/10;
+      vel = 0.5;
+
+      init_traj_pose[0] = radius;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 0.5;
+      init_traj_pose[3] = M_PI/2;
+
+      trajectory[0] = radius*cos(omega*time);
+      trajectory[1] = radius*sin(omega*time);
+      trajectory[2] = init_traj_pose[2] + vel*time;
+      trajectory[3] = -radius*omega*sin(omega*time);
+      trajectory[4] = radius*omega*cos(omega*time);
+      trajectory[5] = vel;
+      trajectory[6] = -radius*omega*omega*cos(omega*time);
+      trajectory[7] = -radius*omega*omega*sin(omega*time);
+      trajectory[9] = omega*time + init_traj_pose[3];
+      trajectory[10] = omega;
+      break;
+
+    case TRAJECTORY_ROTINPLACE:
+      omega = 2*M_PI/2;
+
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = 0;
+
+      trajectory[0] = init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2];
+      trajectory[9] = omega*time + init_traj_pose[3];
+      trajectory[10] = omega;
+      break;
+
+    case TRAJECTORY_VERTOSCIL:
+      amplitude = 0.5;
+      omega = 2*M_PI/5;
+
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = 0;
+
+      trajectory[0] = init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2] + amplitude*sin(omega*time);
+      trajectory[5] = amplitude*omega*cos(omega*time);
+      trajectory[8] = -amplitude*omega*omega*sin(omega*time);
+      trajectory[9] = init_traj_pose[3];
+      break;
+
+    case TRAJECTORY_LYINGCIRCLE:
+      radius = 0.5;
+      omega = 2*M_PI/10;
+      omega_vert = 2*omega;
+      vert_amp = 0.2;
+
+      init_traj_pose[0] = 0.5;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = -M_PI/2;
+
+      trajectory[0] = radius*cos(omega*time) - radius + init_traj_pose[0];
+      trajectory[1] = radius*sin(omega*time) + init_traj_pose[1];
+      trajectory[2] = vert_amp*sin(omega_vert*time) + init_traj_pose[2];
+      trajectory[3] = -radius*omega*sin(omega*time);
+      trajectory[4] = radius*omega*cos(omega*time);
+      trajectory[5] = omega_vert*vert_amp*cos(omega_vert*time);
+      trajectory[6] = -radius*omega*omega*cos(omega*time);
+      trajectory[7] = -radius*omega*omega*sin(omega*time);
+      trajectory[8] = -omega_vert*omega_vert*vert_amp*sin(omega_vert*time);
+      trajectory[9] = init_traj_pose[3];
+      trajectory[10] = 0;
+      break;
+
+    case TRAJECTORY_STANDINGCIRCLE:
+      radius = 1;
+      omega = 2*M_PI/10;
+
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = 0;
+
+      trajectory[0] = radius*sin(omega*time) + init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2] + radius - radius*cos(omega*time);
+      trajectory[3] = radius*omega*cos(omega*time);
+      trajectory[5] = -radius*omega*sin(omega*time);
+      trajectory[6] = -radius*omega*omega*sin(omega*time);
+      trajectory[8] = -radius*omega*omega*cos(omega*time);
+      trajectory[9] = init_traj_pose[3];
+      break;
+
+    case TRAJECTORY_YAWOSCIL:
+      amplitude = M_PI/2;
+      omega = 2*M_PI/4;
+
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = 0;
+
+      trajectory[0] = init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2];
+      trajectory[9] = init_traj_pose[3] + amplitude*sin(omega*time);
+      trajectory[10] = amplitude*omega*cos(omega*time);
+      break;
+
+    case TRAJECTORY_HORZLINE:
+      length = 0.5;
+      vel = 0.15;
+
+      init_traj_pose[0] = 0.5;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = M_PI;
+
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2];
+      trajectory[9] = init_traj_pose[3];
+      if (time < length/vel){
+        trajectory[0] = init_traj_pose[0] - time*vel;
+        trajectory[3] = -vel;
+      }else{
+        trajectory[0] = init_traj_pose[0] - length;
+      }
+      break;
+
+    case TRAJECTORY_STEP:
+      amplitude = M_PI/2;
+
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 0.8;
+      init_traj_pose[3] = -0.8*M_PI;
+
+      trajectory[0] = init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2];
+      if (time < 10)
+        trajectory[9] = init_traj_pose[3];
+      else
+        trajectory[9] = init_traj_pose[3] + amplitude;
+      break;
+
+    default:
+      init_traj_pose[0] = 0;
+      init_traj_pose[1] = 0;
+      init_traj_pose[2] = 1;
+      init_traj_pose[3] = 0;
+
+      trajectory[0] = init_traj_pose[0];
+      trajectory[1] = init_traj_pose[1];
+      trajectory[2] = init_traj_pose[2];
+      trajectory[9] = init_traj_pose[3];
+      break;
+    }
+}
+#endif
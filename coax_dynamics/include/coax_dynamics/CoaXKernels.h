@@ -0,0 +1,307 @@
+#ifndef __COAX_KERNELS__
+#define __COAX_KERNELS__
+
+#include "coax_dynamics/CoaXMath.h"
+
+// Building blocks of the CoaX equations of motion shared by the simulator,
+// the controller and the grey box models of the system identification.
+// Everything is a template on the scalar type: double, float and Dual<N>
+// all work, any other type needs the math functions, comparisons with
+// double and the arithmetic with double. The math functions are those of
+// coax_math, exact or fast with COAX_FAST_MATH (CoaXMath.h).
+
+// Identified parameters, in the order of the coax_params_t fields
+enum
+{
+  PARAM_MASS = 0,
+  PARAM_IXX, PARAM_IYY, PARAM_IZZ,
+  PARAM_D_UP, PARAM_D_LO,
+  PARAM_K_SPRINGUP, PARAM_K_SPRINGLO,
+  PARAM_L_UP, PARAM_L_LO,
+  PARAM_K_TUP, PARAM_K_TLO,
+  PARAM_K_MUP, PARAM_K_MLO,
+  PARAM_TF_MOTUP, PARAM_TF_MOTLO,
+  PARAM_TF_UP,
+  PARAM_RS_MUP, PARAM_RS_BUP,
+  PARAM_RS_MLO, PARAM_RS_BLO,
+  PARAM_ZETA_MUP, PARAM_ZETA_BUP,
+  PARAM_ZETA_MLO, PARAM_ZETA_BLO,
+  PARAM_MAX_SPANGLE,
+  MODEL_PARAMETERS
+};
+
+typedef struct
+{
+  double mass;
+  double Ixx, Iyy, Izz;
+  double d_up, d_lo;
+  double k_springup, k_springlo;
+  double l_up, l_lo;
+  double k_Tup, k_Tlo;
+  double k_Mup, k_Mlo;
+  double Tf_motup, Tf_motlo;
+  double Tf_up;
+  double rs_mup, rs_bup;
+  double rs_mlo, rs_blo;
+  double zeta_mup, zeta_bup;
+  double zeta_mlo, zeta_blo;
+  double max_SPangle;
+} coax_params_t;
+
+// Upper thrust direction in body coordinates: the stabilizer bar direction
+// z_bar tilted by the linkage factor l_up and turned by the phase lag zeta
+template <class T>
+inline void UpperThrustDirection(const T* z_bar, const T &l_up, const T &zeta, T* z_Tup)
+{
+  using coax_math::cos;
+  using coax_math::sin;
+  using coax_math::acos;
+  using coax_math::sqrt;
+
+  T z_Tupz = cos(l_up*acos(z_bar[2]));
+  T z_Tup_p[3] = {0, 0, 1};
+  if (z_Tupz < 1){
+    T temp = sqrt((1-z_Tupz*z_Tupz)/(z_bar[0]*z_bar[0] + z_bar[1]*z_bar[1]));
+    z_Tup_p[0] = z_bar[0]*temp;
+    z_Tup_p[1] = z_bar[1]*temp;
+    z_Tup_p[2] = z_Tupz;
+  }
+  T c_zeta, s_zeta;
+  coax_math::SinCos(zeta, s_zeta, c_zeta);
+  z_Tup[0] = c_zeta*z_Tup_p[0] - s_zeta*z_Tup_p[1];
+  z_Tup[1] = s_zeta*z_Tup_p[0] + c_zeta*z_Tup_p[1];
+  z_Tup[2] = z_Tup_p[2];
+}
+
+// Swash plate normal for the servo positions in [-1 1]
+template <class T>
+inline void SwashPlateDirection(const T &u_serv1, const T &u_serv2, const T &max_SPangle, T* z_SP)
+{
+  T s_a, c_a, s_b, c_b;
+  coax_math::SinCos(u_serv1*max_SPangle, s_a, c_a);
+  coax_math::SinCos(u_serv2*max_SPangle, s_b, c_b);
+  z_SP[0] = s_b;
+  z_SP[1] = -s_a*c_b;
+  z_SP[2] = c_a*c_b;
+}
+
+// Lower thrust direction in body coordinates: the swash plate normal z_SP
+// tilted by the linkage factor l_lo and turned back by the phase lag zeta
+template <class T>
+inline void LowerThrustDirection(const T* z_SP, const T &l_lo, const T &zeta, T* z_Tlo)
+{
+  using coax_math::cos;
+  using coax_math::sin;
+  using coax_math::acos;
+  using coax_math::sqrt;
+
+  T z_Tloz = cos(l_lo*acos(z_SP[2]));
+  T z_Tlo_p[3] = {0, 0, 1};
+  if (z_Tloz < 1){
+    T temp = sqrt((1-z_Tloz*z_Tloz)/(z_SP[0]*z_SP[0] + z_SP[1]*z_SP[1]));
+    z_Tlo_p[0] = z_SP[0]*temp;
+    z_Tlo_p[1] = z_SP[1]*temp;
+    z_Tlo_p[2] = z_Tloz;
+  }
+  T c_zeta, s_zeta;
+  coax_math::SinCos(zeta, s_zeta, c_zeta);
+  z_Tlo[0] = c_zeta*z_Tlo_p[0] + s_zeta*z_Tlo_p[1];
+  z_Tlo[1] = -s_zeta*z_Tlo_p[0] + c_zeta*z_Tlo_p[1];
+  z_Tlo[2] = z_Tlo_p[2];
+}
+
+// Inverse of SwashPlateDirection and LowerThrustDirection: the servo
+// positions, not limited, that tilt the lower thrust to the unit vector
+// z_Tlo
+template <class T>
+inline void LowerThrustServos(const T* z_Tlo, const T &l_lo, const T &zeta,
+                              const T &max_SPangle, T* servo)
+{
+  using coax_math::cos;
+  using coax_math::sin;
+  using coax_math::acos;
+  using coax_math::asin;
+  using coax_math::sqrt;
+
+  // undo the phase lag
+  T c_zeta, s_zeta;
+  coax_math::SinCos(zeta, s_zeta, c_zeta);
+  T z_Tlo_p[3];
+  z_Tlo_p[0] = c_zeta*z_Tlo[0] - s_zeta*z_Tlo[1];
+  z_Tlo_p[1] = s_zeta*z_Tlo[0] + c_zeta*z_Tlo[1];
+  z_Tlo_p[2] = z_Tlo[2];
+
+  T z_SP[3] = {0, 0, 1};
+  T z_SPz = cos(1/l_lo*acos(z_Tlo_p[2]));
+  if (z_SPz < 1){
+    T temp = sqrt((1-z_SPz*z_SPz)/(z_Tlo_p[0]*z_Tlo_p[0] + z_Tlo_p[1]*z_Tlo_p[1]));
+    z_SP[0] = z_Tlo_p[0]*temp;
+    z_SP[1] = z_Tlo_p[1]*temp;
+    z_SP[2] = z_SPz;
+  }
+  T b_SP = asin(z_SP[0]);
+  T a_SP = asin(-z_SP[1]/cos(b_SP));
+
+  servo[0] = a_SP/max_SPangle;
+  servo[1] = b_SP/max_SPangle;
+}
+
+// Moment of the rotor hinge spring k_spring about the body x and y axes
+// for the thrust direction z_T, z_b x z_T scaled to the tilt angle
+template <class T>
+inline void FlappingMoment(const T* z_T, const T &k_spring, T* M_flap)
+{
+  using coax_math::acos;
+  using coax_math::sqrt;
+
+  M_flap[0] = 0;
+  M_flap[1] = 0;
+  T norm_cp = sqrt(z_T[0]*z_T[0] + z_T[1]*z_T[1]);
+  if (norm_cp > 0){
+    T temp = 2*k_spring/norm_cp*acos(z_T[2]);
+    M_flap[0] = -z_T[1]*temp;
+    M_flap[1] = z_T[0]*temp;
+  }
+}
+
+// Rotor thrust magnitude k_T Omega^2
+template <class T>
+inline T RotorThrust(const T &k_T, const T &Omega)
+{
+  return k_T*Omega*Omega;
+}
+
+// Sum of the rotor forces and moments in body coordinates for the thrust
+// magnitudes T_up and T_lo, without gravity and the gyroscopic terms
+template <class T>
+inline void RotorForcesMoments(const T* theta, const T &T_up, const T &T_lo,
+                               const T &Omega_up, const T &Omega_lo,
+                               const T* z_Tup, const T* z_Tlo, T* F, T* M)
+{
+  T M_flapup[2];
+  T M_flaplo[2];
+  FlappingMoment(z_Tup, theta[PARAM_K_SPRINGUP], M_flapup);
+  FlappingMoment(z_Tlo, theta[PARAM_K_SPRINGLO], M_flaplo);
+
+  T d_up = theta[PARAM_D_UP];
+  T d_lo = theta[PARAM_D_LO];
+
+  F[0] = T_up*z_Tup[0] + T_lo*z_Tlo[0];
+  F[1] = T_up*z_Tup[1] + T_lo*z_Tlo[1];
+  F[2] = T_up*z_Tup[2] + T_lo*z_Tlo[2];
+
+  M[0] = -T_up*z_Tup[1]*d_up - T_lo*z_Tlo[1]*d_lo + M_flapup[0] + M_flaplo[0];
+  M[1] = T_up*z_Tup[0]*d_up + T_lo*z_Tlo[0]*d_lo + M_flapup[1] + M_flaplo[1];
+  M[2] = -theta[PARAM_K_MUP]*Omega_up*Omega_up + theta[PARAM_K_MLO]*Omega_lo*Omega_lo;
+}
+
+// Stabilizer bar direction z_bar in body coordinates: it follows the upper
+// rotor mast with the time constant Tf_up while the body turns at omega
+template <class T>
+inline void StabilizerBarDerivative(const T* z_bar, const T &Tf_up, const T* omega, T* z_bardot)
+{
+  using coax_math::acos;
+  using coax_math::sqrt;
+  using coax_math::fabs;
+
+  T b_z_bardotz = 1/Tf_up*acos(z_bar[2])*sqrt(z_bar[0]*z_bar[0] + z_bar[1]*z_bar[1]);
+  T b_z_bardot[3] = {0, 0, 0};
+  if (fabs(b_z_bardotz) > 0){
+    T temp = z_bar[2]*b_z_bardotz/(z_bar[0]*z_bar[0] + z_bar[1]*z_bar[1]);
+    b_z_bardot[0] = -z_bar[0]*temp;
+    b_z_bardot[1] = -z_bar[1]*temp;
+    b_z_bardot[2] = b_z_bardotz;
+  }
+
+  z_bardot[0] = b_z_bardot[0] - omega[1]*z_bar[2] + omega[2]*z_bar[1];
+  z_bardot[1] = b_z_bardot[1] - omega[2]*z_bar[0] + omega[0]*z_bar[2];
+  z_bardot[2] = b_z_bardot[2] - omega[0]*z_bar[1] + omega[1]*z_bar[0];
+}
+
+// Body to world rotation of the quaternion (w, x, y, z), also valid for a
+// quaternion that drifted from unit length
+template <class T>
+inline void QuaternionToRotation(const T* q, T Rb2w[3][3])
+{
+  T s = 2/(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  Rb2w[0][0] = 1 - s*(q[2]*q[2] + q[3]*q[3]);
+  Rb2w[0][1] = s*(q[1]*q[2] - q[3]*q[0]);
+  Rb2w[0][2] = s*(q[1]*q[3] + q[2]*q[0]);
+
+  Rb2w[1][0] = s*(q[1]*q[2] + q[3]*q[0]);
+  Rb2w[1][1] = 1 - s*(q[1]*q[1] + q[3]*q[3]);
+  Rb2w[1][2] = s*(q[2]*q[3] - q[1]*q[0]);
+
+  Rb2w[2][0] = s*(q[1]*q[3] - q[2]*q[0]);
+  Rb2w[2][1] = s*(q[2]*q[3] + q[1]*q[0]);
+  Rb2w[2][2] = 1 - s*(q[1]*q[1] + q[2]*q[2]);
+}
+
+// Body to world rotation of the Z-Y-X Euler angles
+template <class T>
+inline void EulerToRotation(const T &roll, const T &pitch, const T &yaw, T Rb2w[3][3])
+{
+  T c_r, s_r, c_p, s_p, c_y, s_y;
+  coax_math::SinCos(roll, s_r, c_r);
+  coax_math::SinCos(pitch, s_p, c_p);
+  coax_math::SinCos(yaw, s_y, c_y);
+
+  Rb2w[0][0] = c_p*c_y;
+  Rb2w[0][1] = s_r*s_p*c_y - c_r*s_y;
+  Rb2w[0][2] = c_r*s_p*c_y + s_r*s_y;
+
+  Rb2w[1][0] = c_p*s_y;
+  Rb2w[1][1] = s_r*s_p*s_y + c_r*c_y;
+  Rb2w[1][2] = c_r*s_p*s_y - s_r*c_y;
+
+  Rb2w[2][0] = -s_p;
+  Rb2w[2][1] = s_r*c_p;
+  Rb2w[2][2] = c_r*c_p;
+}
+
+template <class T>
+inline void EulerToQuaternion(const T &roll, const T &pitch, const T &yaw, T* q)
+{
+  T c_r, s_r, c_p, s_p, c_y, s_y;
+  coax_math::SinCos(T(0.5*roll), s_r, c_r);
+  coax_math::SinCos(T(0.5*pitch), s_p, c_p);
+  coax_math::SinCos(T(0.5*yaw), s_y, c_y);
+
+  q[0] = c_r*c_p*c_y + s_r*s_p*s_y;
+  q[1] = s_r*c_p*c_y - c_r*s_p*s_y;
+  q[2] = c_r*s_p*c_y + s_r*c_p*s_y;
+  q[3] = c_r*c_p*s_y - s_r*s_p*c_y;
+}
+
+template <class T>
+inline void QuaternionToEuler(const T* q, T& roll, T& pitch, T& yaw)
+{
+  using coax_math::atan2;
+  using coax_math::asin;
+
+  T sinp = 2*(q[0]*q[2] - q[3]*q[1]);
+  if (sinp > 1)
+    sinp = 1;
+  else if (sinp < -1)
+    sinp = -1;
+
+  roll = atan2(2*(q[0]*q[1] + q[2]*q[3]), 1 - 2*(q[1]*q[1] + q[2]*q[2]));
+  pitch = asin(sinp);
+  yaw = atan2(2*(q[0]*q[3] + q[1]*q[2]), 1 - 2*(q[2]*q[2] + q[3]*q[3]));
+}
+
+template <class T>
+inline void NormalizeQuaternion(T* q)
+{
+  using coax_math::sqrt;
+
+  T norm_q = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  if (norm_q > 0)
+    {
+      q[0] /= norm_q;
+      q[1] /= norm_q;
+      q[2] /= norm_q;
+      q[3] /= norm_q;
+    }
+}
+#endif
@@ -0,0 +1,249 @@
+#ifndef __COAX_MATH__
+#define __COAX_MATH__
+
+#include <cmath>
+
+// Math functions of the dynamics and control kernels. By default they are
+// the std ones. With COAX_FAST_MATH defined, sin, cos, asin, acos and atan2
+// of double and float become inline polynomial approximations without
+// calls, errno or table lookups, written as selects so that loops over them
+// can vectorize. sqrt stays std::sqrt in both modes, it is one instruction.
+//
+// The error budget in flight is 1e-8 for double: a thousandth of the 1e-5
+// step tolerance of the CoaXModel integrator and far below the 2e-3 rad
+// orientation noise of the Vicon. Float keeps float precision. Both use
+// the lowest degrees within that, which is what makes the double kernels
+// faster than with libm; in float they only break even with sinf and
+// friends. coax_simulator/bin/coax_kernel_bench times either mode.
+//
+// Largest errors over the domains below, against long double libm, as
+// checked by coax_simulator/bin/coax_math_check:
+//
+//             double      float
+//   sin, cos  2.7e-9      9.8e-8      |x| < 1e5, 8e3 float
+//   asin      5.1e-9      1.8e-7      [-1 1]
+//   acos      5.1e-9      3.2e-7      [-1 1]
+//   atan2     8.1e-9      2.9e-7      finite y, x
+//
+// Beyond them sin and cos lose the argument reduction, asin and acos give
+// NaN outside [-1 1] like libm, atan2 gives 0 for (0, 0) and ignores the
+// sign of zero.
+//
+// Calls in the kernels are unqualified after "using coax_math::sin;", so
+// Dual<N> still finds its own overloads.
+
+namespace coax_math
+{
+using std::sqrt;
+using std::fabs;
+
+#ifndef COAX_FAST_MATH
+
+using std::sin;
+using std::cos;
+using std::asin;
+using std::acos;
+using std::atan2;
+
+#else
+
+// Minimax coefficients of sin(r) = r + r^3 P(r^2), cos(r) = 1 - r^2/2 +
+// r^4 Q(r^2) on [-pi/4 pi/4], asin(x) = x + x^3 R(x^2) on [0 1/2] and
+// atan(x) = x + x^3 S(x^2) on [0 tan(pi/8)], of the lowest degrees that
+// hold float precision. Double evaluates the same polynomials, the error
+// budget is the one above.
+static const double PIO2 = 1.57079632679489661923;
+static const double TANPIO8 = 0.41421356237309504880;
+
+static const float PIO2F_1 = 1.5703125f;
+static const float PIO2F_2 = 4.837512969970703125e-4f;
+static const float PIO2F_3 = 7.54978995489188216e-8f;
+
+template <class T>
+inline T SinPolynomial(T r)
+{
+  T z = r*r;
+  return r + r*z*(T(-1.66666546e-01) + z*(T(8.33216076e-03) + z*T(-1.95152832e-04)));
+}
+
+template <class T>
+inline T CosPolynomial(T r)
+{
+  T z = r*r;
+  return 1 - T(0.5)*z + z*z*(T(4.16666469e-02) + z*(T(-1.38873675e-03) + z*T(2.44384516e-05)));
+}
+
+template <class T>
+inline T AsinPolynomial(T x)
+{
+  T z = x*x;
+  return x + x*z*(T(1.66667525e-01) + z*(T(7.49529765e-02) + z*(T(4.54703752e-02) +
+                  z*(T(2.41795181e-02) + z*T(4.21663030e-02)))));
+}
+
+template <class T>
+inline T AtanPolynomial(T x)
+{
+  T z = x*x;
+  return x + x*z*(T(-3.33329491e-01) + z*(T(1.99777100e-01) + z*(T(-1.38776788e-01) +
+                  z*T(8.05372280e-02))));
+}
+
+// x - k pi/2 in [-pi/4 pi/4], quadrant k modulo 4. k is rounded by
+// adding and subtracting 1.5 2^52 (2^23 for float), floor is a call
+// without SSE4.1. -ffast-math would fold that away. One part of pi/2 is
+// enough for double: it loses k 6e-17, 6e-12 at 1e5.
+inline double ReduceQuadrant(double x, int &quadrant)
+{
+  double k = (x*(1/PIO2) + 6755399441055744.0) - 6755399441055744.0;
+  quadrant = (int)k & 3;
+  return x - k*PIO2;
+}
+
+inline float ReduceQuadrant(float x, int &quadrant)
+{
+  float k = (x*(float)(1/PIO2) + 12582912.0f) - 12582912.0f;
+  quadrant = (int)k & 3;
+  return ((x - k*PIO2F_1) - k*PIO2F_2) - k*PIO2F_3;
+}
+
+// asin(|x|) from the polynomial on [0 1/2], by asin(x) = pi/2 -
+// 2 asin(sqrt((1 - x)/2)) above. Half of acos(|x|) is returned in half_acos
+// for the same reason: it is exact near |x| = 1, where 1 - x cancels.
+template <class T>
+inline T AsinAbs(T x, T &half_acos)
+{
+  T a = fabs(x);
+  bool large = a > T(0.5);
+  T s = large ? sqrt(T(0.5)*(1 - a)) : a;
+  T p = AsinPolynomial(s);
+  half_acos = large ? p : T(0.5)*(T(PIO2) - p);
+  return large ? T(PIO2) - 2*p : p;
+}
+
+template <class T>
+inline T AtanAbs(T y, T x)
+{
+  T ax = fabs(x);
+  T ay = fabs(y);
+  bool steep = ay > ax;
+  T num = steep ? ax : ay;
+  T den = steep ? ay : ax;
+  T t = (den > 0) ? num/den : T(0);
+  // atan(t) = pi/4 + atan((t - 1)/(t + 1)) above tan(pi/8)
+  bool upper = t > T(TANPIO8);
+  T u = upper ? (t - 1)/(t + 1) : t;
+  T a = AtanPolynomial(u) + (upper ? T(0.5*PIO2) : T(0));
+  return steep ? T(PIO2) - a : a;
+}
+
+inline double sin(double x)
+{
+  int q;
+  double r = ReduceQuadrant(x, q);
+  double y = (q & 1) ? CosPolynomial(r) : SinPolynomial(r);
+  return (q & 2) ? -y : y;
+}
+
+inline float sin(float x)
+{
+  int q;
+  float r = ReduceQuadrant(x, q);
+  float y = (q & 1) ? CosPolynomial(r) : SinPolynomial(r);
+  return (q & 2) ? -y : y;
+}
+
+inline double cos(double x)
+{
+  int q;
+  double r = ReduceQuadrant(x, q);
+  double y = (q & 1) ? SinPolynomial(r) : CosPolynomial(r);
+  return ((q + 1) & 2) ? -y : y;
+}
+
+inline float cos(float x)
+{
+  int q;
+  float r = ReduceQuadrant(x, q);
+  float y = (q & 1) ? SinPolynomial(r) : CosPolynomial(r);
+  return ((q + 1) & 2) ? -y : y;
+}
+
+inline void SinCos(double x, double &s, double &c)
+{
+  int q;
+  double r = ReduceQuadrant(x, q);
+  double sr = SinPolynomial(r);
+  double cr = CosPolynomial(r);
+  s = (q & 1) ? cr : sr;
+  c = (q & 1) ? sr : cr;
+  s = (q & 2) ? -s : s;
+  c = ((q + 1) & 2) ? -c : c;
+}
+
+inline void SinCos(float x, float &s, float &c)
+{
+  int q;
+  float r = ReduceQuadrant(x, q);
+  float sr = SinPolynomial(r);
+  float cr = CosPolynomial(r);
+  s = (q & 1) ? cr : sr;
+  c = (q & 1) ? sr : cr;
+  s = (q & 2) ? -s : s;
+  c = ((q + 1) & 2) ? -c : c;
+}
+
+inline double asin(double x)
+{
+  double half_acos;
+  double a = AsinAbs(x, half_acos);
+  return (x < 0) ? -a : a;
+}
+
+inline float asin(float x)
+{
+  float half_acos;
+  float a = AsinAbs(x, half_acos);
+  return (x < 0) ? -a : a;
+}
+
+inline double acos(double x)
+{
+  double half_acos;
+  AsinAbs(x, half_acos);
+  return (x < 0) ? 2*PIO2 - 2*half_acos : 2*half_acos;
+}
+
+inline float acos(float x)
+{
+  float half_acos;
+  AsinAbs(x, half_acos);
+  return (x < 0) ? float(2*PIO2) - 2*half_acos : 2*half_acos;
+}
+
+inline double atan2(double y, double x)
+{
+  double a = AtanAbs(y, x);
+  a = (x < 0) ? 2*PIO2 - a : a;
+  return (y < 0) ? -a : a;
+}
+
+inline float atan2(float y, float x)
+{
+  float a = AtanAbs(y, x);
+  a = (x < 0) ? float(2*PIO2) - a : a;
+  return (y < 0) ? -a : a;
+}
+
+#endif
+
+// sin and cos of the same angle, with one argument reduction in the fast
+// mode
+template <class T>
+inline void SinCos(const T &x, T &s, T &c)
+{
+  s = sin(x);
+  c = cos(x);
+}
+}
+#endif
@@ -0,0 +1,145 @@
+#ifndef __DUAL__
+#define __DUAL__
+
+#include <cmath>
+
+// Forward mode automatic differentiation: a value and its derivatives with
+// respect to N inputs, stored contiguously so that the loops over them
+// vectorize. Comparisons look at the value only.
+template <int N>
+class Dual
+{
+public:
+  Dual() : v(0) { for (int i = 0; i < N; i++) d[i] = 0; }
+  Dual(double v_) : v(v_) { for (int i = 0; i < N; i++) d[i] = 0; }
+  // input number i
+  Dual(double v_, int i) : v(v_) { for (int j = 0; j < N; j++) d[j] = 0; d[i] = 1; }
+
+  Dual& operator+=(const Dual &b) { v += b.v; for (int i = 0; i < N; i++) d[i] += b.d[i]; return *this; }
+  Dual& operator-=(const Dual &b) { v -= b.v; for (int i = 0; i < N; i++) d[i] -= b.d[i]; return *this; }
+  Dual& operator*=(const Dual &b) { *this = *this*b; return *this; }
+  Dual& operator/=(const Dual &b) { *this = *this/b; return *this; }
+
+  double v;
+  double d[N];
+};
+
+// f(a) with f'(a) = k
+template <int N>
+inline Dual<N> DualChain(double f, double k, const Dual<N> &a)
+{
+  Dual<N> c;
+  c.v = f;
+  for (int i = 0; i < N; i++)
+    c.d[i] = k*a.d[i];
+  return c;
+}
+
+inline double Value(double a) { return a; }
+template <int N> inline double Value(const Dual<N> &a) { return a.v; }
+
+template <int N>
+inline Dual<N> operator-(const Dual<N> &a)
+{
+  return DualChain(-a.v, -1.0, a);
+}
+
+template <int N>
+inline Dual<N> operator+(const Dual<N> &a, const Dual<N> &b)
+{
+  Dual<N> c;
+  c.v = a.v + b.v;
+  for (int i = 0; i < N; i++)
+    c.d[i] = a.d[i] + b.d[i];
+  return c;
+}
+
+template <int N>
+inline Dual<N> operator-(const Dual<N> &a, const Dual<N> &b)
+{
+  Dual<N> c;
+  c.v = a.v - b.v;
+  for (int i = 0; i < N; i++)
+    c.d[i] = a.d[i] - b.d[i];
+  return c;
+}
+
+template <int N>
+inline Dual<N> operator*(const Dual<N> &a, const Dual<N> &b)
+{
+  Dual<N> c;
+  c.v = a.v*b.v;
+  for (int i = 0; i < N; i++)
+    c.d[i] = a.d[i]*b.v + a.v*b.d[i];
+  return c;
+}
+
+template <int N>
+inline Dual<N> operator/(const Dual<N> &a, const Dual<N> &b)
+{
+  Dual<N> c;
+  c.v = a.v/b.v;
+  double inv = 1.0/b.v;
+  for (int i = 0; i < N; i++)
+    c.d[i] = (a.d[i] - c.v*b.d[i])*inv;
+  return c;
+}
+
+template <int N> inline Dual<N> operator+(const Dual<N> &a, double b) { Dual<N> c = a; c.v += b; return c; }
+template <int N> inline Dual<N> operator+(double a, const Dual<N> &b) { Dual<N> c = b; c.v = a + b.v; return c; }
+template <int N> inline Dual<N> operator-(const Dual<N> &a, double b) { Dual<N> c = a; c.v -= b; return c; }
+template <int N> inline Dual<N> operator-(double a, const Dual<N> &b) { return DualChain(a - b.v, -1.0, b); }
+template <int N> inline Dual<N> operator*(const Dual<N> &a, double b) { return DualChain(a.v*b, b, a); }
+template <int N> inline Dual<N> operator*(double a, const Dual<N> &b) { return DualChain(a*b.v, a, b); }
+template <int N> inline Dual<N> operator/(const Dual<N> &a, double b) { return DualChain(a.v/b, 1.0/b, a); }
+template <int N> inline Dual<N> operator/(double a, const Dual<N> &b) { return DualChain(a/b.v, -a/(b.v*b.v), b); }
+
+template <int N> inline bool operator<(const Dual<N> &a, const Dual<N> &b) { return a.v < b.v; }
+template <int N> inline bool operator>(const Dual<N> &a, const Dual<N> &b) { return a.v > b.v; }
+template <int N> inline bool operator<(const Dual<N> &a, double b) { return a.v < b; }
+template <int N> inline bool operator>(const Dual<N> &a, double b) { return a.v > b; }
+template <int N> inline bool operator<=(const Dual<N> &a, double b) { return a.v <= b; }
+template <int N> inline bool operator>=(const Dual<N> &a, double b) { return a.v >= b; }
+
+template <int N> inline Dual<N> cos(const Dual<N> &a) { return DualChain(std::cos(a.v), -std::sin(a.v), a); }
+template <int N> inline Dual<N> sin(const Dual<N> &a) { return DualChain(std::sin(a.v), std::cos(a.v), a); }
+template <int N> inline Dual<N> exp(const Dual<N> &a) { double e = std::exp(a.v); return DualChain(e, e, a); }
+template <int N> inline Dual<N> fabs(const Dual<N> &a) { return DualChain(std::fabs(a.v), (a.v < 0) ? -1.0 : 1.0, a); }
+
+// The derivatives of sqrt at 0 and of acos and asin at +-1 are infinite,
+// they are taken as 0 there: the model only reaches these points with
+// vanishing derivatives (e.g. the stabilizer bar upright).
+template <int N>
+inline Dual<N> sqrt(const Dual<N> &a)
+{
+  double s = std::sqrt(a.v);
+  return DualChain(s, (s > 0) ? 0.5/s : 0.0, a);
+}
+
+template <int N>
+inline Dual<N> acos(const Dual<N> &a)
+{
+  double s = 1 - a.v*a.v;
+  return DualChain(std::acos(a.v), (s > 0) ? -1/std::sqrt(s) : 0.0, a);
+}
+
+template <int N>
+inline Dual<N> asin(const Dual<N> &a)
+{
+  double s = 1 - a.v*a.v;
+  return DualChain(std::asin(a.v), (s > 0) ? 1/std::sqrt(s) : 0.0, a);
+}
+
+template <int N>
+inline Dual<N> atan2(const Dual<N> &y, const Dual<N> &x)
+{
+  Dual<N> c;
+  c.v = std::atan2(y.v, x.v);
+  double r2 = x.v*x.v + y.v*y.v;
+  double ky = (r2 > 0) ? x.v/r2 : 0.0;
+  double kx = (r2 > 0) ? -y.v/r2 : 0.0;
+  for (int i = 0; i < N; i++)
+    c.d[i] = ky*y.d[i] + kx*x.d[i];
+  return c;
+}
+#endif
@@ -2,6 +2,7 @@
 #include <string>
 #include <std_msgs/Bool.h>
 #include <geometry_msgs/Quaternion.h>
+#include <nav_msgs/Odometry.h>
 
 #include <coax_interface/SetControlMode.h>
 #include <coax_msgs/CoaxConfigureComm.h>
@@ -25,12 +26,15 @@ protected:
 	ros::Publisher coax_info_pub;
 	ros::Publisher coax_imu_pub;
 	ros::Publisher coax_euler_pub;
+	ros::Publisher coax_state_pub;
 	ros::Publisher control_mode_pub;
 	
 	ros::Subscriber coax_state_sub;
 	ros::Subscriber matlab_nav_mode_sub;
 	ros::Subscriber matlab_raw_control_sub;
 	
+	ros::Timer raw_control_timer;
+	
 	std::vector<ros::ServiceServer> set_control_mode;
 	
 	float motor1;
@@ -39,24 +43,46 @@ protected:
 	float servo2;
 	int matlab_rawcontrol_age;
 	int coax_state_age;
+	unsigned int rate;
+	
+	bool event_driven;
+	bool packed_state;
+	bool legacy_state;
+	
+	coax_msgs::CoaxRawControl raw_control;
+	nav_msgs::Odometry coax_state;
 	
 public:
 	
 	CoaxInterface(ros::NodeHandle & n)
 	{
+		int param;
+		n.param("event_driven", param, 0);
+		event_driven = param;
+		n.param("packed_state", param, 1);
+		packed_state = param;
+		n.param("legacy_state", param, 0);
+		legacy_state = param;
+		
 		reach_nav_state = n.serviceClient<coax_msgs::CoaxReachNavState>("reach_nav_state");
 		configure_comm = n.serviceClient<coax_msgs::CoaxConfigureComm>("configure_comm");
 		set_timeout = n.serviceClient<coax_msgs::CoaxSetTimeout>("set_timeout");
 		
 		raw_control_pub = n.advertise<coax_msgs::CoaxRawControl>("rawcontrol",1);
-		coax_info_pub = n.advertise<geometry_msgs::Quaternion>("info",1);
-		coax_imu_pub = n.advertise<geometry_msgs::Quaternion>("imu",1);
-		coax_euler_pub = n.advertise<geometry_msgs::Quaternion>("euler",1);
+		if (packed_state) {
+			coax_state_pub = n.advertise<nav_msgs::Odometry>("coax_state",1);
+		}
+		if (legacy_state) {
+			coax_info_pub = n.advertise<geometry_msgs::Quaternion>("info",1);
+			coax_imu_pub = n.advertise<geometry_msgs::Quaternion>("imu",1);
+			coax_euler_pub = n.advertise<geometry_msgs::Quaternion>("euler",1);
+		}
 		control_mode_pub = n.advertise<geometry_msgs::Quaternion>("control_mode",1);
 		
 		coax_state_sub = n.subscribe("state", 1, &CoaxInterface::coaxStateCallback, this);
 		matlab_nav_mode_sub = n.subscribe("nav_mode", 1, &CoaxInterface::matlabNavModeCallback, this);
-		matlab_raw_control_sub = n.subscribe("raw_control", 1, &CoaxInterface::matlabRawControlCallback, this);
+		matlab_raw_control_sub = n.subscribe("raw_control", 1, &CoaxInterface::matlabRawControlCallback, this,
+											 ros::TransportHints().tcp().tcpNoDelay());
 		
 		set_control_mode.push_back(n.advertiseService("set_control_mode", &CoaxInterface::setControlMode, this));
 		
@@ -66,6 +92,12 @@ public:
 		servo2 = 0;
 		matlab_rawcontrol_age = 0;
 		coax_state_age = 0;
+		rate = 100;
+		
+		raw_control.motor1 = 0;
+		raw_control.motor2 = 0;
+		raw_control.servo1 = 0;
+		raw_control.servo2 = 0;
 	}
 	~CoaxInterface(){
 	}
@@ -124,6 +156,29 @@ public:
 	
 	void coaxStateCallback(const coax_msgs::CoaxState::ConstPtr & message)
 	{
+		coax_state_age = 0;
+		
+		if (packed_state) {
+			// info, imu and euler packed into one message:
+			// position = [nav_mode battery 0], orientation = [roll pitch yaw 0],
+			// angular twist = gyro
+			coax_state.header.stamp = ros::Time::now();
+			coax_state.pose.pose.position.x = message->mode.navigation;
+			coax_state.pose.pose.position.y = message->battery;
+			coax_state.pose.pose.position.z = 0;
+			coax_state.pose.pose.orientation.x = message->roll;
+			coax_state.pose.pose.orientation.y = message->pitch;
+			coax_state.pose.pose.orientation.z = message->yaw;
+			coax_state.pose.pose.orientation.w = 0;
+			coax_state.twist.twist.angular.x = message->gyro[0];
+			coax_state.twist.twist.angular.y = -message->gyro[1];
+			coax_state.twist.twist.angular.z = -message->gyro[2];
+			coax_state_pub.publish(coax_state);
+		}
+		
+		if (!legacy_state)
+			return;
+		
 		geometry_msgs::Quaternion coax_info;
 		coax_info.x = message->mode.navigation;
 		coax_info.y = message->battery;
@@ -142,8 +197,6 @@ public:
 		coax_euler.z = message->yaw;
 		coax_euler.w = 0;
 		
-		coax_state_age = 0;
-		
 		coax_info_pub.publish(coax_info);
 		coax_imu_pub.publish(coax_imu);
 		coax_euler_pub.publish(coax_euler);
@@ -182,49 +235,63 @@ public:
 		servo2 = message->w;
 		
 		matlab_rawcontrol_age = 0;
+		
+		if (event_driven) {
+			// forward right away instead of waiting for the next tick
+			raw_control.motor1 = motor1;
+			raw_control.motor2 = motor2;
+			raw_control.servo1 = servo1;
+			raw_control.servo2 = servo2;
+			raw_control_pub.publish(raw_control);
+		}
 	}
 	
 	//===================
 	// Publisher
 	//===================
 	
-	void rawControlPublisher(unsigned int rate)
+	// Commands are forwarded by matlabRawControlCallback as soon as
+	// ros::spin() delivers them. The timer at rate republishes them only
+	// when event_driven is off, and sends zero inputs when MATLAB has not
+	// sent a command for 20 ticks.
+	void rawControlPublisher(ros::NodeHandle & n, unsigned int rate_)
 	{
-		ros::Rate loop_rate(rate);
+		rate = rate_;
+		raw_control_timer = n.createTimer(ros::Duration(1.0/rate), &CoaxInterface::rawControlTimerCallback, this);
+		ros::spin();
+	}
+	
+	void rawControlTimerCallback(const ros::TimerEvent & event)
+	{
+		bool publish = !event_driven;
+		if (matlab_rawcontrol_age < 20) {
+			raw_control.motor1 = motor1;
+			raw_control.motor2 = motor2;
+			raw_control.servo1 = servo1;
+			raw_control.servo2 = servo2;
+		} else { // if matlab does not send any commands for too long send zero inputs
+			raw_control.motor1 = 0;
+			raw_control.motor2 = 0;
+			raw_control.servo1 = 0;
+			raw_control.servo2 = 0;
+			publish = true; // watchdog
+		}
 		
-		coax_msgs::CoaxRawControl raw_control;
+		if ((coax_state_age > 0.5*rate) && (coax_state_age <= 0.5*rate + 1)) {
+			ROS_INFO("Lost Zigbee connection for too long (>0.5s)!!!");
+			geometry_msgs::Quaternion control_mode;
+			control_mode.x = 7;
+			control_mode.y = 0;
+			control_mode.z = 0;
+			control_mode.w = 0;
+			control_mode_pub.publish(control_mode);
+		}
 		
-		while(ros::ok())
-		{
-			if (matlab_rawcontrol_age < 20) {
-				raw_control.motor1 = motor1;
-				raw_control.motor2 = motor2;
-				raw_control.servo1 = servo1;
-				raw_control.servo2 = servo2;
-			} else { // if matlab does not send any commands for too long send zero inputs
-				raw_control.motor1 = 0;
-				raw_control.motor2 = 0;
-				raw_control.servo1 = 0;
-				raw_control.servo2 = 0;
-			}
-			
-			if ((coax_state_age > 0.5*rate) && (coax_state_age <= 0.5*rate + 1)) {
-				ROS_INFO("Lost Zigbee connection for too long (>0.5s)!!!");
-				geometry_msgs::Quaternion control_mode;
-				control_mode.x = 7;
-				control_mode.y = 0;
-				control_mode.z = 0;
-				control_mode.w = 0;
-				control_mode_pub.publish(control_mode);
-			}
-			
+		if (publish) {
 			raw_control_pub.publish(raw_control);
-			matlab_rawcontrol_age += 1;
-			coax_state_age += 1;
-			
-			ros::spinOnce();
-			loop_rate.sleep();
 		}
+		matlab_rawcontrol_age += 1;
+		coax_state_age += 1;
 	}
 	
 	//===================
@@ -303,7 +370,7 @@ int main(int argc, char** argv)
 	int frequency;
 	n.param("frequency", frequency, 100);
 
-	api.rawControlPublisher(frequency);
+	api.rawControlPublisher(n, frequency);
 	
 	return(0);
 }
@@ -0,0 +1,46 @@
+#ifndef __STABBAR_ESTIMATOR__
+#define __STABBAR_ESTIMATOR__
+
+#define STABBAR_MAX_MARKERS 8
+
+// Estimates the stabilizer bar direction in body coordinates from one
+// Vicon frame (C++ version of stabbar_dynamics/coax_markers.m).
+// The body pose is found with Horn's closed-form absolute orientation
+// (quaternion method) on fixed-size arrays, the stabilizer bar marker is
+// transformed into the body frame and its direction from the hinge is
+// returned. Units follow the marker data (mm).
+class StabBarEstimator
+{
+public:
+	StabBarEstimator();
+	~StabBarEstimator() {}
+
+	void SetNumBodyMarkers(unsigned int n);
+	void SetBodyMarker(unsigned int i, double x, double y, double z);
+	void SetHinge(double x, double y, double z);
+
+	// world: 3*n marker positions in the same order as the body markers
+	// returns 0 on success, -1 if the bar direction could not be computed
+	int Update(const double* world, const bool* visible,
+			   const double* stabbar, bool stabbar_visible);
+
+	void GetBarDirection(double &z_barx, double &z_bary, double &z_barz);
+	void GetRotation(double R[3][3]);
+	void GetTranslation(double T[3]);
+
+	static int AbsoluteOrientation(const double m[][3], const double d[][3],
+								   unsigned int n, double R[3][3], double T[3]);
+
+private:
+	static void SymmetricEigen4(double A[4][4], double V[4][4]);
+
+	unsigned int num_markers;
+	double body[STABBAR_MAX_MARKERS][3];
+	double hinge[3];
+
+	double R[3][3];
+	double T[3];
+	double bar[3];
+};
+
+#endif
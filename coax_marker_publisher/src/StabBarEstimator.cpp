@@ -0,0 +1,241 @@
+#include <cmath>
+#include <cstring>
+
+#include <StabBarEstimator.h>
+
+StabBarEstimator::StabBarEstimator()
+{
+	num_markers = 0;
+	memset(body, 0, sizeof(body));
+	memset(hinge, 0, sizeof(hinge));
+	memset(R, 0, sizeof(R));
+	R[0][0] = R[1][1] = R[2][2] = 1;
+	memset(T, 0, sizeof(T));
+	bar[0] = 0;
+	bar[1] = 0;
+	bar[2] = 1;
+}
+
+void StabBarEstimator::SetNumBodyMarkers(unsigned int n)
+{
+	if (n > STABBAR_MAX_MARKERS)
+		n = STABBAR_MAX_MARKERS;
+	num_markers = n;
+}
+
+void StabBarEstimator::SetBodyMarker(unsigned int i, double x, double y, double z)
+{
+	if (i >= STABBAR_MAX_MARKERS)
+		return;
+	body[i][0] = x;
+	body[i][1] = y;
+	body[i][2] = z;
+}
+
+void StabBarEstimator::SetHinge(double x, double y, double z)
+{
+	hinge[0] = x;
+	hinge[1] = y;
+	hinge[2] = z;
+}
+
+int StabBarEstimator::Update(const double* world, const bool* visible,
+							 const double* stabbar, bool stabbar_visible)
+{
+	if (!stabbar_visible)
+		return -1;
+
+	// collect visible markers
+	double m[STABBAR_MAX_MARKERS][3];
+	double d[STABBAR_MAX_MARKERS][3];
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < num_markers; i++) {
+		if (!visible[i])
+			continue;
+		for (int j = 0; j < 3; j++) {
+			m[n][j] = body[i][j];
+			d[n][j] = world[3*i + j];
+		}
+		n++;
+	}
+
+	if (AbsoluteOrientation(m, d, n, R, T) != 0)
+		return -1;
+
+	// stabilizer bar marker in body coordinates: sb_body = R'*(sb - T)
+	double sb_body[3];
+	for (int i = 0; i < 3; i++) {
+		sb_body[i] = R[0][i]*(stabbar[0] - T[0]) + R[1][i]*(stabbar[1] - T[1]) + R[2][i]*(stabbar[2] - T[2]);
+	}
+
+	double z_bar[3];
+	z_bar[0] = sb_body[0] - hinge[0];
+	z_bar[1] = sb_body[1] - hinge[1];
+	z_bar[2] = sb_body[2] - hinge[2];
+	double norm_z_bar = sqrt(z_bar[0]*z_bar[0] + z_bar[1]*z_bar[1] + z_bar[2]*z_bar[2]);
+	if (norm_z_bar < 1e-9)
+		return -1;
+
+	bar[0] = z_bar[0]/norm_z_bar;
+	bar[1] = z_bar[1]/norm_z_bar;
+	bar[2] = z_bar[2]/norm_z_bar;
+
+	return 0;
+}
+
+void StabBarEstimator::GetBarDirection(double &z_barx, double &z_bary, double &z_barz)
+{
+	z_barx = bar[0];
+	z_bary = bar[1];
+	z_barz = bar[2];
+}
+
+void StabBarEstimator::GetRotation(double R_[3][3])
+{
+	memcpy(R_, R, sizeof(R));
+}
+
+void StabBarEstimator::GetTranslation(double T_[3])
+{
+	memcpy(T_, T, sizeof(T));
+}
+
+// d = R*m + T in the least squares sense (Horn 1987)
+int StabBarEstimator::AbsoluteOrientation(const double m[][3], const double d[][3],
+										  unsigned int n, double R[3][3], double T[3])
+{
+	if (n < 3)
+		return -1;
+
+	double mbar[3] = {0, 0, 0};
+	double dbar[3] = {0, 0, 0};
+	for (unsigned int i = 0; i < n; i++) {
+		for (int j = 0; j < 3; j++) {
+			mbar[j] += m[i][j];
+			dbar[j] += d[i][j];
+		}
+	}
+	for (int j = 0; j < 3; j++) {
+		mbar[j] /= n;
+		dbar[j] /= n;
+	}
+
+	// S = sum(mc*dc')
+	double S[3][3];
+	memset(S, 0, sizeof(S));
+	for (unsigned int i = 0; i < n; i++) {
+		double mc[3], dc[3];
+		for (int j = 0; j < 3; j++) {
+			mc[j] = m[i][j] - mbar[j];
+			dc[j] = d[i][j] - dbar[j];
+		}
+		for (int j = 0; j < 3; j++)
+			for (int k = 0; k < 3; k++)
+				S[j][k] += mc[j]*dc[k];
+	}
+
+	double Sxx = S[0][0], Sxy = S[0][1], Sxz = S[0][2];
+	double Syx = S[1][0], Syy = S[1][1], Syz = S[1][2];
+	double Szx = S[2][0], Szy = S[2][1], Szz = S[2][2];
+
+	double N[4][4];
+	N[0][0] = Sxx + Syy + Szz;
+	N[0][1] = Syz - Szy;
+	N[0][2] = Szx - Sxz;
+	N[0][3] = Sxy - Syx;
+	N[1][1] = Sxx - Syy - Szz;
+	N[1][2] = Sxy + Syx;
+	N[1][3] = Szx + Sxz;
+	N[2][2] = -Sxx + Syy - Szz;
+	N[2][3] = Syz + Szy;
+	N[3][3] = -Sxx - Syy + Szz;
+	N[1][0] = N[0][1];
+	N[2][0] = N[0][2];
+	N[3][0] = N[0][3];
+	N[2][1] = N[1][2];
+	N[3][1] = N[1][3];
+	N[3][2] = N[2][3];
+
+	double V[4][4];
+	SymmetricEigen4(N, V);
+
+	// eigenvector of the largest eigenvalue is the rotation quaternion
+	int imax = 0;
+	for (int i = 1; i < 4; i++) {
+		if (N[i][i] > N[imax][imax])
+			imax = i;
+	}
+	double qw = V[0][imax];
+	double qx = V[1][imax];
+	double qy = V[2][imax];
+	double qz = V[3][imax];
+	double norm_q = sqrt(qw*qw + qx*qx + qy*qy + qz*qz);
+	qw /= norm_q;
+	qx /= norm_q;
+	qy /= norm_q;
+	qz /= norm_q;
+
+	R[0][0] = 1-2*qy*qy-2*qz*qz;
+	R[0][1] = 2*qx*qy-2*qz*qw;
+	R[0][2] = 2*qx*qz+2*qy*qw;
+	R[1][0] = 2*qx*qy+2*qz*qw;
+	R[1][1] = 1-2*qx*qx-2*qz*qz;
+	R[1][2] = 2*qy*qz-2*qx*qw;
+	R[2][0] = 2*qx*qz-2*qy*qw;
+	R[2][1] = 2*qy*qz+2*qx*qw;
+	R[2][2] = 1-2*qx*qx-2*qy*qy;
+
+	for (int i = 0; i < 3; i++)
+		T[i] = dbar[i] - (R[i][0]*mbar[0] + R[i][1]*mbar[1] + R[i][2]*mbar[2]);
+
+	return 0;
+}
+
+// Cyclic Jacobi rotations, A is diagonalized in place and the
+// eigenvectors are returned in the columns of V
+void StabBarEstimator::SymmetricEigen4(double A[4][4], double V[4][4])
+{
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			V[i][j] = (i == j) ? 1 : 0;
+
+	for (int sweep = 0; sweep < 20; sweep++) {
+		double off = 0;
+		for (int p = 0; p < 3; p++)
+			for (int q = p+1; q < 4; q++)
+				off += A[p][q]*A[p][q];
+		if (off < 1e-24)
+			break;
+
+		for (int p = 0; p < 3; p++) {
+			for (int q = p+1; q < 4; q++) {
+				if (fabs(A[p][q]) < 1e-300)
+					continue;
+
+				double theta = (A[q][q] - A[p][p])/(2*A[p][q]);
+				double t = (theta >= 0 ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1));
+				double c = 1/sqrt(t*t + 1);
+				double s = t*c;
+
+				for (int k = 0; k < 4; k++) {
+					double akp = A[k][p];
+					double akq = A[k][q];
+					A[k][p] = c*akp - s*akq;
+					A[k][q] = s*akp + c*akq;
+				}
+				for (int k = 0; k < 4; k++) {
+					double apk = A[p][k];
+					double aqk = A[q][k];
+					A[p][k] = c*apk - s*aqk;
+					A[q][k] = s*apk + c*aqk;
+				}
+				for (int k = 0; k < 4; k++) {
+					double vkp = V[k][p];
+					double vkq = V[k][q];
+					V[k][p] = c*vkp - s*vkq;
+					V[k][q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+}
@@ -1,66 +1,143 @@
 #include <ros/ros.h>
 #include <geometry_msgs/Quaternion.h>
+#include <geometry_msgs/Vector3Stamped.h>
 #include <vicon/Names.h>
 #include <vicon/Values.h>
 #include <vector>
 #include <string>
+#include <cstdio>
 #include <XMLConfig.h>
+#include <StabBarEstimator.h>
 
 using namespace std;
 
+// One tracked subject (one vsk file)
+typedef struct
+{
+	string name; // topic namespace
+	string model; // root segment in the vsk file
+	unsigned int first_marker; // offset into the flat marker table
+	unsigned int num_markers;
+	int stabbar_marker; // marker of the stabilizer bar segment, -1 if none
+	bool estimate_bar;
+	vector<ros::Publisher> marker_pub;
+	ros::Publisher bar_direction_pub;
+} body_t;
+
 
 class CoaxMarkerPublisher
 {
 protected:
-	
+
 	ros::Subscriber values_sub;
-	//ros::Subscriber names_sub;
-	
-	ros::Publisher marker1_pub;
-	ros::Publisher marker2_pub;
-	ros::Publisher marker3_pub;
-	ros::Publisher marker4_pub;
-	ros::Publisher marker5_pub;
-	ros::Publisher stabbar_pub;
+	ros::Subscriber names_sub;
 	
 	bool names_set;
-	vector<string> vsk_names;
-	vector<float> vsk_values;
-	vector<unsigned int> names_index;
-	vector<double> markers;
-	vector<unsigned int> index;
-	XMLConfig config;
-	string model;
-	string vsk_file;
 	
-public:
+	// Flat lookup table over the markers of all bodies, filled once at startup
+	vector<string> vsk_names; // "model:marker"
+	vector<string> vsk_segments;
+	vector<float> vsk_values; // xyz in segment coordinates
+	vector<int> names_index; // index of the x value of each marker in vicon::Values, -1 if not streamed
+	
+	vector<body_t> bodies;
+	vector<StabBarEstimator> stabbar_estimators;
 	
-	CoaxMarkerPublisher(ros::NodeHandle & n)
+	// per frame buffers
+	vector<double> marker_pos;
+	vector<bool> marker_visible;
+	vector<geometry_msgs::Quaternion> marker_msgs;
+
+public:
+
+	CoaxMarkerPublisher(ros::NodeHandle & n, ros::NodeHandle & pn)
 	{
+		// vsk files are given as body1/vsk, body2/vsk, ... (or a single vsk)
+		for (int k = 1; ; k++) {
+			char key[64];
+			sprintf(key, "body%d/vsk", k);
+			string vsk_file;
+			if (!pn.getParam(key, vsk_file)) {
+				if ((k == 1) && pn.getParam("vsk", vsk_file)) {
+					AddBody(n, pn, vsk_file, string(""));
+				}
+				break;
+			}
+			sprintf(key, "body%d/name", k);
+			string name;
+			pn.param(key, name, string(""));
+			AddBody(n, pn, vsk_file, name);
+		}
 		
-		//n.param("vsk", vsk_file, string("file.vsk"));
-		vsk_file = string("/Users/mfaess/git/CoaX/coax_vsk/vsk/Coax56SB.vsk");
+		if (bodies.empty()) {
+			ROS_FATAL("%s: No vsk files given (set body1/vsk, body2/vsk, ...)",
+					  ros::this_node::getName().c_str());
+		}
+		
+		names_index.assign(vsk_names.size(), -1);
+		marker_pos.assign(3*vsk_names.size(), 0);
+		marker_visible.assign(vsk_names.size(), false);
+		marker_msgs.resize(vsk_names.size());
+		
+		names_set = false;
 		
-		if (ParseVSK(vsk_file, model, vsk_names, vsk_values) != 0)
+		values_sub = n.subscribe("values", 1, &CoaxMarkerPublisher::values_callback, this);
+		names_sub = n.subscribe("names", 1, &CoaxMarkerPublisher::names_callback, this);
+	}
+	~CoaxMarkerPublisher(){
+	}
+	
+	void AddBody(ros::NodeHandle & n, ros::NodeHandle & pn, string &vsk_file, const string &name)
+	{
+		body_t body;
+		body.first_marker = vsk_names.size();
+		
+		if (ParseVSK(vsk_file, body.model, vsk_names, vsk_segments, vsk_values) != 0)
 		{
 			ROS_FATAL("%s: Failed to parse vsk file: %s",
 					  ros::this_node::getName().c_str(),
 					  vsk_file.c_str());
+			// drop the markers parsed before the error, no body owns them
+			vsk_names.resize(body.first_marker);
+			vsk_segments.resize(body.first_marker);
+			vsk_values.resize(3*body.first_marker);
+			return;
 		}
 		
-		values_sub = n.subscribe("values", 1, &CoaxMarkerPublisher::values_callback, this);
-		//names_sub = n.subscribe("names", 1, &CoaxMarkerPublisher::names_callback, this);
+		body.num_markers = vsk_names.size() - body.first_marker;
+		body.name = name.empty() ? body.model : name;
+		body.stabbar_marker = -1;
 		
-		marker1_pub = n.advertise<geometry_msgs::Quaternion>("marker1",1);
-		marker2_pub = n.advertise<geometry_msgs::Quaternion>("marker2",1);
-		marker3_pub = n.advertise<geometry_msgs::Quaternion>("marker3",1);
-		marker4_pub = n.advertise<geometry_msgs::Quaternion>("marker4",1);
-		marker5_pub = n.advertise<geometry_msgs::Quaternion>("marker5",1);
-		stabbar_pub = n.advertise<geometry_msgs::Quaternion>("stabbar",1);
+		// markers of the root segment are published as marker1, marker2, ...
+		// the first marker on another segment is the stabilizer bar marker
+		unsigned int count = 1;
+		for (unsigned int i = 0; i < body.num_markers; i++) {
+			unsigned int m = body.first_marker + i;
+			string topic;
+			if ((vsk_segments[m] != body.model) && (body.stabbar_marker < 0)) {
+				body.stabbar_marker = i;
+				topic = body.name + string("/stabbar");
+			} else {
+				char buf[32];
+				sprintf(buf, "/marker%d", count++);
+				topic = body.name + string(buf);
+			}
+			body.marker_pub.push_back(n.advertise<geometry_msgs::Quaternion>(topic,1));
+		}
 		
-		names_set = false;
-	}
-	~CoaxMarkerPublisher(){
+		StabBarEstimator estimator;
+		body.estimate_bar = false;
+		if (body.stabbar_marker >= 0)
+			body.estimate_bar = LoadStabBarGeometry(pn, body, estimator);
+		if (body.estimate_bar)
+			body.bar_direction_pub = n.advertise<geometry_msgs::Vector3Stamped>(body.name + string("/bar_direction"),1);
+		
+		ROS_INFO("%s: Tracking %s (%d markers) from %s",
+				 ros::this_node::getName().c_str(),
+				 body.name.c_str(), body.num_markers, vsk_file.c_str());
+		
+		bodies.push_back(body);
+		stabbar_estimators.push_back(estimator);
 	}
 	
 	void names_callback(const vicon::Names::ConstPtr &msg)
@@ -68,19 +145,29 @@ public:
 		if (names_set)
 			return;
 		
-		for (vector<string>::iterator i = vsk_names.begin(); i != vsk_names.end(); ++i) {
-			ROS_INFO("loop");
+		// every marker is streamed as four values: x, y, z, occluded
+		unsigned int found = 0;
+		for (unsigned int i = 0; i < vsk_names.size(); i++) {
+			string match_name = vsk_names[i] + string(" ");
 			for (unsigned int j = 0; j < msg->names.size(); j++) {
-				string match_name = *i + string(" ");
-				if (msg->names[j].find(match_name) != string::npos)
-					names_index.push_back(j);
+				if (msg->names[j].find(match_name) != string::npos) {
+					names_index[i] = j;
+					found++;
+					break;
+				}
+			}
+			if (names_index[i] < 0) {
+				ROS_WARN("%s: Marker %s is not streamed by vicon",
+						 ros::this_node::getName().c_str(),
+						 vsk_names[i].c_str());
 			}
 		}
 		
-		if (4*vsk_names.size() != names_index.size())
+		if (found == 0)
 		{
 			ROS_FATAL("Failed to extract names in vsk file from data");
 			ros::shutdown();
+			return;
 		}
 		
 		names_set = true;
@@ -90,84 +177,118 @@ public:
 	
 	void values_callback(const vicon::Values::ConstPtr &msg)
 	{
-		//if (!names_set)
-		//	return;
-		//ROS_INFO("values callback not returned");
-		markers = msg->values;
-		index = names_index;
+		if (!names_set)
+			return;
 		
-		geometry_msgs::Quaternion marker1;
-		geometry_msgs::Quaternion marker2;
-		geometry_msgs::Quaternion marker3;
-		geometry_msgs::Quaternion marker4;
-		geometry_msgs::Quaternion marker5;
-		geometry_msgs::Quaternion stabbar;
+		const vector<double> &values = msg->values;
 		
-		marker1.x = markers[1];
-		marker1.y = markers[2];
-		marker1.z = markers[3];
-		if (markers[4] < 0.5) {
-			marker1.w = 1; // visible
-		} else {
-			marker1.w = 0; // not visible
-		}
-		marker2.x = markers[5];
-		marker2.y = markers[6];
-		marker2.z = markers[7];
-		if (markers[8] < 1e-6) {
-			marker2.w = 1; // visible
-		} else {
-			marker2.w = 0; // not visible
-		}
-		marker3.x = markers[9];
-		marker3.y = markers[10];
-		marker3.z = markers[11];
-		if (markers[12] < 1e-6) {
-			marker3.w = 1; // visible
-		} else {
-			marker3.w = 0; // not visible
-		}
-		marker4.x = markers[13];
-		marker4.y = markers[14];
-		marker4.z = markers[15];
-		if (markers[16] < 1e-6) {
-			marker4.w = 1; // visible
-		} else {
-			marker4.w = 0; // not visible
+		// demultiplex the frame into the flat marker table in one pass
+		for (unsigned int i = 0; i < names_index.size(); i++) {
+			int j = names_index[i];
+			geometry_msgs::Quaternion &marker = marker_msgs[i];
+			if ((j < 0) || (j + 3 >= (int)values.size())) {
+				marker.x = 0;
+				marker.y = 0;
+				marker.z = 0;
+				marker.w = 0; // not visible
+			} else {
+				marker.x = values[j];
+				marker.y = values[j+1];
+				marker.z = values[j+2];
+				marker.w = (values[j+3] < 0.5) ? 1 : 0; // visible / not visible
+			}
+			marker_pos[3*i] = marker.x;
+			marker_pos[3*i+1] = marker.y;
+			marker_pos[3*i+2] = marker.z;
+			marker_visible[i] = (marker.w > 0.5);
 		}
-		marker5.x = markers[17];
-		marker5.y = markers[18];
-		marker5.z = markers[19];
-		if (markers[20] < 1e-6) {
-			marker5.w = 1; // visible
-		} else {
-			marker5.w = 0; // not visible
+		
+		for (unsigned int b = 0; b < bodies.size(); b++) {
+			body_t &body = bodies[b];
+			
+			for (unsigned int i = 0; i < body.num_markers; i++)
+				body.marker_pub[i].publish(marker_msgs[body.first_marker + i]);
+			
+			if (body.estimate_bar)
+				PublishBarDirection(body, stabbar_estimators[b]);
 		}
-		stabbar.x = markers[21];
-		stabbar.y = markers[22];
-		stabbar.z = markers[23];
-		if (markers[24] < 1e-6) {
-			stabbar.w = 1; // visible
-		} else {
-			stabbar.w = 0; // not visible
+		
+		return;
+	}
+	
+	void PublishBarDirection(body_t &body, StabBarEstimator &estimator)
+	{
+		// Stabilizer bar direction in body coordinates
+		double world[3*STABBAR_MAX_MARKERS];
+		bool visible[STABBAR_MAX_MARKERS];
+		unsigned int n = 0;
+		for (unsigned int i = 0; (i < body.num_markers) && (n < STABBAR_MAX_MARKERS); i++) {
+			if ((int)i == body.stabbar_marker)
+				continue;
+			unsigned int m = body.first_marker + i;
+			world[3*n] = marker_pos[3*m];
+			world[3*n+1] = marker_pos[3*m+1];
+			world[3*n+2] = marker_pos[3*m+2];
+			visible[n] = marker_visible[m];
+			n++;
 		}
-
-		marker1_pub.publish(marker1);
-		marker2_pub.publish(marker2);
-		marker3_pub.publish(marker3);
-		marker4_pub.publish(marker4);
-		marker5_pub.publish(marker5);
-		stabbar_pub.publish(stabbar);
+		unsigned int sb = body.first_marker + body.stabbar_marker;
+		
+		// nothing is published while the bar marker or too many body markers
+		// are not visible
+		if (estimator.Update(world, visible, &marker_pos[3*sb], marker_visible[sb]) != 0)
+			return;
 		
+		geometry_msgs::Vector3Stamped bar_direction;
+		bar_direction.header.stamp = ros::Time::now();
+		bar_direction.header.frame_id = body.name;
+		estimator.GetBarDirection(bar_direction.vector.x, bar_direction.vector.y, bar_direction.vector.z);
+		body.bar_direction_pub.publish(bar_direction);
+	}
 	
+	bool LoadStabBarGeometry(ros::NodeHandle & n, body_t &body, StabBarEstimator &estimator)
+	{
+		// hinge position and body markers (without stabilizer bar) in body
+		// coordinates [mm], see config/Coax56_stabbar.yaml
+		double hinge_x, hinge_y, hinge_z;
+		if (!n.getParam(body.name + string("/stabbar_hinge/x"), hinge_x) ||
+			!n.getParam(body.name + string("/stabbar_hinge/y"), hinge_y) ||
+			!n.getParam(body.name + string("/stabbar_hinge/z"), hinge_z))
+		{
+			ROS_INFO("%s: No stabilizer bar hinge given for %s, bar direction not estimated",
+					 ros::this_node::getName().c_str(), body.name.c_str());
+			return false;
+		}
+		estimator.SetHinge(hinge_x, hinge_y, hinge_z);
 		
-		return;
+		// default to the vsk marker positions
+		unsigned int k = 0;
+		for (unsigned int i = 0; (i < body.num_markers) && (k < STABBAR_MAX_MARKERS); i++) {
+			if ((int)i == body.stabbar_marker)
+				continue;
+			unsigned int m = body.first_marker + i;
+			char name[64];
+			double x, y, z;
+			sprintf(name, "/body_markers/marker%d/x", k+1);
+			n.param(body.name + string(name), x, (double)vsk_values[3*m]);
+			sprintf(name, "/body_markers/marker%d/y", k+1);
+			n.param(body.name + string(name), y, (double)vsk_values[3*m+1]);
+			sprintf(name, "/body_markers/marker%d/z", k+1);
+			n.param(body.name + string(name), z, (double)vsk_values[3*m+2]);
+			estimator.SetBodyMarker(k, x, y, z);
+			k++;
+		}
+		estimator.SetNumBodyMarkers(k);
+		
+		return true;
 	}
 	
 	int ParseVSK(string &file, string &model,
 				 vector<string> &names,
+				 vector<string> &segments,
 				 vector<float> &values)
 	{
+		XMLConfig config;
 		
 		if (config.Load(file) != 0)
 		{
@@ -196,20 +317,21 @@ public:
 			if (c == NULL)
 				break;
 			
+			if (!c->HasAttribute("SEGMENT"))
+			{
+				ROS_ERROR("%s: Failed to locate model name in vsk file %s",
+						  ros::this_node::getName().c_str(),
+						  file.c_str());
+				delete c;
+				return -1;
+			}
+			
+			string segment;
+			c->GetAttributeString("SEGMENT", segment);
 			if (!model_set)
 			{
-				if (!c->HasAttribute("SEGMENT"))
-				{
-					ROS_ERROR("%s: Failed to locate model name in vsk file %s",
-							  ros::this_node::getName().c_str(),
-							  file.c_str());
-					return -1;
-				}
-				else
-				{
-					c->GetAttributeString("SEGMENT", model);
-					model_set = true;
-				}
+				model = segment;
+				model_set = true;
 			}
 			
 			if (c->HasAttribute("STATUS"))
@@ -220,12 +342,14 @@ public:
 					ROS_ERROR("%s: Improperly formatted vsk file %s",
 							  ros::this_node::getName().c_str(),
 							  file.c_str());
+					delete c;
 					return -1;
 				}
 				
 				string name;
 				c->GetAttributeString(string("NAME"), name);
 				names.push_back(model + string(":") + name);
+				segments.push_back(segment);
 				
 				float x = c->GetAttributeTupleFloat(string("POSITION"), 0, 0);
 				float y = c->GetAttributeTupleFloat(string("POSITION"), 1, 0);
@@ -251,8 +375,9 @@ int main(int argc, char** argv)
 	ros::init(argc, argv, "coax_marker_publisher");
 	
 	ros::NodeHandle n("/coax_marker_publisher");
+	ros::NodeHandle pn("~");
 	
-	CoaxMarkerPublisher api(n);
+	CoaxMarkerPublisher api(n, pn);
 	
 	
 	ros::spin();
@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <StabBarEstimator.h>
+
+// Checks StabBarEstimator on synthetic Vicon frames of the Coax56 geometry
+// of config/Coax56_stabbar.yaml: random poses and bar directions, with one
+// body marker hidden on every other frame. Fails when the rotation or the
+// bar direction is off by more than the tolerance (default 1e-9), the
+// translation by more than the tolerance times 1e4 mm, or when a frame that
+// cannot be estimated is not rejected. Does not use ROS.
+
+#define BODY_MARKERS 5
+#define BAR_LENGTH 60.0 // hinge to stabilizer bar marker [mm]
+
+const double body[BODY_MARKERS][3] = {
+	{-33.9434, -59.0677, -44.4484},
+	{33.3300, -60.2362, -44.8094},
+	{33.3245, 60.9161, -44.9953},
+	{-20.4397, 20.7246, 33.4755},
+	{24.9739, -17.8216, 34.3630}
+};
+const double hinge[3] = {-0.45, 0.6, 180.0};
+
+// uniform in [a b]
+double uniform(double a, double b)
+{
+	return a + (b - a)*rand()/RAND_MAX;
+}
+
+void euler_to_rotation(double roll, double pitch, double yaw, double R[3][3])
+{
+	R[0][0] = cos(yaw)*cos(pitch);
+	R[0][1] = cos(yaw)*sin(pitch)*sin(roll) - sin(yaw)*cos(roll);
+	R[0][2] = cos(yaw)*sin(pitch)*cos(roll) + sin(yaw)*sin(roll);
+	R[1][0] = sin(yaw)*cos(pitch);
+	R[1][1] = sin(yaw)*sin(pitch)*sin(roll) + cos(yaw)*cos(roll);
+	R[1][2] = sin(yaw)*sin(pitch)*cos(roll) - cos(yaw)*sin(roll);
+	R[2][0] = -sin(pitch);
+	R[2][1] = cos(pitch)*sin(roll);
+	R[2][2] = cos(pitch)*cos(roll);
+}
+
+void record(double &largest, double e)
+{
+	largest = ((e > largest) || (e != e)) ? e : largest;
+}
+
+// w = R*b + T
+void to_world(const double R[3][3], const double T[3], const double b[3], double* w)
+{
+	for (int i = 0; i < 3; i++)
+		w[i] = R[i][0]*b[0] + R[i][1]*b[1] + R[i][2]*b[2] + T[i];
+}
+
+int main(int argc, char** argv)
+{
+	int frames = (argc > 1) ? atoi(argv[1]) : 10000;
+	double tolerance = (argc > 2) ? atof(argv[2]) : 1e-9;
+	if (frames < 1) {
+		fprintf(stderr, "usage: %s [frames] [tolerance]\n", argv[0]);
+		return -1;
+	}
+
+	StabBarEstimator estimator;
+	estimator.SetHinge(hinge[0], hinge[1], hinge[2]);
+	for (int k = 0; k < BODY_MARKERS; k++)
+		estimator.SetBodyMarker(k, body[k][0], body[k][1], body[k][2]);
+	estimator.SetNumBodyMarkers(BODY_MARKERS);
+
+	double rotation_error = 0;
+	double translation_error = 0;
+	double bar_error = 0;
+	int rejected = 0;
+	bool passed = true;
+
+	srand(1);
+	for (int i = 0; i < frames; i++) {
+		// any heading, tilted up to about 30 degrees, anywhere in the room
+		double R[3][3];
+		euler_to_rotation(uniform(-0.5, 0.5), uniform(-0.5, 0.5), uniform(-M_PI, M_PI), R);
+		double T[3] = {uniform(-3000, 3000), uniform(-3000, 3000), uniform(0, 2500)};
+
+		// bar direction up to 0.2 rad off the body z axis
+		double tilt = uniform(0, 0.2);
+		double dir = uniform(-M_PI, M_PI);
+		double z_bar[3] = {sin(tilt)*cos(dir), sin(tilt)*sin(dir), cos(tilt)};
+		double sb_body[3];
+		for (int j = 0; j < 3; j++)
+			sb_body[j] = hinge[j] + BAR_LENGTH*z_bar[j];
+
+		double world[3*BODY_MARKERS];
+		bool visible[BODY_MARKERS];
+		for (int k = 0; k < BODY_MARKERS; k++) {
+			to_world(R, T, body[k], &world[3*k]);
+			visible[k] = !((i % 2) && (k == i % BODY_MARKERS));
+		}
+		double stabbar[3];
+		to_world(R, T, sb_body, stabbar);
+
+		if (estimator.Update(world, visible, stabbar, true) != 0) {
+			fprintf(stderr, "Frame %d not estimated\n", i);
+			passed = false;
+			continue;
+		}
+
+		double R_est[3][3];
+		double T_est[3];
+		double bar[3];
+		estimator.GetRotation(R_est);
+		estimator.GetTranslation(T_est);
+		estimator.GetBarDirection(bar[0], bar[1], bar[2]);
+		for (int j = 0; j < 3; j++) {
+			for (int k = 0; k < 3; k++)
+				record(rotation_error, fabs(R_est[j][k] - R[j][k]));
+			record(translation_error, fabs(T_est[j] - T[j]));
+			record(bar_error, fabs(bar[j] - z_bar[j]));
+		}
+
+		// no bar marker, or fewer than three body markers
+		bool few[BODY_MARKERS] = {true, true, false, false, false};
+		if (estimator.Update(world, visible, stabbar, false) == 0)
+			passed = false;
+		else if (estimator.Update(world, few, stabbar, true) == 0)
+			passed = false;
+		else
+			rejected++;
+	}
+
+	printf("%d frames\n", frames);
+	printf("rotation     largest difference %.3e\n", rotation_error);
+	printf("translation  largest difference %.3e mm\n", translation_error);
+	printf("bar          largest difference %.3e\n", bar_error);
+	printf("rejected %d of %d frames without the bar or three markers\n", rejected, frames);
+	passed = passed && (rejected == frames) && (rotation_error <= tolerance) &&
+		(translation_error <= tolerance*1e4) && (bar_error <= tolerance);
+	printf("%s (tolerance %g)\n", passed ? "PASSED" : "FAILED", tolerance);
+
+	return passed ? 0 : 1;
+}
@@ -1,6 +1,7 @@
 #ifndef __COAX_ROS_CONTROL__
 #define __COAX_ROS_CONTROL__
 
+#include <coax_dynamics/CoaXControl.h>
 
 #define CONTROL_LANDED 0 // State when helicopter has landed successfully
 #define CONTROL_START 1 // Start / Takeoff
@@ -10,47 +11,7 @@
 #define CONTROL_TRAJECTORY 5 // Follow Trajectory
 #define CONTROL_LANDING 6 // Landing maneuver
 
-#define TRAJECTORY_SPIRAL 0
-#define TRAJECTORY_ROTINPLACE 1
-#define TRAJECTORY_VERTOSCIL 2
-#define TRAJECTORY_LYINGCIRCLE 3
-#define TRAJECTORY_STANDINGCIRCLE 4
-#define TRAJECTORY_YAWOSCIL 5
-#define TRAJECTORY_HORZLINE 6
-
-typedef struct
-{
-	double mass;
-	double Ixx, Iyy, Izz;
-	double d_up, d_lo;
-	double k_springup, k_springlo;
-	double l_up, l_lo;
-	double k_Tup, k_Tlo;
-	double k_Mup, k_Mlo;
-	double Tf_motup, Tf_motlo;
-	double Tf_up;
-	double rs_mup, rs_bup;
-	double rs_mlo, rs_blo;
-	double zeta_mup, zeta_bup;
-	double zeta_mlo, zeta_blo;
-	double max_SPangle;
-} model_params_t;
-
-typedef struct
-{
-	
-	double Kp_Fx;
-	double Kp_Fy;
-	double Kp_Fz;
-	double Kd_Fx;
-	double Kd_Fy;
-	double Kd_Fz;
-	double Kp_Mz;
-	double Kd_Mz;
-	double Kpq_roll;
-	double Kpq_pitch;
-	
-} control_params_t;
+#define TRAJECTORY_DURATION 20 // [s] hover after following a trajectory this long
 
 
 class CoaxRosControl
@@ -65,13 +26,19 @@ public:
 	
 	void coaxStateCallback(const coax_msgs::CoaxState::ConstPtr & message);
 	void coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & message);
+	void coaxBarCallback(const geometry_msgs::Vector3Stamped::ConstPtr & message);
 	
+	void innerControl();
 	void controlFunction(double* control, arma::colvec coax_state, arma::mat Rb2w, 
-						 arma::colvec trajectory, model_params_t model_params, control_params_t control_params);
+						 arma::colvec trajectory, coax_params_t model_params, control_params_t control_params);
 	arma::colvec trajectoryGeneration(double time, int TYPE, double* init_traj_pose);
 	void setControls(double* control);
+	void compensateVoltage(double* control);
+	void sendControls();
+	void estimateRotorSpeeds(double time);
 	
-	void rawControlPublisher(unsigned int rate);
+	void rawControlPublisher(ros::NodeHandle & n, unsigned int rate_);
+	void rawControlTimerCallback(const ros::TimerEvent & event);
 	
 	bool setControlMode(coax_ros_control::SetControlMode::Request &req, coax_ros_control::SetControlMode::Response &out);
 	bool setTrajectoryType(coax_ros_control::SetTrajectoryType::Request &req, coax_ros_control::SetTrajectoryType::Response &out);
@@ -94,6 +61,9 @@ public:
 	void SetMaximumSwashPlateAngle(double max_SPangle);
 	void SetHeaveYawGains(double Kp_Fz, double Kd_Fz, double Kp_Mz, double Kd_Mz);
 	void SetLateralGains(double Kp_Fx, double Kp_Fy, double Kd_Fx, double Kd_Fy, double Kpq_roll, double Kpq_pitch);
+	void SetBarCorrectionGain(double gain);
+	void SetInnerLoop(bool enabled);
+	bool LoadTrajectoryTable(const std::string &filename);
 	void load_model_params(ros::NodeHandle &n);
 	void load_control_params(ros::NodeHandle &n);
 	
@@ -107,13 +77,17 @@ private:
 	
 	ros::Subscriber coax_odom_sub;
 	ros::Subscriber coax_state_sub;
+	ros::Subscriber coax_bar_sub;
+	
+	ros::Timer raw_control_timer;
 	
 	std::vector<ros::ServiceServer> set_control_mode;
 	std::vector<ros::ServiceServer> set_trajectory_type;
 	std::vector<ros::ServiceServer> set_target_pose;
 	
-	model_params_t model_params;
+	coax_params_t model_params;
 	control_params_t control_params;
+	attitude_params_t attitude_params;
 	
 	bool LOW_POWER_DETECTED;
 	bool FIRST_START;
@@ -132,6 +106,8 @@ private:
 	int coax_state_age;
 	int coax_nav_mode;
 	int raw_control_age;
+	int jump_count;
+	unsigned int rate;
 	
 	double IDLE_TIME;
 	double RISE_TIME;
@@ -143,6 +119,7 @@ private:
 	
 	double roll_trim;
 	double pitch_trim;
+	servo_trim_t servo_trim;
 	double motor_up;
 	double motor_lo;
 	double servo_roll;
@@ -161,6 +138,9 @@ private:
 	double gotopos_duration;
 	double target_pose[4];
 	
+	// rows "time x y z vx vy vz ax ay az yaw yaw_rate" of TRAJECTORY_TABLE
+	arma::mat trajectory_table;
+	
 	double time_now;
 	double time_prev;
 	double start_time;
@@ -175,12 +155,32 @@ private:
 	double prev_Omega_lo;
 	double z_bar[3];
 	double prev_z_bar[3];
+	double z_bar_meas[3];
+	bool z_bar_meas_new;
+	double BAR_CORRECTION_GAIN;
 	double prev_motor_up;
 	double prev_motor_lo;
+	double rotor_time;
 	
 	double imu_p;
 	double imu_q;
 	double imu_r;
+	
+	// attitude and rotor speed loop on the coax state stream, on the
+	// setpoint of the position loop of the last vicon frame
+	bool INNER_LOOP;
+	bool control_computed;
+	bool outer_closed_loop;
+	double vicon_time;
+	double setpoint[SETPOINT_DIMENSION];
+	arma::colvec outer_state;
+	arma::mat outer_Rb2w;
+	
+	// last accepted vicon measurement (jump detection)
+	double prev_position[3];
+	double prev_velocity[3];
+	double prev_orientation[4];
+	double prev_bodyrates[2];
 
 };
 
@@ -1,5 +1,8 @@
+#include <cstdio>
+#include <cstring>
 #include <ros/ros.h>
 #include <nav_msgs/Odometry.h>
+#include <geometry_msgs/Vector3Stamped.h>
 #include <coax_msgs/CoaxState.h>
 #include <coax_msgs/CoaxReachNavState.h>
 #include <coax_ros_control/SetControlMode.h>
@@ -23,13 +26,16 @@ CoaxRosControl::CoaxRosControl(ros::NodeHandle & n)
 	raw_control_pub = n.advertise<coax_msgs::CoaxRawControl>("rawcontrol",1);
 		
 	coax_odom_sub = n.subscribe("odom", 1, &CoaxRosControl::coaxOdomCallback, this);
-	coax_state_sub = n.subscribe("state", 1, &CoaxRosControl::coaxStateCallback, this);
+	coax_state_sub = n.subscribe("state", 1, &CoaxRosControl::coaxStateCallback, this,
+								 ros::TransportHints().tcp().tcpNoDelay());
+	coax_bar_sub = n.subscribe("bar_direction", 1, &CoaxRosControl::coaxBarCallback, this);
 		
 	set_control_mode.push_back(n.advertiseService("set_control_mode", &CoaxRosControl::setControlMode, this));
 	set_trajectory_type.push_back(n.advertiseService("set_trajectory_type", &CoaxRosControl::setTrajectoryType, this));
 	set_target_pose.push_back(n.advertiseService("set_target_pose", &CoaxRosControl::setTargetPose, this));
 	
 	CONTROL_MODE = CONTROL_LANDED;
+	TRAJECTORY_TYPE = TRAJECTORY_LYINGCIRCLE;
 	LOW_POWER_DETECTED = false;
 	FIRST_START = false;
 	FIRST_HOVER = false;
@@ -44,9 +50,13 @@ CoaxRosControl::CoaxRosControl(ros::NodeHandle & n)
 	coax_state_age = 0;
 	coax_nav_mode = 0;
 	raw_control_age = 0;
+	jump_count = 0;
+	rate = 100;
 	
 	roll_trim = 0;
 	pitch_trim = 0;
+	servo_trim.roll = 0;
+	servo_trim.pitch = 0;
 	motor_up = prev_motor_up = 0;
 	motor_lo = prev_motor_lo = 0;
 	servo_roll = 0;
@@ -54,9 +64,15 @@ CoaxRosControl::CoaxRosControl(ros::NodeHandle & n)
 	
 	Omega_up = prev_Omega_up = 0;
 	Omega_lo = prev_Omega_lo = 0;
+	rotor_time = 0;
 	z_bar[0] = prev_z_bar[0] = 0;
 	z_bar[1] = prev_z_bar[1] = 0;
 	z_bar[2] = prev_z_bar[2] = 1;
+	z_bar_meas[0] = 0;
+	z_bar_meas[1] = 0;
+	z_bar_meas[2] = 1;
+	z_bar_meas_new = false;
+	BAR_CORRECTION_GAIN = 0;
 	
 	IDLE_TIME = 3;
 	START_HEIGHT = 0.3;
@@ -70,6 +86,18 @@ CoaxRosControl::CoaxRosControl(ros::NodeHandle & n)
 	imu_q = 0;
 	imu_r = 0;	
 	
+	INNER_LOOP = false;
+	control_computed = false;
+	outer_closed_loop = false;
+	vicon_time = 0;
+	for (int i=0; i<SETPOINT_DIMENSION; i++) {
+		setpoint[i] = 0;
+	}
+	outer_state = arma::zeros(17);
+	outer_Rb2w = arma::eye(3,3);
+	
+	memset(&attitude_params, 0, sizeof(attitude_params));
+	
 }
 CoaxRosControl::~CoaxRosControl()
 {
@@ -85,9 +113,17 @@ bool CoaxRosControl::reachNavState(int des_state, float timeout)
 	coax_msgs::CoaxReachNavState srv;
 	srv.request.desiredState = des_state;
 	srv.request.timeout = timeout;
-	reach_nav_state.call(srv);
-	
-	return 0;
+	if (reach_nav_state.call(srv)){
+		ROS_INFO("Set nav_state to: %d, Result: %d", des_state, srv.response.result);
+	}else{
+		ROS_INFO("Failed to call service reach_nav_state");
+		return 1; // not successful
+	}
+	if (srv.response.result == 0) {
+		return 0; // successful
+	} else {
+		return 1; // not successful
+	}
 }
 
 bool CoaxRosControl::configureComm(int frequency, int contents)
@@ -129,26 +165,124 @@ void CoaxRosControl::coaxStateCallback(const coax_msgs::CoaxState::ConstPtr & me
 	imu_r = -message->gyro[2];
 	
 	coax_state_age = 0;
+	
+	// commands follow the configureComm stream
+	if (INNER_LOOP && outer_closed_loop) {
+		innerControl();
+	}
 }
 
-void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & message)
+void CoaxRosControl::coaxBarCallback(const geometry_msgs::Vector3Stamped::ConstPtr & message)
 {
+	// stabilizer bar direction in body coordinates from coax_marker_publisher,
+	// only published when the markers are visible
+	z_bar_meas[0] = message->vector.x;
+	z_bar_meas[1] = message->vector.y;
+	z_bar_meas[2] = message->vector.z;
+	z_bar_meas_new = true;
+}
 
-	// vicon jump detection ?
+void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & message)
+{
+	int i;
+	double position[3];
+	double velocity[3];
+	double orientation[4];
+	double bodyrates[2];
+	position[0] = message->pose.pose.position.x;
+	position[1] = message->pose.pose.position.y;
+	position[2] = message->pose.pose.position.z;
+	velocity[0] = message->twist.twist.linear.x;
+	velocity[1] = message->twist.twist.linear.y;
+	velocity[2] = message->twist.twist.linear.z;
+	orientation[0] = message->pose.pose.orientation.x;
+	orientation[1] = message->pose.pose.orientation.y;
+	orientation[2] = message->pose.pose.orientation.z;
+	orientation[3] = message->pose.pose.orientation.w;
+	bodyrates[0] = message->twist.twist.angular.x;
+	bodyrates[1] = message->twist.twist.angular.y;
 	
 	// getting current time
 	time_now = ros::Time::now().toSec();
+	estimateRotorSpeeds(time_now);
 	if (FIRST_RUN){
 		time_prev = time_now;
+		for (i=0; i<3; i++) {
+			prev_position[i] = position[i];
+			prev_velocity[i] = velocity[i];
+		}
+		for (i=0; i<4; i++) {
+			prev_orientation[i] = orientation[i];
+		}
+		prev_bodyrates[0] = bodyrates[0];
+		prev_bodyrates[1] = bodyrates[1];
 		FIRST_RUN = 0;
 	}
 	double delta_t = time_now - time_prev;
 	
+	// Vicon position jump detection (same as Coax_Control.m)
+	double jump = 0;
+	for (i=0; i<3; i++) {
+		jump += (position[i] - prev_position[i])*(position[i] - prev_position[i]);
+	}
+	jump = sqrt(jump);
+	
+	bool keep_pose = false;
+	bool keep_twist = false;
+	if (jump_count > 0) {
+		if (jump_count > 20) {
+			// vicon did not come back, accept the new position
+			if (CONTROL_MODE != CONTROL_LANDED) {
+				CONTROL_MODE = CONTROL_HOVER;
+				FIRST_HOVER = true;
+				ROS_INFO("Vicon estimate has jumped to another position!!!");
+			}
+			jump_count = 0;
+		} else if (jump > 0.1) {
+			jump_count += 1;
+			keep_pose = true;
+			keep_twist = true;
+		} else {
+			jump_count = 0;
+			keep_twist = true;
+		}
+	} else if (jump > 0.05) {
+		jump_count = 1;
+		keep_pose = true;
+		keep_twist = true;
+	}
+	
+	if (keep_pose) {
+		for (i=0; i<3; i++) {
+			position[i] = prev_position[i];
+		}
+		for (i=0; i<4; i++) {
+			orientation[i] = prev_orientation[i];
+		}
+	}
+	if (keep_twist) {
+		for (i=0; i<3; i++) {
+			velocity[i] = prev_velocity[i];
+		}
+		bodyrates[0] = prev_bodyrates[0];
+		bodyrates[1] = prev_bodyrates[1];
+	}
+	
+	for (i=0; i<3; i++) {
+		prev_position[i] = position[i];
+		prev_velocity[i] = velocity[i];
+	}
+	for (i=0; i<4; i++) {
+		prev_orientation[i] = orientation[i];
+	}
+	prev_bodyrates[0] = bodyrates[0];
+	prev_bodyrates[1] = bodyrates[1];
+	
 	// Get orientation quaternion
-	double qx = message->pose.pose.orientation.x;
-	double qy = message->pose.pose.orientation.y;
-	double qz = message->pose.pose.orientation.z;
-	double qw = message->pose.pose.orientation.w;
+	double qx = orientation[0];
+	double qy = orientation[1];
+	double qz = orientation[2];
+	double qw = orientation[3];
 	
 	// Compute rotation matrix
 	arma::mat Rb2w = arma::zeros(3,3);
@@ -163,7 +297,7 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 	Rb2w(2,2) = 1-2*qx*qx-2*qy*qy;
 	
 	// Estimate stabilizer bar orientation
-	double b_z_bardotz = 1/model_params.Tf_up*acos(prev_z_bar[2])*sqrt(prev_z_bar[0]*prev_z_bar[0] + prev_z_bar[1]*prev_z_bar[1]);
+	double b_z_bardotz = 1/model_params.Tf_up*coax_math::acos(prev_z_bar[2])*sqrt(prev_z_bar[0]*prev_z_bar[0] + prev_z_bar[1]*prev_z_bar[1]);
 	arma::colvec b_z_bardot(3);
 	if (b_z_bardotz <= 0){
 		b_z_bardot = arma::zeros(3);
@@ -174,8 +308,8 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 		b_z_bardot(2) = b_z_bardotz;
 	}
 
-	double p = message->twist.twist.angular.x;
-	double q = message->twist.twist.angular.y;
+	double p = bodyrates[0];
+	double q = bodyrates[1];
 	double r = imu_r;
 	
 	z_bar[0] = prev_z_bar[0] + (r*prev_z_bar[1] - q*prev_z_bar[2] + b_z_bardot(0))*delta_t;
@@ -187,21 +321,35 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 	z_bar[1] = z_bar[1]/norm_z_bar;
 	z_bar[2] = z_bar[2]/norm_z_bar;
 	
+	// Correct stabilizer bar estimate with marker measurement
+	if (z_bar_meas_new && (BAR_CORRECTION_GAIN > 0)){
+		z_bar[0] += BAR_CORRECTION_GAIN*(z_bar_meas[0] - z_bar[0]);
+		z_bar[1] += BAR_CORRECTION_GAIN*(z_bar_meas[1] - z_bar[1]);
+		z_bar[2] += BAR_CORRECTION_GAIN*(z_bar_meas[2] - z_bar[2]);
+		
+		norm_z_bar = sqrt(z_bar[0]*z_bar[0] + z_bar[1]*z_bar[1] + z_bar[2]*z_bar[2]);
+		z_bar[0] = z_bar[0]/norm_z_bar;
+		z_bar[1] = z_bar[1]/norm_z_bar;
+		z_bar[2] = z_bar[2]/norm_z_bar;
+		
+		z_bar_meas_new = false;
+	}
+	
 	prev_z_bar[0] = z_bar[0];
 	prev_z_bar[1] = z_bar[1];
 	prev_z_bar[2] = z_bar[2];
 	
 	// Compose coax_state
 	arma::colvec coax_state = arma::zeros(17);
-	coax_state(0) = message->pose.pose.position.x;
-	coax_state(1) = message->pose.pose.position.y;
-	coax_state(2) = message->pose.pose.position.z;
-	coax_state(3) = message->twist.twist.linear.x;
-	coax_state(4) = message->twist.twist.linear.y;
-	coax_state(5) = message->twist.twist.linear.z;	
-	coax_state(6) = atan2(2*(qw*qx+qy*qz),1-2*(qx*qx+qy*qy));
-	coax_state(7) = asin(2*(qw*qy-qz*qx));
-	coax_state(8) = atan2(2*(qw*qz+qx*qy),1-2*(qy*qy+qz*qz));
+	coax_state(0) = position[0];
+	coax_state(1) = position[1];
+	coax_state(2) = position[2];
+	coax_state(3) = velocity[0];
+	coax_state(4) = velocity[1];
+	coax_state(5) = velocity[2];
+	coax_state(6) = coax_math::atan2(2*(qw*qx+qy*qz),1-2*(qx*qx+qy*qy));
+	coax_state(7) = coax_math::asin(2*(qw*qy-qz*qx));
+	coax_state(8) = coax_math::atan2(2*(qw*qz+qx*qy),1-2*(qy*qy+qz*qz));
 	coax_state(9) = p;
 	coax_state(10) = q;
 	coax_state(11) = r;
@@ -218,11 +366,12 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 	double dt_gotopos;
 	double dt_land;
 	double dt_traj;
+	double trajectory_duration;
 	double gotopos_distance;
 	double position_error;
 	double init_traj_pose[4];
-	int i;
 	
+	control_computed = false;
 	switch (CONTROL_MODE) {
 			
 		case CONTROL_START:
@@ -442,6 +591,18 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 				
 				// compute control commands
 				controlFunction(control, coax_state, Rb2w, trajectory, model_params, control_params);
+				
+				// a table ends with its last row, the others after TRAJECTORY_DURATION
+				if (TRAJECTORY_TYPE == TRAJECTORY_TABLE){
+					trajectory_duration = trajectory_table(trajectory_table.n_rows-1,0);
+				}else{
+					trajectory_duration = TRAJECTORY_DURATION;
+				}
+				
+				if (dt_traj > trajectory_duration){
+					CONTROL_MODE = CONTROL_HOVER;
+					FIRST_HOVER = true;
+				}
 			}
 			
 			if (LOW_POWER_DETECTED){
@@ -498,6 +659,7 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 					control[3] = 0;
 				}else{
 					CONTROL_MODE = CONTROL_LANDED; // in the end of maneuver
+					outer_closed_loop = false;
 					// flush integrators
 					motor_up = 0;
 					motor_lo = 0;
@@ -519,336 +681,150 @@ void CoaxRosControl::coaxOdomCallback(const nav_msgs::Odometry::ConstPtr & messa
 	}
 	
 	// Voltage compensation
-	double volt_compUp = (12.22 - battery_voltage)*0.0279;
-	double volt_compLo = (12.22 - battery_voltage)*0.0287;
-	if (control[0] > 0.05 || control[1] > 0.05){
-		control[0] = control[0] + volt_compUp;
-		control[1] = control[1] + volt_compLo;
-	}
+	compensateVoltage(control);
 	
 	// set control commands
 	setControls(control);
+	
+	// keep what the inner loop needs until the next vicon frame
+	outer_closed_loop = control_computed && (CONTROL_MODE != CONTROL_LANDED);
+	outer_state = coax_state;
+	outer_Rb2w = Rb2w;
+	vicon_time = time_now;
+	
+	if (INNER_LOOP) {
+		sendControls();
+	}
 										
 	raw_control_age = 0;
 	time_prev = time_now;
 }
-										
-//===================
-// Control functions
-//===================
 
-void CoaxRosControl::controlFunction(double* control, arma::colvec coax_state, arma::mat Rb2w, 
-									 arma::colvec trajectory, model_params_t model_params, control_params_t control_params)
+void CoaxRosControl::innerControl()
 {
-	
-	double z = coax_state(2);
-	double zdot = coax_state(5);
-	double p = coax_state(9);
-	double q = coax_state(10);
-	double r = coax_state(11);
-	
-	// rotor speeds
-	double Omega_up = coax_state(12);
-	double Omega_lo = coax_state(13);
-	
-	// stabilizer bar direction
-	double z_barx = coax_state(14);
-	double z_bary = coax_state(15);
-	double z_barz = coax_state(16);
-	
-	// Parameters
-	double g = 9.81;
-	double m = model_params.mass;
-	//double Ixx = model_params.Ixx;
-	//double Iyy = model_params.Iyy;
-	//double Izz = model_params.Izz;
-	//double d_up = model_params.d_up;
-	//double d_lo = model_params.d_lo;
-	//double k_springup = model_params.k_springup;
-	//double k_springlo = model_params.k_springlo;
-	double l_up = model_params.l_up;
-	double l_lo = model_params.l_lo;
-	double k_Tup = model_params.k_Tup;
-	double k_Tlo = model_params.k_Tlo;
-	double k_Mup = model_params.k_Mup;
-	double k_Mlo = model_params.k_Mlo;
-	//double Tf_motup = model_params.Tf_motup;
-	//double Tf_motlo = model_params.Tf_motlo;
-	//double Tf_up = model_params.Tf_up;
-	double rs_mup = model_params.rs_mup;
-	double rs_bup = model_params.rs_bup;
-	double rs_mlo = model_params.rs_mlo;
-	double rs_blo = model_params.rs_blo;
-	double zeta_mup = model_params.zeta_mup;
-	double zeta_bup = model_params.zeta_bup;
-	double zeta_mlo = model_params.zeta_mlo;
-	double zeta_blo = model_params.zeta_blo;
-	double max_SPangle = model_params.max_SPangle;
-	
-	// Control Parameters
-	double Kp_Fx = control_params.Kp_Fx;
-	double Kp_Fy = control_params.Kp_Fy;
-	double Kp_Fz = control_params.Kp_Fz;
-	double Kd_Fx = control_params.Kd_Fx;
-	double Kd_Fy = control_params.Kd_Fy;
-	double Kd_Fz = control_params.Kd_Fz;
-	double Kp_Mz = control_params.Kp_Mz;
-	double Kd_Mz = control_params.Kd_Mz;
-	double Kpq_roll = control_params.Kpq_roll;
-	double Kpq_pitch = control_params.Kpq_pitch;
-	
-	// Desired Forces
-	arma::colvec kpxy(2);
-	arma::colvec kdxy(2);
-	arma::colvec kpq(2);
-	kpxy(0) = Kp_Fx;
-	kpxy(1) = Kp_Fy;
-	kdxy(0) = Kd_Fx;
-	kdxy(1) = Kd_Fy;
-	kpq(0) = Kpq_pitch;
-	kpq(1) = Kpq_roll;
-	
-	arma::colvec pos_error(2);
-	arma::colvec vel_error(2);
-	arma::colvec pq_error(2);
-	pos_error = coax_state.subvec(0, 1) - trajectory.subvec(0, 1);
-	vel_error = coax_state.subvec(3, 4) - trajectory.subvec(3, 4);
-	pq_error(0) = q;
-	pq_error(1) = p;
-	
-	arma::colvec Fxy_des(2);
-	Fxy_des = -arma::diagmat(kpxy)*pos_error - arma::diagmat(kdxy)*vel_error - Rb2w.submat(0,0,1,1)*arma::diagmat(kpq)*pq_error + m*trajectory.subvec(6, 7);
-	
-	// Upper thrust vector direction
-	double z_Tupz = cos(l_up*acos(z_barz));
-	arma::colvec z_Tup_p(3);
-	double temp;
-	if (z_Tupz < 1){
-		temp = sqrt((1-z_Tupz*z_Tupz)/(z_barx*z_barx + z_bary*z_bary));
-		z_Tup_p(0) = z_barx*temp;
-		z_Tup_p(1) = z_bary*temp;
-		z_Tup_p(2) = z_Tupz;
-	}else {
-		z_Tup_p(0) = 0;
-		z_Tup_p(1) = 0;
-		z_Tup_p(2) = 1;
-	}
-	double zeta = zeta_mup*Omega_up + zeta_bup;
-	arma::colvec z_Tup(3);
-	z_Tup(0) = cos(zeta)*z_Tup_p(0) - sin(zeta)*z_Tup_p(1);
-	z_Tup(1) = sin(zeta)*z_Tup_p(0) + cos(zeta)*z_Tup_p(1);
-	z_Tup(2) = z_Tup_p(2);
-
-	// Lower thrust vector direction
-	arma::colvec z_Tlo(3);
-	if (Omega_lo < 10) {
-		z_Tlo(0) = 0;
-		z_Tlo(1) = 0;
-		z_Tlo(2) = 1;
-	} else {
-		z_Tlo(0) = 1/(k_Tlo*Omega_lo*Omega_lo)*(Rb2w(0,0)*Fxy_des(0) + Rb2w(1,0)*Fxy_des(1));
-		z_Tlo(1) = 1/(k_Tlo*Omega_lo*Omega_lo)*(Rb2w(0,1)*Fxy_des(0) + Rb2w(1,1)*Fxy_des(1));
-		z_Tlo(2) = sqrt(1-z_Tlo(0)*z_Tlo(0)-z_Tlo(1)*z_Tlo(1));
+	// The attitude and rotor speed loop between two vicon frames: the
+	// setpoint of the position loop is kept, the heading reference moves
+	// with the yaw rate, the attitude of the last frame is propagated with
+	// the gyro and the rotor speeds are estimated up to now.
+	if ((CONTROL_MODE != CONTROL_START) && (CONTROL_MODE != CONTROL_HOVER) &&
+		(CONTROL_MODE != CONTROL_GOTOPOS) && (CONTROL_MODE != CONTROL_TRAJECTORY) &&
+		(CONTROL_MODE != CONTROL_LANDING)) {
+		outer_closed_loop = false;
+		return; // landed or stopped: only the odometry callback sets commands
 	}
 	
-	// correct for phase lag of servo inputs
-	zeta = zeta_mlo*Omega_lo + zeta_blo;
-	arma::colvec z_Tlo_p(3);
-	z_Tlo_p(0) = cos(zeta)*z_Tlo(0) - sin(zeta)*z_Tlo(1);
-	z_Tlo_p(1) = sin(zeta)*z_Tlo(0) + cos(zeta)*z_Tlo(1);
-	z_Tlo_p(2) = z_Tlo(2);
-	
-	arma::colvec z_SP(3);
-	double z_SPz = cos(1/l_lo*acos(z_Tlo_p(2)));
-	if (z_SPz < 1){
-		temp = sqrt((1-z_SPz*z_SPz)/(z_Tlo_p(0)*z_Tlo_p(0) + z_Tlo_p(1)*z_Tlo_p(1)));
-		z_SP(0) = z_Tlo_p(0)*temp;
-		z_SP(1) = z_Tlo_p(1)*temp;
-		z_SP(2) = z_SPz;
-	}else{
-		z_SP(0) = 0;
-		z_SP(1) = 0;
-		z_SP(2) = 1;
+	double time = ros::Time::now().toSec();
+	double dt = time - vicon_time;
+	if ((dt <= 0) || (dt > 0.1)) {
+		return; // no vicon for too long, the watchdog falls back to zero commands
 	}
-	double b_lo_des = asin(z_SP(0));
-	double a_lo_des = asin(-z_SP(1)/cos(b_lo_des));
-	
-	control[2] = a_lo_des/max_SPangle;
-	control[3] = b_lo_des/max_SPangle;
+	estimateRotorSpeeds(time);
 	
-	// New heave-yaw control
-	double Fz_des = -Kp_Fz*(z-trajectory(2)) - Kd_Fz*(zdot-trajectory(5)) + m*trajectory(8);
-	double ori_error = atan2(Rb2w(1,0),Rb2w(0,0)) - trajectory(9);
-	while (ori_error > M_PI){
-		ori_error = ori_error - 2*M_PI;
+	double inner_setpoint[SETPOINT_DIMENSION];
+	for (int i=0; i<SETPOINT_DIMENSION; i++) {
+		inner_setpoint[i] = setpoint[i];
+	}
+	inner_setpoint[3] += inner_setpoint[4]*dt;
+	
+	// Rb2w*exp([w]x*dt), Rodrigues' formula
+	double w[3] = {imu_p, imu_q, imu_r};
+	double angle = sqrt(w[0]*w[0] + w[1]*w[1] + w[2]*w[2])*dt;
+	arma::mat Rb2w = outer_Rb2w;
+	if (angle > 1e-9) {
+		arma::mat K = arma::zeros(3,3);
+		K(0,1) = -w[2]*dt/angle;
+		K(0,2) = w[1]*dt/angle;
+		K(1,0) = w[2]*dt/angle;
+		K(1,2) = -w[0]*dt/angle;
+		K(2,0) = -w[1]*dt/angle;
+		K(2,1) = w[0]*dt/angle;
+		Rb2w = outer_Rb2w*(arma::eye(3,3) + coax_math::sin(angle)*K + (1-coax_math::cos(angle))*K*K);
 	}
-	while (ori_error < -M_PI){
-		ori_error = ori_error + 2*M_PI;
+	double R[3][3];
+	for (int i=0; i<3; i++) {
+		for (int j=0; j<3; j++) {
+			R[i][j] = Rb2w(i,j);
+		}
 	}
-	double Mz_des = -Kp_Mz*ori_error - Kd_Mz*(r-Rb2w(2,2)*trajectory(10));
 	
-	double A = k_Tup/k_Mup*Mz_des*(arma::as_scalar(Rb2w.row(2)*z_Tup));
-	double B = k_Tup/k_Mup*k_Mlo*(arma::as_scalar(Rb2w.row(2)*z_Tup)) + k_Tlo*(arma::as_scalar(Rb2w.row(2)*z_Tlo));
+	arma::colvec coax_state = outer_state;
+	coax_state(6) = coax_math::atan2(Rb2w(2,1),Rb2w(2,2));
+	coax_state(7) = coax_math::asin(-Rb2w(2,0));
+	coax_state(8) = coax_math::atan2(Rb2w(1,0),Rb2w(0,0));
+	coax_state(9) = imu_p;
+	coax_state(10) = imu_q;
+	coax_state(11) = imu_r;
+	coax_state(12) = Omega_up;
+	coax_state(13) = Omega_lo;
+	coax_state(14) = z_bar[0];
+	coax_state(15) = z_bar[1];
+	coax_state(16) = z_bar[2];
 	
-	double Omega_lo_des = sqrt((m*g + A + Fz_des)/B);
-	double Omega_up_des = sqrt((k_Mlo*Omega_lo_des*Omega_lo_des - Mz_des)/k_Mup);
-	control[0] = (Omega_up_des - rs_bup)/rs_mup;
-	control[1] = (Omega_lo_des - rs_blo)/rs_mlo;
+	double control[4] = {0,0,0,0};
+	AttitudeControlLaw(coax_state.memptr(), R, inner_setpoint, model_params, attitude_params, control);
+	compensateVoltage(control);
+	setControls(control);
+	sendControls();
 	
+	raw_control_age = 0;
+}
+										
+//===================
+// Control functions
+//===================
+
+void CoaxRosControl::controlFunction(double* control, arma::colvec coax_state, arma::mat Rb2w, 
+									 arma::colvec trajectory, coax_params_t model_params, control_params_t control_params)
+{
+	double R[3][3];
+	for (int i=0; i<3; i++) {
+		for (int j=0; j<3; j++) {
+			R[i][j] = Rb2w(i,j);
+		}
+	}
+	
+	// shared with the batch simulation of coax_simulator
+	if (INNER_LOOP) {
+		// position loop at the vicon rate, its setpoint is kept for innerControl
+		PositionControlLaw(coax_state.memptr(), trajectory.memptr(), model_params, control_params, setpoint);
+		AttitudeControlLaw(coax_state.memptr(), R, setpoint, model_params, attitude_params, control);
+	} else {
+		ControlLaw(coax_state.memptr(), R, trajectory.memptr(), model_params, control_params, control);
+	}
+	
+	control_computed = true;
 }
 
 arma::colvec CoaxRosControl::trajectoryGeneration(double time, int TYPE, double* init_traj_pose)
 {
-	arma::colvec trajectory = arma::zeros(11);
-	double radius;
-	double omega;
-	double omega_vert;
-	double amplitude;
-	double vert_amp;
-	double length;
-	double vel;
-	
-	switch (TYPE) {
-			//case TRAJECTORY_SPIRAL:
-			
-			//break;
-			
-		case TRAJECTORY_ROTINPLACE:
-			
-			omega      = 2*M_PI/2;
-			
-			init_traj_pose[0] = 0;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = 0;
-			
-			trajectory(0) = init_traj_pose[0];
-			trajectory(1) = init_traj_pose[1];
-			trajectory(2) = init_traj_pose[2];
-			trajectory(9) = omega*time + init_traj_pose[3];
-			trajectory(10) = omega;
-			
-			break;
-			
-		case TRAJECTORY_VERTOSCIL:
-			
-			amplitude  = 0.5;
-			omega      = 2*M_PI/5;
-			
-			init_traj_pose[0] = 0;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = 0;
-			
-			trajectory(0) = init_traj_pose[0];
-			trajectory(1) = init_traj_pose[1];
-			trajectory(2) = init_traj_pose[2] + amplitude*sin(omega*time);
-			trajectory(5) = amplitude*omega*cos(omega*time);
-			trajectory(8) = -amplitude*omega*omega*sin(omega*time);
-			trajectory(9) = init_traj_pose[3];
-			
-			break;
-			
-		case TRAJECTORY_LYINGCIRCLE:
-			
-			radius     = 0.5;
-			omega      = 2*M_PI/10;
-			omega_vert = 2*omega;
-			vert_amp   = 0.2;
-			
-			init_traj_pose[0] = 0.5;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = -M_PI/2;
-			
-			trajectory(0) = radius*cos(omega*time) - radius + init_traj_pose[0];
-			trajectory(1) = radius*sin(omega*time) + init_traj_pose[1];
-			trajectory(2) = vert_amp*sin(omega_vert*time) + init_traj_pose[2];
-			trajectory(3) = -radius*omega*sin(omega*time);
-			trajectory(4) = radius*omega*cos(omega*time);
-			trajectory(5) = omega_vert*vert_amp*cos(omega_vert*time);
-			trajectory(6) = -radius*omega*omega*cos(omega*time);
-			trajectory(7) = -radius*omega*omega*sin(omega*time);
-			trajectory(8) = -omega_vert*omega_vert*vert_amp*sin(omega_vert*time);
-			trajectory(9) = init_traj_pose[3]; //+ omega*time;
-			trajectory(10) = 0; //omega;
-			break;
-			
-		case TRAJECTORY_STANDINGCIRCLE:
-			
-			radius = 1;
-			omega = 2*M_PI/10;
-			
-			init_traj_pose[0] = 0;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = 0;
-			
-			trajectory(0) = radius*sin(omega*time) + init_traj_pose[0];
-			trajectory(1) = init_traj_pose[1];
-			trajectory(2) = init_traj_pose[2] + radius - radius*cos(omega*time);
-			trajectory(3) = radius*omega*cos(omega*time);
-			trajectory(5) = -radius*omega*sin(omega*time);
-			trajectory(6) = -radius*omega*omega*sin(omega*time);
-			trajectory(8) = -radius*omega*omega*cos(omega*time);
-			trajectory(9) = init_traj_pose[3];
-			
-			break;
-			
-		case TRAJECTORY_YAWOSCIL:
-			
-			amplitude  = M_PI/2;
-			omega      = 2*M_PI/4;
-			
-			init_traj_pose[0] = 0;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = 0;
-			
-			trajectory(0) = init_traj_pose[0];
-			trajectory(1) = init_traj_pose[1];
-			trajectory(2) = init_traj_pose[2];
-			trajectory(9) = init_traj_pose[3] + amplitude*sin(omega*time);
-			trajectory(10) = amplitude*omega*cos(omega*time);
-			
-			break;
-			
-		case TRAJECTORY_HORZLINE:
-			
-			length = 0.5;
-			vel = 0.15;
-			
-			init_traj_pose[0] = 0.5;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = M_PI;
-			
-			if (time < length/vel){
-				trajectory(0) = init_traj_pose[0] - time*vel;
-				trajectory(1) = init_traj_pose[1];
-				trajectory(2) = init_traj_pose[2];
-				trajectory(3) = -vel;
-				trajectory(9) = init_traj_pose[3];
-			}else{
-				trajectory(0) = init_traj_pose[0] - length;
-				trajectory(1) = init_traj_pose[1];
-				trajectory(2) = init_traj_pose[2];
-				trajectory(9) = init_traj_pose[3];
+	arma::colvec trajectory = arma::zeros(REFERENCE_DIMENSION);
+	
+	if (TYPE == TRAJECTORY_TABLE) {
+		init_traj_pose[0] = trajectory_table(0,1);
+		init_traj_pose[1] = trajectory_table(0,2);
+		init_traj_pose[2] = trajectory_table(0,3);
+		init_traj_pose[3] = trajectory_table(0,10);
+		
+		// linear between the rows, the first and last row outside
+		double length = trajectory_table(trajectory_table.n_rows-1,0);
+		if (time <= trajectory_table(0,0)){
+			trajectory = trajectory_table.row(0).cols(1,11).t();
+		}else if (time >= length){
+			trajectory = trajectory_table.row(trajectory_table.n_rows-1).cols(1,11).t();
+		}else{
+			unsigned int k = 0;
+			while (trajectory_table(k+1,0) < time) {
+				k++;
 			}
-			
-			break;
-			
-		default:
-			init_traj_pose[0] = 0;
-			init_traj_pose[1] = 0;
-			init_traj_pose[2] = 1;
-			init_traj_pose[3] = 0;
-			
-			trajectory(0) = init_traj_pose[0];
-			trajectory(1) = init_traj_pose[1];
-			trajectory(2) = init_traj_pose[2];
-			trajectory(9) = init_traj_pose[3];
-			break;
+			double w = (time - trajectory_table(k,0))/(trajectory_table(k+1,0) - trajectory_table(k,0));
+			arma::colvec previous = trajectory_table.row(k).cols(1,11).t();
+			arma::colvec next = trajectory_table.row(k+1).cols(1,11).t();
+			next(9) = previous(9) + atan2(sin(next(9) - previous(9)),cos(next(9) - previous(9)));
+			trajectory = (1 - w)*previous + w*next;
+		}
+	} else {
+		// shared with the batch simulation of coax_simulator
+		ReferenceTrajectory(time, TYPE, trajectory.memptr(), init_traj_pose);
 	}
 	
 	return trajectory;
@@ -889,56 +865,100 @@ void CoaxRosControl::setControls(double* control)
 	}
 }
 
+void CoaxRosControl::compensateVoltage(double* control)
+{
+	double volt_compUp = (12.22 - battery_voltage)*0.0279;
+	double volt_compLo = (12.22 - battery_voltage)*0.0287;
+	if (control[0] > 0.05 || control[1] > 0.05){
+		control[0] = control[0] + volt_compUp;
+		control[1] = control[1] + volt_compLo;
+	}
+}
+
+void CoaxRosControl::sendControls()
+{
+	coax_msgs::CoaxRawControl raw_control;
+	raw_control.motor1 = motor_up;
+	raw_control.motor2 = motor_lo;
+	raw_control.servo1 = servo_roll + roll_trim;
+	raw_control.servo2 = servo_pitch + pitch_trim;
+	raw_control_pub.publish(raw_control);
+	
+	// the rotor speeds follow these commands from now on
+	prev_motor_up = raw_control.motor1;
+	prev_motor_lo = raw_control.motor2;
+}
+
+// Rotor speed observer: first order response of the motors to the commands
+// sent since the last call, in steps of at most one period of the
+// watchdog timer
+void CoaxRosControl::estimateRotorSpeeds(double time)
+{
+	double dt = time - rotor_time;
+	if (dt <= 0) {
+		return;
+	}
+	rotor_time = time;
+	if (dt > 1.0/rate) {
+		dt = 1.0/rate;
+	}
+	
+	double prev_Omega_up_des = model_params.rs_mup*prev_motor_up + model_params.rs_bup;
+	double prev_Omega_lo_des = model_params.rs_mlo*prev_motor_lo + model_params.rs_blo;
+	
+	Omega_up = prev_Omega_up + 1/model_params.Tf_motup*(prev_Omega_up_des - prev_Omega_up)*dt;
+	Omega_lo = prev_Omega_lo + 1/model_params.Tf_motlo*(prev_Omega_lo_des - prev_Omega_lo)*dt;
+	prev_Omega_up = Omega_up;
+	prev_Omega_lo = Omega_lo;
+}
+
 //===================
 // Publisher
 //===================
 
-void CoaxRosControl::rawControlPublisher(unsigned int rate)
+// Commands go out from the callbacks as soon as ros::spin() delivers the
+// odometry, and with the inner loop every coax state message. The timer at
+// rate republishes them without the inner loop, sends zero commands when
+// none was computed for 20 ticks and runs the rotor speed observer.
+void CoaxRosControl::rawControlPublisher(ros::NodeHandle & n, unsigned int rate_)
+{
+	rate = rate_;
+	raw_control_timer = n.createTimer(ros::Duration(1.0/rate), &CoaxRosControl::rawControlTimerCallback, this);
+	ros::spin();
+}
+
+void CoaxRosControl::rawControlTimerCallback(const ros::TimerEvent & event)
 {
-	ros::Rate loop_rate(rate);
-	
 	coax_msgs::CoaxRawControl raw_control;
 	
-	while(ros::ok())
-	{
-		if (raw_control_age < 20) {
-			raw_control.motor1 = motor_up;
-			raw_control.motor2 = motor_lo;
-			raw_control.servo1 = servo_roll + roll_trim;
-			raw_control.servo2 = servo_pitch + pitch_trim;
-		} else { // if we do not get new control_values for too long -> send zero commands
-			raw_control.motor1 = 0;
-			raw_control.motor2 = 0;
-			raw_control.servo1 = 0;
-			raw_control.servo2 = 0;
-		}
-		
-		if ((coax_state_age > 0.5*rate) && (coax_state_age <= 0.5*rate + 1)) {
-			ROS_INFO("Lost Zigbee connection for too long!!!");
-		}
-		
+	if (raw_control_age < 20) {
+		raw_control.motor1 = motor_up;
+		raw_control.motor2 = motor_lo;
+		raw_control.servo1 = servo_roll + roll_trim;
+		raw_control.servo2 = servo_pitch + pitch_trim;
+	} else { // if we do not get new control_values for too long -> send zero commands
+		raw_control.motor1 = 0;
+		raw_control.motor2 = 0;
+		raw_control.servo1 = 0;
+		raw_control.servo2 = 0;
+	}
+	
+	if ((coax_state_age > 0.5*rate) && (coax_state_age <= 0.5*rate + 1)) {
+		// same as control mode 7 in Coax_Control.m
+		ROS_INFO("Lost Zigbee connection for more than 0.5s");
+	}
+	
+	// with the inner loop, commands go out from the callbacks and this is only a watchdog
+	if (!INNER_LOOP || (raw_control_age >= 20)) {
 		raw_control_pub.publish(raw_control);
-		raw_control_age += 1;
-		coax_state_age += 1;
-		
-		// Estimate rotor speeds (do that here to have the same frequency as we apply inputs)
-		double prev_Omega_up_des = model_params.rs_mup*prev_motor_up + model_params.rs_bup;
-		double prev_Omega_lo_des = model_params.rs_mlo*prev_motor_lo + model_params.rs_blo;
-		//printf("%f   %f \n", prev_Omega_up_des,prev_Omega_lo_des);
-		//printf("%f   %f \n", prev_Omega_up,prev_Omega_lo);
-		
-		Omega_up = prev_Omega_up + 1/model_params.Tf_motup*(prev_Omega_up_des - prev_Omega_up)/rate;
-		Omega_lo = prev_Omega_lo + 1/model_params.Tf_motlo*(prev_Omega_lo_des - prev_Omega_lo)/rate;
-		prev_Omega_up = Omega_up;
-		prev_Omega_lo = Omega_lo;
-		prev_motor_up = raw_control.motor1;
-		prev_motor_lo = raw_control.motor2;
-		//printf("%f   %f \n", model_params.Tf_motup,model_params.Tf_motlo);
-		//printf("%f   %f \n\n", Omega_up,Omega_lo);
-		
-		ros::spinOnce();
-		loop_rate.sleep();
 	}
+	raw_control_age += 1;
+	coax_state_age += 1;
+	
+	// Estimate rotor speeds (up to now with the commands held so far)
+	estimateRotorSpeeds(ros::Time::now().toSec());
+	prev_motor_up = raw_control.motor1;
+	prev_motor_lo = raw_control.motor2;
 }
 
 //===================
@@ -959,16 +979,18 @@ bool CoaxRosControl::setControlMode(coax_ros_control::SetControlMode::Request &r
 							reachNavState(SB_NAV_STOP, 0.5);
 							ros::Duration(0.5).sleep(); // make sure CoaX is in SB_NAV_STOP mode
 						}
-						reachNavState(SB_NAV_RAW, 0.5);
+						if (reachNavState(SB_NAV_RAW, 0.5)) {
+							// same as control mode 8 in Coax_Control.m
+							ROS_INFO("Not possible to switch to NAV_RAW_MODE");
+							ROS_INFO("Set RC to \"autonomous\" and Kill Switch to off");
+							ROS_INFO("Check if Zigbee connection is working");
+							out.result = -1;
+							break;
+						}
 					}
 					// set initial trim
-					if (COAX == 56) {
-						roll_trim = 0.0285;
-						pitch_trim = 0.0921;
-					} else {
-						roll_trim = 0;
-						pitch_trim = 0;
-					}
+					roll_trim = servo_trim.roll;
+					pitch_trim = servo_trim.pitch;
 					// switch to start procedure
 					CONTROL_MODE = CONTROL_START;
 					FIRST_START = true;
@@ -1039,6 +1061,8 @@ bool CoaxRosControl::setControlMode(coax_ros_control::SetControlMode::Request &r
 			reachNavState(SB_NAV_STOP, 0.5);
 			
 			CONTROL_MODE = CONTROL_LANDED;
+			// no inner loop commands until the next start
+			outer_closed_loop = false;
 			break;
 		
 		default:
@@ -1052,7 +1076,10 @@ bool CoaxRosControl::setControlMode(coax_ros_control::SetControlMode::Request &r
 bool CoaxRosControl::setTrajectoryType(coax_ros_control::SetTrajectoryType::Request &req, coax_ros_control::SetTrajectoryType::Response &out)
 {
 	
-	if ((req.trajectory_type <= 6) && (req.trajectory_type >= 0)) {
+	if ((req.trajectory_type == TRAJECTORY_TABLE) && (trajectory_table.n_rows == 0)) {
+		ROS_INFO("No trajectory table loaded!");
+		out.result = -1;
+	} else if ((req.trajectory_type <= TRAJECTORY_TABLE) && (req.trajectory_type >= 0)) {
 		TRAJECTORY_TYPE = req.trajectory_type;
 		out.result = 0;
 	} else {
@@ -1208,6 +1235,57 @@ void CoaxRosControl::SetLateralGains(double Kp_Fx, double Kp_Fy, double Kd_Fx, d
 	control_params.Kpq_pitch = Kpq_pitch;
 }
 
+void CoaxRosControl::SetBarCorrectionGain(double gain)
+{
+	if (gain < 0) {
+		BAR_CORRECTION_GAIN = 0;
+	} else if (gain > 1) {
+		BAR_CORRECTION_GAIN = 1;
+	} else {
+		BAR_CORRECTION_GAIN = gain;
+	}
+}
+
+void CoaxRosControl::SetInnerLoop(bool enabled)
+{
+	INNER_LOOP = enabled;
+}
+
+bool CoaxRosControl::LoadTrajectoryTable(const std::string &filename)
+{
+	FILE* file = fopen(filename.c_str(), "r");
+	if (!file) {
+		return false;
+	}
+	
+	// lines starting with '#' are comments
+	std::vector<double> values;
+	char line[512];
+	double row[12];
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file)) {
+		if ((line[0] == '#') || (line[0] == '\n')) {
+			continue;
+		}
+		ok = (sscanf(line, "%lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf %lf",
+					 &row[0], &row[1], &row[2], &row[3], &row[4], &row[5], &row[6],
+					 &row[7], &row[8], &row[9], &row[10], &row[11]) == 12);
+		// the time has to increase
+		if (ok && !values.empty()) {
+			ok = (row[0] > values[values.size()-12]);
+		}
+		values.insert(values.end(), row, row + 12);
+	}
+	fclose(file);
+	
+	if (!ok || values.empty()) {
+		return false;
+	}
+	
+	trajectory_table = arma::trans(arma::mat(&values[0], 12, values.size()/12));
+	return true;
+}
+
 void CoaxRosControl::load_model_params(ros::NodeHandle &n)
 {
 	
@@ -1279,33 +1357,32 @@ void CoaxRosControl::load_model_params(ros::NodeHandle &n)
 	n.getParam("max_swashplate_angle", max_SPangle);
 	SetMaximumSwashPlateAngle(max_SPangle);
 	
+	LoadServoTrim(n, "", servo_trim);
+	
 	return;
 }
 
 void CoaxRosControl::load_control_params(ros::NodeHandle &n)
 {
-	double Kp_Fx;
-	double Kp_Fy;
-	double Kp_Fz;
-	double Kd_Fx;
-	double Kd_Fy;
-	double Kd_Fz;
-	double Kp_Mz;
-	double Kd_Mz;
-	double Kpq_roll;
-	double Kpq_pitch;
-	n.getParam("lateral/proportional/x",Kp_Fx);
-	n.getParam("lateral/proportional/y",Kp_Fy);
-	n.getParam("heave_yaw/force/proportional",Kp_Fz);
-	n.getParam("lateral/differential/x",Kd_Fx);
-	n.getParam("lateral/differential/y",Kd_Fy);
-	n.getParam("heave_yaw/force/differential",Kd_Fz);
-	n.getParam("heave_yaw/moment/proportional",Kp_Mz);
-	n.getParam("heave_yaw/moment/differential",Kd_Mz);
-	n.getParam("pq_damping/roll",Kpq_roll);
-	n.getParam("pq_damping/pitch",Kpq_pitch);
-	SetHeaveYawGains(Kp_Fz, Kd_Fz, Kp_Mz, Kd_Mz);
-	SetLateralGains(Kp_Fx, Kp_Fy, Kd_Fx, Kd_Fy, Kpq_roll, Kpq_pitch);
+	control_params_t gains;
+	LoadControlParams(n, "", gains);
+	SetHeaveYawGains(gains.Kp_Fz, gains.Kd_Fz, gains.Kp_Mz, gains.Kd_Mz);
+	SetLateralGains(gains.Kp_Fx, gains.Kp_Fy, gains.Kd_Fx, gains.Kd_Fy, gains.Kpq_roll, gains.Kpq_pitch);
+	
+	double bar_correction_gain;
+	n.param("bar_correction/gain", bar_correction_gain, 0.2);
+	SetBarCorrectionGain(bar_correction_gain);
+	
+	bool inner_loop;
+	n.param("inner_loop/enabled", inner_loop, false);
+	SetInnerLoop(inner_loop);
+	LoadAttitudeParams(n, "inner_loop/", attitude_params);
+	
+	std::string trajectory_table_file;
+	n.param("trajectory/table", trajectory_table_file, std::string(""));
+	if (!trajectory_table_file.empty() && !LoadTrajectoryTable(trajectory_table_file)) {
+		ROS_WARN("Cannot read the trajectory table %s", trajectory_table_file.c_str());
+	}
 }
 
 
@@ -1318,8 +1395,11 @@ int main(int argc, char** argv)
 	
 	CoaxRosControl api(n);
 	
+	int state_frequency;
+	n.param("state_frequency", state_frequency, 100);
+	
 	ros::Duration(1.5).sleep(); // make sure coax_server has enough time to boot up
-	api.configureComm(100, SBS_MODES | SBS_BATTERY | SBS_GYRO); // configuration of sending back data from CoaX
+	api.configureComm(state_frequency, SBS_MODES | SBS_BATTERY | SBS_GYRO); // configuration of sending back data from CoaX
 	api.setTimeout(500, 5000);
 	
 	int CoaX;
@@ -1333,7 +1413,7 @@ int main(int argc, char** argv)
 	int frequency;
 	n.param("frequency", frequency, 100);
 	
-	api.rawControlPublisher(frequency);
+	api.rawControlPublisher(n, frequency);
 
 	return(0);
 }
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#include <coax_dynamics/CoaXControl.h>
+
+// Checks ControlLaw against a trace in the layout of
+// matlab_control/record_control_trace.m, default test/control_trace.txt.
+// The committed trace is a transcription of control_function.m, not a
+// MATLAB recording, see its header. Prints the largest difference per
+// output and fails when one is above the tolerance (default 1e-9, 1e-7
+// with the 1e-8 polynomials of COAX_FAST_MATH).
+
+#define TRACE_INPUTS (17 + 9 + REFERENCE_DIMENSION)
+
+#ifdef COAX_FAST_MATH
+#define DEFAULT_TOLERANCE 1e-7
+#else
+#define DEFAULT_TOLERANCE 1e-9
+#endif
+
+// next line that is not a comment, false at the end of the file
+bool read_line(FILE* file, char* line, int size)
+{
+	while (fgets(line, size, file)) {
+		if (line[0] != '#')
+			return true;
+	}
+	return false;
+}
+
+int read_values(const char* line, double* values, int count)
+{
+	int n = 0;
+	int used;
+	while ((n < count) && (sscanf(line, "%lf%n", &values[n], &used) == 1)) {
+		line += used;
+		n++;
+	}
+	return n;
+}
+
+int main(int argc, char** argv)
+{
+	const char* name = (argc > 1) ? argv[1] : "test/control_trace.txt";
+	double tolerance = (argc > 2) ? atof(argv[2]) : DEFAULT_TOLERANCE;
+
+	FILE* file = fopen(name, "r");
+	if (!file) {
+		fprintf(stderr, "usage: %s [trace] [tolerance]\nCannot read the trace %s\n", argv[0], name);
+		return -1;
+	}
+
+	char line[4096];
+	double p[16];
+	double g[10];
+	if (!read_line(file, line, sizeof(line)) || (read_values(line, p, 16) != 16) ||
+	    !read_line(file, line, sizeof(line)) || (read_values(line, g, 10) != 10)) {
+		fprintf(stderr, "Cannot read the parameters and gains of %s\n", name);
+		fclose(file);
+		return -1;
+	}
+
+	coax_params_t model_params = coax_params_t();
+	model_params.mass = p[0];
+	model_params.l_up = p[1];
+	model_params.l_lo = p[2];
+	model_params.k_Tup = p[3];
+	model_params.k_Tlo = p[4];
+	model_params.k_Mup = p[5];
+	model_params.k_Mlo = p[6];
+	model_params.rs_mup = p[7];
+	model_params.rs_bup = p[8];
+	model_params.rs_mlo = p[9];
+	model_params.rs_blo = p[10];
+	model_params.zeta_mup = p[11];
+	model_params.zeta_bup = p[12];
+	model_params.zeta_mlo = p[13];
+	model_params.zeta_blo = p[14];
+	model_params.max_SPangle = p[15];
+
+	control_params_t control_params;
+	control_params.Kp_Fx = g[0];
+	control_params.Kp_Fy = g[1];
+	control_params.Kd_Fx = g[2];
+	control_params.Kd_Fy = g[3];
+	control_params.Kpq_pitch = g[4];
+	control_params.Kpq_roll = g[5];
+	control_params.Kp_Fz = g[6];
+	control_params.Kd_Fz = g[7];
+	control_params.Kp_Mz = g[8];
+	control_params.Kd_Mz = g[9];
+
+	const char* outputs[4] = {"motor_up", "motor_lo", "servo1", "servo2"};
+	double error[4] = {0, 0, 0, 0};
+	int samples = 0;
+	while (read_line(file, line, sizeof(line))) {
+		double v[TRACE_INPUTS + 4];
+		if (read_values(line, v, TRACE_INPUTS + 4) != TRACE_INPUTS + 4) {
+			fprintf(stderr, "Short line %d in %s\n", samples + 1, name);
+			fclose(file);
+			return -1;
+		}
+
+		double Rb2w[3][3];
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				Rb2w[i][j] = v[17 + 3*i + j];
+
+		double control[4];
+		ControlLaw(v, Rb2w, &v[17 + 9], model_params, control_params, control);
+		for (int i = 0; i < 4; i++) {
+			double e = fabs(control[i] - v[TRACE_INPUTS + i]);
+			error[i] = ((e > error[i]) || (e != e)) ? e : error[i];
+		}
+		samples++;
+	}
+	fclose(file);
+
+	bool passed = (samples > 0);
+	printf("%d samples of %s\n", samples, name);
+	for (int i = 0; i < 4; i++) {
+		printf("%-8s  largest difference %.3e\n", outputs[i], error[i]);
+		passed = passed && (error[i] <= tolerance);
+	}
+	printf("%s (tolerance %g)\n", passed ? "PASSED" : "FAILED", tolerance);
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#ifndef __BINARY_IO__
+#define __BINARY_IO__
+
+#include <cstdio>
+#include <vector>
+
+// Native binary images of plain values and vectors of them, for journals
+// that are read back on the same kind of machine. All return false on a
+// short read or write.
+template <class T>
+inline bool WriteBinary(FILE* file, const T &value)
+{
+  return fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+template <class T>
+inline bool ReadBinary(FILE* file, T &value)
+{
+  return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+template <class T>
+inline bool WriteBinary(FILE* file, const std::vector<T> &values)
+{
+  unsigned int size = values.size();
+  if (!WriteBinary(file, size))
+    return false;
+  if (size == 0)
+    return true;
+  return fwrite(&values[0], sizeof(T), size, file) == size;
+}
+
+template <class T>
+inline bool ReadBinary(FILE* file, std::vector<T> &values)
+{
+  unsigned int size;
+  if (!ReadBinary(file, size))
+    return false;
+  values.resize(size);
+  if (size == 0)
+    return true;
+  return fread(&values[0], sizeof(T), size, file) == size;
+}
+#endif
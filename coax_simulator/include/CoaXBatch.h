@@ -0,0 +1,109 @@
+#ifndef __COAX_BATCH__
+#define __COAX_BATCH__
+
+#include <vector>
+
+#include "coax_dynamics/CoaXControl.h"
+#include "CoaXModel.h"
+
+// Many CoaX flying the coax_ros_control position controller at once, for
+// Monte Carlo sweeps. Every vehicle follows its own reference from its own
+// state; they share the parameters, wind field, proximity tables and
+// ground of one CoaXModel.
+//
+// The vehicles advance in lockstep by fixed step fourth order Runge-Kutta
+// in the scalar type T instead of GSL, which is double only. The states
+// are stored state after state over the vehicles, so the stage updates are
+// loops over the vehicles that vectorize, float with twice the width of
+// double; the equations of motion are evaluated vehicle by vehicle. The
+// positions and the time are accumulated in double whatever T is: the
+// position change of one step is below the float resolution of the
+// position after a few meters.
+//
+// Compared to CoaXModel the firmware is taken in raw mode, the servos
+// follow their commands at once and the battery keeps the voltage of the
+// model, so the inputs are constant over a control period.
+template <class T>
+class CoaXBatch
+{
+public:
+  CoaXBatch();
+
+  // copies the parameters, wind field and proximity tables, later changes
+  // of model are not seen
+  void SetModel(CoaXModel* model);
+  void SetGains(const control_params_t &gains_);
+  // integration step and control period, rounded to a multiple of the step
+  void SetTimeStep(double dt_, double control_period);
+  // position loop at the control period and the attitude loop of
+  // attitude_gains_ at inner_period, rounded to a multiple of the step,
+  // instead of ControlLaw at the control period
+  void SetInnerLoop(bool enabled, const attitude_params_t &attitude_gains_, double inner_period);
+
+  // n vehicles hovering at 1 m, at the current time
+  void SetVehicles(unsigned int n_);
+  unsigned int GetVehicles() const;
+
+  // TRAJECTORY_* reference of vehicle k started at time start. Moves the
+  // vehicle to the start pose of the reference, offset by offset (x y z
+  // yaw, may be NULL), at hover rotor speeds.
+  void SetTrajectory(unsigned int k, int type, double start, const double* offset);
+
+  // DIMENSION long state with Euler angles
+  void SetState(unsigned int k, const double* state);
+  void GetState(unsigned int k, double* state) const;
+
+  double GetTime() const;
+  // one control step of all vehicles, then the integration over the
+  // control period, with the attitude steps of the inner loop in between
+  void Update();
+
+  // position error to the reference at the control steps since the last
+  // SetTrajectory: root mean square and largest
+  void GetTrackingError(unsigned int k, double &rms, double &max) const;
+
+private:
+  void Control();
+  void AttitudeControl(double elapsed);
+  // public state and attitude of vehicle k
+  void PublicState(unsigned int k, T* coax_state, T Rb2w[3][3]) const;
+  void SetInputs(unsigned int k, const T* control);
+  void Integrate(double h);
+  // x with the positions added of vehicle k
+  void Gather(const std::vector<T> &x_, unsigned int k, T* state) const;
+  void LimitRotorSpeeds();
+
+  model_params_t param;
+  T theta[MODEL_PARAMETERS];
+  control_params_t gains;
+  attitude_params_t attitude_gains;
+  bool inner_loop;
+  unsigned int inner_steps;
+  double hover_speed[2];
+
+  double dt;
+  unsigned int steps;
+  double time;
+
+  unsigned int n;
+  // ODE_DIMENSION x n, vehicle fastest. The positions there are offsets
+  // from positions, 0 between the steps.
+  std::vector<T> x;
+  std::vector<double> positions;
+  // 4 x n motor commands and servos
+  std::vector<T> inputs;
+  // SETPOINT_DIMENSION x n of the position loop, with the inner loop
+  std::vector<T> setpoints;
+
+  // Runge-Kutta stage state, stage derivative and weighted sum
+  std::vector<T> stage;
+  std::vector<T> stage_xdot;
+  std::vector<T> sum;
+
+  std::vector<int> types;
+  std::vector<double> starts;
+  std::vector<double> squared_error;
+  std::vector<double> max_error;
+  std::vector<unsigned int> samples;
+};
+#endif
@@ -0,0 +1,141 @@
+#ifndef __COAX_COLLOCATION__
+#define __COAX_COLLOCATION__
+
+#include <string>
+#include <vector>
+
+#include "CoaXModel.h"
+#include "CoaXTrim.h"
+
+// variables at a node: the ODE_DIMENSION states but the bar z, which
+// follows from x and y, then the motor commands and servos
+#define COLLOCATION_STATES (ODE_DIMENSION - 1)
+#define COLLOCATION_NODE (COLLOCATION_STATES + 4)
+
+enum
+{
+  COLLOCATION_TIME = 0,
+  COLLOCATION_ENERGY
+};
+
+// Steady flight through a position with a velocity and heading, no yaw
+// rate
+typedef struct
+{
+  double position[3];
+  double velocity[3];
+  double yaw;
+} collocation_boundary_t;
+
+// One sample of a reference, as the trajectory vector of the controller
+typedef struct
+{
+  double time;
+  double position[3];
+  double velocity[3];
+  double acceleration[3];
+  double yaw;
+  double yaw_rate;
+} collocation_reference_t;
+
+// Transfer between two steady flight conditions by trapezoidal collocation
+// of the CoaXModel equations of motion on equally spaced nodes, with the
+// motor commands in [0 1], the servos in [-1 1] and an optional minimum
+// altitude. Time-optimal transfers free the duration, energy-optimal ones
+// minimize the rotor power over a fixed duration. Wind, ground contact and
+// the proximity tables are left out, as in CoaXTrim.
+//
+// The equality constraints are handled by an augmented Lagrangian around
+// Levenberg-Marquardt steps. Every defect only couples two neighbouring
+// nodes and the duration, so the normal equations are banded with one
+// dense border and are solved by a banded Cholesky factorization in
+// O(nodes) instead of O(nodes^3).
+class CoaXCollocation
+{
+public:
+  CoaXCollocation();
+
+  // copies the parameters, later changes of model are not seen
+  void SetModel(CoaXModel* model);
+  // at least 2 nodes
+  void SetNodes(unsigned int nodes_);
+  // COLLOCATION_ENERGY: fixed duration, COLLOCATION_TIME: the initial
+  // guess and upper limit of the duration
+  void SetObjective(int objective_, double duration_);
+  void SetMinimumAltitude(double altitude);
+  // largest constraint violation accepted
+  void SetTolerance(double tolerance_, int max_iterations_);
+
+  // starts from the trims of start and goal, interpolated. Returns 0 if the
+  // constraints were met.
+  int Solve(const collocation_boundary_t &start, const collocation_boundary_t &goal);
+
+  unsigned int GetNodes() const;
+  double GetDuration() const;
+  // largest constraint violation and Levenberg-Marquardt steps of the last
+  // Solve
+  double GetViolation() const;
+  int GetIterations() const;
+  // node k: ODE_DIMENSION states and the 4 inputs, the quaternion as
+  // solved, not normalized: its norm drifts at the interior nodes, to
+  // about 0.951 on a coarse grid
+  void GetNode(unsigned int k, double* state, double* inputs) const;
+
+  // positions and velocities are cubic between the nodes, accelerations
+  // and yaw rate linear, every dt from 0 and at the duration
+  void Sample(double dt, std::vector<collocation_reference_t> &table) const;
+  // Sample as text, one line "time x y z vx vy vz ax ay az yaw yaw_rate"
+  // per sample. Returns 0 on success, -1 otherwise.
+  int SaveTable(const std::string &filename, double dt) const;
+
+private:
+  // a residual that depends on at most two neighbouring nodes, from node,
+  // and the duration
+  typedef struct
+  {
+    double r;
+    int node;
+    double d[2*COLLOCATION_NODE];
+    double dT;
+  } row_t;
+
+  void InitialGuess(const collocation_boundary_t &start, const collocation_boundary_t &goal);
+  void NodeJacobian(const double* xk, double* J) const;
+  void Derivatives(const double* x, std::vector<double> &f,
+                   std::vector<double>* df) const;
+  void Constraints(const double* x, std::vector<row_t> &rows) const;
+  void Boundary(const double* x, unsigned int k, const collocation_boundary_t &boundary,
+                const std::vector<double> &f, const std::vector<double> &df,
+                std::vector<row_t> &rows) const;
+  void Objective(const double* x, std::vector<row_t> &rows) const;
+  double Merit(const double* x, std::vector<row_t> &constraints,
+               std::vector<row_t> &objective) const;
+  int Step(const std::vector<row_t> &constraints, const std::vector<row_t> &objective,
+           double lambda, std::vector<double> &dz) const;
+  int Minimize();
+
+  model_params_t param;
+  double theta[MODEL_PARAMETERS];
+  CoaXTrim trim;
+
+  unsigned int nodes;
+  int objective;
+  double duration;
+  double min_altitude;
+  double tolerance;
+  int max_iterations;
+
+  collocation_boundary_t boundaries[2];
+  // node variables, node after node, then the duration
+  std::vector<double> z;
+  std::vector<double> lower;
+  std::vector<double> upper;
+
+  // augmented Lagrangian multipliers and penalty
+  std::vector<double> multipliers;
+  double penalty;
+
+  double violation;
+  int iterations;
+};
+#endif
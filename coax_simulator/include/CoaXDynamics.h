@@ -0,0 +1,225 @@
+#ifndef __COAX_DYNAMICS__
+#define __COAX_DYNAMICS__
+
+#include <cmath>
+
+#include "coax_dynamics/CoaXKernels.h"
+#include "coax_dynamics/Dual.h"
+#include "CoaXModel.h"
+
+// The CoaX equations of motion for any scalar type: double for the
+// integration, dual numbers for the parameter sensitivities and the trim
+// Jacobian. The rotor and stabilizer bar physics are the kernels of
+// coax_dynamics, shared with the controller and the grey box models.
+// theta holds the identified parameters (PARAM_*), everything else (ground,
+// drag, wind, proximity, battery) comes from param and is not
+// differentiated. u are the motor commands and servo positions at t.
+template <class T>
+void CoaXDerivatives(double t, const T* state, T* xdot, const T* theta,
+                     const T* u, const model_params_t* param, double* acc)
+{
+  using std::sqrt;
+
+  // rotation quaternion (w, x, y, z)
+  T qw = state[6];
+  T qx = state[7];
+  T qy = state[8];
+  T qz = state[9];
+
+  // angular velocity
+  T p = state[10];
+  T q = state[11];
+  T r = state[12];
+
+  // rotor speeds
+  T Omega_up = state[13];
+  T Omega_lo = state[14];
+
+  // stabilizer bar direction
+  T z_barx = state[15];
+  T z_bary = state[16];
+  T z_barz = state[17];
+
+  // Parameters
+  double g = 9.81;
+  T m = theta[PARAM_MASS];
+  T Ixx = theta[PARAM_IXX];
+  T Iyy = theta[PARAM_IYY];
+  T Izz = theta[PARAM_IZZ];
+  T d_up = theta[PARAM_D_UP];
+  T d_lo = theta[PARAM_D_LO];
+  T l_up = theta[PARAM_L_UP];
+  T l_lo = theta[PARAM_L_LO];
+  T k_Tup = theta[PARAM_K_TUP];
+  T k_Tlo = theta[PARAM_K_TLO];
+  T Tf_motup = theta[PARAM_TF_MOTUP];
+  T Tf_motlo = theta[PARAM_TF_MOTLO];
+  T Tf_up = theta[PARAM_TF_UP];
+  T rs_mup = theta[PARAM_RS_MUP];
+  T rs_bup = theta[PARAM_RS_BUP];
+  T rs_mlo = theta[PARAM_RS_MLO];
+  T rs_blo = theta[PARAM_RS_BLO];
+  T zeta_mup = theta[PARAM_ZETA_MUP];
+  T zeta_bup = theta[PARAM_ZETA_BUP];
+  T zeta_mlo = theta[PARAM_ZETA_MLO];
+  T zeta_blo = theta[PARAM_ZETA_BLO];
+  T max_SPangle = theta[PARAM_MAX_SPANGLE];
+
+  // Controls
+  T u_motup = u[0];
+  T u_motlo = u[1];
+  T u_serv1 = u[2];
+  T u_serv2 = u[3];
+
+  // Thrust vector directions
+  T z_bar[3] = {z_barx, z_bary, z_barz};
+  T z_Tup[3];
+  UpperThrustDirection(z_bar, l_up, zeta_mup*Omega_up + zeta_bup, z_Tup);
+
+  T z_SP[3];
+  T z_Tlo[3];
+  SwashPlateDirection(u_serv1, u_serv2, max_SPangle, z_SP);
+  LowerThrustDirection(z_SP, l_lo, zeta_mlo*Omega_lo + zeta_blo, z_Tlo);
+
+  // Coordinate transformation body to world coordinates
+  T quat[4] = {qw, qx, qy, qz};
+  T Rb2w[3][3];
+  QuaternionToRotation(quat, Rb2w);
+
+  // Thrust magnitudes
+  T T_up = RotorThrust(k_Tup, Omega_up);
+  T T_lo = RotorThrust(k_Tlo, Omega_lo);
+
+  // Ground and wall effect at the rotor hubs
+  if (param->proximity){
+    double hub[3];
+    for (int j = 0; j < 3; j++)
+      hub[j] = Value(state[j]) + Value(Rb2w[j][2])*Value(d_up);
+    T_up *= param->proximity->GetThrustFactor(hub);
+    for (int j = 0; j < 3; j++)
+      hub[j] = Value(state[j]) + Value(Rb2w[j][2])*Value(d_lo);
+    T_lo *= param->proximity->GetThrustFactor(hub);
+  }
+
+  // Summarized Forces and Moments
+  T F_thrust[3];
+  T M_rotors[3];
+  RotorForcesMoments(theta, T_up, T_lo, Omega_up, Omega_lo, z_Tup, z_Tlo, F_thrust, M_rotors);
+  T Fx = Rb2w[0][0]*F_thrust[0] + Rb2w[0][1]*F_thrust[1] + Rb2w[0][2]*F_thrust[2];
+  T Fy = Rb2w[1][0]*F_thrust[0] + Rb2w[1][1]*F_thrust[1] + Rb2w[1][2]*F_thrust[2];
+  T Fz = -m*g + Rb2w[2][0]*F_thrust[0] + Rb2w[2][1]*F_thrust[1] + Rb2w[2][2]*F_thrust[2];
+
+  T Mx = q*r*(Iyy-Izz) + M_rotors[0];
+  T My = p*r*(Izz-Ixx) + M_rotors[1];
+  T Mz = p*q*(Ixx-Iyy) + M_rotors[2];
+
+  // Drag on the velocity relative to the air
+  if ((param->drag_lin > 0) || (param->drag_quad > 0)){
+    T v_rel[3] = {state[3], state[4], state[5]};
+    if (param->wind){
+      double pos[3] = {Value(state[0]), Value(state[1]), Value(state[2])};
+      double wind[3];
+      param->wind->GetWind(t, pos, wind);
+      v_rel[0] -= wind[0];
+      v_rel[1] -= wind[1];
+      v_rel[2] -= wind[2];
+    }
+    T speed = sqrt(v_rel[0]*v_rel[0] + v_rel[1]*v_rel[1] + v_rel[2]*v_rel[2]);
+    T k_drag = param->drag_lin + param->drag_quad*speed;
+    Fx -= k_drag*v_rel[0];
+    Fy -= k_drag*v_rel[1];
+    Fz -= k_drag*v_rel[2];
+  }
+
+  // Ground contact: spring-damper with regularized Coulomb friction at
+  // four landing gear points (body frame) on the plane z = 0
+  if (param->k_ground > 0){
+    double gear[4][3] = {{ param->gear_radius, 0, -param->gear_height},
+                         {-param->gear_radius, 0, -param->gear_height},
+                         {0,  param->gear_radius, -param->gear_height},
+                         {0, -param->gear_radius, -param->gear_height}};
+    for (int i = 0; i < 4; i++){
+      T zc = state[2] + Rb2w[2][0]*gear[i][0] + Rb2w[2][1]*gear[i][1] + Rb2w[2][2]*gear[i][2];
+      if (zc >= 0)
+        continue;
+
+      // contact point velocity: v + Rb2w*(w x r)
+      T wxr[3];
+      wxr[0] = q*gear[i][2] - r*gear[i][1];
+      wxr[1] = r*gear[i][0] - p*gear[i][2];
+      wxr[2] = p*gear[i][1] - q*gear[i][0];
+      T vc[3];
+      for (int j = 0; j < 3; j++)
+        vc[j] = state[3+j] + Rb2w[j][0]*wxr[0] + Rb2w[j][1]*wxr[1] + Rb2w[j][2]*wxr[2];
+
+      T Fn = -param->k_ground*zc - param->d_ground*vc[2];
+      if (Fn <= 0)
+        continue;
+
+      T v_t = sqrt(vc[0]*vc[0] + vc[1]*vc[1] + 1e-4);
+      T Fc[3];
+      Fc[0] = -param->mu_ground*Fn*vc[0]/v_t;
+      Fc[1] = -param->mu_ground*Fn*vc[1]/v_t;
+      Fc[2] = Fn;
+      Fx += Fc[0];
+      Fy += Fc[1];
+      Fz += Fc[2];
+
+      // moment in body coordinates: r x Rb2w'*F
+      T Fb[3];
+      for (int j = 0; j < 3; j++)
+        Fb[j] = Rb2w[0][j]*Fc[0] + Rb2w[1][j]*Fc[1] + Rb2w[2][j]*Fc[2];
+      Mx += gear[i][1]*Fb[2] - gear[i][2]*Fb[1];
+      My += gear[i][2]*Fb[0] - gear[i][0]*Fb[2];
+      Mz += gear[i][0]*Fb[1] - gear[i][1]*Fb[0];
+    }
+  }
+
+  // State derivatives
+  T xddot = 1/m*Fx;
+  T yddot = 1/m*Fy;
+  T zddot = 1/m*Fz;
+
+  // qdot = 1/2*q*[0 p q r]
+  T qwdot = (-qx*p - qy*q - qz*r)/2;
+  T qxdot = (qw*p + qy*r - qz*q)/2;
+  T qydot = (qw*q + qz*p - qx*r)/2;
+  T qzdot = (qw*r + qx*q - qy*p)/2;
+
+  T pdot = 1/Ixx*Mx;
+  T qdot = 1/Iyy*My;
+  T rdot = 1/Izz*Mz;
+
+  T Omega_up_des = (rs_mup*u_motup + rs_bup)*param->voltage_scale;
+  T Omega_lo_des = (rs_mlo*u_motlo + rs_blo)*param->voltage_scale;
+  T Omega_updot = 1/Tf_motup*(Omega_up_des - Omega_up);
+  T Omega_lodot = 1/Tf_motlo*(Omega_lo_des - Omega_lo);
+
+  T omega[3] = {p, q, r};
+  T z_bardot[3];
+  StabilizerBarDerivative(z_bar, Tf_up, omega, z_bardot);
+
+  xdot[0] = state[3];
+  xdot[1] = state[4];
+  xdot[2] = state[5];
+  xdot[3] = xddot;
+  xdot[4] = yddot;
+  xdot[5] = zddot;
+  xdot[6] = qwdot;
+  xdot[7] = qxdot;
+  xdot[8] = qydot;
+  xdot[9] = qzdot;
+  xdot[10] = pdot;
+  xdot[11] = qdot;
+  xdot[12] = rdot;
+  xdot[13] = Omega_updot;
+  xdot[14] = Omega_lodot;
+  xdot[15] = z_bardot[0];
+  xdot[16] = z_bardot[1];
+  xdot[17] = z_bardot[2];
+
+  acc[0] = Value(xddot);
+  acc[1] = Value(yddot);
+  acc[2] = Value(zddot);
+}
+#endif
@@ -0,0 +1,78 @@
+#ifndef __COAX_JOURNAL__
+#define __COAX_JOURNAL__
+
+#include <cstdio>
+#include <string>
+
+#include "CoaXSimulator.h"
+#include "CoaXRadio.h"
+
+enum
+{
+  JOURNAL_END = 0,
+  JOURNAL_RESET,
+  JOURNAL_RAW_COMMAND,
+  JOURNAL_CONTROL,
+  JOURNAL_NAV_STATE,
+  JOURNAL_TRIM,
+  JOURNAL_TIMEOUT
+};
+
+// One input, received after tick simulator updates at simulation time time
+typedef struct
+{
+  unsigned long tick;
+  int type;
+  // navigation state or trim mode
+  int mode;
+  double time;
+  double value[4];
+} journal_entry_t;
+
+// Rates the simulator events were scheduled at, 0 if they are off
+typedef struct
+{
+  double odometry;
+  double command;
+  double onboard;
+  double state;
+} journal_rates_t;
+
+// Binary journal of everything that goes into a simulation: the
+// configuration and state it starts from, then every input keyed by the
+// simulation tick it was received at. Entries are a few bytes of header and
+// only the values of their type, in native byte order. Replaying the
+// inputs through the same CoaXRadio and CoaXSimulator calls reproduces the
+// run bit for bit, whatever the timing of the ROS messages was.
+class CoaXJournal
+{
+public:
+  CoaXJournal();
+  ~CoaXJournal();
+
+  // Before the first simulator update. Returns 0 on success, -1 otherwise.
+  int Create(const std::string &filename, CoaXSimulator &simulator,
+             const CoaXRadio &radio, const journal_rates_t &rates);
+  // Configures simulator and radio and restores the state the recording
+  // started from. Returns 0 on success, -1 otherwise.
+  int Open(const std::string &filename, CoaXSimulator &simulator,
+           CoaXRadio &radio, journal_rates_t &rates);
+  // ends a recording with JOURNAL_END at the current tick
+  void Close();
+
+  // inputs recorded from now on were received after tick updates
+  void SetTick(unsigned long tick_);
+  // value holds as many values as the type has
+  void Record(int type, double time, int mode, const double* value);
+  // false at the end of the journal
+  bool Next(journal_entry_t &entry);
+
+private:
+  static int ValueCount(int type);
+  static bool HasMode(int type);
+
+  FILE* file;
+  bool recording;
+  unsigned long tick;
+};
+#endif
@@ -1,42 +1,102 @@
 #ifndef __COAX_MODEL__
 #define __COAX_MODEL__
 
+#include <cstdio>
 #include <string>
+#include <vector>
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_odeiv.h>
 
+#include "coax_dynamics/CoaXKernels.h"
 #include "CoaXOnboardControl.h"
+#include "ProximityTables.h"
+#include "WindField.h"
 
+// public state: x y z xdot ydot zdot roll pitch yaw p q r Omega_up Omega_lo z_bar
 #define DIMENSION 17
+// integrator state: attitude as quaternion (w x y z) instead of roll pitch yaw
+#define ODE_DIMENSION 18
 
-typedef struct
+// The identified parameters (PARAM_*) and what the simulation adds to them
+struct model_params_t : public coax_params_t
 {
-  double mass;
-  double Ixx, Iyy, Izz;
-  double d_up, d_lo;
-  double k_springup, k_springlo;
-  double l_up, l_lo;
-  double k_Tup, k_Tlo;
-  double k_Mup, k_Mlo;
-  double Tf_motup, Tf_motlo;
-  double Tf_up;
-  double rs_mup, rs_bup;
-  double rs_mlo, rs_blo;
-  double zeta_mup, zeta_bup;
-  double zeta_mlo, zeta_blo;
-  double max_SPangle;
+  double k_ground, d_ground, mu_ground;
+  double gear_radius, gear_height;
+  double Tf_servo, servo_rate, servo_deadband;
+  double battery_capacity;
+  double R0_battery, R1_battery, C1_battery;
+  double motor_efficiency, base_current;
+  double nominal_voltage;
+  int battery_cells;
+  double drag_lin, drag_quad;
   double acc[3];
 
+  // shared by all vehicles, NULL for still air
+  const WindField* wind;
+  // shared by all vehicles, NULL for free air thrust
+  const ProximityTables* proximity;
+
   // Control inputs
   double control[4];
-} model_params_t;
+
+  // Servo positions at t_servo and where they are heading during this
+  // update, evaluated in closed form by ServoPosition
+  double servo0[2];
+  double servo_target[2];
+  double t_servo;
+
+  // battery voltage over the voltage the speed conversion was identified at
+  double voltage_scale;
+};
+
+// Everything that evolves during a simulation, as one plain block so that
+// it can be copied with a single memcpy
+typedef struct
+{
+  double time;
+  double pos[3];
+  double vel[3];
+  double quat[4];
+  double angvel[3];
+  double acc[3];
+  double rotors[2];
+  double bar[3];
+  double servo[2];
+
+  // battery state of charge, RC pair voltage and the resulting terminal
+  // voltage and current
+  double battery_soc;
+  double battery_vrc;
+  double battery_voltage;
+  double battery_current;
+
+  // last integrator step size
+  double step_size;
+
+  // firmware state and the pending commands
+  onboard_state_t onboard;
+  double command[4];
+  bool cmd_updated;
+} coax_model_state_t;
 
 class CoaXModel
 {
 public:
   CoaXModel();
+  CoaXModel(const CoaXModel &other);
   ~CoaXModel();
 
+  CoaXModel& operator=(const CoaXModel &other);
+
+  void Snapshot(coax_model_state_t &state);
+  void Restore(const coax_model_state_t &state);
+  void Fork(unsigned int n, std::vector<CoaXModel> &rollouts);
+
+  // Parameters, initial conditions and firmware gains. The wind field and
+  // proximity tables are not part of it, the model keeps its own.
+  int WriteConfiguration(FILE* file);
+  int ReadConfiguration(FILE* file);
+
   void Update(double time);
   void ResetSimulation();
   void ResetSimulation(double time_,
@@ -54,6 +114,13 @@ public:
   void SetRotation(double roll, double pitch, double yaw);
   void GetRotation(double& roll, double& pitch, double& yaw);
 
+  void SetOrientation(double qw, double qx, double qy, double qz);
+  void GetOrientation(double& qw, double& qx, double& qy, double& qz);
+
+  // DIMENSION long state vector with Euler angles
+  void SetState(const double* state);
+  void GetState(double* state);
+
   void SetWorldLinearVelocity(double x, double y, double z);
   void GetWorldLinearVelocity(double& xdot, double& ydot, double& zdot);
 
@@ -62,6 +129,9 @@ public:
 
   void SetWorldLinearAcceleration(double x, double y, double z);
   void GetWorldLinearAcceleration(double& x, double& y, double& z);
+  // what an accelerometer on the body measures: R_b2w'*(a + g*e_z), 1 g
+  // up at rest
+  void GetBodySpecificForce(double& x, double& y, double& z);
 
   void SetRotorSpeed(double upper, double lower);
   void GetRotorSpeed(double &upper, double &lower);
@@ -88,31 +158,98 @@ public:
   void SetUpperPhaseLag(double zeta_mup, double zeta_bup);
   void SetLowerPhaseLag(double zeta_mlo, double zeta_blo);
   void SetMaximumSwashPlateAngle(double max_SPangle);
+  void SetGroundContact(double k_ground, double d_ground, double mu_ground,
+                        double gear_radius, double gear_height);
+  void SetServoDynamics(double Tf_servo, double servo_rate, double servo_deadband);
+
+  void GetServoPosition(double &servo1, double &servo2);
+
+  // everything the equations of motion are evaluated with
+  const model_params_t* GetModelParams();
+
+  // identified parameters as a MODEL_PARAMETERS long vector (PARAM_*)
+  void GetParameters(double* theta);
+  void SetParameters(const double* theta);
+  static const char* GetParameterName(int i);
+
+  // Forward sensitivities d(state)/d(theta) of the identified parameters,
+  // integrated with the state by automatic differentiation of the
+  // equations of motion. The inputs are taken as given, the firmware is not
+  // differentiated. They start from 0 here, at every reset and restore and
+  // are not part of the snapshot. The integrator step sizes follow the state
+  // error only, so the state is the same as without sensitivities.
+  void EnableSensitivities(bool enable);
+  bool SensitivitiesEnabled();
+  // DIMENSION x MODEL_PARAMETERS, row major, public state with Euler angles
+  void GetSensitivities(double* S);
+
+  // capacity in Ah (0 runs the motors at the nominal voltage), pack
+  // resistance R0 and RC pair R1 C1, motor efficiency from shaft to
+  // battery power and the current of everything else
+  void SetBattery(int cells, double capacity,
+                  double R0, double R1, double C1,
+                  double motor_efficiency, double base_current,
+                  double nominal_voltage);
+  void SetInitialBatteryCharge(double soc);
+
+  // Drag on the airspeed v - wind: -linear*v_rel - quadratic*|v_rel|*v_rel (N)
+  void SetWindField(const WindField* wind);
+  void SetAerodynamicDrag(double linear, double quadratic);
+  // Ground and wall effect on the rotor thrusts at the hub positions
+  void SetProximityTables(const ProximityTables* proximity);
+  void GetBattery(double &voltage, double &current, double &soc);
 
   void SetCommand(double u_motup, double u_motlo,
                   double u_serv1, double u_serv2);
   void SendCommand();
-  double LimitRotorSpeed(double rotor_speed);
+  static double LimitRotorSpeed(double rotor_speed);
+
+  // one step of the onboard firmware at the current time
+  void UpdateOnboard();
+  CoaXOnboardControl* GetOnboardControlPtr();
 
 private:
   static int ODEStep(double t, const double* x, double* xdot, void* params);
+  static int SensitivityStep(double t, const double* y, double* ydot, void* params);
+  static void ModelInputs(const model_params_t* param, double t, double* u);
+  static double ServoPosition(const model_params_t* param, int i, double dt);
+  void IntegrateSensitivities(double &tstart, double tstop, double &h);
+  void LimitRotorSensitivities(const double* unlimited, const double* limited);
+  void ResetSensitivities();
+  static double CellOpenCircuitVoltage(double soc);
+  void UpdateBattery(double dt);
 
   double pos[3];
   double vel[3];
-  double rot[3];
+  double quat[4];
   double angvel[3];
   double acc[3];
   double rotors[2];
   double bar[3];
+  double servo[2];
+
+  double battery_soc;
+  double battery_vrc;
+  double battery_voltage;
+  double battery_current;
 
   double init_pos[3];
   double init_rot[3];
   double init_rotors[2];
   double init_bar[3];
+  double init_battery_soc;
 
   double time;
+  double step_size;
+
+  double statespace[ODE_DIMENSION];
 
-  double statespace[DIMENSION];
+  bool sensitivities;
+  // d(statespace[i])/d(theta[j]) at i*MODEL_PARAMETERS + j
+  double sensitivity[ODE_DIMENSION*MODEL_PARAMETERS];
+  gsl_odeiv_step* sensitivity_step;
+  gsl_odeiv_control* sensitivity_control;
+  gsl_odeiv_evolve* sensitivity_evolve;
 
   model_params_t model_params;
 
@@ -1,36 +1,102 @@
 #ifndef __COAX_ONBOARD_CONTROL__
 #define __COAX_ONBOARD_CONTROL__
 
+#include <com/sbapi.h>
+
+// What the firmware measures, in model (body z up) coordinates
+typedef struct
+{
+  double roll, pitch, yaw;
+  double p, q, r;
+  double z, zdot;
+} onboard_sensors_t;
+
+typedef struct
+{
+  // motor commands that hold the vehicle in hover
+  double hover_upper, hover_lower;
+  double idle;
+  // servo per rad and per rad/s
+  double kp_att, kd_att;
+  // differential motor command per rad/s of yaw rate error
+  double kp_yaw;
+  // collective motor command per m, per m/s and per m*s
+  double kp_z, kd_z, ki_z;
+  double takeoff_altitude;
+  double takeoff_speed;
+  double land_speed, sink_speed;
+} onboard_gains_t;
+
+// Everything the firmware carries from one step to the next
+typedef struct
+{
+  int nav_mode;
+  double raw[4];
+  // roll, pitch, yaw rate, altitude
+  double setpoint[4];
+  double trim[2];
+  int trim_mode;
+  double outputs[4];
+  double z_ref;
+  double z_integral;
+  // last measured altitude, to start takeoff from
+  double z;
+  double last_update;
+  double last_command;
+  double control_timeout;
+} onboard_state_t;
+
+// Emulates the CoaX firmware: the navigation state machine and the
+// attitude/altitude loops that run on board between the Zigbee link and
+// the motors. Raw commands pass straight through in SB_NAV_RAW, all other
+// modes compute the outputs in Update, which the simulator calls at the
+// firmware rate.
 class CoaXOnboardControl
 {
 public:
-  CoaXOnboardControl() : motor_upper(0), motor_lower(0),
-                         servo_upper(0), servo_lower(0) { }
+  CoaXOnboardControl();
   ~CoaXOnboardControl() {}
 
+  void SetGains(const onboard_gains_t &gains_);
+  void GetGains(onboard_gains_t &gains_) { gains_ = gains; }
+  void Reset();
+
+  void GetState(onboard_state_t &state_) { state_ = state; }
+  void SetState(const onboard_state_t &state_) { state = state_; }
+
+  // returns 0 if the transition is possible, -1 otherwise
+  int ReachNavState(int mode, double time);
+  int GetNavState() { return state.nav_mode; }
+
+  void SetTrim(int mode, double roll, double pitch);
+  // 0 disables the timeout
+  void SetControlTimeout(double timeout);
+
   void SetCommands(double motor1, double motor2,
-                   double servo1, double servo2)
-  {
-    motor_upper = motor1;
-    motor_lower = motor2;
+                   double servo1, double servo2, double time);
+  // roll and pitch in rad, yaw rate in rad/s, altitude in m
+  void SetControl(double roll, double pitch, double yaw_rate,
+                  double altitude, double time);
 
-    servo_upper = servo1;
-    servo_lower = servo2;
-  }
+  void Update(double time, const onboard_sensors_t &sensors);
 
   void GetControls(double& motor1, double& motor2,
                    double& servo1, double& servo2)
   {
-    motor1 = motor_upper;
-    motor2 = motor_lower;
+    motor1 = state.outputs[0];
+    motor2 = state.outputs[1];
 
-    servo1 = servo_upper;
-    servo2 = servo_lower;
+    servo1 = state.outputs[2];
+    servo2 = state.outputs[3];
   }
 
 private:
-  double motor_upper, motor_lower;
-  double servo_upper, servo_lower;
+  static double Limit(double x, double lower, double upper);
+  void SetOutputs(double motor1, double motor2,
+                  double servo1, double servo2);
+
+  onboard_gains_t gains;
+  onboard_state_t state;
 };
 
 #endif
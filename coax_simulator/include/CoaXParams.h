@@ -0,0 +1,25 @@
+#ifndef __COAX_PARAMS__
+#define __COAX_PARAMS__
+
+#include <string>
+
+#include <ros/ros.h>
+
+#include "CoaXCollocation.h"
+#include "CoaXModel.h"
+#include "CoaXTrimMap.h"
+
+// Model parameters, firmware gains and drag from the parameter server, laid
+// out as in config/coax_parameters.yaml
+void load_model_params(ros::NodeHandle &n, CoaXModel *model);
+
+double xmlrpc_to_double(XmlRpc::XmlRpcValue &v);
+
+// prefix/forward, lateral, climb and yaw_rate as [start stop size], an
+// axis that is not set has a single sample at 0
+void load_trim_axes(ros::NodeHandle &n, const std::string &prefix, CoaXTrimMap &map);
+
+// prefix/position and velocity as [x y z], prefix/yaw; what is not set is 0
+void load_collocation_boundary(ros::NodeHandle &n, const std::string &prefix,
+                               collocation_boundary_t &boundary);
+#endif
@@ -0,0 +1,86 @@
+#ifndef __COAX_RADIO__
+#define __COAX_RADIO__
+
+#include <cstdio>
+#include <map>
+
+#include "CoaXModel.h"
+#include "LinkEmulator.h"
+
+class CoaXJournal;
+
+// telemetry messages in flight on the link
+#define STATE_QUEUE_SIZE 256
+
+typedef struct
+{
+  double value[4];
+} radio_packet_t;
+
+// The vehicle end of the Zigbee link, without ROS: raw commands and
+// setpoints wait in the command link until they arrive and ApplyCommand
+// hands them to the firmware, telemetry is timed by the state link.
+// Every input from the ground station goes through here and is recorded
+// in the journal if there is one, so that a replay can make the same calls.
+// The telemetry in flight is kept here too, so that a replay drops the
+// same states when the queue is full.
+class CoaXRadio
+{
+public:
+  CoaXRadio(CoaXModel* model_);
+  ~CoaXRadio() {}
+
+  void SetCommandLink(const LinkEmulator &link, unsigned int packet_size);
+  void SetStateLink(const LinkEmulator &link, unsigned int packet_size);
+  void SetJournal(CoaXJournal* journal_);
+
+  void Reset();
+
+  // Inputs, at the simulation time they are received
+  void SendRawCommand(double time, double motor1, double motor2,
+                      double servo1, double servo2);
+  // ground station frame like CoaxControl, pitch and yaw rate are flipped
+  // for the firmware
+  void SendControl(double time, double roll, double pitch, double yaw_rate,
+                   double altitude);
+  // returns 0 if the firmware accepts the transition, -1 otherwise
+  int ReachNavState(double time, int mode);
+  void SetTrim(double time, int mode, double roll, double pitch);
+  void SetControlTimeout(double time, double timeout);
+
+  // Commands that have come through the link by now are applied in order
+  // of arrival, the last one to arrive wins
+  void ApplyCommand(double time);
+  // Returns the arrival time of telemetry sent at time, -1 if it is lost
+  // and -2 if STATE_QUEUE_SIZE states are already in flight. slot is where
+  // the caller keeps the message until ReceiveState returns it.
+  double SendState(double time, unsigned int &slot);
+  // Slot of a state that arrived by time, earliest arrival first and in
+  // sending order for equal arrivals, -1 if there is none. The slot is
+  // free after the call.
+  int ReceiveState(double time);
+
+  // both links and packet sizes
+  int WriteConfiguration(FILE* file) const;
+  int ReadConfiguration(FILE* file);
+
+private:
+  CoaXModel* model;
+  CoaXOnboardControl* onboard;
+  CoaXJournal* journal;
+
+  LinkEmulator cmd_link;
+  LinkEmulator state_link;
+  unsigned int cmd_packet_size;
+  unsigned int state_packet_size;
+  // packets in flight by arrival time
+  std::multimap<double, radio_packet_t> cmd_queue;
+  std::multimap<double, radio_packet_t> control_queue;
+  // telemetry in sending order with the arrival times, reordering on the
+  // link makes arrivals out of order, received slots are marked with
+  // arrival -1 until the tail passes them
+  double state_arrival[STATE_QUEUE_SIZE];
+  unsigned int state_tail;
+  unsigned int state_count;
+};
+#endif
@@ -1,8 +1,34 @@
 #ifndef __COAXSIMULATOR__
 #define __COAXSIMULATOR__
+#include <cstdio>
 #include <string>
+#include <vector>
+#include <queue>
 #include "CoaXModel.h"
 
+// Called with the simulation time at which the event happens; the model
+// has been integrated exactly up to that time
+typedef void (*sim_event_callback_t)(double time, void* data);
+
+typedef struct
+{
+  double time;
+  double period; // 0 for one-shot events
+  unsigned long seq; // keeps events at the same time in insertion order
+  sim_event_callback_t callback;
+  void* data;
+} sim_event_t;
+
+struct sim_event_later
+{
+  bool operator()(const sim_event_t &a, const sim_event_t &b) const
+  {
+    if (a.time == b.time)
+      return a.seq > b.seq;
+    return a.time > b.time;
+  }
+};
+
 class CoaXSimulator
 {
  public:
@@ -10,18 +36,41 @@ class CoaXSimulator
   ~CoaXSimulator();
 
   double GetSimulationTime();
+  // number of Update calls so far, resets don't start it over
+  unsigned long GetTick();
   void SendCommand();
   void Update();
   CoaXModel* GetModelPtr();
+  WindField* GetWindFieldPtr();
+  ProximityTables* GetProximityTablesPtr();
 
   void ResetSimulation();
 
+  // Sensor, actuator and link events. Periodic events first fire at
+  // simulation time phase, one-shot events (e.g. delayed delivery of a
+  // sample) at the given time.
+  void AddPeriodicEvent(double period, double phase,
+                        sim_event_callback_t callback, void* data);
+  void ScheduleEvent(double time, sim_event_callback_t callback, void* data);
+  void AdvanceTo(double time);
+
+  // Time step, wind, proximity tables and model configuration
+  int WriteConfiguration(FILE* file);
+  int ReadConfiguration(FILE* file);
+  // time and public state of the model on one line
+  void PrintState(FILE* file);
+
 private:
   double time_step;
   double simulation_time;
+  unsigned long tick;
 
-  CoaXModel coax;
+  std::priority_queue<sim_event_t, std::vector<sim_event_t>, sim_event_later> events;
+  std::vector<sim_event_t> periodic_events;
+  unsigned long event_seq;
 
-  int CheckCollision();
+  WindField wind;
+  ProximityTables proximity;
+  CoaXModel coax;
 };
 #endif
@@ -0,0 +1,75 @@
+#ifndef __COAX_TRIM__
+#define __COAX_TRIM__
+
+#include <vector>
+
+#include "CoaXModel.h"
+
+// motor commands, servo positions, roll, pitch and bar direction x y
+#define TRIM_UNKNOWNS 8
+
+// Steady flight in still air: velocity in the heading frame (forward,
+// left), climb rate and yaw rate
+typedef struct
+{
+  double forward;
+  double lateral;
+  double climb;
+  double yaw_rate;
+} trim_condition_t;
+
+// Inputs, attitude, rotor speeds and bar direction that hold a trim
+// condition
+typedef struct
+{
+  double motor[2];
+  double servo[2];
+  double roll, pitch;
+  double rotors[2];
+  double bar[3];
+
+  // largest remaining acceleration, linear or angular
+  double residual;
+  int iterations;
+  bool converged;
+  // converged with the inputs and rotor speeds within their ranges
+  bool feasible;
+} trim_t;
+
+// Equilibrium of the CoaXModel equations of motion for a steady flight
+// condition, by Levenberg-Marquardt on the TRIM_UNKNOWNS inputs and states
+// with the Jacobian from automatic differentiation. The rotor speeds
+// follow from the motor commands at the nominal battery voltage, the
+// ground, the wind and the proximity tables are left out.
+class CoaXTrim
+{
+public:
+  CoaXTrim();
+
+  // copies the parameters, later changes of model are not seen
+  void SetModel(CoaXModel* model);
+  void SetTolerance(double tolerance_, int max_iterations_);
+
+  // hover estimate from the thrust and moment balance of the rotors
+  void InitialGuess(trim_t &trim);
+  // starts from trim, returns 0 if it converged
+  int Solve(const trim_condition_t &condition, trim_t &trim);
+
+  // identified parameters and drag the trims depend on
+  void GetParameters(std::vector<double> &parameters);
+
+private:
+  template <class T>
+  void Residuals(const trim_condition_t &condition, const T* x, T* f);
+  double Evaluate(const trim_condition_t &condition, const double* x,
+                  double* f, double* J);
+  void Unpack(const double* x, trim_t &trim);
+  static int SolveLinear(double* A, double* b, int n);
+
+  model_params_t param;
+  double theta[MODEL_PARAMETERS];
+
+  double tolerance;
+  int max_iterations;
+};
+#endif
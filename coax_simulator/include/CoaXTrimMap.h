@@ -0,0 +1,71 @@
+#ifndef __COAX_TRIM_MAP__
+#define __COAX_TRIM_MAP__
+
+#include <string>
+#include <vector>
+
+#include "CoaXTrim.h"
+
+enum
+{
+  TRIM_FORWARD = 0,
+  TRIM_LATERAL,
+  TRIM_CLIMB,
+  TRIM_YAW_RATE,
+  TRIM_AXES
+};
+
+// Uniform sampling of one trim condition
+typedef struct
+{
+  double start;
+  double step;
+  unsigned int size;
+} trim_axis_t;
+
+// Trims over a grid of forward and lateral speed, climb rate and yaw rate,
+// the yaw rate varying fastest. The map remembers the parameters it was
+// built with, so that a saved map is only reused for the same airframe.
+class CoaXTrimMap
+{
+public:
+  CoaXTrimMap();
+
+  // size samples from start to stop, a single sample at start if size is 1
+  void SetAxis(int axis, double start, double stop, unsigned int size);
+  const trim_axis_t& GetAxis(int axis) const;
+
+  // Solves every grid point on threads threads, from the hover guess and
+  // then from converged neighbours. Returns the number of feasible points.
+  unsigned int Build(CoaXTrim &trim, unsigned int threads = 1);
+
+  unsigned int GetSize() const;
+  void GetCondition(unsigned int i, trim_condition_t &condition) const;
+  const trim_t& GetTrim(unsigned int i) const;
+
+  // Multilinear between the grid points, clamped to the grid. The result
+  // is converged and feasible only if all points it is interpolated from
+  // are.
+  void Interpolate(const trim_condition_t &condition, trim_t &trim) const;
+
+  // whether the map was built for the parameters of trim, and over the axes
+  // of grid
+  bool Matches(CoaXTrim &trim) const;
+  bool Matches(CoaXTrim &trim, const CoaXTrimMap &grid) const;
+
+  // Returns 0 on success, -1 otherwise
+  int Save(const std::string &filename) const;
+  int Load(const std::string &filename);
+
+private:
+  static void* BuildThread(void* data);
+  void BuildPass(CoaXTrim &trim, unsigned int threads,
+                 const std::vector<trim_t>* previous);
+  void BuildPoints(CoaXTrim &trim, unsigned int first, unsigned int stride,
+                   const std::vector<trim_t>* previous);
+
+  trim_axis_t axes[TRIM_AXES];
+  std::vector<double> parameters;
+  std::vector<trim_t> trims;
+};
+#endif
@@ -0,0 +1,63 @@
+#ifndef __LINK_EMULATOR__
+#define __LINK_EMULATOR__
+
+#include <cstdio>
+#include <gsl/gsl_rng.h>
+
+// One direction of the radio link between the ground station and the
+// vehicle. Packets are serialized at a bounded bandwidth, wait in a
+// bounded queue, get a latency of latency + exponential(jitter), are
+// sometimes held back by reorder_delay (so later packets overtake them)
+// and are lost following a two state (Gilbert-Elliott) burst model.
+// The emulator only computes arrival times, the caller keeps the payload.
+class LinkEmulator
+{
+public:
+  LinkEmulator();
+  LinkEmulator(const LinkEmulator &other);
+  ~LinkEmulator();
+
+  LinkEmulator& operator=(const LinkEmulator &other);
+
+  void SetSeed(unsigned long seed);
+  // bandwidth in bytes/s (0 for unlimited), packets that would wait
+  // longer than max_queue_delay are dropped
+  void SetBandwidth(double bandwidth, double max_queue_delay);
+  void SetLatency(double latency, double jitter);
+  // loss probability in the good and bad state and the probabilities per
+  // packet to enter and to leave a burst
+  void SetLoss(double loss_good, double loss_bad,
+               double burst_start, double burst_end);
+  void SetReorder(double probability, double delay);
+
+  void Reset();
+
+  // configuration only, reading it back also resets the link
+  int WriteConfiguration(FILE* file) const;
+  int ReadConfiguration(FILE* file);
+
+  // returns 0 and the arrival time if the packet gets through, -1 if lost
+  int Send(double time, unsigned int size, double &arrival);
+
+  unsigned long GetSent() { return sent; }
+  unsigned long GetLost() { return lost; }
+
+private:
+  double bandwidth;
+  double max_queue_delay;
+  double latency;
+  double jitter;
+  double loss_good, loss_bad;
+  double burst_start, burst_end;
+  double reorder_probability;
+  double reorder_delay;
+
+  bool burst;
+  double busy_until;
+  unsigned long sent;
+  unsigned long lost;
+
+  unsigned long seed;
+  gsl_rng* rng;
+};
+#endif
@@ -0,0 +1,74 @@
+#ifndef __PROXIMITY_TABLES__
+#define __PROXIMITY_TABLES__
+
+#include <cstdio>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Uniform sampling of one table axis, in rotor radii
+typedef struct
+{
+  double start;
+  double inv_step;
+  // index of the last sample
+  double last;
+  unsigned int size;
+} table_axis_t;
+
+// Vertical wall through point with the horizontal unit normal pointing to
+// the free side
+typedef struct
+{
+  double point[2];
+  double normal[2];
+} wall_t;
+
+// Thrust correction factors T/T_free for a rotor close to the floor (z = 0)
+// and to vertical walls, tabulated over the distances in rotor radii: a 1D
+// ground table over the height and a 2D wall table over the wall distance
+// and the height. Lookups clamp to the table range and read padded tables,
+// so they are branchless and never go out of bounds. The tables are
+// read-only after setup and can be shared by any number of vehicles.
+class ProximityTables
+{
+public:
+  ProximityTables();
+  ~ProximityTables() {}
+
+  // returns 0 on success, -1 if the file can't be read or is malformed, in
+  // which case the factors stay 1
+  int Load(const std::string &filename);
+  void SetRotorRadius(double radius);
+
+  void AddWall(double x, double y, double nx, double ny);
+  void ClearWalls();
+
+  // factor for a rotor hub at pos (world coordinates)
+  double GetThrustFactor(const double* pos) const;
+
+  int WriteConfiguration(FILE* file) const;
+  int ReadConfiguration(FILE* file);
+
+private:
+  void Clear();
+  static int ReadAxis(std::istream &in, table_axis_t &axis);
+  static double Interpolate(const table_axis_t &axis,
+                            const std::vector<double> &table, double x);
+  static double Interpolate(const table_axis_t &axis_x,
+                            const table_axis_t &axis_y,
+                            const std::vector<double> &table,
+                            double x, double y);
+
+  double inv_radius;
+
+  table_axis_t ground_axis;
+  std::vector<double> ground;
+
+  // wall distance, height
+  table_axis_t wall_axis[2];
+  std::vector<double> wall;
+
+  std::vector<wall_t> walls;
+};
+#endif
@@ -1,18 +1,27 @@
 #ifndef __ROSCOAX__
 #define __ROSCOAX__
 #include <ros/ros.h>
-#include <tf/tf.h>
-#include <armadillo>
 
 #include <nav_msgs/Odometry.h>
 #include <coax_msgs/CoaxRawControl.h>
+#include <coax_msgs/CoaxState.h>
+#include <coax_msgs/CoaxReachNavState.h>
+#include <coax_msgs/CoaxControl.h>
+#include <coax_msgs/CoaxSetTrimMode.h>
+#include <coax_msgs/CoaxSetTimeout.h>
+
+#include <com/sbapi.h>
 
 #include "CoaXModel.h"
+#include "ViconEmulator.h"
+#include "LinkEmulator.h"
+#include "CoaXRadio.h"
 
 class ROSCoaX
 {
 public:
   ROSCoaX(CoaXModel *model_, ros::NodeHandle &parent, const std::string &name_)
+    : radio(model_)
   {
     model = model_;
     name = name_;
@@ -21,22 +30,113 @@ public:
 
     ros::NodeHandle n(parent, name);
 
-    double odometry_rate;
+    // The simulator schedules the sensor and actuator events at these
+    // rates, latencies are from sampling to delivery
+    odometry_rate = 0;
     if (parent.getParam("rates/odometry", odometry_rate))
-      {
-        odometry_timer =
-          parent.createTimer(ros::Rate(odometry_rate).expectedCycleTime(),
-                             &ROSCoaX::odometry_callback, this);
-        odometry_pub = n.advertise<nav_msgs::Odometry>("odom", 100);
-      }
+      odometry_pub = n.advertise<nav_msgs::Odometry>("odom", 100);
+
+    // Odometry goes through the emulated Vicon pipeline, the odometry
+    // latency is its transport delay
+    double odometry_latency, jitter;
+    parent.param("latencies/odometry", odometry_latency, 0.0);
+    parent.param("vicon/jitter", jitter, 0.0);
+    vicon.SetDelay(odometry_latency, jitter);
+
+    double sigma_pos, sigma_rot;
+    parent.param("vicon/noise/position", sigma_pos, 0.0);
+    parent.param("vicon/noise/orientation", sigma_rot, 0.0);
+    vicon.SetNoise(sigma_pos, sigma_rot);
+
+    double dropout;
+    parent.param("vicon/dropout", dropout, 0.0);
+    vicon.SetDropout(dropout);
+
+    double swap_probability, swap_distance, swap_yaw;
+    int swap_frames;
+    parent.param("vicon/swap/probability", swap_probability, 0.0);
+    parent.param("vicon/swap/distance", swap_distance, 0.0);
+    parent.param("vicon/swap/yaw", swap_yaw, 0.0);
+    parent.param("vicon/swap/frames", swap_frames, 0);
+    vicon.SetMarkerSwap(swap_probability, swap_distance, swap_yaw, swap_frames);
+
+    bool finite_difference;
+    parent.param("vicon/finite_difference", finite_difference, false);
+    vicon.SetFiniteDifference(finite_difference);
+
+    int seed;
+    parent.param("vicon/seed", seed, 0);
+    vicon.SetSeed(seed);
+
+    // Zigbee link, commands up and telemetry down
+    parent.param("rates/command", command_rate, 100.0);
+    LinkEmulator link;
+    unsigned int packet_size;
+    LoadLink(parent, "command", link, packet_size);
+    radio.SetCommandLink(link, packet_size);
+    LoadLink(parent, "state", link, packet_size);
+    radio.SetStateLink(link, packet_size);
+
+    // Onboard telemetry, published like coax_server does on hardware
+    state_rate = 0;
+    if (parent.getParam("rates/state", state_rate))
+      state_pub = n.advertise<coax_msgs::CoaxState>("state", 100);
+
+    // Services and setpoints of the onboard firmware
+    onboard = model->GetOnboardControlPtr();
+    nav_state_srv = n.advertiseService("reach_nav_state", &ROSCoaX::ReachNavState, this);
+    trim_mode_srv = n.advertiseService("set_trim_mode", &ROSCoaX::SetTrimMode, this);
+    timeout_srv = n.advertiseService("set_timeout", &ROSCoaX::SetTimeout, this);
+
+    state_msg.content = SBS_MODES | SBS_TIMESTAMP | SBS_BATTERY | SBS_GYRO | SBS_RPY | SBS_ACCEL;
+    state_msg.mode.navigation = SB_NAV_STOP;
+
+    sim_time = 0;
 
     cmd_sub = n.subscribe("cmd", 10, &ROSCoaX::CmdCallback, this,
                           ros::TransportHints().tcp().tcpNoDelay());
+    control_sub = n.subscribe("control", 10, &ROSCoaX::ControlCallback, this,
+                              ros::TransportHints().tcp().tcpNoDelay());
   }
-  ~ROSCoaX()
+  ~ROSCoaX() {}
+
+  double GetOdometryRate() { return odometry_rate; }
+  double GetCommandRate() { return command_rate; }
+  double GetStateRate() { return state_rate; }
+  CoaXRadio* GetRadioPtr() { return &radio; }
+
+  static void LoadLink(ros::NodeHandle &n, const std::string &direction,
+                       LinkEmulator &link, unsigned int &packet_size)
   {
-    if (odometry_timer.isValid())
-      odometry_timer.stop();
+    double latency, jitter;
+    n.param("latencies/" + direction, latency, 0.0);
+    n.param("link/" + direction + "/jitter", jitter, 0.0);
+    link.SetLatency(latency, jitter);
+
+    double bandwidth, max_queue_delay;
+    n.param("link/bandwidth", bandwidth, 0.0);
+    n.param("link/max_queue_delay", max_queue_delay, 0.0);
+    link.SetBandwidth(bandwidth, max_queue_delay);
+
+    double loss_good, loss_bad, burst_start, burst_end;
+    n.param("link/" + direction + "/loss/good", loss_good, 0.0);
+    n.param("link/" + direction + "/loss/bad", loss_bad, 0.0);
+    n.param("link/" + direction + "/loss/burst_start", burst_start, 0.0);
+    n.param("link/" + direction + "/loss/burst_end", burst_end, 1.0);
+    link.SetLoss(loss_good, loss_bad, burst_start, burst_end);
+
+    double reorder_probability, reorder_delay;
+    n.param("link/" + direction + "/reorder/probability", reorder_probability, 0.0);
+    n.param("link/" + direction + "/reorder/delay", reorder_delay, 0.0);
+    link.SetReorder(reorder_probability, reorder_delay);
+
+    int size;
+    n.param("link/" + direction + "/packet_size", size, 32);
+    packet_size = size;
+
+    int seed;
+    n.param("link/" + direction + "/seed", seed, 0);
+    link.SetSeed(seed);
   }
 
   void SetFrameId(const std::string &frame_id_)
@@ -44,82 +144,190 @@ public:
     frame_id = frame_id_;
   }
 
-  void odometry_callback(const ros::TimerEvent& e)
+  void Reset()
+  {
+    vicon.Reset();
+    radio.Reset();
+    sim_time = 0;
+
+    state_msg.mode.navigation = SB_NAV_STOP;
+  }
+
+  // Feed the true state of the model to the Vicon emulator and send
+  // whatever frame it delivers at this time
+  void PublishOdometry(double time, const ros::Time &stamp)
   {
+    sim_time = time;
+
+    double pos[3], quat[4], vel[3], angvel[3];
+
+    model->GetXYZ(pos[0], pos[1], pos[2]);
+    model->GetOrientation(quat[0], quat[1], quat[2], quat[3]);
+    model->GetWorldLinearVelocity(vel[0], vel[1], vel[2]);
+    model->GetBodyAngularVelocity(angvel[0], angvel[1], angvel[2]);
+
+    if (vicon.Update(time, pos, quat, vel, angvel, frame) != 0)
+      return;
+
     ROS_DEBUG("Sending Odometry");
 
-    double x, y, z;
+    // *** Load up and send the Odometry message
+    odom_msg.header.frame_id = "/map";
+    odom_msg.child_frame_id = frame_id;
+    odom_msg.header.stamp = stamp;
+    odom_msg.pose.pose.position.x = frame.pos[0];
+    odom_msg.pose.pose.position.y = frame.pos[1];
+    odom_msg.pose.pose.position.z = frame.pos[2];
+    odom_msg.pose.pose.orientation.x = frame.quat[1];
+    odom_msg.pose.pose.orientation.y = frame.quat[2];
+    odom_msg.pose.pose.orientation.z = frame.quat[3];
+    odom_msg.pose.pose.orientation.w = frame.quat[0];
+    odom_msg.twist.twist.linear.x = frame.vel[0];
+    odom_msg.twist.twist.linear.y = frame.vel[1];
+    odom_msg.twist.twist.linear.z = frame.vel[2];
+    odom_msg.twist.twist.angular.x = frame.angvel[0];
+    odom_msg.twist.twist.angular.y = frame.angvel[1];
+    odom_msg.twist.twist.angular.z = frame.angvel[2];
+
+    odometry_pub.publish(odom_msg);
+  }
+
+  // The firmware only passes raw commands to the motors in SB_NAV_RAW and
+  // setpoints in SB_NAV_CTRLLED
+  void ApplyCommand(double time)
+  {
+    sim_time = time;
+
+    radio.ApplyCommand(time);
+  }
+
+  // Gyro and Euler angles are reported in the onboard IMU frame (y and z
+  // flipped), battery in the raw units CoaxRosControl calibrates.
+  // The message is handed to the link, returns its arrival time or -1 if
+  // it was lost.
+  double SampleState(double time, const ros::Time &stamp)
+  {
+    sim_time = time;
+
+    state_msg.mode.navigation = onboard->GetNavState();
+
     double roll, pitch, yaw;
-    double vx, vy, vz;
     double wx, wy, wz;
+    double ax, ay, az;
+    double battery_voltage, battery_current, battery_soc;
 
-    model->GetXYZ(x, y, z);
     model->GetRotation(roll, pitch, yaw);
-    model->GetWorldLinearVelocity(vx, vy, vz);
     model->GetBodyAngularVelocity(wx, wy, wz);
+    model->GetBodySpecificForce(ax, ay, az);
+    model->GetBattery(battery_voltage, battery_current, battery_soc);
 
-    double c_r = cos(roll);
-    double s_r = sin(roll);
-    double c_p = cos(pitch);
-    double s_p = sin(pitch);
-    double c_y = cos(yaw);
-    double s_y = sin(yaw);
+    state_msg.header.stamp = stamp;
+    state_msg.timeStamp = (unsigned int)(time*1000);
+    state_msg.roll = roll;
+    state_msg.pitch = -pitch;
+    state_msg.yaw = -yaw;
+    state_msg.gyro[0] = wx;
+    state_msg.gyro[1] = -wy;
+    state_msg.gyro[2] = -wz;
+    // specific force in the axes of the gyro, -1 g on z at rest
+    state_msg.accel[0] = ax;
+    state_msg.accel[1] = -ay;
+    state_msg.accel[2] = -az;
+    state_msg.battery = (battery_voltage - 1.5299)/0.8817;
 
-    arma::mat Rb2w(3, 3);
-    Rb2w(0, 0) = c_p*c_y;
-    Rb2w(0, 1) = s_r*s_p*c_y - c_r*s_y;
-    Rb2w(0, 2) = c_r*s_p*c_y + s_r*s_y;
+    unsigned int slot;
+    double arrival = radio.SendState(time, slot);
+    if (arrival == -2)
+      ROS_WARN("%s: more than %d states in flight, dropping one",
+               name.c_str(), STATE_QUEUE_SIZE);
+    if (arrival < 0)
+      return -1;
 
-    Rb2w(1, 0) = c_p*s_y;
-    Rb2w(1, 1) = s_r*s_p*s_y + c_r*c_y;
-    Rb2w(1, 2) = c_r*s_p*s_y - s_r*c_y;
+    state_queue[slot] = state_msg;
 
-    Rb2w(2, 0) = -s_p;
-    Rb2w(2, 1) = s_r*c_p;
-    Rb2w(2, 2) = c_r*c_p;
+    return arrival;
+  }
 
-    btMatrix3x3 r(Rb2w(0, 0), Rb2w(0, 1), Rb2w(0, 2),
-                  Rb2w(1, 0), Rb2w(1, 1), Rb2w(1, 2),
-                  Rb2w(2, 0), Rb2w(2, 1), Rb2w(2, 2));
+  // Publishes the states that arrived by time, earliest arrival first and
+  // in sending order for equal arrivals
+  void PublishState(double time)
+  {
+    int next;
+    while ((next = radio.ReceiveState(time)) >= 0)
+      state_pub.publish(state_queue[next]);
+  }
 
-    btQuaternion quat;
-    r.getRotation(quat);
-    quat.normalize();
+  bool ReachNavState(coax_msgs::CoaxReachNavState::Request &req,
+                     coax_msgs::CoaxReachNavState::Response &res)
+  {
+    res.result = radio.ReachNavState(sim_time, req.desiredState);
+    if (res.result != 0)
+      ROS_WARN("Cannot reach navigation state %d from %d",
+               req.desiredState, onboard->GetNavState());
 
-    // *** Load up and send the Odometry message
-    odom_msg.header.frame_id = "/map";
-    odom_msg.child_frame_id = frame_id;
-    odom_msg.header.stamp = e.current_real;
-    odom_msg.pose.pose.position.x = x;
-    odom_msg.pose.pose.position.y = y;
-    odom_msg.pose.pose.position.z = z;
-    tf::quaternionTFToMsg(quat, odom_msg.pose.pose.orientation);
-    odom_msg.twist.twist.linear.x = vx;
-    odom_msg.twist.twist.linear.y = vy;
-    odom_msg.twist.twist.linear.z = vz;
-    odom_msg.twist.twist.angular.x = wx;
-    odom_msg.twist.twist.angular.y = wy;
-    odom_msg.twist.twist.angular.z = wz;
+    return true;
+  }
 
-    odometry_pub.publish(odom_msg);
+  bool SetTrimMode(coax_msgs::CoaxSetTrimMode::Request &req,
+                   coax_msgs::CoaxSetTrimMode::Response &res)
+  {
+    radio.SetTrim(sim_time, req.mode.trimMode, req.mode.rollTrim, req.mode.pitchTrim);
+    res.result = 0;
+
+    return true;
+  }
+
+  // Only the control timeout is emulated
+  bool SetTimeout(coax_msgs::CoaxSetTimeout::Request &req,
+                  coax_msgs::CoaxSetTimeout::Response &res)
+  {
+    radio.SetControlTimeout(sim_time, req.control_timeout_ms/1000.0);
+    res.result = 0;
+
+    return true;
   }
 
   void CmdCallback(const coax_msgs::CoaxRawControl::ConstPtr& msg)
   {
-    model->SetCommand(msg->motor1, msg->motor2,
-                      msg->servo1, msg->servo2);
+    radio.SendRawCommand(sim_time, msg->motor1, msg->motor2, msg->servo1, msg->servo2);
+  }
+
+  void ControlCallback(const coax_msgs::CoaxControl::ConstPtr& msg)
+  {
+    radio.SendControl(sim_time, msg->roll, msg->pitch, msg->yaw, msg->altitude);
   }
 
 private:
   std::string name;
   CoaXModel* model;
+  CoaXOnboardControl* onboard;
 
   ros::Subscriber cmd_sub;
+  ros::Subscriber control_sub;
   ros::Publisher odometry_pub;
-  ros::Timer odometry_timer;
+  ros::Publisher state_pub;
+  ros::ServiceServer nav_state_srv;
+  ros::ServiceServer trim_mode_srv;
+  ros::ServiceServer timeout_srv;
 
   std::string frame_id;
 
+  double odometry_rate;
+  double command_rate;
+  double state_rate;
+
+  // simulation time of the last event seen
+  double sim_time;
+
   nav_msgs::Odometry odom_msg;
+  coax_msgs::CoaxState state_msg;
+
+  ViconEmulator vicon;
+  vicon_frame_t frame;
+
+  // commands and setpoints, and the timing of the telemetry
+  CoaXRadio radio;
+  // telemetry in flight, preallocated, in the slots of the radio
+  coax_msgs::CoaxState state_queue[STATE_QUEUE_SIZE];
 };
 #endif
@@ -0,0 +1,89 @@
+#ifndef __VICON_EMULATOR__
+#define __VICON_EMULATOR__
+
+#include <gsl/gsl_rng.h>
+
+// past poses kept for the transport delay
+#define VICON_BUFFER_SIZE 256
+
+typedef struct
+{
+  double time;
+  double pos[3];
+  double quat[4];
+  double vel[3];
+  double angvel[3];
+} vicon_sample_t;
+
+// What comes out of vicon2odometry: pose at the capture time, linear
+// velocity in the world frame and angular velocity in the body frame, both
+// by finite differences of consecutive frames
+typedef struct
+{
+  double time;
+  double pos[3];
+  double quat[4];
+  double vel[3];
+  double angvel[3];
+} vicon_frame_t;
+
+// Turns the true pose of the model into what the motion capture pipeline
+// delivers: delayed (with jitter), noisy, occasionally dropped frames and
+// marker swaps that make the pose jump for a few frames. All randomness
+// comes from one seeded generator so runs are repeatable.
+class ViconEmulator
+{
+public:
+  ViconEmulator();
+  ViconEmulator(const ViconEmulator &other);
+  ~ViconEmulator();
+
+  ViconEmulator& operator=(const ViconEmulator &other);
+
+  void SetSeed(unsigned long seed);
+  void SetDelay(double delay, double jitter);
+  void SetNoise(double sigma_pos, double sigma_rot);
+  void SetDropout(double probability);
+  void SetMarkerSwap(double probability, double distance, double yaw,
+                     unsigned int frames);
+  void SetFiniteDifference(bool enabled);
+
+  void Reset();
+
+  // Called at the frame rate with the true pose, returns 0 and fills frame
+  // if a frame is delivered at this time, -1 otherwise
+  int Update(double time, const double* pos, const double* quat,
+             const double* vel, const double* angvel, vicon_frame_t &frame);
+
+private:
+  static void QuaternionMultiply(const double* a, const double* b, double* c);
+  static void RotationToQuaternion(const double* r, double* q);
+
+  vicon_sample_t buffer[VICON_BUFFER_SIZE];
+  unsigned int head;
+  unsigned int count;
+
+  double delay;
+  double jitter;
+  double sigma_pos;
+  double sigma_rot;
+  double dropout;
+  double swap_probability;
+  double swap_distance;
+  double swap_yaw;
+  unsigned int swap_frames;
+  bool finite_difference;
+
+  // current marker swap
+  unsigned int swap_left;
+  double swap_offset[3];
+  double swap_quat[4];
+
+  // last delivered frame for the finite differences
+  bool has_last;
+  vicon_frame_t last;
+
+  unsigned long seed;
+  gsl_rng* rng;
+};
+#endif
@@ -0,0 +1,60 @@
+#ifndef __WIND_FIELD__
+#define __WIND_FIELD__
+
+#include <cstdio>
+#include <vector>
+
+typedef struct
+{
+  double start;
+  double duration;
+  double amplitude[3];
+} wind_gust_t;
+
+// Wind in world coordinates at a time and place: steady wind, (1-cos)
+// gusts and Dryden turbulence. The turbulence is frozen (Taylor) and
+// convected with the steady wind, so it is read from tables of filtered
+// noise generated once, with one O(1) lookup per axis. All three axes are
+// read at the along wind coordinate only: the turbulence is the same
+// across the wind and at any height, which is fine for one vehicle but
+// gives vehicles side by side the same gusts. The field is read-only after
+// setup and can be shared by any number of vehicles.
+class WindField
+{
+public:
+  WindField();
+  ~WindField() {}
+
+  void SetSteady(double wx, double wy, double wz);
+  void AddGust(double start, double duration, double wx, double wy, double wz);
+  void ClearGusts();
+
+  // sigma and length (m) along wind, lateral and vertical, table resolution
+  // dx (m) and number of entries. Turbulence is convected at least with
+  // min_advection (m/s) so that it also varies in still air.
+  void SetTurbulence(const double* sigma, const double* length,
+                     double dx, unsigned int size, unsigned long seed,
+                     double min_advection);
+
+  void GetWind(double t, const double* pos, double* wind) const;
+
+  // steady wind, gusts and the turbulence tables as they are
+  int WriteConfiguration(FILE* file) const;
+  int ReadConfiguration(FILE* file);
+
+private:
+  void UpdateDirection();
+
+  double steady[3];
+  std::vector<wind_gust_t> gusts;
+
+  // unit along wind direction in the horizontal plane
+  double dir[2];
+  double advection;
+  double min_advection;
+
+  double dx;
+  // along wind, lateral, vertical
+  std::vector<double> table[3];
+};
+#endif
@@ -0,0 +1,71 @@
+%% Flight envelope written by coax_envelope
+clear
+clc
+
+filename = '/tmp/coax_envelope.env';
+
+f = fopen(filename, 'r');
+magic = fread(f, 4, 'char=>char')';
+if (~strcmp(magic, 'CXE1'))
+    fclose(f);
+    error('%s is not an envelope file', filename);
+end
+
+% forward, lateral, climb, yaw rate
+names = {'forward speed [m/s]', 'lateral speed [m/s]', 'climb rate [m/s]', 'yaw rate [rad/s]'};
+axes_ = cell(1, 4);
+sizes = zeros(1, 4);
+for a = 1:4
+    start = fread(f, 1, 'double');
+    step = fread(f, 1, 'double');
+    sizes(a) = fread(f, 1, 'uint32');
+    axes_{a} = start + (0:sizes(a)-1)*step;
+end
+n = fread(f, 1, 'uint32');
+status = fread(f, n, 'uint8');
+values = fread(f, [8 n], 'float32');
+fclose(f);
+
+% status: 0 no trim, 1 saturated inputs, 2 feasible
+% values: motor up, motor lo, servo 1, servo 2, roll, pitch, motor margin,
+% servo margin. The yaw rate varies fastest, so the reshaped arrays are
+% indexed (yaw rate, climb, lateral, forward).
+status = reshape(status, fliplr(sizes));
+motor_margin = reshape(values(7,:), fliplr(sizes));
+servo_margin = reshape(values(8,:), fliplr(sizes));
+servo_margin(status == 0) = NaN;
+motor_margin(status == 0) = NaN;
+
+% slices through the samples closest to 0
+[~, i_fwd] = min(abs(axes_{1}));
+[~, i_lat] = min(abs(axes_{2}));
+[~, i_clb] = min(abs(axes_{3}));
+[~, i_yaw] = min(abs(axes_{4}));
+
+figure(1)
+subplot(2,2,1)
+imagesc(axes_{1}, axes_{2}, squeeze(status(i_yaw, i_clb, :, :)), [0 2]);
+axis xy, xlabel(names{1}), ylabel(names{2}), title('status, 0 no trim, 2 feasible')
+subplot(2,2,2)
+imagesc(axes_{1}, axes_{3}, squeeze(status(i_yaw, :, i_lat, :)), [0 2]);
+axis xy, xlabel(names{1}), ylabel(names{3}), title('status')
+subplot(2,2,3)
+imagesc(axes_{1}, axes_{4}, squeeze(status(:, i_clb, i_lat, :)), [0 2]);
+axis xy, xlabel(names{1}), ylabel(names{4}), title('status')
+subplot(2,2,4)
+imagesc(axes_{3}, axes_{4}, squeeze(status(:, :, i_lat, i_fwd)), [0 2]);
+axis xy, xlabel(names{3}), ylabel(names{4}), title('status')
+
+figure(2)
+subplot(2,2,1)
+contourf(axes_{1}, axes_{2}, squeeze(servo_margin(i_yaw, i_clb, :, :)));
+colorbar, xlabel(names{1}), ylabel(names{2}), title('servo margin')
+subplot(2,2,2)
+contourf(axes_{1}, axes_{4}, squeeze(servo_margin(:, i_clb, i_lat, :)));
+colorbar, xlabel(names{1}), ylabel(names{4}), title('servo margin')
+subplot(2,2,3)
+contourf(axes_{1}, axes_{3}, squeeze(motor_margin(i_yaw, :, i_lat, :)));
+colorbar, xlabel(names{1}), ylabel(names{3}), title('motor margin')
+subplot(2,2,4)
+contourf(axes_{3}, axes_{4}, squeeze(motor_margin(:, :, i_lat, i_fwd)));
+colorbar, xlabel(names{3}), ylabel(names{4}), title('motor margin')
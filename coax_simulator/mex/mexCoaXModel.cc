@@ -6,6 +6,12 @@
 
 CoaXModel model;
 
+// The firmware starts in SB_NAV_STOP, where it ignores set_cmd. The model is
+// put in SB_NAV_RAW on the first call and on reset, reach_nav_state changes
+// that. Modes other than raw compute the motor commands in update_onboard,
+// to be called at the firmware rate.
+bool raw_mode_set = false;
+
 #define CHECKINPUTCOUNT(nrhs, count) \
   if (nrhs != count)\
     {\
@@ -59,6 +65,12 @@ extern "C"
     // Register the exit function
     mexAtExit(mexExit);
 
+    if (!raw_mode_set)
+      {
+        model.GetOnboardControlPtr()->ReachNavState(SB_NAV_RAW, model.GetTime());
+        raw_mode_set = true;
+      }
+
     // Verify the input is good, something must be given
     if (nrhs == 0)
       {
@@ -281,6 +293,32 @@ extern "C"
         CHECKINPUTCOUNT(nrhs, 1);
 
         model.ResetSimulation();
+        model.GetOnboardControlPtr()->ReachNavState(SB_NAV_RAW, model.GetTime());
+        plhs[0] = mxCreateDoubleScalar(0);
+        return;
+      }
+    else if (strcmp("reach_nav_state", buf) == 0)
+      {
+        CHECKINPUTCOUNT(nrhs, 2);
+
+        // SB_NAV_* of com/sbapi.h, -1 if the firmware refuses
+        int mode = (int)mxGetScalar(prhs[1]);
+        int ret = model.GetOnboardControlPtr()->ReachNavState(mode, model.GetTime());
+        plhs[0] = mxCreateDoubleScalar(ret);
+        return;
+      }
+    else if (strcmp("get_nav_state", buf) == 0)
+      {
+        CHECKINPUTCOUNT(nrhs, 1);
+
+        plhs[0] = mxCreateDoubleScalar(model.GetOnboardControlPtr()->GetNavState());
+        return;
+      }
+    else if (strcmp("update_onboard", buf) == 0)
+      {
+        CHECKINPUTCOUNT(nrhs, 1);
+
+        model.UpdateOnboard();
         plhs[0] = mxCreateDoubleScalar(0);
         return;
       }
@@ -0,0 +1,375 @@
+#include <cmath>
+#include <cstring>
+
+#include "CoaXBatch.h"
+#include "CoaXDynamics.h"
+
+using namespace std;
+
+template <class T>
+CoaXBatch<T>::CoaXBatch()
+{
+  memset((void*)&param, 0, sizeof(param));
+  memset((void*)&gains, 0, sizeof(gains));
+  memset((void*)&attitude_gains, 0, sizeof(attitude_gains));
+  inner_loop = false;
+  inner_steps = 1;
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta[i] = 0;
+  hover_speed[0] = 0;
+  hover_speed[1] = 0;
+
+  dt = 1e-3;
+  steps = 10;
+  time = 0;
+  n = 0;
+
+  return;
+}
+
+// Omega_lo = sqrt(m*g/(k_Tup*k_Mlo/k_Mup + k_Tlo)), the upper rotor
+// balances the moment of the lower one, as in CoaXTrim
+template <class T>
+void CoaXBatch<T>::SetModel(CoaXModel* model)
+{
+  param = *model->GetModelParams();
+  time = model->GetTime();
+
+  double theta_d[MODEL_PARAMETERS];
+  model->GetParameters(theta_d);
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta[i] = theta_d[i];
+
+  hover_speed[0] = 0;
+  hover_speed[1] = 0;
+  double den = param.k_Tup*param.k_Mlo/param.k_Mup + param.k_Tlo;
+  if ((param.k_Mup > 0) && (den > 0))
+    {
+      hover_speed[1] = sqrt(param.mass*9.81/den);
+      hover_speed[0] = sqrt(param.k_Mlo/param.k_Mup)*hover_speed[1];
+    }
+}
+
+template <class T>
+void CoaXBatch<T>::SetGains(const control_params_t &gains_)
+{
+  gains = gains_;
+}
+
+template <class T>
+void CoaXBatch<T>::SetTimeStep(double dt_, double control_period)
+{
+  dt = dt_;
+  double s = floor(control_period/dt + 0.5);
+  steps = (s > 1) ? (unsigned int)s : 1;
+}
+
+template <class T>
+void CoaXBatch<T>::SetInnerLoop(bool enabled, const attitude_params_t &attitude_gains_, double inner_period)
+{
+  inner_loop = enabled;
+  attitude_gains = attitude_gains_;
+  double s = floor(inner_period/dt + 0.5);
+  inner_steps = (s > 1) ? (unsigned int)s : 1;
+}
+
+template <class T>
+void CoaXBatch<T>::SetVehicles(unsigned int n_)
+{
+  n = n_;
+  x.assign(ODE_DIMENSION*n, T(0));
+  positions.assign(3*n, 0);
+  inputs.assign(4*n, T(0));
+  setpoints.assign(SETPOINT_DIMENSION*n, T(0));
+  stage.assign(ODE_DIMENSION*n, T(0));
+  stage_xdot.assign(ODE_DIMENSION*n, T(0));
+  sum.assign(ODE_DIMENSION*n, T(0));
+
+  types.assign(n, -1);
+  starts.assign(n, time);
+  squared_error.assign(n, 0);
+  max_error.assign(n, 0);
+  samples.assign(n, 0);
+
+  for (unsigned int k = 0; k < n; k++)
+    SetTrajectory(k, -1, time, NULL);
+}
+
+template <class T>
+unsigned int CoaXBatch<T>::GetVehicles() const
+{
+  return n;
+}
+
+template <class T>
+void CoaXBatch<T>::SetTrajectory(unsigned int k, int type, double start, const double* offset)
+{
+  double reference[REFERENCE_DIMENSION];
+  double pose[4];
+  ReferenceTrajectory(0, type, reference, pose);
+  if (offset)
+    for (int i = 0; i < 4; i++)
+      pose[i] += offset[i];
+
+  double state[DIMENSION];
+  memset(state, 0, sizeof(state));
+  state[0] = pose[0];
+  state[1] = pose[1];
+  state[2] = pose[2];
+  state[3] = reference[3];
+  state[4] = reference[4];
+  state[5] = reference[5];
+  state[8] = pose[3];
+  state[11] = reference[10];
+  state[12] = hover_speed[0];
+  state[13] = hover_speed[1];
+  state[16] = 1;
+  SetState(k, state);
+
+  types[k] = type;
+  starts[k] = start;
+  squared_error[k] = 0;
+  max_error[k] = 0;
+  samples[k] = 0;
+}
+
+template <class T>
+void CoaXBatch<T>::SetState(unsigned int k, const double* state)
+{
+  double q[4];
+  EulerToQuaternion(state[6], state[7], state[8], q);
+
+  for (int i = 0; i < 3; i++)
+    {
+      positions[i*n + k] = state[i];
+      x[i*n + k] = 0;
+      x[(3+i)*n + k] = state[3+i];
+      x[(10+i)*n + k] = state[9+i];
+      x[(15+i)*n + k] = state[14+i];
+    }
+  for (int i = 0; i < 4; i++)
+    x[(6+i)*n + k] = q[i];
+  x[13*n + k] = state[12];
+  x[14*n + k] = state[13];
+}
+
+template <class T>
+void CoaXBatch<T>::GetState(unsigned int k, double* state) const
+{
+  double q[4];
+  for (int i = 0; i < 4; i++)
+    q[i] = x[(6+i)*n + k];
+
+  for (int i = 0; i < 3; i++)
+    {
+      state[i] = positions[i*n + k];
+      state[3+i] = x[(3+i)*n + k];
+      state[9+i] = x[(10+i)*n + k];
+      state[14+i] = x[(15+i)*n + k];
+    }
+  QuaternionToEuler(q, state[6], state[7], state[8]);
+  state[12] = x[13*n + k];
+  state[13] = x[14*n + k];
+}
+
+template <class T>
+double CoaXBatch<T>::GetTime() const
+{
+  return time;
+}
+
+template <class T>
+void CoaXBatch<T>::GetTrackingError(unsigned int k, double &rms, double &max) const
+{
+  rms = (samples[k] > 0) ? sqrt(squared_error[k]/samples[k]) : 0;
+  max = max_error[k];
+}
+
+template <class T>
+void CoaXBatch<T>::Update()
+{
+  Control();
+
+  LimitRotorSpeeds();
+  for (unsigned int s = 0; s < steps; s++)
+    {
+      if (inner_loop && (s > 0) && (s % inner_steps == 0))
+        AttitudeControl(s*dt);
+      Integrate(dt);
+    }
+  LimitRotorSpeeds();
+}
+
+template <class T>
+void CoaXBatch<T>::Gather(const vector<T> &x_, unsigned int k, T* state) const
+{
+  for (int i = 0; i < ODE_DIMENSION; i++)
+    state[i] = x_[i*n + k];
+  for (int i = 0; i < 3; i++)
+    state[i] = T(positions[i*n + k] + (double)x_[i*n + k]);
+}
+
+// The controller of coax_ros_control on the true state, limited as its
+// setControls does. With the inner loop the position loop keeps its
+// setpoint for AttitudeControl until the next control step.
+template <class T>
+void CoaXBatch<T>::Control()
+{
+  for (unsigned int k = 0; k < n; k++)
+    {
+      double reference_d[REFERENCE_DIMENSION];
+      double pose[4];
+      double t = (time > starts[k]) ? time - starts[k] : 0;
+      ReferenceTrajectory(t, types[k], reference_d, pose);
+
+      double error = 0;
+      for (int i = 0; i < 3; i++)
+        error += (positions[i*n + k] - reference_d[i])*(positions[i*n + k] - reference_d[i]);
+      squared_error[k] += error;
+      max_error[k] = (sqrt(error) > max_error[k]) ? sqrt(error) : max_error[k];
+      samples[k]++;
+
+      T coax_state[DIMENSION];
+      T Rb2w[3][3];
+      PublicState(k, coax_state, Rb2w);
+
+      T reference[REFERENCE_DIMENSION];
+      for (int i = 0; i < REFERENCE_DIMENSION; i++)
+        reference[i] = reference_d[i];
+
+      T control[4];
+      if (inner_loop)
+        {
+          T setpoint[SETPOINT_DIMENSION];
+          PositionControlLaw(coax_state, reference, param, gains, setpoint);
+          for (int i = 0; i < SETPOINT_DIMENSION; i++)
+            setpoints[i*n + k] = setpoint[i];
+          AttitudeControlLaw(coax_state, Rb2w, setpoint, param, attitude_gains, control);
+        }
+      else
+        ControlLaw(coax_state, Rb2w, reference, param, gains, control);
+      SetInputs(k, control);
+    }
+}
+
+// The attitude loop elapsed after the last control step, on the setpoint
+// of that step with the heading advanced at the yaw rate
+template <class T>
+void CoaXBatch<T>::AttitudeControl(double elapsed)
+{
+  for (unsigned int k = 0; k < n; k++)
+    {
+      T coax_state[DIMENSION];
+      T Rb2w[3][3];
+      PublicState(k, coax_state, Rb2w);
+
+      T setpoint[SETPOINT_DIMENSION];
+      for (int i = 0; i < SETPOINT_DIMENSION; i++)
+        setpoint[i] = setpoints[i*n + k];
+      setpoint[3] += setpoint[4]*T(elapsed);
+
+      T control[4];
+      AttitudeControlLaw(coax_state, Rb2w, setpoint, param, attitude_gains, control);
+      SetInputs(k, control);
+    }
+}
+
+template <class T>
+void CoaXBatch<T>::PublicState(unsigned int k, T* coax_state, T Rb2w[3][3]) const
+{
+  T state[ODE_DIMENSION];
+  Gather(x, k, state);
+
+  for (int i = 0; i < 6; i++)
+    coax_state[i] = state[i];
+  QuaternionToEuler(&state[6], coax_state[6], coax_state[7], coax_state[8]);
+  for (int i = 9; i < DIMENSION; i++)
+    coax_state[i] = state[i+1];
+
+  QuaternionToRotation(&state[6], Rb2w);
+}
+
+// Limited as setControls of coax_ros_control does. A NaN command, when the
+// heave demand cannot be met, gives 0.
+template <class T>
+void CoaXBatch<T>::SetInputs(unsigned int k, const T* control)
+{
+  for (int i = 0; i < 4; i++)
+    {
+      T low = (i < 2) ? T(0) : T(-1);
+      T u = (control[i] == control[i]) ? control[i] : T(0);
+      inputs[i*n + k] = (u < low) ? low : ((u > 1) ? T(1) : u);
+    }
+}
+
+template <class T>
+void CoaXBatch<T>::LimitRotorSpeeds()
+{
+  for (unsigned int k = 0; k < 2*n; k++)
+    x[13*n + k] = CoaXModel::LimitRotorSpeed(x[13*n + k]);
+}
+
+// Classic Runge-Kutta, the stages of all vehicles at once
+template <class T>
+void CoaXBatch<T>::Integrate(double h)
+{
+  static const double c[4] = {0, 0.5, 0.5, 1};
+  static const double w[4] = {1, 2, 2, 1};
+
+  unsigned int N = ODE_DIMENSION*n;
+  for (int s = 0; s < 4; s++)
+    {
+      const vector<T> &xs = (s == 0) ? x : stage;
+      for (unsigned int k = 0; k < n; k++)
+        {
+          T state[ODE_DIMENSION];
+          T xdot[ODE_DIMENSION];
+          T u[4];
+          double acc[3];
+          Gather(xs, k, state);
+          for (int i = 0; i < 4; i++)
+            u[i] = inputs[i*n + k];
+
+          CoaXDerivatives(time + c[s]*h, state, xdot, theta, u, &param, acc);
+
+          for (int i = 0; i < ODE_DIMENSION; i++)
+            stage_xdot[i*n + k] = xdot[i];
+        }
+
+      T ws = w[s];
+      if (s == 0)
+        for (unsigned int i = 0; i < N; i++)
+          sum[i] = stage_xdot[i];
+      else
+        for (unsigned int i = 0; i < N; i++)
+          sum[i] += ws*stage_xdot[i];
+
+      if (s < 3)
+        {
+          T a = c[s+1]*h;
+          for (unsigned int i = 0; i < N; i++)
+            stage[i] = x[i] + a*stage_xdot[i];
+        }
+    }
+
+  T b = h/6;
+  for (unsigned int i = 0; i < 3*n; i++)
+    positions[i] += (double)(b*sum[i]);
+  for (unsigned int i = 3*n; i < N; i++)
+    x[i] += b*sum[i];
+
+  for (unsigned int k = 0; k < n; k++)
+    {
+      T q[4];
+      for (int i = 0; i < 4; i++)
+        q[i] = x[(6+i)*n + k];
+      NormalizeQuaternion(q);
+      for (int i = 0; i < 4; i++)
+        x[(6+i)*n + k] = q[i];
+    }
+
+  time += h;
+}
+
+template class CoaXBatch<float>;
+template class CoaXBatch<double>;
@@ -0,0 +1,785 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "CoaXDynamics.h"
+#include "CoaXCollocation.h"
+
+using namespace std;
+
+// defects and steady conditions are divided by these, the rotor speeds
+// being two orders of magnitude above the other states
+static const double state_scale[COLLOCATION_STATES] =
+  {1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 100, 100, 1, 1};
+
+// weights of the objectives against the squared constraints
+static const double time_weight = 1;
+static const double energy_weight = 0.01;
+static const double smoothing_weight = 1e-3;
+
+// rows of a boundary: position, velocity, yaw, body rates, then the
+// derivatives of steady_states
+#define BOUNDARY_ROWS 20
+#define BOUNDARY_STEADY 10
+#define STEADY_STATES 10
+static const int steady_states[STEADY_STATES] = {3, 4, 5, 10, 11, 12, 13, 14, 15, 16};
+
+// largest bar tilt, as in CoaXTrim
+static const double max_bar = 0.7;
+
+static double wrap_angle(double a)
+{
+  while (a > M_PI)
+    a -= 2*M_PI;
+  while (a < -M_PI)
+    a += 2*M_PI;
+  return a;
+}
+
+CoaXCollocation::CoaXCollocation()
+{
+  memset((void*)&param, 0, sizeof(param));
+  memset(theta, 0, sizeof(theta));
+  memset(boundaries, 0, sizeof(boundaries));
+
+  nodes = 41;
+  objective = COLLOCATION_TIME;
+  duration = 5;
+  min_altitude = -HUGE_VAL;
+  tolerance = 1e-6;
+  max_iterations = 2000;
+
+  penalty = 100;
+  violation = HUGE_VAL;
+  iterations = 0;
+
+  return;
+}
+
+void CoaXCollocation::SetModel(CoaXModel* model)
+{
+  param = *model->GetModelParams();
+  param.wind = NULL;
+  param.proximity = NULL;
+  param.k_ground = 0;
+  param.voltage_scale = 1;
+
+  model->GetParameters(theta);
+  trim.SetModel(model);
+}
+
+void CoaXCollocation::SetNodes(unsigned int nodes_)
+{
+  nodes = (nodes_ > 2) ? nodes_ : 2;
+}
+
+void CoaXCollocation::SetObjective(int objective_, double duration_)
+{
+  objective = objective_;
+  duration = duration_;
+}
+
+void CoaXCollocation::SetMinimumAltitude(double altitude)
+{
+  min_altitude = altitude;
+}
+
+void CoaXCollocation::SetTolerance(double tolerance_, int max_iterations_)
+{
+  tolerance = tolerance_;
+  max_iterations = max_iterations_;
+}
+
+unsigned int CoaXCollocation::GetNodes() const
+{
+  return nodes;
+}
+
+double CoaXCollocation::GetDuration() const
+{
+  return z.empty() ? 0 : z.back();
+}
+
+double CoaXCollocation::GetViolation() const
+{
+  return violation;
+}
+
+int CoaXCollocation::GetIterations() const
+{
+  return iterations;
+}
+
+void CoaXCollocation::GetNode(unsigned int k, double* state, double* inputs) const
+{
+  const double* x = &z[k*COLLOCATION_NODE];
+  memcpy(state, x, COLLOCATION_STATES*sizeof(double));
+  state[17] = sqrt(1 - x[15]*x[15] - x[16]*x[16]);
+  memcpy(inputs, &x[COLLOCATION_STATES], 4*sizeof(double));
+}
+
+// Trims of start and goal, the position cubic between them and the other
+// states and the inputs linear
+void CoaXCollocation::InitialGuess(const collocation_boundary_t &start,
+                                   const collocation_boundary_t &goal)
+{
+  const collocation_boundary_t* ends[2] = {&start, &goal};
+  trim_t trims[2];
+  double roll[2], pitch[2];
+  for (int e = 0; e < 2; e++)
+    {
+      const collocation_boundary_t &b = *ends[e];
+      trim_condition_t condition;
+      condition.forward = cos(b.yaw)*b.velocity[0] + sin(b.yaw)*b.velocity[1];
+      condition.lateral = -sin(b.yaw)*b.velocity[0] + cos(b.yaw)*b.velocity[1];
+      condition.climb = b.velocity[2];
+      condition.yaw_rate = 0;
+
+      trim.InitialGuess(trims[e]);
+      trim.Solve(condition, trims[e]);
+      roll[e] = trims[e].roll;
+      pitch[e] = trims[e].pitch;
+    }
+
+  double T = duration;
+  double yaw_change = wrap_angle(goal.yaw - start.yaw);
+
+  z.assign(nodes*COLLOCATION_NODE + 1, 0);
+  for (unsigned int k = 0; k < nodes; k++)
+    {
+      double s = (double)k/(nodes - 1);
+      double* x = &z[k*COLLOCATION_NODE];
+
+      // cubic Hermite through the boundary positions and velocities
+      double h00 = 2*s*s*s - 3*s*s + 1;
+      double h10 = s*s*s - 2*s*s + s;
+      double h01 = -2*s*s*s + 3*s*s;
+      double h11 = s*s*s - s*s;
+      for (int i = 0; i < 3; i++)
+        {
+          x[i] = h00*start.position[i] + h10*T*start.velocity[i] +
+            h01*goal.position[i] + h11*T*goal.velocity[i];
+          x[3+i] = ((6*s*s - 6*s)*start.position[i] + (3*s*s - 4*s + 1)*T*start.velocity[i] +
+                    (-6*s*s + 6*s)*goal.position[i] + (3*s*s - 2*s)*T*goal.velocity[i])/T;
+        }
+
+      EulerToQuaternion((1 - s)*roll[0] + s*roll[1], (1 - s)*pitch[0] + s*pitch[1],
+                        start.yaw + s*yaw_change, &x[6]);
+      bool interior = (k > 0) && (k + 1 < nodes);
+      x[12] = interior ? yaw_change/T : 0;
+
+      x[13] = (1 - s)*trims[0].rotors[0] + s*trims[1].rotors[0];
+      x[14] = (1 - s)*trims[0].rotors[1] + s*trims[1].rotors[1];
+      x[15] = (1 - s)*trims[0].bar[0] + s*trims[1].bar[0];
+      x[16] = (1 - s)*trims[0].bar[1] + s*trims[1].bar[1];
+
+      x[COLLOCATION_STATES] = (1 - s)*trims[0].motor[0] + s*trims[1].motor[0];
+      x[COLLOCATION_STATES+1] = (1 - s)*trims[0].motor[1] + s*trims[1].motor[1];
+      x[COLLOCATION_STATES+2] = (1 - s)*trims[0].servo[0] + s*trims[1].servo[0];
+      x[COLLOCATION_STATES+3] = (1 - s)*trims[0].servo[1] + s*trims[1].servo[1];
+    }
+  z.back() = T;
+
+  // bounds, the guess is moved inside
+  lower.assign(z.size(), -HUGE_VAL);
+  upper.assign(z.size(), HUGE_VAL);
+  for (unsigned int k = 0; k < nodes; k++)
+    {
+      unsigned int i = k*COLLOCATION_NODE;
+      lower[i+2] = min_altitude;
+      lower[i+15] = -max_bar;
+      upper[i+15] = max_bar;
+      lower[i+16] = -max_bar;
+      upper[i+16] = max_bar;
+      for (int j = 0; j < 2; j++)
+        {
+          lower[i+COLLOCATION_STATES+j] = 0;
+          upper[i+COLLOCATION_STATES+j] = 1;
+          lower[i+COLLOCATION_STATES+2+j] = -1;
+          upper[i+COLLOCATION_STATES+2+j] = 1;
+        }
+    }
+  lower.back() = (objective == COLLOCATION_ENERGY) ? duration : 1e-2;
+  upper.back() = duration;
+
+  for (unsigned int i = 0; i < z.size(); i++)
+    {
+      z[i] = (z[i] < lower[i]) ? lower[i] : z[i];
+      z[i] = (z[i] > upper[i]) ? upper[i] : z[i];
+    }
+}
+
+// Jacobian J of the state derivatives at the node variables xk,
+// COLLOCATION_STATES x COLLOCATION_NODE, row major. As in CoaXTrim it is
+// taken at most 1e-5 away from the servos and the bar upright.
+void CoaXCollocation::NodeJacobian(const double* xk, double* J) const
+{
+  typedef Dual<COLLOCATION_NODE> dual_t;
+
+  dual_t theta_d[MODEL_PARAMETERS];
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta_d[i] = theta[i];
+
+  dual_t xd[COLLOCATION_NODE];
+  for (int j = 0; j < COLLOCATION_NODE; j++)
+    {
+      double v = xk[j];
+      if (((j == 15) || (j == 16) || (j == COLLOCATION_STATES + 2) ||
+           (j == COLLOCATION_STATES + 3)) && (fabs(v) < 1e-5))
+        v = (v < 0) ? -1e-5 : 1e-5;
+      xd[j] = dual_t(v, j);
+    }
+
+  dual_t state[ODE_DIMENSION];
+  dual_t xdot[ODE_DIMENSION];
+  double acc[3];
+  for (int j = 0; j < COLLOCATION_STATES; j++)
+    state[j] = xd[j];
+  state[17] = sqrt(1 - xd[15]*xd[15] - xd[16]*xd[16]);
+  CoaXDerivatives(0.0, state, xdot, theta_d, &xd[COLLOCATION_STATES], &param, acc);
+
+  for (int i = 0; i < COLLOCATION_STATES; i++)
+    memcpy(&J[i*COLLOCATION_NODE], xdot[i].d, COLLOCATION_NODE*sizeof(double));
+}
+
+// State derivatives f at every node and, if df is given, their Jacobians,
+// one node after the other
+void CoaXCollocation::Derivatives(const double* x, vector<double> &f,
+                                  vector<double>* df) const
+{
+  f.resize(nodes*COLLOCATION_STATES);
+  if (df)
+    df->resize(nodes*COLLOCATION_STATES*COLLOCATION_NODE);
+
+  double state[ODE_DIMENSION];
+  double xdot[ODE_DIMENSION];
+  double acc[3];
+  for (unsigned int k = 0; k < nodes; k++)
+    {
+      const double* xk = &x[k*COLLOCATION_NODE];
+
+      memcpy(state, xk, COLLOCATION_STATES*sizeof(double));
+      state[17] = sqrt(1 - xk[15]*xk[15] - xk[16]*xk[16]);
+      CoaXDerivatives(0.0, state, xdot, theta, &xk[COLLOCATION_STATES], &param, acc);
+      memcpy(&f[k*COLLOCATION_STATES], xdot, COLLOCATION_STATES*sizeof(double));
+
+      if (df)
+        NodeJacobian(xk, &(*df)[k*COLLOCATION_STATES*COLLOCATION_NODE]);
+    }
+}
+
+// Trapezoidal defects x_k+1 - x_k - h/2 (f_k + f_k+1), the unit quaternion
+// at the first node and the steady boundaries, always in this order so that
+// the multipliers stay with their constraints. The defects carry the
+// quaternion to the other nodes, where its norm is only held approximately:
+// it drifts by the trapezoidal error, to about 0.951 on a coarse grid,
+// without a row of its own, as more rows would over-determine the defects. The drift does not reach
+// the dynamics, QuaternionToRotation normalizes, nor the yaw of the
+// boundaries and of Sample.
+void CoaXCollocation::Constraints(const double* x, vector<row_t> &rows) const
+{
+  vector<double> f, df;
+  Derivatives(x, f, &df);
+
+  const int n = COLLOCATION_NODE;
+  double T = x[nodes*n];
+  double h = T/(nodes - 1);
+
+  rows.clear();
+  row_t row;
+  for (unsigned int k = 0; k + 1 < nodes; k++)
+    {
+      const double* f0 = &f[k*COLLOCATION_STATES];
+      const double* f1 = &f[(k+1)*COLLOCATION_STATES];
+      const double* J0 = &df[k*COLLOCATION_STATES*n];
+      const double* J1 = &df[(k+1)*COLLOCATION_STATES*n];
+      for (int i = 0; i < COLLOCATION_STATES; i++)
+        {
+          double s = 1/state_scale[i];
+          row.node = k;
+          row.r = s*(x[(k+1)*n + i] - x[k*n + i] - 0.5*h*(f0[i] + f1[i]));
+          for (int j = 0; j < n; j++)
+            {
+              row.d[j] = -s*0.5*h*J0[i*n + j];
+              row.d[n+j] = -s*0.5*h*J1[i*n + j];
+            }
+          row.d[i] -= s;
+          row.d[n+i] += s;
+          row.dT = -s*0.5*(f0[i] + f1[i])/(nodes - 1);
+          rows.push_back(row);
+        }
+    }
+
+  const double* q = &x[6];
+  memset(&row, 0, sizeof(row));
+  row.node = 0;
+  row.r = q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3] - 1;
+  for (int j = 0; j < 4; j++)
+    row.d[6+j] = 2*q[j];
+  rows.push_back(row);
+
+  Boundary(x, 0, boundaries[0], f, df, rows);
+  Boundary(x, nodes - 1, boundaries[1], f, df, rows);
+}
+
+// Position, velocity and yaw at node k, no body rates and no acceleration
+// of the states that settle in steady flight
+void CoaXCollocation::Boundary(const double* x, unsigned int k,
+                               const collocation_boundary_t &boundary,
+                               const vector<double> &f, const vector<double> &df,
+                               vector<row_t> &rows) const
+{
+  const int n = COLLOCATION_NODE;
+  const double* xk = &x[k*n];
+  row_t row;
+
+  for (int i = 0; i < 6; i++)
+    {
+      memset(&row, 0, sizeof(row));
+      row.node = k;
+      row.r = xk[i] - ((i < 3) ? boundary.position[i] : boundary.velocity[i-3]);
+      row.d[i] = 1;
+      rows.push_back(row);
+    }
+
+  // yaw = atan2(a, b) of the quaternion, in a form that does not depend on
+  // its length
+  const double* q = &xk[6];
+  double a = 2*(q[0]*q[3] + q[1]*q[2]);
+  double b = q[0]*q[0] + q[1]*q[1] - q[2]*q[2] - q[3]*q[3];
+  double r2 = a*a + b*b;
+  memset(&row, 0, sizeof(row));
+  row.node = k;
+  row.r = wrap_angle(atan2(a, b) - boundary.yaw);
+  if (r2 > 0)
+    {
+      row.d[6] = (b*2*q[3] - a*2*q[0])/r2;
+      row.d[7] = (b*2*q[2] - a*2*q[1])/r2;
+      row.d[8] = (b*2*q[1] + a*2*q[2])/r2;
+      row.d[9] = (b*2*q[0] + a*2*q[3])/r2;
+    }
+  rows.push_back(row);
+
+  for (int i = 10; i < 13; i++)
+    {
+      memset(&row, 0, sizeof(row));
+      row.node = k;
+      row.r = xk[i];
+      row.d[i] = 1;
+      rows.push_back(row);
+    }
+
+  for (int s = 0; s < STEADY_STATES; s++)
+    {
+      int i = steady_states[s];
+      double scale = 1/state_scale[i];
+      memset(&row, 0, sizeof(row));
+      row.node = k;
+      row.r = scale*f[k*COLLOCATION_STATES + i];
+      for (int j = 0; j < n; j++)
+        row.d[j] = scale*df[(k*COLLOCATION_STATES + i)*n + j];
+      rows.push_back(row);
+    }
+}
+
+// Least squares terms of the objective: the duration or the rotor power
+// k_M Omega^3 integrated by the trapezoidal rule, plus a small penalty on
+// input changes between nodes against chattering at the limits
+void CoaXCollocation::Objective(const double* x, vector<row_t> &rows) const
+{
+  const int n = COLLOCATION_NODE;
+  double T = x[nodes*n];
+  double h = T/(nodes - 1);
+
+  rows.clear();
+  row_t row;
+  if (objective == COLLOCATION_TIME)
+    {
+      memset(&row, 0, sizeof(row));
+      row.node = -1;
+      row.r = sqrt(time_weight)*T;
+      row.dT = sqrt(time_weight);
+      rows.push_back(row);
+    }
+  else
+    {
+      for (unsigned int k = 0; k < nodes; k++)
+        {
+          double w = energy_weight*h*(((k == 0) || (k + 1 == nodes)) ? 0.5 : 1);
+          double Omega_up = x[k*n + 13];
+          double Omega_lo = x[k*n + 14];
+          double power = param.k_Mup*Omega_up*Omega_up*Omega_up +
+            param.k_Mlo*Omega_lo*Omega_lo*Omega_lo;
+
+          memset(&row, 0, sizeof(row));
+          row.node = k;
+          if (power > 0)
+            {
+              row.r = sqrt(w*power);
+              row.d[13] = w*3*param.k_Mup*Omega_up*Omega_up/(2*row.r);
+              row.d[14] = w*3*param.k_Mlo*Omega_lo*Omega_lo/(2*row.r);
+              row.dT = row.r/(2*T);
+            }
+          rows.push_back(row);
+        }
+    }
+
+  for (unsigned int k = 0; k + 1 < nodes; k++)
+    for (int j = COLLOCATION_STATES; j < n; j++)
+      {
+        memset(&row, 0, sizeof(row));
+        row.node = k;
+        row.r = sqrt(smoothing_weight)*(x[(k+1)*n + j] - x[k*n + j]);
+        row.d[j] = -sqrt(smoothing_weight);
+        row.d[n+j] = sqrt(smoothing_weight);
+        rows.push_back(row);
+      }
+}
+
+// Augmented Lagrangian 1/2 |objective|^2 + y'c + penalty/2 |c|^2
+double CoaXCollocation::Merit(const double* x, vector<row_t> &constraints,
+                              vector<row_t> &objective_rows) const
+{
+  Constraints(x, constraints);
+  Objective(x, objective_rows);
+
+  double merit = 0;
+  for (unsigned int i = 0; i < objective_rows.size(); i++)
+    merit += 0.5*objective_rows[i].r*objective_rows[i].r;
+  for (unsigned int i = 0; i < constraints.size(); i++)
+    merit += (multipliers[i] + 0.5*penalty*constraints[i].r)*constraints[i].r;
+
+  // outside the model, e.g. the bar beyond horizontal
+  if (merit != merit)
+    merit = HUGE_VAL;
+
+  return merit;
+}
+
+// Levenberg-Marquardt step on the merit function as a least squares
+// problem with the residuals sqrt(penalty) (c + y/penalty). The variables
+// are ordered node by node, so J'J is banded with 2 COLLOCATION_NODE - 1
+// subdiagonals and a dense border for the duration; the band is factorized
+// by Cholesky and the border eliminated by its Schur complement. Variables
+// on a bound that the step would push beyond are held. Returns -1 if the
+// damped system is not positive definite.
+int CoaXCollocation::Step(const vector<row_t> &constraints, const vector<row_t> &objective_rows,
+                          double lambda, vector<double> &dz) const
+{
+  const unsigned int m = nodes*COLLOCATION_NODE;
+  const unsigned int b = 2*COLLOCATION_NODE - 1;
+  const unsigned int w = b + 1;
+
+  // band: H(i, j) for j <= i at i*w + i - j
+  vector<double> H(m*w, 0);
+  vector<double> border(m, 0);
+  vector<double> g(m, 0);
+  double HTT = 0;
+  double gT = 0;
+
+  for (unsigned int c = 0; c < constraints.size() + objective_rows.size(); c++)
+    {
+      bool constraint = (c < constraints.size());
+      const row_t &row = constraint ? constraints[c] : objective_rows[c - constraints.size()];
+      double scale = constraint ? sqrt(penalty) : 1;
+      double r = constraint ? scale*row.r + multipliers[c]/scale : row.r;
+      double dT = scale*row.dT;
+
+      HTT += dT*dT;
+      gT -= dT*r;
+      if (row.node < 0)
+        continue;
+
+      unsigned int base = row.node*COLLOCATION_NODE;
+      unsigned int size = (row.node + 1 < (int)nodes) ? 2*COLLOCATION_NODE : COLLOCATION_NODE;
+      for (unsigned int a = 0; a < size; a++)
+        {
+          double da = scale*row.d[a];
+          if (da == 0)
+            continue;
+          g[base + a] -= da*r;
+          border[base + a] += da*dT;
+          double* Ha = &H[(base + a)*w];
+          for (unsigned int j = 0; j <= a; j++)
+            Ha[a - j] += da*scale*row.d[j];
+        }
+    }
+
+  // held variables: bounds the gradient points across, and fixed ones
+  vector<bool> held(m + 1, false);
+  for (unsigned int i = 0; i <= m; i++)
+    {
+      double gi = (i < m) ? g[i] : gT;
+      held[i] = (lower[i] == upper[i]) ||
+        ((z[i] <= lower[i]) && (gi < 0)) || ((z[i] >= upper[i]) && (gi > 0));
+    }
+
+  for (unsigned int i = 0; i < m; i++)
+    {
+      double* Hi = &H[i*w];
+      if (held[i])
+        {
+          for (unsigned int j = 0; j < w; j++)
+            Hi[j] = 0;
+          for (unsigned int j = i + 1; (j < m) && (j <= i + b); j++)
+            H[j*w + j - i] = 0;
+          Hi[0] = 1;
+          g[i] = 0;
+          border[i] = 0;
+        }
+      else
+        Hi[0] += lambda*Hi[0] + 1e-12;
+    }
+
+  // banded Cholesky, L replaces H
+  for (unsigned int i = 0; i < m; i++)
+    {
+      unsigned int first = (i > b) ? i - b : 0;
+      for (unsigned int j = first; j <= i; j++)
+        {
+          double s = H[i*w + i - j];
+          for (unsigned int k = first; k < j; k++)
+            s -= H[i*w + i - k]*H[j*w + j - k];
+          if (i == j)
+            {
+              if (s <= 0)
+                return -1;
+              H[i*w] = sqrt(s);
+            }
+          else
+            H[i*w + i - j] = s/H[j*w];
+        }
+    }
+
+  // L L' y = g and L L' v = border
+  vector<double> y = g;
+  vector<double> v = border;
+  for (unsigned int i = 0; i < m; i++)
+    {
+      unsigned int first = (i > b) ? i - b : 0;
+      for (unsigned int k = first; k < i; k++)
+        {
+          y[i] -= H[i*w + i - k]*y[k];
+          v[i] -= H[i*w + i - k]*v[k];
+        }
+      y[i] /= H[i*w];
+      v[i] /= H[i*w];
+    }
+  for (int i = m - 1; i >= 0; i--)
+    {
+      for (unsigned int k = i + 1; (k < m) && (k <= i + b); k++)
+        {
+          y[i] -= H[k*w + k - i]*y[k];
+          v[i] -= H[k*w + k - i]*v[k];
+        }
+      y[i] /= H[i*w];
+      v[i] /= H[i*w];
+    }
+
+  double step_T = 0;
+  if (!held[m])
+    {
+      HTT += lambda*HTT + 1e-12;
+      double s = HTT;
+      double r = gT;
+      for (unsigned int i = 0; i < m; i++)
+        {
+          s -= border[i]*v[i];
+          r -= border[i]*y[i];
+        }
+      if (s <= 0)
+        return -1;
+      step_T = r/s;
+    }
+
+  dz.resize(m + 1);
+  for (unsigned int i = 0; i < m; i++)
+    dz[i] = y[i] - v[i]*step_T;
+  dz[m] = step_T;
+
+  return 0;
+}
+
+// Levenberg-Marquardt on the merit function for the current multipliers,
+// the steps projected on the bounds. A step that does not decrease the
+// merit is first halved twice, the penalty makes the merit steep across
+// the constraints while the direction is still good. Returns the number
+// of steps.
+int CoaXCollocation::Minimize()
+{
+  vector<row_t> constraints, objective_rows;
+  vector<row_t> constraints_new, objective_new;
+  double merit = Merit(&z[0], constraints, objective_rows);
+
+  double lambda = 1e-3;
+  int steps = 0;
+  vector<double> dz;
+  vector<double> z_new(z.size());
+  while ((steps < 100) && (iterations + steps < max_iterations))
+    {
+      steps++;
+
+      bool accepted = false;
+      double merit_new = HUGE_VAL;
+      while (!accepted && (lambda < 1e12))
+        {
+          if (Step(constraints, objective_rows, lambda, dz) == 0)
+            {
+              for (double alpha = 1; !accepted && (alpha > 0.2); alpha *= 0.5)
+                {
+                  for (unsigned int i = 0; i < z.size(); i++)
+                    {
+                      z_new[i] = z[i] + alpha*dz[i];
+                      z_new[i] = (z_new[i] < lower[i]) ? lower[i] : z_new[i];
+                      z_new[i] = (z_new[i] > upper[i]) ? upper[i] : z_new[i];
+                    }
+                  merit_new = Merit(&z_new[0], constraints_new, objective_new);
+                  accepted = (merit_new < merit);
+                }
+            }
+
+          if (!accepted)
+            lambda *= 10;
+        }
+      if (!accepted)
+        break;
+
+      double decrease = merit - merit_new;
+      z.swap(z_new);
+      constraints.swap(constraints_new);
+      objective_rows.swap(objective_new);
+      merit = merit_new;
+      lambda = (lambda > 1e-12) ? 0.1*lambda : lambda;
+
+      if (decrease < 1e-10*(1 + fabs(merit)))
+        break;
+    }
+
+  return steps;
+}
+
+int CoaXCollocation::Solve(const collocation_boundary_t &start, const collocation_boundary_t &goal)
+{
+  boundaries[0] = start;
+  boundaries[1] = goal;
+  InitialGuess(start, goal);
+
+  vector<row_t> constraints;
+  Constraints(&z[0], constraints);
+  multipliers.assign(constraints.size(), 0);
+  penalty = 100;
+  iterations = 0;
+  violation = HUGE_VAL;
+
+  double previous = HUGE_VAL;
+  while (iterations < max_iterations)
+    {
+      iterations += Minimize();
+
+      Constraints(&z[0], constraints);
+      violation = 0;
+      for (unsigned int i = 0; i < constraints.size(); i++)
+        violation = (fabs(constraints[i].r) > violation) ? fabs(constraints[i].r) : violation;
+      if (violation != violation)
+        violation = HUGE_VAL;
+      if (violation < tolerance)
+        return 0;
+
+      for (unsigned int i = 0; i < constraints.size(); i++)
+        multipliers[i] += penalty*constraints[i].r;
+      if ((violation > 0.25*previous) && (penalty < 1e9))
+        penalty *= 10;
+      previous = violation;
+    }
+
+  return -1;
+}
+
+void CoaXCollocation::Sample(double dt, vector<collocation_reference_t> &table) const
+{
+  table.clear();
+  if (z.empty() || (dt <= 0))
+    return;
+
+  const int n = COLLOCATION_NODE;
+  vector<double> f;
+  Derivatives(&z[0], f, NULL);
+
+  // yaw, unwrapped, and yaw rate at the nodes
+  vector<double> yaw(nodes), yaw_rate(nodes);
+  for (unsigned int k = 0; k < nodes; k++)
+    {
+      const double* x = &z[k*n];
+      double q[4];
+      memcpy(q, &x[6], sizeof(q));
+      NormalizeQuaternion(q);
+      double roll, pitch, psi;
+      QuaternionToEuler(q, roll, pitch, psi);
+      yaw[k] = (k > 0) ? yaw[k-1] + wrap_angle(psi - yaw[k-1]) : psi;
+      yaw_rate[k] = (x[11]*sin(roll) + x[12]*cos(roll))/cos(pitch);
+    }
+
+  double T = z.back();
+  double h = T/(nodes - 1);
+  // every dt, and the end if it falls between two samples
+  unsigned int samples = (unsigned int)floor(T/dt + 1e-9) + 1;
+  if ((samples - 1)*dt < T - 1e-9)
+    samples++;
+  for (unsigned int s = 0; s < samples; s++)
+    {
+      double t = (s*dt < T) ? s*dt : T;
+      unsigned int k = (unsigned int)(t/h);
+      k = (k + 1 < nodes) ? k : nodes - 2;
+      double u = (t - k*h)/h;
+
+      double h00 = 2*u*u*u - 3*u*u + 1;
+      double h10 = u*u*u - 2*u*u + u;
+      double h01 = -2*u*u*u + 3*u*u;
+      double h11 = u*u*u - u*u;
+
+      const double* x0 = &z[k*n];
+      const double* x1 = &z[(k+1)*n];
+      const double* f0 = &f[k*COLLOCATION_STATES];
+      const double* f1 = &f[(k+1)*COLLOCATION_STATES];
+
+      collocation_reference_t r;
+      r.time = t;
+      for (int i = 0; i < 3; i++)
+        {
+          r.position[i] = h00*x0[i] + h10*h*f0[i] + h01*x1[i] + h11*h*f1[i];
+          r.velocity[i] = h00*x0[3+i] + h10*h*f0[3+i] + h01*x1[3+i] + h11*h*f1[3+i];
+          r.acceleration[i] = (1 - u)*f0[3+i] + u*f1[3+i];
+        }
+      r.yaw = wrap_angle(h00*yaw[k] + h10*h*yaw_rate[k] + h01*yaw[k+1] + h11*h*yaw_rate[k+1]);
+      r.yaw_rate = (1 - u)*yaw_rate[k] + u*yaw_rate[k+1];
+      table.push_back(r);
+    }
+}
+
+int CoaXCollocation::SaveTable(const string &filename, double dt) const
+{
+  vector<collocation_reference_t> table;
+  Sample(dt, table);
+
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file)
+    return -1;
+
+  fprintf(file, "# CoaXCollocation reference, %s-optimal over %.4f s\n",
+          (objective == COLLOCATION_TIME) ? "time" : "energy", GetDuration());
+  fprintf(file, "# time x y z vx vy vz ax ay az yaw yaw_rate\n");
+  for (unsigned int i = 0; i < table.size(); i++)
+    {
+      const collocation_reference_t &r = table[i];
+      fprintf(file, "%.4f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f\n",
+              r.time, r.position[0], r.position[1], r.position[2],
+              r.velocity[0], r.velocity[1], r.velocity[2],
+              r.acceleration[0], r.acceleration[1], r.acceleration[2],
+              r.yaw, r.yaw_rate);
+    }
+
+  if (fclose(file) != 0)
+    return -1;
+
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include <cstring>
+
+#include "BinaryIO.h"
+#include "CoaXJournal.h"
+
+using namespace std;
+
+static const char journal_magic[4] = {'C', 'X', 'J', '1'};
+
+CoaXJournal::CoaXJournal()
+{
+  file = NULL;
+  recording = false;
+  tick = 0;
+
+  return;
+}
+
+CoaXJournal::~CoaXJournal()
+{
+  Close();
+
+  return;
+}
+
+int CoaXJournal::Create(const string &filename, CoaXSimulator &simulator,
+                        const CoaXRadio &radio, const journal_rates_t &rates)
+{
+  Close();
+
+  file = fopen(filename.c_str(), "wb");
+  if (!file)
+    return -1;
+
+  coax_model_state_t state;
+  simulator.GetModelPtr()->Snapshot(state);
+
+  if ((fwrite(journal_magic, sizeof(journal_magic), 1, file) != 1) ||
+      !WriteBinary(file, rates) ||
+      (simulator.WriteConfiguration(file) != 0) ||
+      (radio.WriteConfiguration(file) != 0) ||
+      !WriteBinary(file, state))
+    {
+      fclose(file);
+      file = NULL;
+      return -1;
+    }
+
+  recording = true;
+  tick = simulator.GetTick();
+
+  return 0;
+}
+
+int CoaXJournal::Open(const string &filename, CoaXSimulator &simulator,
+                      CoaXRadio &radio, journal_rates_t &rates)
+{
+  Close();
+
+  file = fopen(filename.c_str(), "rb");
+  if (!file)
+    return -1;
+
+  char magic[sizeof(journal_magic)];
+  coax_model_state_t state;
+
+  if ((fread(magic, sizeof(magic), 1, file) != 1) ||
+      (memcmp(magic, journal_magic, sizeof(magic)) != 0) ||
+      !ReadBinary(file, rates) ||
+      (simulator.ReadConfiguration(file) != 0) ||
+      (radio.ReadConfiguration(file) != 0) ||
+      !ReadBinary(file, state))
+    {
+      fclose(file);
+      file = NULL;
+      return -1;
+    }
+
+  simulator.GetModelPtr()->Restore(state);
+  recording = false;
+
+  return 0;
+}
+
+void CoaXJournal::Close()
+{
+  if (!file)
+    return;
+
+  if (recording)
+    Record(JOURNAL_END, 0, 0, NULL);
+
+  fclose(file);
+  file = NULL;
+  recording = false;
+}
+
+void CoaXJournal::SetTick(unsigned long tick_)
+{
+  tick = tick_;
+}
+
+// tick, type, then time, mode and values where the type has them
+void CoaXJournal::Record(int type, double time, int mode, const double* value)
+{
+  if (!file || !recording)
+    return;
+
+  unsigned int entry_tick = tick;
+  unsigned char entry_type = type;
+  WriteBinary(file, entry_tick);
+  WriteBinary(file, entry_type);
+  if (type == JOURNAL_END)
+    return;
+
+  WriteBinary(file, time);
+  if (HasMode(type))
+    {
+      signed char entry_mode = mode;
+      WriteBinary(file, entry_mode);
+    }
+  int n = ValueCount(type);
+  if (n > 0)
+    fwrite(value, sizeof(double), n, file);
+}
+
+bool CoaXJournal::Next(journal_entry_t &entry)
+{
+  if (!file || recording)
+    return false;
+
+  memset(&entry, 0, sizeof(entry));
+
+  unsigned int entry_tick;
+  unsigned char entry_type;
+  if (!ReadBinary(file, entry_tick) || !ReadBinary(file, entry_type))
+    return false;
+  entry.tick = entry_tick;
+  entry.type = entry_type;
+  if (entry.type == JOURNAL_END)
+    return true;
+
+  if (!ReadBinary(file, entry.time))
+    return false;
+  if (HasMode(entry.type))
+    {
+      signed char entry_mode;
+      if (!ReadBinary(file, entry_mode))
+        return false;
+      entry.mode = entry_mode;
+    }
+  int n = ValueCount(entry.type);
+  if ((n > 0) && (fread(entry.value, sizeof(double), n, file) != (size_t)n))
+    return false;
+
+  return true;
+}
+
+int CoaXJournal::ValueCount(int type)
+{
+  switch (type)
+    {
+    case JOURNAL_RAW_COMMAND:
+    case JOURNAL_CONTROL:
+      return 4;
+    case JOURNAL_TRIM:
+      return 2;
+    case JOURNAL_TIMEOUT:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+bool CoaXJournal::HasMode(int type)
+{
+  return (type == JOURNAL_NAV_STATE) || (type == JOURNAL_TRIM);
+}
@@ -1,49 +1,249 @@
 #include <cmath>
 #include <cstring>
 
+#include "BinaryIO.h"
 #include "CoaXModel.h"
-#include <armadillo>
+#include "CoaXDynamics.h"
 
 using namespace std;
 
+static double model_params_t::* const parameter_fields[MODEL_PARAMETERS] =
+  {&model_params_t::mass,
+   &model_params_t::Ixx, &model_params_t::Iyy, &model_params_t::Izz,
+   &model_params_t::d_up, &model_params_t::d_lo,
+   &model_params_t::k_springup, &model_params_t::k_springlo,
+   &model_params_t::l_up, &model_params_t::l_lo,
+   &model_params_t::k_Tup, &model_params_t::k_Tlo,
+   &model_params_t::k_Mup, &model_params_t::k_Mlo,
+   &model_params_t::Tf_motup, &model_params_t::Tf_motlo,
+   &model_params_t::Tf_up,
+   &model_params_t::rs_mup, &model_params_t::rs_bup,
+   &model_params_t::rs_mlo, &model_params_t::rs_blo,
+   &model_params_t::zeta_mup, &model_params_t::zeta_bup,
+   &model_params_t::zeta_mlo, &model_params_t::zeta_blo,
+   &model_params_t::max_SPangle};
+
+static const char* const parameter_names[MODEL_PARAMETERS] =
+  {"mass",
+   "Ixx", "Iyy", "Izz",
+   "d_up", "d_lo",
+   "k_springup", "k_springlo",
+   "l_up", "l_lo",
+   "k_Tup", "k_Tlo",
+   "k_Mup", "k_Mlo",
+   "Tf_motup", "Tf_motlo",
+   "Tf_up",
+   "rs_mup", "rs_bup",
+   "rs_mlo", "rs_blo",
+   "zeta_mup", "zeta_bup",
+   "zeta_mlo", "zeta_blo",
+   "max_SPangle"};
+
 CoaXModel::CoaXModel()
 {
   time = 0;
+  step_size = 1e-5;
   memset((void*)statespace, 0, sizeof(statespace));
   memset((void*)&model_params, 0, sizeof(model_params));
 
   const gsl_odeiv_step_type* step_type = gsl_odeiv_step_rkf45;
-  step = gsl_odeiv_step_alloc(step_type, DIMENSION);
+  step = gsl_odeiv_step_alloc(step_type, ODE_DIMENSION);
   control = gsl_odeiv_control_y_new(1e-5, 0.0);
-  evolve = gsl_odeiv_evolve_alloc(DIMENSION);
+  evolve = gsl_odeiv_evolve_alloc(ODE_DIMENSION);
+
+  sensitivities = false;
+  memset(sensitivity, 0, sizeof(sensitivity));
+  sensitivity_step = NULL;
+  sensitivity_control = NULL;
+  sensitivity_evolve = NULL;
 
   memset(pos, 0, sizeof(pos));
-  memset(rot, 0, sizeof(rot));
+  memset(quat, 0, sizeof(quat));
+  quat[0] = 1;
   memset(vel, 0, sizeof(vel));
   memset(angvel, 0, sizeof(angvel));
   memset(acc, 0, sizeof(acc));
   memset(rotors, 0, sizeof(rotors));
   memset(bar, 0, sizeof(bar));
+  memset(servo, 0, sizeof(servo));
+
+  model_params.voltage_scale = 1;
+  battery_soc = 1;
+  battery_vrc = 0;
+  battery_voltage = 0;
+  battery_current = 0;
 
   memset(init_pos, 0, sizeof(init_pos));
   memset(init_rot, 0, sizeof(init_rot));
   memset(init_rotors, 0, sizeof(init_rotors));
   memset(init_bar, 0, sizeof(init_bar));
+  init_battery_soc = 1;
 
+  u_motup_w = 0;
+  u_motlo_w = 0;
+  u_serv1_w = 0;
+  u_serv2_w = 0;
   cmd_updated = false;
 
   return;
 }
 
+CoaXModel::CoaXModel(const CoaXModel &other)
+{
+  const gsl_odeiv_step_type* step_type = gsl_odeiv_step_rkf45;
+  step = gsl_odeiv_step_alloc(step_type, ODE_DIMENSION);
+  control = gsl_odeiv_control_y_new(1e-5, 0.0);
+  evolve = gsl_odeiv_evolve_alloc(ODE_DIMENSION);
+
+  sensitivities = false;
+  sensitivity_step = NULL;
+  sensitivity_control = NULL;
+  sensitivity_evolve = NULL;
+
+  *this = other;
+}
+
 CoaXModel::~CoaXModel()
 {
   gsl_odeiv_evolve_free(evolve);
   gsl_odeiv_control_free(control);
   gsl_odeiv_step_free(step);
 
+  if (sensitivity_step)
+    {
+      gsl_odeiv_evolve_free(sensitivity_evolve);
+      gsl_odeiv_control_free(sensitivity_control);
+      gsl_odeiv_step_free(sensitivity_step);
+    }
+
   return;
 }
 
+// Copies parameters, initial conditions and state, the GSL workspaces
+// stay with each model
+CoaXModel& CoaXModel::operator=(const CoaXModel &other)
+{
+  if (this == &other)
+    return *this;
+
+  model_params = other.model_params;
+
+  memcpy(init_pos, other.init_pos, sizeof(init_pos));
+  memcpy(init_rot, other.init_rot, sizeof(init_rot));
+  memcpy(init_rotors, other.init_rotors, sizeof(init_rotors));
+  memcpy(init_bar, other.init_bar, sizeof(init_bar));
+  init_battery_soc = other.init_battery_soc;
+
+  c = other.c;
+
+  coax_model_state_t state;
+  const_cast<CoaXModel&>(other).Snapshot(state);
+  Restore(state);
+
+  EnableSensitivities(other.sensitivities);
+  memcpy(sensitivity, other.sensitivity, sizeof(sensitivity));
+
+  return *this;
+}
+
+void CoaXModel::Snapshot(coax_model_state_t &state)
+{
+  state.time = time;
+  memcpy(state.pos, pos, sizeof(pos));
+  memcpy(state.vel, vel, sizeof(vel));
+  memcpy(state.quat, quat, sizeof(quat));
+  memcpy(state.angvel, angvel, sizeof(angvel));
+  memcpy(state.acc, acc, sizeof(acc));
+  memcpy(state.rotors, rotors, sizeof(rotors));
+  memcpy(state.bar, bar, sizeof(bar));
+  memcpy(state.servo, servo, sizeof(servo));
+  state.battery_soc = battery_soc;
+  state.battery_vrc = battery_vrc;
+  state.battery_voltage = battery_voltage;
+  state.battery_current = battery_current;
+  state.step_size = step_size;
+
+  c.GetState(state.onboard);
+  state.command[0] = u_motup_w;
+  state.command[1] = u_motlo_w;
+  state.command[2] = u_serv1_w;
+  state.command[3] = u_serv2_w;
+  state.cmd_updated = cmd_updated;
+}
+
+void CoaXModel::Restore(const coax_model_state_t &state)
+{
+  time = state.time;
+  memcpy(pos, state.pos, sizeof(pos));
+  memcpy(vel, state.vel, sizeof(vel));
+  memcpy(quat, state.quat, sizeof(quat));
+  memcpy(angvel, state.angvel, sizeof(angvel));
+  memcpy(acc, state.acc, sizeof(acc));
+  memcpy(rotors, state.rotors, sizeof(rotors));
+  memcpy(bar, state.bar, sizeof(bar));
+  memcpy(servo, state.servo, sizeof(servo));
+  battery_soc = state.battery_soc;
+  battery_vrc = state.battery_vrc;
+  battery_voltage = state.battery_voltage;
+  battery_current = state.battery_current;
+  step_size = state.step_size;
+
+  // the speed conversion scale UpdateBattery derived from that voltage
+  if ((model_params.battery_capacity > 0) && (model_params.nominal_voltage > 0))
+    model_params.voltage_scale = battery_voltage/model_params.nominal_voltage;
+  else
+    model_params.voltage_scale = 1;
+
+  c.SetState(state.onboard);
+  u_motup_w = state.command[0];
+  u_motlo_w = state.command[1];
+  u_serv1_w = state.command[2];
+  u_serv2_w = state.command[3];
+  cmd_updated = state.cmd_updated;
+
+  // rkf45 keeps no history besides the step size, which is part of the state
+  gsl_odeiv_evolve_reset(evolve);
+  ResetSensitivities();
+}
+
+int CoaXModel::WriteConfiguration(FILE* file)
+{
+  onboard_gains_t gains;
+  c.GetGains(gains);
+
+  bool ok = WriteBinary(file, model_params) &&
+    WriteBinary(file, init_pos) && WriteBinary(file, init_rot) &&
+    WriteBinary(file, init_rotors) && WriteBinary(file, init_bar) &&
+    WriteBinary(file, init_battery_soc) && WriteBinary(file, gains);
+
+  return ok ? 0 : -1;
+}
+
+int CoaXModel::ReadConfiguration(FILE* file)
+{
+  const WindField* wind = model_params.wind;
+  const ProximityTables* proximity = model_params.proximity;
+  onboard_gains_t gains;
+
+  bool ok = ReadBinary(file, model_params) &&
+    ReadBinary(file, init_pos) && ReadBinary(file, init_rot) &&
+    ReadBinary(file, init_rotors) && ReadBinary(file, init_bar) &&
+    ReadBinary(file, init_battery_soc) && ReadBinary(file, gains);
+
+  model_params.wind = wind;
+  model_params.proximity = proximity;
+  if (ok)
+    c.SetGains(gains);
+
+  return ok ? 0 : -1;
+}
+
+// n independent copies of this model, each can be stepped on its own thread
+void CoaXModel::Fork(unsigned int n, std::vector<CoaXModel> &rollouts)
+{
+  rollouts.assign(n, *this);
+}
+
 void CoaXModel::SetTime(double time_)
 {
   time = time_;
@@ -136,6 +336,219 @@ void CoaXModel::SetMaximumSwashPlateAngle(double max_SPangle)
 	model_params.max_SPangle = max_SPangle;
 }
 
+void CoaXModel::SetGroundContact(double k_ground, double d_ground, double mu_ground,
+                                 double gear_radius, double gear_height)
+{
+  model_params.k_ground = k_ground;
+  model_params.d_ground = d_ground;
+  model_params.mu_ground = mu_ground;
+  model_params.gear_radius = gear_radius;
+  model_params.gear_height = gear_height;
+}
+
+// First order servo with time constant Tf_servo (0 for none), rate limit in
+// servo command per second (0 for none) and a deadband around the command
+void CoaXModel::SetServoDynamics(double Tf_servo, double servo_rate, double servo_deadband)
+{
+  model_params.Tf_servo = Tf_servo;
+  model_params.servo_rate = servo_rate;
+  model_params.servo_deadband = servo_deadband;
+}
+
+void CoaXModel::GetServoPosition(double &servo1, double &servo2)
+{
+  servo1 = servo[0];
+  servo2 = servo[1];
+}
+
+const model_params_t* CoaXModel::GetModelParams()
+{
+  return &model_params;
+}
+
+void CoaXModel::GetParameters(double* theta)
+{
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta[i] = model_params.*parameter_fields[i];
+}
+
+void CoaXModel::SetParameters(const double* theta)
+{
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    model_params.*parameter_fields[i] = theta[i];
+}
+
+const char* CoaXModel::GetParameterName(int i)
+{
+  if ((i < 0) || (i >= MODEL_PARAMETERS))
+    return NULL;
+
+  return parameter_names[i];
+}
+
+void CoaXModel::EnableSensitivities(bool enable)
+{
+  if (enable && !sensitivity_step)
+    {
+      // the same absolute tolerance on the states as the plain integration,
+      // the sensitivities do not take part in the error estimate
+      const int dimension = ODE_DIMENSION*(MODEL_PARAMETERS + 1);
+      double scale_abs[ODE_DIMENSION*(MODEL_PARAMETERS + 1)];
+      for (int i = 0; i < dimension; i++)
+        scale_abs[i] = (i < ODE_DIMENSION) ? 1 : 1e30;
+
+      const gsl_odeiv_step_type* step_type = gsl_odeiv_step_rkf45;
+      sensitivity_step = gsl_odeiv_step_alloc(step_type, dimension);
+      sensitivity_control = gsl_odeiv_control_scaled_new(1e-5, 0.0, 1.0, 0.0,
+                                                         scale_abs, dimension);
+      sensitivity_evolve = gsl_odeiv_evolve_alloc(dimension);
+    }
+
+  if (enable && !sensitivities)
+    ResetSensitivities();
+
+  sensitivities = enable;
+}
+
+bool CoaXModel::SensitivitiesEnabled()
+{
+  return sensitivities;
+}
+
+void CoaXModel::GetSensitivities(double* S)
+{
+  typedef Dual<MODEL_PARAMETERS> dual_t;
+
+  memcpy(S, sensitivity, 6*MODEL_PARAMETERS*sizeof(double));
+
+  dual_t q[4];
+  for (int i = 0; i < 4; i++)
+    {
+      q[i].v = quat[i];
+      memcpy(q[i].d, &sensitivity[(6+i)*MODEL_PARAMETERS], sizeof(q[i].d));
+    }
+  dual_t euler[3];
+  QuaternionToEuler(q, euler[0], euler[1], euler[2]);
+  for (int i = 0; i < 3; i++)
+    memcpy(&S[(6+i)*MODEL_PARAMETERS], euler[i].d, sizeof(euler[i].d));
+
+  memcpy(&S[9*MODEL_PARAMETERS], &sensitivity[10*MODEL_PARAMETERS],
+         (DIMENSION - 9)*MODEL_PARAMETERS*sizeof(double));
+}
+
+void CoaXModel::ResetSensitivities()
+{
+  memset(sensitivity, 0, sizeof(sensitivity));
+  if (sensitivity_evolve)
+    gsl_odeiv_evolve_reset(sensitivity_evolve);
+}
+
+void CoaXModel::SetBattery(int cells, double capacity,
+                           double R0, double R1, double C1,
+                           double motor_efficiency, double base_current,
+                           double nominal_voltage)
+{
+  model_params.battery_cells = cells;
+  model_params.battery_capacity = capacity;
+  model_params.R0_battery = R0;
+  model_params.R1_battery = R1;
+  model_params.C1_battery = C1;
+  model_params.motor_efficiency = motor_efficiency;
+  model_params.base_current = base_current;
+  model_params.nominal_voltage = nominal_voltage;
+
+  UpdateBattery(0);
+}
+
+void CoaXModel::SetInitialBatteryCharge(double soc)
+{
+  init_battery_soc = soc;
+}
+
+void CoaXModel::SetWindField(const WindField* wind)
+{
+  model_params.wind = wind;
+}
+
+void CoaXModel::SetAerodynamicDrag(double linear, double quadratic)
+{
+  model_params.drag_lin = linear;
+  model_params.drag_quad = quadratic;
+}
+
+void CoaXModel::SetProximityTables(const ProximityTables* proximity)
+{
+  model_params.proximity = proximity;
+}
+
+void CoaXModel::GetBattery(double &voltage, double &current, double &soc)
+{
+  voltage = battery_voltage;
+  current = battery_current;
+  soc = battery_soc;
+}
+
+// Li-Po open circuit voltage per cell over state of charge in steps of 0.1
+double CoaXModel::CellOpenCircuitVoltage(double soc)
+{
+  static const double ocv[11] = {3.27, 3.55, 3.62, 3.66, 3.71, 3.75,
+                                 3.79, 3.84, 3.91, 4.01, 4.20};
+
+  if (soc <= 0)
+    return ocv[0];
+  if (soc >= 1)
+    return ocv[10];
+
+  int i = (int)(soc*10);
+  double f = soc*10 - i;
+
+  return ocv[i] + f*(ocv[i+1] - ocv[i]);
+}
+
+// Draws the current for the rotor shaft power at the present rotor speeds
+// for dt (constant over an update, the RC pair is discretized exactly) and
+// sets the voltage scale of the speed conversion for the next update
+void CoaXModel::UpdateBattery(double dt)
+{
+  if (model_params.battery_capacity <= 0)
+    {
+      battery_voltage = model_params.nominal_voltage;
+      battery_current = 0;
+      model_params.voltage_scale = 1;
+      return;
+    }
+
+  double P_shaft = model_params.k_Mup*rotors[0]*rotors[0]*rotors[0] +
+    model_params.k_Mlo*rotors[1]*rotors[1]*rotors[1];
+
+  // terminal voltage of the last update, the current changes slowly
+  double V = battery_voltage;
+  if (V <= 0)
+    V = model_params.battery_cells*CellOpenCircuitVoltage(battery_soc);
+
+  double I = P_shaft/(model_params.motor_efficiency*V) + model_params.base_current;
+
+  battery_soc -= I*dt/(3600*model_params.battery_capacity);
+  if (battery_soc < 0)
+    battery_soc = 0;
+
+  double tau = model_params.R1_battery*model_params.C1_battery;
+  double vrc_inf = I*model_params.R1_battery;
+  if (tau > 0)
+    battery_vrc = vrc_inf + (battery_vrc - vrc_inf)*exp(-dt/tau);
+  else
+    battery_vrc = vrc_inf;
+
+  battery_current = I;
+  battery_voltage = model_params.battery_cells*CellOpenCircuitVoltage(battery_soc) -
+    I*model_params.R0_battery - battery_vrc;
+  if (battery_voltage < 0)
+    battery_voltage = 0;
+
+  if (model_params.nominal_voltage > 0)
+    model_params.voltage_scale = battery_voltage/model_params.nominal_voltage;
+}
+
 void CoaXModel::SetCommand(double u_motup, double u_motlo,
                            double u_serv1, double u_serv2)
 {
@@ -154,8 +567,26 @@ void CoaXModel::SendCommand()
 
   cmd_updated = false;
 
-  c.SetCommands(u_motup_w, u_motlo_w, u_serv1_w, u_serv2_w);
+  c.SetCommands(u_motup_w, u_motlo_w, u_serv1_w, u_serv2_w, time);
+}
+
+void CoaXModel::UpdateOnboard()
+{
+  onboard_sensors_t sensors;
 
+  QuaternionToEuler(quat, sensors.roll, sensors.pitch, sensors.yaw);
+  sensors.p = angvel[0];
+  sensors.q = angvel[1];
+  sensors.r = angvel[2];
+  sensors.z = pos[2];
+  sensors.zdot = vel[2];
+
+  c.Update(time, sensors);
+}
+
+CoaXOnboardControl* CoaXModel::GetOnboardControlPtr()
+{
+  return &c;
 }
 
 double CoaXModel::LimitRotorSpeed(double rotor_speed)
@@ -169,239 +600,167 @@ double CoaXModel::LimitRotorSpeed(double rotor_speed)
 	return rotor_speed;
 }
 
+// Exact solution of the rate limited first order lag towards a constant
+// target, dt after t_servo. While the lag would exceed the rate limit the
+// servo moves at the limit, then it closes in exponentially.
+double CoaXModel::ServoPosition(const model_params_t* param, int i, double dt)
+{
+  double s0 = param->servo0[i];
+  double e = param->servo_target[i] - s0;
+  double sign = (e < 0) ? -1 : 1;
+  double T = param->Tf_servo;
+  double rate = param->servo_rate;
+
+  if (T <= 0)
+    {
+      if ((rate > 0) && (sign*e > rate*dt))
+        return s0 + sign*rate*dt;
+      return param->servo_target[i];
+    }
+
+  if ((rate > 0) && (sign*e > rate*T))
+    {
+      double t_lin = (sign*e - rate*T)/rate;
+      if (dt <= t_lin)
+        return s0 + sign*rate*dt;
+      return param->servo_target[i] - sign*rate*T*exp(-(dt - t_lin)/T);
+    }
+
+  return param->servo_target[i] - e*exp(-dt/T);
+}
+
 int CoaXModel::ODEStep(double t, const double* state, double* xdot, void* params)
 {
   model_params_t* param = reinterpret_cast<model_params_t*>(params);
 
-  // rotation
-  double roll = state[6];
-  double pitch = state[7];
-  double yaw = state[8];
-
-  // angular velocity
-  double p = state[9];
-  double q = state[10];
-  double r = state[11];
-
-  // rotor speeds
-  double Omega_up = state[12];
-  double Omega_lo = state[13];
-
-  // stabilizer bar direction
-  double z_barx = state[14];
-  double z_bary = state[15];
-  double z_barz = state[16];
-
-  // Parameters
-  double g = 9.81;
-  double m = param->mass;
-  double Ixx = param->Ixx;
-  double Iyy = param->Iyy;
-  double Izz = param->Izz;
-  double d_up = param->d_up;
-  double d_lo = param->d_lo;
-  double k_springup = param->k_springup;
-  double k_springlo = param->k_springlo;
-  double l_up = param->l_up;
-  double l_lo = param->l_lo;
-  double k_Tup = param->k_Tup;
-  double k_Tlo = param->k_Tlo;
-  double k_Mup = param->k_Mup;
-  double k_Mlo = param->k_Mlo;
-  double Tf_motup = param->Tf_motup;
-  double Tf_motlo = param->Tf_motlo;
-  double Tf_up = param->Tf_up;
-  double rs_mup = param->rs_mup;
-  double rs_bup = param->rs_bup;
-  double rs_mlo = param->rs_mlo;
-  double rs_blo = param->rs_blo;
-  double zeta_mup = param->zeta_mup;
-  double zeta_bup = param->zeta_bup;
-  double zeta_mlo = param->zeta_mlo;
-  double zeta_blo = param->zeta_blo;
-  double max_SPangle = param->max_SPangle;
-
-  // Controls
-  double u_motup = param->control[0];
-  double u_motlo = param->control[1];
-  double u_serv1 = param->control[2];
-  double u_serv2 = param->control[3];
-
-  // Upper thrust vector direction
-  double z_Tupz = cos(l_up*acos(z_barz));
-  arma::colvec z_Tup_p(3);
-  if (z_Tupz < 1){
-	  double temp = sqrt((1-z_Tupz*z_Tupz)/(z_barx*z_barx + z_bary*z_bary));
-	  z_Tup_p(0) = z_barx*temp;
-	  z_Tup_p(1) = z_bary*temp;
-	  z_Tup_p(2) = z_Tupz;
-  }else {
-  	  z_Tup_p(0) = 0;
-      z_Tup_p(1) = 0;
-      z_Tup_p(2) = 1;
-  }
-  double zeta = zeta_mup*Omega_up + zeta_bup;
-  arma::colvec z_Tup(3);
-  z_Tup(0) = cos(zeta)*z_Tup_p(0) - sin(zeta)*z_Tup_p(1);
-  z_Tup(1) = sin(zeta)*z_Tup_p(0) + cos(zeta)*z_Tup_p(1);
-  z_Tup(2) = z_Tup_p(2);
-
-  // Lower thrust vector direction
-  double a_SP = u_serv1*max_SPangle;
-  double b_SP = u_serv2*max_SPangle;
-
-  arma::colvec z_SP(3);
-  z_SP(0) = sin(b_SP);
-  z_SP(1) = -sin(a_SP)*cos(b_SP);
-  z_SP(2) = cos(a_SP)*cos(b_SP);
-  double z_Tloz = cos(l_lo*acos(z_SP(2)));
-  arma::colvec z_Tlo_p(3);
-  if (z_Tloz < 1){
-	  double temp = sqrt((1-z_Tloz*z_Tloz)/(z_SP(0)*z_SP(0) + z_SP(1)*z_SP(1)));
-	  z_Tlo_p(0) = z_SP(0)*temp;
-	  z_Tlo_p(1) = z_SP(1)*temp;
-	  z_Tlo_p(2) = z_Tloz;
-  }else {
-	  z_Tlo_p(0) = 0;
-	  z_Tlo_p(1) = 0;
-	  z_Tlo_p(2) = 1;
-  }
-  zeta = zeta_mlo*Omega_lo + zeta_blo;
-  arma::colvec z_Tlo(3);
-  z_Tlo(0) = cos(zeta)*z_Tlo_p(0) + sin(zeta)*z_Tlo_p(1);
-  z_Tlo(1) = -sin(zeta)*z_Tlo_p(0) + cos(zeta)*z_Tlo_p(1);
-  z_Tlo(2) = z_Tlo_p(2);
-
-  // Coordinate transformation body to world coordinates
-  double c_r = cos(roll);
-  double s_r = sin(roll);
-  double c_p = cos(pitch);
-  double s_p = sin(pitch);
-  double c_y = cos(yaw);
-  double s_y = sin(yaw);
-
-  arma::mat Rb2w(3, 3);
-  Rb2w(0, 0) = c_p*c_y;
-  Rb2w(0, 1) = s_r*s_p*c_y - c_r*s_y;
-  Rb2w(0, 2) = c_r*s_p*c_y + s_r*s_y;
-
-  Rb2w(1, 0) = c_p*s_y;
-  Rb2w(1, 1) = s_r*s_p*s_y + c_r*c_y;
-  Rb2w(1, 2) = c_r*s_p*s_y - s_r*c_y;
-
-  Rb2w(2, 0) = -s_p;
-  Rb2w(2, 1) = s_r*c_p;
-  Rb2w(2, 2) = c_r*c_p;
-
-  // Flapping Moments
-  // z_b x z_Tup
-  arma::colvec cp(3);
-  cp(0) = -z_Tup(1);
-  cp(1) = z_Tup(0);
-  cp(2) = 0;
-
-  double norm_cp = sqrt(cp(0)*cp(0) + cp(1)*cp(1) + cp(2)*cp(2));
-  arma::colvec M_flapup = arma::zeros(3);
-  if (fabs(norm_cp) > 0)
-    M_flapup = 2*k_springup*cp/norm_cp*acos(z_Tup(2));
-
-  // z_b x z_Tlo
-  cp(0) = -z_Tlo(1);
-  cp(1) = z_Tlo(0);
-  cp(2) = 0;
-  norm_cp = sqrt(cp(0)*cp(0) + cp(1)*cp(1) + cp(2)*cp(2));
-
-  arma::colvec M_flaplo = arma::zeros(3);
-  if (fabs(norm_cp) > 0)
-    M_flaplo = 2*k_springlo*cp/norm_cp*acos(z_Tlo(2));
-
-  // Thrust magnitudes
-  double T_up = k_Tup*Omega_up*Omega_up;
-  double T_lo = k_Tlo*Omega_lo*Omega_lo;
-
-  // Summarized Forces
-  arma::colvec F_thrust = T_up*z_Tup + T_lo*z_Tlo;
-  double Fx = arma::as_scalar(Rb2w.row(0)*F_thrust);
-  double Fy = arma::as_scalar(Rb2w.row(1)*F_thrust);
-  double Fz = -m*g + arma::as_scalar(Rb2w.row(2)*F_thrust);
-
-  // Summarized Moments
-  double Mx = q*r*(Iyy-Izz) - T_up*z_Tup(1)*d_up - T_lo*z_Tlo(1)*d_lo + M_flapup(0) + M_flaplo(0);
-  double My = p*r*(Izz-Ixx) + T_up*z_Tup(0)*d_up + T_lo*z_Tlo(0)*d_lo + M_flapup(1) + M_flaplo(1);
-  double Mz = p*q*(Ixx-Iyy) - k_Mup*Omega_up*Omega_up + k_Mlo*Omega_lo*Omega_lo;
-
-  // State derivatives
-  double xddot = 1.0/m*Fx;
-  double yddot = 1.0/m*Fy;
-  double zddot = 1.0/m*Fz;
-
-  double rolldot = p + q*s_r*s_p/c_p + r*c_r*s_p/c_p;
-  double pitchdot = q*c_r - r*s_r;
-  double yawdot = q*s_r/c_p + r*c_r/c_p;
-
-  double pdot = 1.0/Ixx*Mx;
-  double qdot = 1.0/Iyy*My;
-  double rdot = 1.0/Izz*Mz;
-
-  double Omega_up_des = rs_mup*u_motup + rs_bup;
-  double Omega_lo_des = rs_mlo*u_motlo + rs_blo;
-  double Omega_updot = 1.0/Tf_motup*(Omega_up_des - Omega_up);
-  double Omega_lodot = 1.0/Tf_motlo*(Omega_lo_des - Omega_lo);
-
-  double b_z_bardotz = 1.0/Tf_up*acos(z_barz)*sqrt(z_barx*z_barx + z_bary*z_bary);
-  arma::colvec b_z_bardot = arma::zeros(3);
-  if (fabs(b_z_bardotz) > 0){
-	  double temp = z_barz*b_z_bardotz/(z_barx*z_barx + z_bary*z_bary);
-	  b_z_bardot(0) = -z_barx*temp;
-	  b_z_bardot(1) = -z_bary*temp;
-	  b_z_bardot(2) = b_z_bardotz;
-  }
-
-  double z_barxdot = b_z_bardot(0) - q*z_barz + r*z_bary;
-  double z_barydot = b_z_bardot(1) - r*z_barx + p*z_barz;
-  double z_barzdot = b_z_bardot(2) - p*z_bary + q*z_barx;
-
-
-  xdot[0] = state[3];
-  xdot[1] = state[4];
-  xdot[2] = state[5];
-  xdot[3] = xddot;
-  xdot[4] = yddot;
-  xdot[5] = zddot;
-  xdot[6] = rolldot;
-  xdot[7] = pitchdot;
-  xdot[8] = yawdot;
-  xdot[9] = pdot;
-  xdot[10] = qdot;
-  xdot[11] = rdot;
-  xdot[12] = Omega_updot;
-  xdot[13] = Omega_lodot;
-  xdot[14] = z_barxdot;
-  xdot[15] = z_barydot;
-  xdot[16] = z_barzdot;
-	
-  param->acc[0] = xddot;
-  param->acc[1] = yddot;
-  param->acc[2] = zddot;
+  double theta[MODEL_PARAMETERS];
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta[i] = param->*parameter_fields[i];
+
+  double u[4];
+  ModelInputs(param, t, u);
+
+  CoaXDerivatives(t, state, xdot, theta, u, param, param->acc);
+
+  return GSL_SUCCESS;
+}
+
+// The state with the sensitivities as one dual number per state, seeded
+// with the parameters as the independent inputs
+int CoaXModel::SensitivityStep(double t, const double* y, double* ydot, void* params)
+{
+  typedef Dual<MODEL_PARAMETERS> dual_t;
+  model_params_t* param = reinterpret_cast<model_params_t*>(params);
+
+  dual_t state[ODE_DIMENSION];
+  dual_t xdot[ODE_DIMENSION];
+  dual_t theta[MODEL_PARAMETERS];
+
+  const double* S = &y[ODE_DIMENSION];
+  for (int i = 0; i < ODE_DIMENSION; i++)
+    {
+      state[i].v = y[i];
+      memcpy(state[i].d, &S[i*MODEL_PARAMETERS], sizeof(state[i].d));
+    }
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta[i] = dual_t(param->*parameter_fields[i], i);
+
+  double inputs[4];
+  ModelInputs(param, t, inputs);
+  dual_t u[4] = {inputs[0], inputs[1], inputs[2], inputs[3]};
+
+  CoaXDerivatives(t, state, xdot, theta, u, param, param->acc);
+
+  double* Sdot = &ydot[ODE_DIMENSION];
+  for (int i = 0; i < ODE_DIMENSION; i++)
+    {
+      ydot[i] = xdot[i].v;
+      memcpy(&Sdot[i*MODEL_PARAMETERS], xdot[i].d, sizeof(xdot[i].d));
+    }
 
   return GSL_SUCCESS;
 }
 
+// Motor commands and servo positions at time t
+void CoaXModel::ModelInputs(const model_params_t* param, double t, double* u)
+{
+  u[0] = param->control[0];
+  u[1] = param->control[1];
+  u[2] = ServoPosition(param, 0, t - param->t_servo);
+  u[3] = ServoPosition(param, 1, t - param->t_servo);
+}
+
+void CoaXModel::IntegrateSensitivities(double &tstart, double tstop, double &h)
+{
+  typedef Dual<MODEL_PARAMETERS> dual_t;
+
+  double y[ODE_DIMENSION*(MODEL_PARAMETERS + 1)];
+  double* S = &y[ODE_DIMENSION];
+  memcpy(y, statespace, sizeof(statespace));
+  memcpy(S, sensitivity, sizeof(sensitivity));
+
+  gsl_odeiv_system sys = {CoaXModel::SensitivityStep, NULL,
+                          ODE_DIMENSION*(MODEL_PARAMETERS + 1),
+                          (void*)&model_params};
+
+  while (tstart < tstop)
+    {
+      int status = gsl_odeiv_evolve_apply(sensitivity_evolve,
+                                          sensitivity_control,
+                                          sensitivity_step,
+                                          &sys,
+                                          &tstart, tstop,
+                                          &h, y);
+
+      if (status != GSL_SUCCESS)
+        break;
+
+      // the normalization is part of the map from parameters to state
+      dual_t q[4];
+      for (int i = 0; i < 4; i++)
+        {
+          q[i].v = y[6+i];
+          memcpy(q[i].d, &S[(6+i)*MODEL_PARAMETERS], sizeof(q[i].d));
+        }
+      NormalizeQuaternion(q);
+      for (int i = 0; i < 4; i++)
+        {
+          y[6+i] = q[i].v;
+          memcpy(&S[(6+i)*MODEL_PARAMETERS], q[i].d, sizeof(q[i].d));
+        }
+    }
+
+  memcpy(statespace, y, sizeof(statespace));
+  memcpy(sensitivity, S, sizeof(sensitivity));
+}
+
+// a rotor speed held at its limit does not depend on the parameters
+void CoaXModel::LimitRotorSensitivities(const double* unlimited, const double* limited)
+{
+  if (!sensitivities)
+    return;
+
+  for (int i = 0; i < 2; i++)
+    if (unlimited[i] != limited[i])
+      memset(&sensitivity[(13+i)*MODEL_PARAMETERS], 0, MODEL_PARAMETERS*sizeof(double));
+}
+
 void CoaXModel::Update(double time_)
 {
   double tstart = time;
   double tstop = time_;
-  double h = 1e-5;
+  double h = step_size;
 
   memcpy(statespace, pos, sizeof(pos));
   memcpy((void*)(&statespace[3]), vel, sizeof(vel));
-  memcpy((void*)(&statespace[6]), rot, sizeof(rot));
-  memcpy((void*)(&statespace[9]), angvel, sizeof(angvel));
-  memcpy((void*)(&statespace[12]), rotors, sizeof(rotors));
-  memcpy((void*)(&statespace[14]), bar, sizeof(bar));
+  memcpy((void*)(&statespace[6]), quat, sizeof(quat));
+  memcpy((void*)(&statespace[10]), angvel, sizeof(angvel));
+  memcpy((void*)(&statespace[13]), rotors, sizeof(rotors));
+  memcpy((void*)(&statespace[15]), bar, sizeof(bar));
 
-  statespace[12] = CoaXModel::LimitRotorSpeed(statespace[12]);
   statespace[13] = CoaXModel::LimitRotorSpeed(statespace[13]);
+  statespace[14] = CoaXModel::LimitRotorSpeed(statespace[14]);
+  LimitRotorSensitivities(rotors, &statespace[13]);
 
   double u1, u2, u3, u4;
   c.GetControls(u1, u2, u3, u4);
@@ -410,35 +769,61 @@ void CoaXModel::Update(double time_)
   model_params.control[1] = u2;
   model_params.control[2] = u3;
   model_params.control[3] = u4;
-	
-  gsl_odeiv_system sys = {CoaXModel::ODEStep, NULL,
-                          DIMENSION, (void*)&model_params};
 
-  while (tstart < tstop)
+  // the servos stop within the deadband of their command
+  model_params.t_servo = tstart;
+  for (int i = 0; i < 2; i++)
     {
-      int status = gsl_odeiv_evolve_apply(evolve,
-                                          control,
-                                          step,
-                                          &sys,
-                                          &tstart, tstop,
-                                          &h, statespace);
-
-      if (status != GSL_SUCCESS)
-        break;
+      double e = model_params.control[2+i] - servo[i];
+      double db = model_params.servo_deadband;
+      model_params.servo0[i] = servo[i];
+      if (fabs(e) <= db)
+        model_params.servo_target[i] = servo[i];
+      else
+        model_params.servo_target[i] = model_params.control[2+i] - ((e < 0) ? -db : db);
+    }
+	
+  if (sensitivities)
+    IntegrateSensitivities(tstart, tstop, h);
+  else
+    {
+      gsl_odeiv_system sys = {CoaXModel::ODEStep, NULL,
+                              ODE_DIMENSION, (void*)&model_params};
+
+      while (tstart < tstop)
+        {
+          int status = gsl_odeiv_evolve_apply(evolve,
+                                              control,
+                                              step,
+                                              &sys,
+                                              &tstart, tstop,
+                                              &h, statespace);
+
+          if (status != GSL_SUCCESS)
+            break;
+
+          NormalizeQuaternion(&statespace[6]);
+        }
     }
 
   time = tstop;
+  step_size = h;
 
   memcpy(pos, statespace, sizeof(pos));
   memcpy(vel, (void*)(&statespace[3]), sizeof(vel));
-  memcpy(rot, (void*)(&statespace[6]), sizeof(rot));
-  memcpy(angvel, (void*)(&statespace[9]), sizeof(angvel));
-  memcpy(rotors, (void*)(&statespace[12]), sizeof(rotors));
-  memcpy(bar, (void*)(&statespace[14]), sizeof(bar));
+  memcpy(quat, (void*)(&statespace[6]), sizeof(quat));
+  memcpy(angvel, (void*)(&statespace[10]), sizeof(angvel));
+  memcpy(rotors, (void*)(&statespace[13]), sizeof(rotors));
+  memcpy(bar, (void*)(&statespace[15]), sizeof(bar));
   memcpy(acc, model_params.acc, sizeof(model_params.acc));
+  servo[0] = ServoPosition(&model_params, 0, tstop - model_params.t_servo);
+  servo[1] = ServoPosition(&model_params, 1, tstop - model_params.t_servo);
+
+  UpdateBattery(tstop - model_params.t_servo);
 	
   rotors[0] = CoaXModel::LimitRotorSpeed(rotors[0]);
   rotors[1] = CoaXModel::LimitRotorSpeed(rotors[1]);
+  LimitRotorSensitivities(&statespace[13], rotors);
 
   return;
 }
@@ -452,9 +837,16 @@ void CoaXModel::SetXYZ(double x, double y, double z)
 
 void CoaXModel::SetRotation(double roll, double pitch, double yaw)
 {
-  rot[0] = roll;
-  rot[1] = pitch;
-  rot[2] = yaw;
+  EulerToQuaternion(roll, pitch, yaw, quat);
+}
+
+void CoaXModel::SetOrientation(double qw, double qx, double qy, double qz)
+{
+  quat[0] = qw;
+  quat[1] = qx;
+  quat[2] = qy;
+  quat[3] = qz;
+  NormalizeQuaternion(quat);
 }
 
 void CoaXModel::SetInitialXYZ(double x, double y, double z)
@@ -469,11 +861,9 @@ void CoaXModel::SetInitialXYZ(double x, double y, double z)
 
 void CoaXModel::SetInitialRotation(double roll, double pitch, double yaw)
 {
-  rot[0] = roll;
+  EulerToQuaternion(roll, pitch, yaw, quat);
   init_rot[0] = roll;
-  rot[1] = pitch;
   init_rot[1] = pitch;
-  rot[2] = yaw;
   init_rot[2] = yaw;
 }
 
@@ -481,8 +871,8 @@ void CoaXModel::SetInitialRotorSpeeds(double Omega_up, double Omega_lo)
 {
 	rotors[0] = Omega_up;
 	init_rotors[0] = Omega_up;
-	rotors[1] = Omega_up;
-	init_rotors[1] = Omega_up;
+	rotors[1] = Omega_lo;
+	init_rotors[1] = Omega_lo;
 }
 
 void CoaXModel::SetInitialStabilizerBar(double x, double y, double z)
@@ -505,9 +895,35 @@ void CoaXModel::GetXYZ(double& x, double& y, double& z)
 
 void CoaXModel::GetRotation(double& roll, double& pitch, double& yaw)
 {
-  roll = rot[0];
-  pitch = rot[1];
-  yaw = rot[2];
+  QuaternionToEuler(quat, roll, pitch, yaw);
+}
+
+void CoaXModel::GetOrientation(double& qw, double& qx, double& qy, double& qz)
+{
+  qw = quat[0];
+  qx = quat[1];
+  qy = quat[2];
+  qz = quat[3];
+}
+
+void CoaXModel::SetState(const double* state)
+{
+  memcpy(pos, state, sizeof(pos));
+  memcpy(vel, &state[3], sizeof(vel));
+  EulerToQuaternion(state[6], state[7], state[8], quat);
+  memcpy(angvel, &state[9], sizeof(angvel));
+  memcpy(rotors, &state[12], sizeof(rotors));
+  memcpy(bar, &state[14], sizeof(bar));
+}
+
+void CoaXModel::GetState(double* state)
+{
+  memcpy(state, pos, sizeof(pos));
+  memcpy(&state[3], vel, sizeof(vel));
+  QuaternionToEuler(quat, state[6], state[7], state[8]);
+  memcpy(&state[9], angvel, sizeof(angvel));
+  memcpy(&state[12], rotors, sizeof(rotors));
+  memcpy(&state[14], bar, sizeof(bar));
 }
 
 void CoaXModel::SetWorldLinearVelocity(double x, double y, double z)
@@ -551,6 +967,18 @@ void CoaXModel::GetWorldLinearAcceleration(double& x,
   z = acc[2];
 }
 
+void CoaXModel::GetBodySpecificForce(double& x,
+                                     double& y,
+                                     double& z)
+{
+  double R[3][3];
+  QuaternionToRotation(quat, R);
+  double f[3] = {acc[0], acc[1], acc[2] + 9.81};
+  x = R[0][0]*f[0] + R[1][0]*f[1] + R[2][0]*f[2];
+  y = R[0][1]*f[0] + R[1][1]*f[1] + R[2][1]*f[2];
+  z = R[0][2]*f[0] + R[1][2]*f[1] + R[2][2]*f[2];
+}
+
 void CoaXModel::SetWorldLinearAcceleration(double x,
                                            double y,
                                            double z)
@@ -601,9 +1029,7 @@ void CoaXModel::ResetSimulation(double time_,
   pos[1] = y;
   pos[2] = z;
 
-  rot[0] = 0;//roll;
-  rot[1] = 0;//pitch;
-  rot[2] = yaw;
+  EulerToQuaternion(0.0/*roll*/, 0.0/*pitch*/, yaw, quat);
 
   bar[0] = 0;
   bar[1] = 0;
@@ -615,9 +1041,12 @@ void CoaXModel::ResetSimulation(double time_,
   memset(vel, 0, sizeof(vel));
   memset(angvel, 0, sizeof(angvel));
   memset(acc, 0, sizeof(acc));
+  memset(servo, 0, sizeof(servo));
 
   // Reset the evolution of the ODE
+  step_size = 1e-5;
   gsl_odeiv_evolve_reset(evolve);
+  ResetSensitivities();
 
   return;
 }
@@ -626,15 +1055,25 @@ void CoaXModel::ResetSimulation()
 {
   time = 0;
   memcpy(pos, init_pos, sizeof(pos));
-  memcpy(rot, init_rot, sizeof(rot));
+  EulerToQuaternion(init_rot[0], init_rot[1], init_rot[2], quat);
   memset(vel, 0, sizeof(vel));
   memset(angvel, 0, sizeof(angvel));
   memcpy(rotors, init_rotors, sizeof(rotors));
   memcpy(bar, init_bar, sizeof(bar));
   memset(acc, 0, sizeof(acc));
+  memset(servo, 0, sizeof(servo));
+
+  battery_soc = init_battery_soc;
+  battery_vrc = 0;
+  battery_voltage = 0;
+  UpdateBattery(0);
+
+  c.Reset();
 
   // Reset the evolution of the ODE
+  step_size = 1e-5;
   gsl_odeiv_evolve_reset(evolve);
+  ResetSensitivities();
 }
 
 void CoaXModel::PrintModelDescription()
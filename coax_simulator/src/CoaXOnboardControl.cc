@@ -0,0 +1,246 @@
+#include <cstring>
+
+#include "CoaXOnboardControl.h"
+
+using namespace std;
+
+CoaXOnboardControl::CoaXOnboardControl()
+{
+  // Hover commands of coax_parameters.yaml, gains for about 3 rad/s
+  // altitude bandwidth
+  gains.hover_upper = 0.5386;
+  gains.hover_lower = 0.5526;
+  gains.idle = 0.2;
+  gains.kp_att = 1.0;
+  gains.kd_att = 0.2;
+  gains.kp_yaw = 0.01;
+  gains.kp_z = 0.25;
+  gains.kd_z = 0.12;
+  gains.ki_z = 0.05;
+  gains.takeoff_altitude = 0.5;
+  gains.takeoff_speed = 0.3;
+  gains.land_speed = 0.2;
+  gains.sink_speed = 0.1;
+
+  memset(&state, 0, sizeof(state));
+  Reset();
+
+  return;
+}
+
+void CoaXOnboardControl::SetGains(const onboard_gains_t &gains_)
+{
+  gains = gains_;
+}
+
+// Back to SB_NAV_STOP, the control timeout and trims are kept like the
+// firmware keeps its configuration
+void CoaXOnboardControl::Reset()
+{
+  onboard_state_t config = state;
+
+  memset(&state, 0, sizeof(state));
+  state.nav_mode = SB_NAV_STOP;
+  state.trim_mode = config.trim_mode;
+  state.trim[0] = config.trim[0];
+  state.trim[1] = config.trim[1];
+  state.control_timeout = config.control_timeout;
+}
+
+int CoaXOnboardControl::ReachNavState(int mode, double time)
+{
+  int current = state.nav_mode;
+
+  switch (mode)
+    {
+    case SB_NAV_STOP:
+      break;
+    case SB_NAV_IDLE:
+      if ((current != SB_NAV_STOP) && (current != SB_NAV_IDLE))
+        return -1;
+      break;
+    case SB_NAV_RAW:
+      if ((current != SB_NAV_STOP) && (current != SB_NAV_RAW))
+        return -1;
+      break;
+    case SB_NAV_TAKEOFF:
+    case SB_NAV_HOVER:
+    case SB_NAV_CTRLLED:
+      if ((current == SB_NAV_STOP) || (current == SB_NAV_RAW))
+        return -1;
+      if ((current == SB_NAV_IDLE) ||
+          (current == SB_NAV_LAND) || (current == SB_NAV_SINK))
+        {
+          // on the ground: climb from where we are
+          state.z_ref = state.z;
+          state.z_integral = 0;
+          if (mode == SB_NAV_HOVER)
+            mode = SB_NAV_TAKEOFF;
+        }
+      break;
+    case SB_NAV_LAND:
+    case SB_NAV_SINK:
+      if ((current != SB_NAV_TAKEOFF) && (current != SB_NAV_HOVER) &&
+          (current != SB_NAV_CTRLLED) &&
+          (current != SB_NAV_LAND) && (current != SB_NAV_SINK))
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+
+  state.nav_mode = mode;
+  state.last_command = time;
+
+  if (mode == SB_NAV_STOP)
+    SetOutputs(0, 0, 0, 0);
+
+  return 0;
+}
+
+void CoaXOnboardControl::SetTrim(int mode, double roll, double pitch)
+{
+  state.trim_mode = mode;
+  state.trim[0] = roll;
+  state.trim[1] = pitch;
+}
+
+void CoaXOnboardControl::SetControlTimeout(double timeout)
+{
+  state.control_timeout = timeout;
+}
+
+void CoaXOnboardControl::SetCommands(double motor1, double motor2,
+                                     double servo1, double servo2, double time)
+{
+  state.raw[0] = motor1;
+  state.raw[1] = motor2;
+  state.raw[2] = servo1;
+  state.raw[3] = servo2;
+  state.last_command = time;
+
+  if (state.nav_mode == SB_NAV_RAW)
+    SetOutputs(motor1, motor2, servo1, servo2);
+}
+
+void CoaXOnboardControl::SetControl(double roll, double pitch, double yaw_rate,
+                                    double altitude, double time)
+{
+  state.setpoint[0] = roll;
+  state.setpoint[1] = pitch;
+  state.setpoint[2] = yaw_rate;
+  state.setpoint[3] = altitude;
+  state.last_command = time;
+}
+
+// One firmware step
+void CoaXOnboardControl::Update(double time, const onboard_sensors_t &sensors)
+{
+  double dt = time - state.last_update;
+  if (dt < 0)
+    dt = 0;
+  if (dt > 0.1)
+    dt = 0.1;
+  state.last_update = time;
+  state.z = sensors.z;
+
+  if ((state.control_timeout > 0) &&
+      (time - state.last_command > state.control_timeout))
+    {
+      if (state.nav_mode == SB_NAV_RAW)
+        ReachNavState(SB_NAV_STOP, time);
+      else if (state.nav_mode == SB_NAV_CTRLLED)
+        ReachNavState(SB_NAV_HOVER, time);
+    }
+
+  double roll_ref = 0;
+  double pitch_ref = 0;
+  double yaw_rate_ref = 0;
+  double step;
+
+  switch (state.nav_mode)
+    {
+    case SB_NAV_STOP:
+      SetOutputs(0, 0, 0, 0);
+      return;
+    case SB_NAV_IDLE:
+      state.z_integral = 0;
+      SetOutputs(gains.idle, gains.idle, 0, 0);
+      return;
+    case SB_NAV_RAW:
+      return;
+    case SB_NAV_TAKEOFF:
+      state.z_ref += gains.takeoff_speed*dt;
+      if (state.z_ref >= gains.takeoff_altitude)
+        {
+          state.z_ref = gains.takeoff_altitude;
+          state.nav_mode = SB_NAV_HOVER;
+        }
+      break;
+    case SB_NAV_HOVER:
+      break;
+    case SB_NAV_CTRLLED:
+      roll_ref = state.setpoint[0];
+      pitch_ref = state.setpoint[1];
+      yaw_rate_ref = state.setpoint[2];
+      step = gains.takeoff_speed*dt;
+      state.z_ref += Limit(state.setpoint[3] - state.z_ref, -step, step);
+      break;
+    case SB_NAV_LAND:
+    case SB_NAV_SINK:
+      state.z_ref -= ((state.nav_mode == SB_NAV_LAND) ?
+                      gains.land_speed : gains.sink_speed)*dt;
+      // touched down and settled
+      if ((state.z_ref < sensors.z - 0.1) && (sensors.zdot > -0.05) &&
+          (sensors.zdot < 0.05))
+        {
+          state.nav_mode = SB_NAV_IDLE;
+          state.z_integral = 0;
+          SetOutputs(gains.idle, gains.idle, 0, 0);
+          return;
+        }
+      break;
+    default:
+      return;
+    }
+
+  double ez = state.z_ref - sensors.z;
+  if (gains.ki_z > 0)
+    state.z_integral = Limit(state.z_integral + ez*dt,
+                             -0.1/gains.ki_z, 0.1/gains.ki_z);
+  double collective = gains.kp_z*ez - gains.kd_z*sensors.zdot +
+    gains.ki_z*state.z_integral;
+
+  double dyaw = gains.kp_yaw*(yaw_rate_ref - sensors.r);
+
+  double roll_trim = 0;
+  double pitch_trim = 0;
+  if (state.trim_mode != 0)
+    {
+      roll_trim = state.trim[0];
+      pitch_trim = state.trim[1];
+    }
+
+  SetOutputs(gains.hover_upper + collective - dyaw,
+             gains.hover_lower + collective + dyaw,
+             roll_trim + gains.kp_att*(roll_ref - sensors.roll) - gains.kd_att*sensors.p,
+             pitch_trim + gains.kp_att*(pitch_ref - sensors.pitch) - gains.kd_att*sensors.q);
+}
+
+double CoaXOnboardControl::Limit(double x, double lower, double upper)
+{
+  if (x < lower)
+    return lower;
+  if (x > upper)
+    return upper;
+  return x;
+}
+
+void CoaXOnboardControl::SetOutputs(double motor1, double motor2,
+                                    double servo1, double servo2)
+{
+  state.outputs[0] = Limit(motor1, 0, 1);
+  state.outputs[1] = Limit(motor2, 0, 1);
+  state.outputs[2] = Limit(servo1, -1, 1);
+  state.outputs[3] = Limit(servo2, -1, 1);
+}
@@ -0,0 +1,168 @@
+#include "CoaXParams.h"
+
+void load_model_params(ros::NodeHandle &n, CoaXModel *model)
+{
+  double m;
+  n.getParam("mass", m);
+  model->SetMass(m);
+
+  double Ixx, Iyy, Izz;
+  n.getParam("inertia/Ixx", Ixx);
+  n.getParam("inertia/Iyy", Iyy);
+  n.getParam("inertia/Izz", Izz);
+  model->SetInertia(Ixx, Iyy, Izz);
+
+  double d_up, d_lo;
+  n.getParam("offset/upper", d_up);
+  n.getParam("offset/lower", d_lo);
+  model->SetRotorOffset(d_up, d_lo);
+
+  double l_up, l_lo;
+  n.getParam("linkage_factor/upper", l_up);
+  n.getParam("linkage_factor/lower", l_lo);
+  model->SetRotorLinkageFactor(l_up, l_lo);
+
+  double k_springup, k_springlo;
+  n.getParam("spring_constant/upper", k_springup);
+  n.getParam("spring_constant/lower", k_springlo);
+  model->SetRotorSpringConstant(k_springup, k_springlo);
+
+  double k_Tup, k_Tlo;
+  n.getParam("thrust_factor/upper", k_Tup);
+  n.getParam("thrust_factor/lower", k_Tlo);
+  model->SetRotorThrustFactor(k_Tup, k_Tlo);
+
+  double k_Mup, k_Mlo;
+  n.getParam("moment_factor/upper", k_Mup);
+  n.getParam("moment_factor/lower", k_Mlo);
+  model->SetRotorMomentFactor(k_Mup, k_Mlo);
+
+  double Tf_up;
+  n.getParam("following_time/bar", Tf_up);
+  model->SetUpperRotorFollowingTime(Tf_up);
+
+  double Tf_motup, Tf_motlo;
+  n.getParam("following_time/motors/upper", Tf_motup);
+  n.getParam("following_time/motors/lower", Tf_motlo);
+  model->SetMotorFollowingTime(Tf_motup, Tf_motlo);
+
+  double rs_mup, rs_bup;
+  n.getParam("speed_conversion/slope/upper", rs_mup);
+  n.getParam("speed_conversion/offset/upper", rs_bup);
+  model->SetUpperRotorSpeedConversion(rs_mup, rs_bup);
+
+  double rs_mlo, rs_blo;
+  n.getParam("speed_conversion/slope/lower", rs_mlo);
+  n.getParam("speed_conversion/offset/lower", rs_blo);
+  model->SetLowerRotorSpeedConversion(rs_mlo, rs_blo);
+	
+  double zeta_mup, zeta_bup;
+  n.getParam("phase_lag/slope/upper", zeta_mup);
+  n.getParam("phase_lag/offset/upper", zeta_bup);
+  model->SetUpperPhaseLag(zeta_mup, zeta_bup);
+	
+  double zeta_mlo, zeta_blo;
+  n.getParam("phase_lag/slope/lower", zeta_mlo);
+  n.getParam("phase_lag/offset/lower", zeta_blo);
+  model->SetLowerPhaseLag(zeta_mlo, zeta_blo);
+
+  double max_SPangle;
+  n.getParam("max_swashplate_angle", max_SPangle);
+  model->SetMaximumSwashPlateAngle(max_SPangle);
+
+  double k_ground, d_ground, mu_ground, gear_radius, gear_height;
+  n.param("ground/stiffness", k_ground, 400.0);
+  n.param("ground/damping", d_ground, 5.0);
+  n.param("ground/friction", mu_ground, 0.5);
+  n.param("ground/gear_radius", gear_radius, 0.1);
+  n.param("ground/gear_height", gear_height, 0.0);
+  model->SetGroundContact(k_ground, d_ground, mu_ground, gear_radius, gear_height);
+
+  double Tf_servo, servo_rate, servo_deadband;
+  n.param("servo/following_time", Tf_servo, 0.0);
+  n.param("servo/rate", servo_rate, 0.0);
+  n.param("servo/deadband", servo_deadband, 0.0);
+  model->SetServoDynamics(Tf_servo, servo_rate, servo_deadband);
+
+  int cells;
+  double capacity, R0, R1, C1, motor_efficiency, base_current, nominal_voltage;
+  n.param("battery/cells", cells, 3);
+  n.param("battery/capacity", capacity, 0.0);
+  n.param("battery/R0", R0, 0.06);
+  n.param("battery/R1", R1, 0.02);
+  n.param("battery/C1", C1, 1000.0);
+  n.param("battery/motor_efficiency", motor_efficiency, 0.66);
+  n.param("battery/base_current", base_current, 0.16);
+  n.param("battery/nominal_voltage", nominal_voltage, 12.22);
+  model->SetBattery(cells, capacity, R0, R1, C1,
+                    motor_efficiency, base_current, nominal_voltage);
+
+  double soc;
+  n.param("battery/charge", soc, 1.0);
+  model->SetInitialBatteryCharge(soc);
+
+  double drag_lin, drag_quad;
+  n.param("drag/linear", drag_lin, 0.0);
+  n.param("drag/quadratic", drag_quad, 0.0);
+  model->SetAerodynamicDrag(drag_lin, drag_quad);
+
+  onboard_gains_t gains;
+  n.param("onboard/hover/upper", gains.hover_upper, 0.5386);
+  n.param("onboard/hover/lower", gains.hover_lower, 0.5526);
+  n.param("onboard/idle", gains.idle, 0.2);
+  n.param("onboard/attitude/kp", gains.kp_att, 1.0);
+  n.param("onboard/attitude/kd", gains.kd_att, 0.2);
+  n.param("onboard/yaw/kp", gains.kp_yaw, 0.01);
+  n.param("onboard/altitude/kp", gains.kp_z, 0.25);
+  n.param("onboard/altitude/kd", gains.kd_z, 0.12);
+  n.param("onboard/altitude/ki", gains.ki_z, 0.05);
+  n.param("onboard/takeoff/altitude", gains.takeoff_altitude, 0.5);
+  n.param("onboard/takeoff/speed", gains.takeoff_speed, 0.3);
+  n.param("onboard/land/speed", gains.land_speed, 0.2);
+  n.param("onboard/sink/speed", gains.sink_speed, 0.1);
+  model->GetOnboardControlPtr()->SetGains(gains);
+  
+  return;
+}
+
+double xmlrpc_to_double(XmlRpc::XmlRpcValue &v)
+{
+  if (v.getType() == XmlRpc::XmlRpcValue::TypeInt)
+    return (int)v;
+  return (double)v;
+}
+
+void load_trim_axes(ros::NodeHandle &n, const std::string &prefix, CoaXTrimMap &map)
+{
+  const char* axis_names[TRIM_AXES] = {"forward", "lateral", "climb", "yaw_rate"};
+  for (int i = 0; i < TRIM_AXES; i++)
+    {
+      XmlRpc::XmlRpcValue axis;
+      if (n.getParam(prefix + "/" + axis_names[i], axis) &&
+          (axis.getType() == XmlRpc::XmlRpcValue::TypeArray) && (axis.size() == 3))
+        map.SetAxis(i, xmlrpc_to_double(axis[0]), xmlrpc_to_double(axis[1]),
+                    (unsigned int)xmlrpc_to_double(axis[2]));
+      else
+        map.SetAxis(i, 0, 0, 1);
+    }
+
+  return;
+}
+
+void load_collocation_boundary(ros::NodeHandle &n, const std::string &prefix,
+                               collocation_boundary_t &boundary)
+{
+  const char* vector_names[2] = {"position", "velocity"};
+  double* vectors[2] = {boundary.position, boundary.velocity};
+  for (int i = 0; i < 2; i++)
+    {
+      XmlRpc::XmlRpcValue v;
+      bool ok = n.getParam(prefix + "/" + vector_names[i], v) &&
+        (v.getType() == XmlRpc::XmlRpcValue::TypeArray) && (v.size() == 3);
+      for (int j = 0; j < 3; j++)
+        vectors[i][j] = ok ? xmlrpc_to_double(v[j]) : 0;
+    }
+  n.param(prefix + "/yaw", boundary.yaw, 0.0);
+
+  return;
+}
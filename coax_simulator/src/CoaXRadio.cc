@@ -0,0 +1,187 @@
+#include "BinaryIO.h"
+#include "CoaXJournal.h"
+#include "CoaXRadio.h"
+
+using namespace std;
+
+CoaXRadio::CoaXRadio(CoaXModel* model_)
+{
+  model = model_;
+  onboard = model->GetOnboardControlPtr();
+  journal = NULL;
+
+  cmd_packet_size = 32;
+  state_packet_size = 32;
+  state_tail = 0;
+  state_count = 0;
+
+  return;
+}
+
+void CoaXRadio::SetCommandLink(const LinkEmulator &link, unsigned int packet_size)
+{
+  cmd_link = link;
+  cmd_packet_size = packet_size;
+}
+
+void CoaXRadio::SetStateLink(const LinkEmulator &link, unsigned int packet_size)
+{
+  state_link = link;
+  state_packet_size = packet_size;
+}
+
+void CoaXRadio::SetJournal(CoaXJournal* journal_)
+{
+  journal = journal_;
+}
+
+void CoaXRadio::Reset()
+{
+  cmd_queue.clear();
+  control_queue.clear();
+  cmd_link.Reset();
+  state_link.Reset();
+  state_tail = 0;
+  state_count = 0;
+}
+
+void CoaXRadio::SendRawCommand(double time, double motor1, double motor2,
+                               double servo1, double servo2)
+{
+  radio_packet_t packet;
+  packet.value[0] = motor1;
+  packet.value[1] = motor2;
+  packet.value[2] = servo1;
+  packet.value[3] = servo2;
+
+  if (journal)
+    journal->Record(JOURNAL_RAW_COMMAND, time, 0, packet.value);
+
+  double arrival;
+  if (cmd_link.Send(time, cmd_packet_size, arrival) != 0)
+    return;
+
+  cmd_queue.insert(make_pair(arrival, packet));
+}
+
+void CoaXRadio::SendControl(double time, double roll, double pitch,
+                            double yaw_rate, double altitude)
+{
+  radio_packet_t packet;
+  packet.value[0] = roll;
+  packet.value[1] = pitch;
+  packet.value[2] = yaw_rate;
+  packet.value[3] = altitude;
+
+  if (journal)
+    journal->Record(JOURNAL_CONTROL, time, 0, packet.value);
+
+  double arrival;
+  if (cmd_link.Send(time, cmd_packet_size, arrival) != 0)
+    return;
+
+  control_queue.insert(make_pair(arrival, packet));
+}
+
+int CoaXRadio::ReachNavState(double time, int mode)
+{
+  if (journal)
+    journal->Record(JOURNAL_NAV_STATE, time, mode, NULL);
+
+  return onboard->ReachNavState(mode, time);
+}
+
+void CoaXRadio::SetTrim(double time, int mode, double roll, double pitch)
+{
+  double value[2] = {roll, pitch};
+  if (journal)
+    journal->Record(JOURNAL_TRIM, time, mode, value);
+
+  onboard->SetTrim(mode, roll, pitch);
+}
+
+void CoaXRadio::SetControlTimeout(double time, double timeout)
+{
+  if (journal)
+    journal->Record(JOURNAL_TIMEOUT, time, 0, &timeout);
+
+  onboard->SetControlTimeout(timeout);
+}
+
+void CoaXRadio::ApplyCommand(double time)
+{
+  while (!cmd_queue.empty() && (cmd_queue.begin()->first <= time))
+    {
+      const double* cmd = cmd_queue.begin()->second.value;
+      model->SetCommand(cmd[0], cmd[1], cmd[2], cmd[3]);
+      cmd_queue.erase(cmd_queue.begin());
+    }
+
+  while (!control_queue.empty() && (control_queue.begin()->first <= time))
+    {
+      const double* control = control_queue.begin()->second.value;
+      onboard->SetControl(control[0], -control[1], -control[2], control[3], time);
+      control_queue.erase(control_queue.begin());
+    }
+
+  model->SendCommand();
+}
+
+double CoaXRadio::SendState(double time, unsigned int &slot)
+{
+  double arrival;
+  if (state_link.Send(time, state_packet_size, arrival) != 0)
+    return -1;
+
+  if (state_count == STATE_QUEUE_SIZE)
+    return -2;
+
+  slot = (state_tail + state_count) % STATE_QUEUE_SIZE;
+  state_arrival[slot] = arrival;
+  state_count++;
+
+  return arrival;
+}
+
+int CoaXRadio::ReceiveState(double time)
+{
+  int next = -1;
+  for (unsigned int k = 0; k < state_count; k++)
+    {
+      unsigned int i = (state_tail + k) % STATE_QUEUE_SIZE;
+      if ((state_arrival[i] >= 0) && (state_arrival[i] <= time) &&
+          ((next < 0) || (state_arrival[i] < state_arrival[next])))
+        next = i;
+    }
+  if (next < 0)
+    return -1;
+
+  state_arrival[next] = -1;
+  while ((state_count > 0) && (state_arrival[state_tail] < 0))
+    {
+      state_tail = (state_tail + 1) % STATE_QUEUE_SIZE;
+      state_count--;
+    }
+
+  return next;
+}
+
+int CoaXRadio::WriteConfiguration(FILE* file) const
+{
+  if ((cmd_link.WriteConfiguration(file) != 0) || !WriteBinary(file, cmd_packet_size) ||
+      (state_link.WriteConfiguration(file) != 0) || !WriteBinary(file, state_packet_size))
+    return -1;
+
+  return 0;
+}
+
+int CoaXRadio::ReadConfiguration(FILE* file)
+{
+  Reset();
+
+  if ((cmd_link.ReadConfiguration(file) != 0) || !ReadBinary(file, cmd_packet_size) ||
+      (state_link.ReadConfiguration(file) != 0) || !ReadBinary(file, state_packet_size))
+    return -1;
+
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include "BinaryIO.h"
 #include "CoaXSimulator.h"
 
 #include <cstdio>
@@ -12,6 +13,11 @@ CoaXSimulator::CoaXSimulator()
   // This is where we set the simulation time
   // It should match the processing rate onboard the robot
   time_step = 1e-2;
+  event_seq = 0;
+  tick = 0;
+
+  coax.SetWindField(&wind);
+  coax.SetProximityTables(&proximity);
 
   return;
 }
@@ -26,48 +32,141 @@ double CoaXSimulator::GetSimulationTime()
   return simulation_time;
 }
 
+unsigned long CoaXSimulator::GetTick()
+{
+  return tick;
+}
+
 CoaXModel* CoaXSimulator::GetModelPtr()
 {
   return &coax;
 }
 
-int CoaXSimulator::CheckCollision()
+WindField* CoaXSimulator::GetWindFieldPtr()
 {
-  double x, y, z;
-  coax.GetXYZ(x, y, z);
-
-  // Simple ground plane check
-  if (z <= 0)
-    {
-      // Put the robot just above the ground
-      coax.SetXYZ(x, y, 1e-2);
-      return -1;
-    }
+  return &wind;
+}
 
-  return 0;
+ProximityTables* CoaXSimulator::GetProximityTablesPtr()
+{
+  return &proximity;
 }
 
 void CoaXSimulator::ResetSimulation()
 {
   simulation_time = 0;
   coax.ResetSimulation();
+
+  // start the periodic events over, pending one-shot events are dropped
+  events = std::priority_queue<sim_event_t, std::vector<sim_event_t>, sim_event_later>();
+  for (unsigned int i = 0; i < periodic_events.size(); i++)
+    {
+      sim_event_t e = periodic_events[i];
+      e.seq = event_seq++;
+      events.push(e);
+    }
 }
 
-void CoaXSimulator::Update()
+void CoaXSimulator::AddPeriodicEvent(double period, double phase,
+                                     sim_event_callback_t callback, void* data)
+{
+  assert(period > 0);
+
+  sim_event_t e;
+  e.time = simulation_time + phase;
+  e.period = period;
+  e.seq = event_seq++;
+  e.callback = callback;
+  e.data = data;
+
+  events.push(e);
+
+  e.time = phase;
+  periodic_events.push_back(e);
+}
+
+void CoaXSimulator::ScheduleEvent(double time, sim_event_callback_t callback, void* data)
 {
-  simulation_time += time_step;
-  coax.Update(simulation_time);
+  sim_event_t e;
+  e.time = time < simulation_time ? simulation_time : time;
+  e.period = 0;
+  e.seq = event_seq++;
+  e.callback = callback;
+  e.data = data;
+
+  events.push(e);
+}
 
-  if (CheckCollision() != 0)
+// Integrate the model from event to event up to time
+void CoaXSimulator::AdvanceTo(double time)
+{
+  while (!events.empty() && (events.top().time <= time))
     {
-      double x, y, z;
-      double roll, pitch, yaw;
-		printf("simulation reset (ground collision) \n");
-      coax.GetXYZ(x, y, z);
-      coax.GetRotation(roll, pitch, yaw);
-      coax.ResetSimulation(simulation_time,
-                           x, y, z, roll, pitch, yaw);
+      sim_event_t e = events.top();
+      events.pop();
+
+      if (e.time > simulation_time)
+        {
+          simulation_time = e.time;
+          coax.Update(simulation_time);
+        }
+
+      e.callback(e.time, e.data);
+
+      if (e.period > 0)
+        {
+          e.time += e.period;
+          e.seq = event_seq++;
+          events.push(e);
+        }
+    }
+
+  if (time > simulation_time)
+    {
+      simulation_time = time;
+      // ground contact is part of the model dynamics
+      coax.Update(simulation_time);
     }
+}
+
+void CoaXSimulator::Update()
+{
+  AdvanceTo(simulation_time + time_step);
+  tick++;
 
   return;
 }
+
+int CoaXSimulator::WriteConfiguration(FILE* file)
+{
+  if (!WriteBinary(file, time_step) ||
+      (wind.WriteConfiguration(file) != 0) ||
+      (proximity.WriteConfiguration(file) != 0) ||
+      (coax.WriteConfiguration(file) != 0))
+    return -1;
+
+  return 0;
+}
+
+int CoaXSimulator::ReadConfiguration(FILE* file)
+{
+  if (!ReadBinary(file, time_step) ||
+      (wind.ReadConfiguration(file) != 0) ||
+      (proximity.ReadConfiguration(file) != 0) ||
+      (coax.ReadConfiguration(file) != 0))
+    return -1;
+
+  return 0;
+}
+
+// %.17g so that runs can be compared bit for bit
+void CoaXSimulator::PrintState(FILE* file)
+{
+  double state[DIMENSION];
+  coax.GetState(state);
+
+  fprintf(file, "%.17g", simulation_time);
+  for (int i = 0; i < DIMENSION; i++)
+    fprintf(file, " %.17g", state[i]);
+  fprintf(file, "\n");
+}
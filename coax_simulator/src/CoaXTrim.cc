@@ -0,0 +1,307 @@
+#include <cmath>
+#include <cstring>
+
+#include "CoaXDynamics.h"
+#include "CoaXTrim.h"
+
+using namespace std;
+
+CoaXTrim::CoaXTrim()
+{
+  memset((void*)&param, 0, sizeof(param));
+  memset(theta, 0, sizeof(theta));
+
+  tolerance = 1e-8;
+  max_iterations = 50;
+
+  return;
+}
+
+void CoaXTrim::SetModel(CoaXModel* model)
+{
+  param = *model->GetModelParams();
+  param.wind = NULL;
+  param.proximity = NULL;
+  param.k_ground = 0;
+  param.voltage_scale = 1;
+
+  model->GetParameters(theta);
+}
+
+void CoaXTrim::SetTolerance(double tolerance_, int max_iterations_)
+{
+  tolerance = tolerance_;
+  max_iterations = max_iterations_;
+}
+
+void CoaXTrim::GetParameters(vector<double> &parameters)
+{
+  parameters.assign(theta, theta + MODEL_PARAMETERS);
+  parameters.push_back(param.drag_lin);
+  parameters.push_back(param.drag_quad);
+}
+
+// Omega_lo0 = sqrt(m*g/(k_Tup*k_Mlo/k_Mup + k_Tlo)), the upper rotor
+// balances the moment of the lower one
+void CoaXTrim::InitialGuess(trim_t &trim)
+{
+  double x[TRIM_UNKNOWNS];
+  memset(x, 0, sizeof(x));
+
+  double den = param.k_Tup*param.k_Mlo/param.k_Mup + param.k_Tlo;
+  if ((param.k_Mup > 0) && (den > 0) && (param.rs_mup != 0) && (param.rs_mlo != 0))
+    {
+      double Omega_lo = sqrt(param.mass*9.81/den);
+      double Omega_up = sqrt(param.k_Mlo/param.k_Mup)*Omega_lo;
+      x[0] = (Omega_up - param.rs_bup)/param.rs_mup;
+      x[1] = (Omega_lo - param.rs_blo)/param.rs_mlo;
+    }
+
+  Unpack(x, trim);
+  trim.residual = 0;
+  trim.iterations = 0;
+  trim.converged = false;
+  trim.feasible = false;
+}
+
+// Linear and angular accelerations off the steady turn and the bar motion
+// relative to the body, with the attitude at yaw 0. Body rates follow
+// from the yaw rate at constant roll and pitch.
+template <class T>
+void CoaXTrim::Residuals(const trim_condition_t &condition, const T* x, T* f)
+{
+  using std::sin;
+  using std::cos;
+  using std::sqrt;
+
+  T state[ODE_DIMENSION];
+  T xdot[ODE_DIMENSION];
+  T theta_[MODEL_PARAMETERS];
+  for (int i = 0; i < MODEL_PARAMETERS; i++)
+    theta_[i] = theta[i];
+
+  T u[4] = {x[0], x[1], x[2], x[3]};
+  T roll = x[4];
+  T pitch = x[5];
+  double r = condition.yaw_rate;
+
+  state[0] = 0;
+  state[1] = 0;
+  state[2] = 0;
+  state[3] = condition.forward;
+  state[4] = condition.lateral;
+  state[5] = condition.climb;
+  EulerToQuaternion(roll, pitch, T(0.0), &state[6]);
+  state[10] = -sin(pitch)*r;
+  state[11] = sin(roll)*cos(pitch)*r;
+  state[12] = cos(roll)*cos(pitch)*r;
+  state[13] = param.rs_mup*x[0] + param.rs_bup;
+  state[14] = param.rs_mlo*x[1] + param.rs_blo;
+  state[15] = x[6];
+  state[16] = x[7];
+  state[17] = sqrt(1 - x[6]*x[6] - x[7]*x[7]);
+
+  double acc[3];
+  CoaXDerivatives(0.0, state, xdot, theta_, u, &param, acc);
+
+  f[0] = xdot[3] + r*condition.lateral;
+  f[1] = xdot[4] - r*condition.forward;
+  f[2] = xdot[5];
+  f[3] = xdot[10];
+  f[4] = xdot[11];
+  f[5] = xdot[12];
+  f[6] = xdot[15];
+  f[7] = xdot[16];
+}
+
+// Residuals f at x and their Jacobian J (row major), returns |f|^2. The
+// rotor tilts lose their derivative with the swashplate or the bar exactly
+// upright (acos at 1), so the Jacobian is taken at most 1e-5 away from
+// upright.
+double CoaXTrim::Evaluate(const trim_condition_t &condition, const double* x,
+                          double* f, double* J)
+{
+  typedef Dual<TRIM_UNKNOWNS> dual_t;
+
+  dual_t xd[TRIM_UNKNOWNS];
+  dual_t fd[TRIM_UNKNOWNS];
+  for (int i = 0; i < TRIM_UNKNOWNS; i++)
+    {
+      double xi = x[i];
+      if (((i == 2) || (i == 3) || (i == 6) || (i == 7)) && (fabs(xi) < 1e-5))
+        xi = (xi < 0) ? -1e-5 : 1e-5;
+      xd[i] = dual_t(xi, i);
+    }
+
+  Residuals(condition, xd, fd);
+  Residuals(condition, x, f);
+
+  double cost = 0;
+  for (int i = 0; i < TRIM_UNKNOWNS; i++)
+    {
+      memcpy(&J[i*TRIM_UNKNOWNS], fd[i].d, sizeof(fd[i].d));
+      cost += f[i]*f[i];
+    }
+
+  // outside the model, e.g. the bar beyond horizontal
+  if (cost != cost)
+    cost = HUGE_VAL;
+
+  return cost;
+}
+
+int CoaXTrim::Solve(const trim_condition_t &condition, trim_t &trim)
+{
+  const int n = TRIM_UNKNOWNS;
+
+  double x[n] = {trim.motor[0], trim.motor[1], trim.servo[0], trim.servo[1],
+                 trim.roll, trim.pitch, trim.bar[0], trim.bar[1]};
+  double f[n], J[n*n];
+  double cost = Evaluate(condition, x, f, J);
+
+  double lambda = 1e-3;
+  double residual = HUGE_VAL;
+  int iteration = 0;
+  bool converged = false;
+
+  while (true)
+    {
+      residual = 0;
+      for (int i = 0; i < n; i++)
+        residual = (fabs(f[i]) > residual) ? fabs(f[i]) : residual;
+      if (residual < tolerance)
+        {
+          converged = true;
+          break;
+        }
+      if ((iteration >= max_iterations) || (cost == HUGE_VAL))
+        break;
+      iteration++;
+
+      // normal equations J'J dx = -J'f
+      double JtJ[n*n], g[n];
+      for (int i = 0; i < n; i++)
+        {
+          g[i] = 0;
+          for (int k = 0; k < n; k++)
+            g[i] -= J[k*n + i]*f[k];
+          for (int j = 0; j < n; j++)
+            {
+              double s = 0;
+              for (int k = 0; k < n; k++)
+                s += J[k*n + i]*J[k*n + j];
+              JtJ[i*n + j] = s;
+            }
+        }
+
+      // Marquardt's damping, scaled by the diagonal, until the step
+      // reduces the residuals
+      bool accepted = false;
+      while (!accepted && (lambda < 1e12))
+        {
+          double A[n*n], dx[n];
+          memcpy(A, JtJ, sizeof(A));
+          memcpy(dx, g, sizeof(dx));
+          for (int i = 0; i < n; i++)
+            A[i*n + i] += lambda*JtJ[i*n + i] + 1e-12;
+
+          double x_new[n], f_new[n], J_new[n*n];
+          double cost_new = HUGE_VAL;
+          if (SolveLinear(A, dx, n) == 0)
+            {
+              for (int i = 0; i < n; i++)
+                x_new[i] = x[i] + dx[i];
+              if (x_new[6]*x_new[6] + x_new[7]*x_new[7] < 0.5)
+                cost_new = Evaluate(condition, x_new, f_new, J_new);
+            }
+
+          if (cost_new < cost)
+            {
+              memcpy(x, x_new, sizeof(x));
+              memcpy(f, f_new, sizeof(f));
+              memcpy(J, J_new, sizeof(J));
+              cost = cost_new;
+              lambda = (lambda > 1e-12) ? 0.1*lambda : lambda;
+              accepted = true;
+            }
+          else
+            lambda *= 10;
+        }
+
+      if (!accepted)
+        break;
+    }
+
+  Unpack(x, trim);
+  trim.residual = residual;
+  trim.iterations = iteration;
+  trim.converged = converged;
+  trim.feasible = converged &&
+    (trim.motor[0] >= 0) && (trim.motor[0] <= 1) &&
+    (trim.motor[1] >= 0) && (trim.motor[1] <= 1) &&
+    (fabs(trim.servo[0]) <= 1) && (fabs(trim.servo[1]) <= 1) &&
+    (trim.rotors[0] >= 0) && (trim.rotors[0] <= 320) &&
+    (trim.rotors[1] >= 0) && (trim.rotors[1] <= 320);
+
+  return converged ? 0 : -1;
+}
+
+void CoaXTrim::Unpack(const double* x, trim_t &trim)
+{
+  trim.motor[0] = x[0];
+  trim.motor[1] = x[1];
+  trim.servo[0] = x[2];
+  trim.servo[1] = x[3];
+  trim.roll = x[4];
+  trim.pitch = x[5];
+  trim.rotors[0] = param.rs_mup*x[0] + param.rs_bup;
+  trim.rotors[1] = param.rs_mlo*x[1] + param.rs_blo;
+  trim.bar[0] = x[6];
+  trim.bar[1] = x[7];
+  trim.bar[2] = sqrt(1 - x[6]*x[6] - x[7]*x[7]);
+}
+
+// Gaussian elimination with partial pivoting, the solution replaces b.
+// Returns -1 if A is singular.
+int CoaXTrim::SolveLinear(double* A, double* b, int n)
+{
+  for (int k = 0; k < n; k++)
+    {
+      int pivot = k;
+      for (int i = k + 1; i < n; i++)
+        if (fabs(A[i*n + k]) > fabs(A[pivot*n + k]))
+          pivot = i;
+      if (A[pivot*n + k] == 0)
+        return -1;
+
+      if (pivot != k)
+        {
+          for (int j = 0; j < n; j++)
+            {
+              double a = A[k*n + j];
+              A[k*n + j] = A[pivot*n + j];
+              A[pivot*n + j] = a;
+            }
+          double a = b[k];
+          b[k] = b[pivot];
+          b[pivot] = a;
+        }
+
+      for (int i = k + 1; i < n; i++)
+        {
+          double l = A[i*n + k]/A[k*n + k];
+          for (int j = k; j < n; j++)
+            A[i*n + j] -= l*A[k*n + j];
+          b[i] -= l*b[k];
+        }
+    }
+
+  for (int k = n - 1; k >= 0; k--)
+    {
+      for (int j = k + 1; j < n; j++)
+        b[k] -= A[k*n + j]*b[j];
+      b[k] /= A[k*n + k];
+    }
+
+  return 0;
+}
@@ -0,0 +1,325 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+
+#include "BinaryIO.h"
+#include "CoaXTrimMap.h"
+
+using namespace std;
+
+static const char trim_map_magic[4] = {'C', 'X', 'T', '1'};
+
+CoaXTrimMap::CoaXTrimMap()
+{
+  for (int i = 0; i < TRIM_AXES; i++)
+    SetAxis(i, 0, 0, 1);
+
+  return;
+}
+
+void CoaXTrimMap::SetAxis(int axis, double start, double stop, unsigned int size)
+{
+  axes[axis].start = start;
+  axes[axis].step = (size > 1) ? (stop - start)/(size - 1) : 0;
+  axes[axis].size = (size > 0) ? size : 1;
+  trims.clear();
+}
+
+const trim_axis_t& CoaXTrimMap::GetAxis(int axis) const
+{
+  return axes[axis];
+}
+
+unsigned int CoaXTrimMap::GetSize() const
+{
+  return trims.size();
+}
+
+void CoaXTrimMap::GetCondition(unsigned int i, trim_condition_t &condition) const
+{
+  double value[TRIM_AXES];
+  for (int a = TRIM_AXES - 1; a >= 0; a--)
+    {
+      value[a] = axes[a].start + (i % axes[a].size)*axes[a].step;
+      i /= axes[a].size;
+    }
+
+  condition.forward = value[TRIM_FORWARD];
+  condition.lateral = value[TRIM_LATERAL];
+  condition.climb = value[TRIM_CLIMB];
+  condition.yaw_rate = value[TRIM_YAW_RATE];
+}
+
+const trim_t& CoaXTrimMap::GetTrim(unsigned int i) const
+{
+  return trims[i];
+}
+
+// Every stride-th point from first, each from the hover guess or, when
+// retrying, from the first converged neighbour in previous
+typedef struct
+{
+  CoaXTrimMap* map;
+  CoaXTrim trim;
+  unsigned int first;
+  unsigned int stride;
+  const vector<trim_t>* previous;
+} trim_worker_t;
+
+void* CoaXTrimMap::BuildThread(void* data)
+{
+  trim_worker_t* worker = (trim_worker_t*)data;
+  worker->map->BuildPoints(worker->trim, worker->first, worker->stride, worker->previous);
+
+  return NULL;
+}
+
+void CoaXTrimMap::BuildPoints(CoaXTrim &trim, unsigned int first, unsigned int stride,
+                              const vector<trim_t>* previous)
+{
+  trim_t hover;
+  trim.InitialGuess(hover);
+
+  for (unsigned int i = first; i < trims.size(); i += stride)
+    {
+      trim_condition_t condition;
+      GetCondition(i, condition);
+
+      if (!previous)
+        {
+          trims[i] = hover;
+          trim.Solve(condition, trims[i]);
+          continue;
+        }
+
+      if ((*previous)[i].converged)
+        continue;
+
+      // neighbours along each axis, below then above
+      unsigned int s = 1;
+      unsigned int j = i;
+      for (int a = TRIM_AXES - 1; a >= 0; a--)
+        {
+          unsigned int index = j % axes[a].size;
+          j /= axes[a].size;
+
+          const trim_t* start = NULL;
+          if ((index > 0) && (*previous)[i - s].converged)
+            start = &(*previous)[i - s];
+          else if ((index + 1 < axes[a].size) && (*previous)[i + s].converged)
+            start = &(*previous)[i + s];
+          s *= axes[a].size;
+
+          if (!start)
+            continue;
+
+          trim_t retry = *start;
+          if (trim.Solve(condition, retry) == 0)
+            {
+              trims[i] = retry;
+              break;
+            }
+        }
+    }
+}
+
+// Runs one pass over all points on threads threads
+void CoaXTrimMap::BuildPass(CoaXTrim &trim, unsigned int threads,
+                            const vector<trim_t>* previous)
+{
+  if (threads <= 1)
+    {
+      BuildPoints(trim, 0, 1, previous);
+      return;
+    }
+
+  vector<trim_worker_t> workers(threads);
+  vector<pthread_t> ids(threads);
+  unsigned int started = 0;
+  for (unsigned int k = 0; k < threads; k++)
+    {
+      workers[k].map = this;
+      workers[k].trim = trim;
+      workers[k].first = k;
+      workers[k].stride = threads;
+      workers[k].previous = previous;
+      if (pthread_create(&ids[k], NULL, BuildThread, &workers[k]) != 0)
+        break;
+      started++;
+    }
+
+  for (unsigned int k = 0; k < started; k++)
+    pthread_join(ids[k], NULL);
+
+  // whatever could not be started runs here
+  for (unsigned int k = started; k < threads; k++)
+    BuildPoints(trim, k, threads, previous);
+}
+
+unsigned int CoaXTrimMap::Build(CoaXTrim &trim, unsigned int threads)
+{
+  unsigned int size = 1;
+  for (int a = 0; a < TRIM_AXES; a++)
+    size *= axes[a].size;
+
+  trim.GetParameters(parameters);
+  trims.resize(size);
+
+  // Independent solves from hover, then one retry of the failed points
+  // from their converged neighbours. Each pass only reads the results of
+  // the one before, so the map does not depend on the number of threads.
+  BuildPass(trim, threads, NULL);
+  vector<trim_t> previous = trims;
+  BuildPass(trim, threads, &previous);
+
+  unsigned int feasible = 0;
+  for (unsigned int i = 0; i < size; i++)
+    if (trims[i].feasible)
+      feasible++;
+
+  return feasible;
+}
+
+void CoaXTrimMap::Interpolate(const trim_condition_t &condition, trim_t &trim) const
+{
+  memset(&trim, 0, sizeof(trim));
+  if (trims.empty())
+    return;
+
+  double value[TRIM_AXES] = {condition.forward, condition.lateral,
+                             condition.climb, condition.yaw_rate};
+
+  // lower grid index and weight of the upper one on each axis
+  unsigned int index[TRIM_AXES];
+  double weight[TRIM_AXES];
+  unsigned int stride[TRIM_AXES];
+  unsigned int s = 1;
+  for (int a = TRIM_AXES - 1; a >= 0; a--)
+    {
+      stride[a] = s;
+      s *= axes[a].size;
+
+      index[a] = 0;
+      weight[a] = 0;
+      if (axes[a].size < 2)
+        continue;
+
+      double u = (value[a] - axes[a].start)/axes[a].step;
+      double last = axes[a].size - 1;
+      u = (u > 0) ? u : 0;
+      u = (u < last) ? u : last;
+      index[a] = (unsigned int)u;
+      if (index[a] == axes[a].size - 1)
+        index[a]--;
+      weight[a] = u - index[a];
+    }
+
+  trim.converged = true;
+  trim.feasible = true;
+  for (unsigned int corner = 0; corner < (1u << TRIM_AXES); corner++)
+    {
+      double w = 1;
+      unsigned int i = 0;
+      for (int a = 0; a < TRIM_AXES; a++)
+        {
+          bool upper = (corner >> a) & 1;
+          w *= upper ? weight[a] : 1 - weight[a];
+          i += (index[a] + (upper ? 1 : 0))*stride[a];
+        }
+      if (w == 0)
+        continue;
+
+      const trim_t &t = trims[i];
+      trim.motor[0] += w*t.motor[0];
+      trim.motor[1] += w*t.motor[1];
+      trim.servo[0] += w*t.servo[0];
+      trim.servo[1] += w*t.servo[1];
+      trim.roll += w*t.roll;
+      trim.pitch += w*t.pitch;
+      trim.rotors[0] += w*t.rotors[0];
+      trim.rotors[1] += w*t.rotors[1];
+      trim.bar[0] += w*t.bar[0];
+      trim.bar[1] += w*t.bar[1];
+
+      trim.residual = (t.residual > trim.residual) ? t.residual : trim.residual;
+      trim.iterations = (t.iterations > trim.iterations) ? t.iterations : trim.iterations;
+      trim.converged = trim.converged && t.converged;
+      trim.feasible = trim.feasible && t.feasible;
+    }
+
+  trim.bar[2] = sqrt(1 - trim.bar[0]*trim.bar[0] - trim.bar[1]*trim.bar[1]);
+}
+
+bool CoaXTrimMap::Matches(CoaXTrim &trim) const
+{
+  vector<double> current;
+  trim.GetParameters(current);
+
+  return !trims.empty() && (current == parameters);
+}
+
+bool CoaXTrimMap::Matches(CoaXTrim &trim, const CoaXTrimMap &grid) const
+{
+  if (!Matches(trim))
+    return false;
+
+  for (int a = 0; a < TRIM_AXES; a++)
+    {
+      const trim_axis_t &axis = grid.GetAxis(a);
+      if ((axes[a].start != axis.start) || (axes[a].step != axis.step) ||
+          (axes[a].size != axis.size))
+        return false;
+    }
+
+  return true;
+}
+
+int CoaXTrimMap::Save(const string &filename) const
+{
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file)
+    return -1;
+
+  bool ok = (fwrite(trim_map_magic, sizeof(trim_map_magic), 1, file) == 1);
+  for (int a = 0; ok && (a < TRIM_AXES); a++)
+    ok = WriteBinary(file, axes[a]);
+  ok = ok && WriteBinary(file, parameters) && WriteBinary(file, trims);
+
+  if (fclose(file) != 0)
+    ok = false;
+
+  return ok ? 0 : -1;
+}
+
+int CoaXTrimMap::Load(const string &filename)
+{
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (!file)
+    return -1;
+
+  char magic[sizeof(trim_map_magic)];
+  bool ok = (fread(magic, sizeof(magic), 1, file) == 1) &&
+    (memcmp(magic, trim_map_magic, sizeof(magic)) == 0);
+
+  unsigned int size = 1;
+  for (int a = 0; ok && (a < TRIM_AXES); a++)
+    {
+      ok = ReadBinary(file, axes[a]) && (axes[a].size > 0);
+      size *= axes[a].size;
+    }
+  ok = ok && ReadBinary(file, parameters) && ReadBinary(file, trims) &&
+    (trims.size() == size);
+
+  fclose(file);
+
+  if (!ok)
+    {
+      for (int a = 0; a < TRIM_AXES; a++)
+        SetAxis(a, 0, 0, 1);
+      parameters.clear();
+      return -1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include <gsl/gsl_randist.h>
+
+#include "BinaryIO.h"
+#include "LinkEmulator.h"
+
+using namespace std;
+
+LinkEmulator::LinkEmulator()
+{
+  bandwidth = 0;
+  max_queue_delay = 0;
+  latency = 0;
+  jitter = 0;
+  loss_good = 0;
+  loss_bad = 0;
+  burst_start = 0;
+  burst_end = 1;
+  reorder_probability = 0;
+  reorder_delay = 0;
+
+  seed = 0;
+  rng = gsl_rng_alloc(gsl_rng_mt19937);
+
+  Reset();
+
+  return;
+}
+
+LinkEmulator::LinkEmulator(const LinkEmulator &other)
+{
+  rng = gsl_rng_alloc(gsl_rng_mt19937);
+
+  *this = other;
+}
+
+LinkEmulator::~LinkEmulator()
+{
+  gsl_rng_free(rng);
+
+  return;
+}
+
+LinkEmulator& LinkEmulator::operator=(const LinkEmulator &other)
+{
+  if (this == &other)
+    return *this;
+
+  bandwidth = other.bandwidth;
+  max_queue_delay = other.max_queue_delay;
+  latency = other.latency;
+  jitter = other.jitter;
+  loss_good = other.loss_good;
+  loss_bad = other.loss_bad;
+  burst_start = other.burst_start;
+  burst_end = other.burst_end;
+  reorder_probability = other.reorder_probability;
+  reorder_delay = other.reorder_delay;
+
+  burst = other.burst;
+  busy_until = other.busy_until;
+  sent = other.sent;
+  lost = other.lost;
+
+  seed = other.seed;
+  gsl_rng_memcpy(rng, other.rng);
+
+  return *this;
+}
+
+void LinkEmulator::SetSeed(unsigned long seed_)
+{
+  seed = seed_;
+  gsl_rng_set(rng, seed);
+}
+
+void LinkEmulator::SetBandwidth(double bandwidth_, double max_queue_delay_)
+{
+  bandwidth = bandwidth_;
+  max_queue_delay = max_queue_delay_;
+}
+
+void LinkEmulator::SetLatency(double latency_, double jitter_)
+{
+  latency = latency_;
+  jitter = jitter_;
+}
+
+void LinkEmulator::SetLoss(double loss_good_, double loss_bad_,
+                           double burst_start_, double burst_end_)
+{
+  loss_good = loss_good_;
+  loss_bad = loss_bad_;
+  burst_start = burst_start_;
+  burst_end = burst_end_;
+}
+
+void LinkEmulator::SetReorder(double probability, double delay)
+{
+  reorder_probability = probability;
+  reorder_delay = delay;
+}
+
+void LinkEmulator::Reset()
+{
+  burst = false;
+  busy_until = 0;
+  sent = 0;
+  lost = 0;
+
+  gsl_rng_set(rng, seed);
+}
+
+int LinkEmulator::WriteConfiguration(FILE* file) const
+{
+  bool ok = WriteBinary(file, bandwidth) && WriteBinary(file, max_queue_delay) &&
+    WriteBinary(file, latency) && WriteBinary(file, jitter) &&
+    WriteBinary(file, loss_good) && WriteBinary(file, loss_bad) &&
+    WriteBinary(file, burst_start) && WriteBinary(file, burst_end) &&
+    WriteBinary(file, reorder_probability) && WriteBinary(file, reorder_delay) &&
+    WriteBinary(file, seed);
+
+  return ok ? 0 : -1;
+}
+
+int LinkEmulator::ReadConfiguration(FILE* file)
+{
+  bool ok = ReadBinary(file, bandwidth) && ReadBinary(file, max_queue_delay) &&
+    ReadBinary(file, latency) && ReadBinary(file, jitter) &&
+    ReadBinary(file, loss_good) && ReadBinary(file, loss_bad) &&
+    ReadBinary(file, burst_start) && ReadBinary(file, burst_end) &&
+    ReadBinary(file, reorder_probability) && ReadBinary(file, reorder_delay) &&
+    ReadBinary(file, seed);
+
+  Reset();
+
+  return ok ? 0 : -1;
+}
+
+int LinkEmulator::Send(double time, unsigned int size, double &arrival)
+{
+  sent++;
+
+  // serialization behind the packets already queued
+  double start = (busy_until > time) ? busy_until : time;
+  if (bandwidth > 0)
+    {
+      if ((max_queue_delay > 0) && (start - time > max_queue_delay))
+        {
+          lost++;
+          return -1;
+        }
+      busy_until = start + size/bandwidth;
+    }
+  else
+    busy_until = start;
+
+  if (burst)
+    {
+      if (gsl_rng_uniform(rng) < burst_end)
+        burst = false;
+    }
+  else if ((burst_start > 0) && (gsl_rng_uniform(rng) < burst_start))
+    burst = true;
+
+  double loss = burst ? loss_bad : loss_good;
+  if ((loss > 0) && (gsl_rng_uniform(rng) < loss))
+    {
+      lost++;
+      return -1;
+    }
+
+  arrival = busy_until + latency;
+  if (jitter > 0)
+    arrival += gsl_ran_exponential(rng, jitter);
+  if ((reorder_probability > 0) && (gsl_rng_uniform(rng) < reorder_probability))
+    arrival += reorder_delay;
+
+  return 0;
+}
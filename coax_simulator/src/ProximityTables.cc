@@ -0,0 +1,224 @@
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "BinaryIO.h"
+#include "ProximityTables.h"
+
+using namespace std;
+
+ProximityTables::ProximityTables()
+{
+  // CoaX rotor
+  inv_radius = 1.0/0.17;
+
+  Clear();
+
+  return;
+}
+
+// Single sample tables with factor 1
+void ProximityTables::Clear()
+{
+  ground_axis.start = 0;
+  ground_axis.inv_step = 0;
+  ground_axis.last = 0;
+  ground_axis.size = 1;
+  ground.assign(2, 1.0);
+
+  wall_axis[0] = ground_axis;
+  wall_axis[1] = ground_axis;
+  wall.assign(4, 1.0);
+}
+
+// Text file with '#' comments and two sections, each optional:
+//   ground <h start> <h step> <n> followed by n factors
+//   wall <d start> <d step> <n> <h start> <h step> <m> followed by n rows
+//   of m factors
+// with distances in rotor radii
+int ProximityTables::Load(const string &filename)
+{
+  ifstream file(filename.c_str());
+  if (!file)
+    return -1;
+
+  stringstream in;
+  string line;
+  while (getline(file, line))
+    in << line.substr(0, line.find('#')) << "\n";
+
+  Clear();
+
+  bool ok = true;
+  string section;
+  while (ok && (in >> section))
+    {
+      if (section == "ground")
+        {
+          ok = (ReadAxis(in, ground_axis) == 0);
+          if (!ok)
+            break;
+          unsigned int n = ground_axis.size;
+          ground.assign(n + 1, 1.0);
+          for (unsigned int i = 0; i < n; i++)
+            in >> ground[i];
+          // padding for the lookup at the last sample
+          ground[n] = ground[n - 1];
+        }
+      else if (section == "wall")
+        {
+          ok = (ReadAxis(in, wall_axis[0]) == 0) && (ReadAxis(in, wall_axis[1]) == 0);
+          if (!ok)
+            break;
+          unsigned int n = wall_axis[0].size;
+          unsigned int m = wall_axis[1].size;
+          unsigned int stride = m + 1;
+          wall.assign((n + 1)*stride, 1.0);
+          for (unsigned int i = 0; i < n; i++)
+            {
+              for (unsigned int j = 0; j < m; j++)
+                in >> wall[i*stride + j];
+              wall[i*stride + m] = wall[i*stride + m - 1];
+            }
+          for (unsigned int j = 0; j < stride; j++)
+            wall[n*stride + j] = wall[(n - 1)*stride + j];
+        }
+      else
+        ok = false;
+
+      if (in.fail())
+        ok = false;
+    }
+
+  if (!ok)
+    {
+      Clear();
+      return -1;
+    }
+
+  return 0;
+}
+
+int ProximityTables::ReadAxis(istream &in, table_axis_t &axis)
+{
+  double step;
+  int size;
+  in >> axis.start >> step >> size;
+  if (in.fail() || (step <= 0) || (size < 1))
+    return -1;
+
+  axis.inv_step = 1.0/step;
+  axis.size = size;
+  axis.last = size - 1;
+
+  return 0;
+}
+
+void ProximityTables::SetRotorRadius(double radius)
+{
+  if (radius > 0)
+    inv_radius = 1.0/radius;
+}
+
+void ProximityTables::AddWall(double x, double y, double nx, double ny)
+{
+  double norm = sqrt(nx*nx + ny*ny);
+  if (norm <= 0)
+    return;
+
+  wall_t w;
+  w.point[0] = x;
+  w.point[1] = y;
+  w.normal[0] = nx/norm;
+  w.normal[1] = ny/norm;
+
+  walls.push_back(w);
+}
+
+void ProximityTables::ClearWalls()
+{
+  walls.clear();
+}
+
+int ProximityTables::WriteConfiguration(FILE* file) const
+{
+  bool ok = WriteBinary(file, inv_radius) &&
+    WriteBinary(file, ground_axis) && WriteBinary(file, ground) &&
+    WriteBinary(file, wall_axis) && WriteBinary(file, wall) &&
+    WriteBinary(file, walls);
+
+  return ok ? 0 : -1;
+}
+
+int ProximityTables::ReadConfiguration(FILE* file)
+{
+  bool ok = ReadBinary(file, inv_radius) &&
+    ReadBinary(file, ground_axis) && ReadBinary(file, ground) &&
+    ReadBinary(file, wall_axis) && ReadBinary(file, wall) &&
+    ReadBinary(file, walls);
+
+  // the lookups rely on the padded tables
+  if (!ok || (ground.size() != ground_axis.size + 1) ||
+      (wall.size() != (wall_axis[0].size + 1)*(wall_axis[1].size + 1)))
+    {
+      Clear();
+      return -1;
+    }
+
+  return 0;
+}
+
+double ProximityTables::GetThrustFactor(const double* pos) const
+{
+  double h = pos[2]*inv_radius;
+  double factor = Interpolate(ground_axis, ground, h);
+
+  for (unsigned int i = 0; i < walls.size(); i++)
+    {
+      const wall_t &w = walls[i];
+      double d = ((pos[0] - w.point[0])*w.normal[0] +
+                  (pos[1] - w.point[1])*w.normal[1])*inv_radius;
+      factor *= Interpolate(wall_axis[0], wall_axis[1], wall, d, h);
+    }
+
+  return factor;
+}
+
+// The clamps compile to min/max and are written so that NaN ends up at the
+// first sample
+double ProximityTables::Interpolate(const table_axis_t &axis,
+                                    const vector<double> &table, double x)
+{
+  double u = (x - axis.start)*axis.inv_step;
+  u = (u > 0) ? u : 0;
+  u = (u < axis.last) ? u : axis.last;
+  unsigned int i = (unsigned int)u;
+  double f = u - i;
+
+  return table[i] + f*(table[i + 1] - table[i]);
+}
+
+double ProximityTables::Interpolate(const table_axis_t &axis_x,
+                                    const table_axis_t &axis_y,
+                                    const vector<double> &table,
+                                    double x, double y)
+{
+  double u = (x - axis_x.start)*axis_x.inv_step;
+  u = (u > 0) ? u : 0;
+  u = (u < axis_x.last) ? u : axis_x.last;
+  unsigned int i = (unsigned int)u;
+  double fx = u - i;
+
+  double v = (y - axis_y.start)*axis_y.inv_step;
+  v = (v > 0) ? v : 0;
+  v = (v < axis_y.last) ? v : axis_y.last;
+  unsigned int j = (unsigned int)v;
+  double fy = v - j;
+
+  unsigned int stride = axis_y.size + 1;
+  const double* t = &table[i*stride + j];
+  double a = t[0] + fy*(t[1] - t[0]);
+  double b = t[stride] + fy*(t[stride + 1] - t[stride]);
+
+  return a + fx*(b - a);
+}
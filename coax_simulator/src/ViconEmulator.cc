@@ -0,0 +1,283 @@
+#include <cmath>
+#include <cstring>
+#include <gsl/gsl_randist.h>
+
+#include "ViconEmulator.h"
+
+using namespace std;
+
+ViconEmulator::ViconEmulator()
+{
+  delay = 0;
+  jitter = 0;
+  sigma_pos = 0;
+  sigma_rot = 0;
+  dropout = 0;
+  swap_probability = 0;
+  swap_distance = 0;
+  swap_yaw = 0;
+  swap_frames = 0;
+  finite_difference = false;
+
+  seed = 0;
+  rng = gsl_rng_alloc(gsl_rng_mt19937);
+
+  Reset();
+
+  return;
+}
+
+ViconEmulator::ViconEmulator(const ViconEmulator &other)
+{
+  rng = gsl_rng_alloc(gsl_rng_mt19937);
+
+  *this = other;
+}
+
+ViconEmulator::~ViconEmulator()
+{
+  gsl_rng_free(rng);
+
+  return;
+}
+
+ViconEmulator& ViconEmulator::operator=(const ViconEmulator &other)
+{
+  if (this == &other)
+    return *this;
+
+  memcpy(buffer, other.buffer, sizeof(buffer));
+  head = other.head;
+  count = other.count;
+
+  delay = other.delay;
+  jitter = other.jitter;
+  sigma_pos = other.sigma_pos;
+  sigma_rot = other.sigma_rot;
+  dropout = other.dropout;
+  swap_probability = other.swap_probability;
+  swap_distance = other.swap_distance;
+  swap_yaw = other.swap_yaw;
+  swap_frames = other.swap_frames;
+  finite_difference = other.finite_difference;
+
+  swap_left = other.swap_left;
+  memcpy(swap_offset, other.swap_offset, sizeof(swap_offset));
+  memcpy(swap_quat, other.swap_quat, sizeof(swap_quat));
+
+  has_last = other.has_last;
+  last = other.last;
+
+  seed = other.seed;
+  gsl_rng_memcpy(rng, other.rng);
+
+  return *this;
+}
+
+void ViconEmulator::SetSeed(unsigned long seed_)
+{
+  seed = seed_;
+  gsl_rng_set(rng, seed);
+}
+
+void ViconEmulator::SetDelay(double delay_, double jitter_)
+{
+  delay = delay_;
+  jitter = jitter_;
+}
+
+void ViconEmulator::SetNoise(double sigma_pos_, double sigma_rot_)
+{
+  sigma_pos = sigma_pos_;
+  sigma_rot = sigma_rot_;
+}
+
+void ViconEmulator::SetDropout(double probability)
+{
+  dropout = probability;
+}
+
+void ViconEmulator::SetMarkerSwap(double probability, double distance, double yaw,
+                                  unsigned int frames)
+{
+  swap_probability = probability;
+  swap_distance = distance;
+  swap_yaw = yaw;
+  swap_frames = frames;
+}
+
+void ViconEmulator::SetFiniteDifference(bool enabled)
+{
+  finite_difference = enabled;
+}
+
+void ViconEmulator::Reset()
+{
+  memset(buffer, 0, sizeof(buffer));
+  head = 0;
+  count = 0;
+
+  swap_left = 0;
+  memset(swap_offset, 0, sizeof(swap_offset));
+  memset(swap_quat, 0, sizeof(swap_quat));
+  swap_quat[0] = 1;
+
+  has_last = false;
+  memset(&last, 0, sizeof(last));
+
+  gsl_rng_set(rng, seed);
+}
+
+int ViconEmulator::Update(double time, const double* pos, const double* quat,
+                          const double* vel, const double* angvel,
+                          vicon_frame_t &frame)
+{
+  head = (head + 1) % VICON_BUFFER_SIZE;
+  if (count < VICON_BUFFER_SIZE)
+    count++;
+
+  vicon_sample_t &s = buffer[head];
+  s.time = time;
+  memcpy(s.pos, pos, sizeof(s.pos));
+  memcpy(s.quat, quat, sizeof(s.quat));
+  memcpy(s.vel, vel, sizeof(s.vel));
+  memcpy(s.angvel, angvel, sizeof(s.angvel));
+
+  // newest sample that has made it through the delay line
+  double capture = time - delay;
+  if (jitter > 0)
+    capture -= jitter*gsl_rng_uniform(rng);
+
+  const vicon_sample_t* sample = NULL;
+  for (unsigned int i = 0; i < count; i++)
+    {
+      const vicon_sample_t &b = buffer[(head + VICON_BUFFER_SIZE - i) % VICON_BUFFER_SIZE];
+      if (b.time <= capture + 1e-9)
+        {
+          sample = &b;
+          break;
+        }
+    }
+
+  // nothing new since the last frame (start up or jitter)
+  if ((sample == NULL) || (has_last && (sample->time <= last.time)))
+    return -1;
+
+  if ((dropout > 0) && (gsl_rng_uniform(rng) < dropout))
+    return -1;
+
+  if ((swap_left == 0) && (swap_probability > 0) &&
+      (gsl_rng_uniform(rng) < swap_probability))
+    {
+      // the wrong markers fit the body model: offset and rotated about z
+      double dir = 2*M_PI*gsl_rng_uniform(rng);
+      double yaw = (gsl_rng_uniform(rng) < 0.5) ? swap_yaw : -swap_yaw;
+
+      swap_left = swap_frames;
+      swap_offset[0] = swap_distance*cos(dir);
+      swap_offset[1] = swap_distance*sin(dir);
+      swap_offset[2] = 0;
+      swap_quat[0] = cos(yaw/2);
+      swap_quat[1] = 0;
+      swap_quat[2] = 0;
+      swap_quat[3] = sin(yaw/2);
+    }
+
+  frame.time = sample->time;
+
+  for (int i = 0; i < 3; i++)
+    {
+      frame.pos[i] = sample->pos[i];
+      if (sigma_pos > 0)
+        frame.pos[i] += gsl_ran_gaussian_ziggurat(rng, sigma_pos);
+    }
+
+  double q[4];
+  memcpy(q, sample->quat, sizeof(q));
+
+  if (sigma_rot > 0)
+    {
+      double r[3], dq[4], qn[4];
+      for (int i = 0; i < 3; i++)
+        r[i] = gsl_ran_gaussian_ziggurat(rng, sigma_rot);
+      RotationToQuaternion(r, dq);
+      QuaternionMultiply(q, dq, qn);
+      memcpy(q, qn, sizeof(q));
+    }
+
+  if (swap_left > 0)
+    {
+      double qs[4];
+      QuaternionMultiply(swap_quat, q, qs);
+      memcpy(q, qs, sizeof(q));
+
+      for (int i = 0; i < 3; i++)
+        frame.pos[i] += swap_offset[i];
+
+      swap_left--;
+    }
+
+  double norm_q = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+  for (int i = 0; i < 4; i++)
+    frame.quat[i] = q[i]/norm_q;
+
+  // same hemisphere as the last frame
+  if (has_last &&
+      (frame.quat[0]*last.quat[0] + frame.quat[1]*last.quat[1] +
+       frame.quat[2]*last.quat[2] + frame.quat[3]*last.quat[3] < 0))
+    {
+      for (int i = 0; i < 4; i++)
+        frame.quat[i] = -frame.quat[i];
+    }
+
+  double dt = frame.time - last.time;
+  if (finite_difference && has_last && (dt > 0))
+    {
+      for (int i = 0; i < 3; i++)
+        frame.vel[i] = (frame.pos[i] - last.pos[i])/dt;
+
+      // body rates from q_last^-1*q = [1 w*dt/2]
+      double ql[4] = {last.quat[0], -last.quat[1], -last.quat[2], -last.quat[3]};
+      double dq[4];
+      QuaternionMultiply(ql, frame.quat, dq);
+      for (int i = 0; i < 3; i++)
+        frame.angvel[i] = 2*dq[i+1]/dt;
+    }
+  else
+    {
+      memcpy(frame.vel, sample->vel, sizeof(frame.vel));
+      memcpy(frame.angvel, sample->angvel, sizeof(frame.angvel));
+    }
+
+  last = frame;
+  has_last = true;
+
+  return 0;
+}
+
+void ViconEmulator::QuaternionMultiply(const double* a, const double* b, double* c)
+{
+  c[0] = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+  c[1] = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+  c[2] = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+  c[3] = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+}
+
+void ViconEmulator::RotationToQuaternion(const double* r, double* q)
+{
+  double angle = sqrt(r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+  if (angle < 1e-12)
+    {
+      q[0] = 1;
+      q[1] = r[0]/2;
+      q[2] = r[1]/2;
+      q[3] = r[2]/2;
+      return;
+    }
+
+  double s = sin(angle/2)/angle;
+  q[0] = cos(angle/2);
+  q[1] = r[0]*s;
+  q[2] = r[1]*s;
+  q[3] = r[2]*s;
+}
@@ -0,0 +1,202 @@
+#include <cmath>
+#include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+
+#include "BinaryIO.h"
+#include "WindField.h"
+
+using namespace std;
+
+WindField::WindField()
+{
+  steady[0] = 0;
+  steady[1] = 0;
+  steady[2] = 0;
+  min_advection = 0;
+  dx = 1;
+
+  UpdateDirection();
+
+  return;
+}
+
+void WindField::SetSteady(double wx, double wy, double wz)
+{
+  steady[0] = wx;
+  steady[1] = wy;
+  steady[2] = wz;
+
+  UpdateDirection();
+}
+
+void WindField::AddGust(double start, double duration, double wx, double wy, double wz)
+{
+  wind_gust_t gust;
+  gust.start = start;
+  gust.duration = duration;
+  gust.amplitude[0] = wx;
+  gust.amplitude[1] = wy;
+  gust.amplitude[2] = wz;
+
+  gusts.push_back(gust);
+}
+
+void WindField::ClearGusts()
+{
+  gusts.clear();
+}
+
+// Dryden spectra in distance: along wind first order, lateral and vertical
+// (1 + sqrt(3)*L*s)/(1 + L*s)^2, discretized with Tustin at dx and scaled
+// to the requested sigma
+void WindField::SetTurbulence(const double* sigma, const double* length,
+                              double dx_, unsigned int size, unsigned long seed,
+                              double min_advection_)
+{
+  dx = dx_;
+  min_advection = min_advection_;
+  UpdateDirection();
+
+  gsl_rng* rng = gsl_rng_alloc(gsl_rng_mt19937);
+  gsl_rng_set(rng, seed);
+
+  for (int i = 0; i < 3; i++)
+    {
+      table[i].assign(size, 0);
+      if ((size == 0) || (sigma[i] <= 0) || (length[i] <= 0))
+        continue;
+
+      // start the filters in steady state
+      unsigned int warmup = (unsigned int)(10*length[i]/dx) + 1;
+
+      double k = 2*length[i]/dx;
+      double b0, b1, b2, a0, a1, a2;
+      if (i == 0)
+        {
+          // (1 + L*s)^-1 = (1 + z^-1)/((1 + k) + (1 - k)*z^-1)
+          b0 = 1;
+          b1 = 1;
+          b2 = 0;
+          a0 = 1 + k;
+          a1 = 1 - k;
+          a2 = 0;
+        }
+      else
+        {
+          b0 = 1 + sqrt(3.0)*k;
+          b1 = 2;
+          b2 = 1 - sqrt(3.0)*k;
+          a0 = (1 + k)*(1 + k);
+          a1 = 2*(1 + k)*(1 - k);
+          a2 = (1 - k)*(1 - k);
+        }
+
+      double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+      double sum = 0, sum2 = 0;
+      for (unsigned int n = 0; n < warmup + size; n++)
+        {
+          double x = gsl_ran_gaussian_ziggurat(rng, 1.0);
+          double y = (b0*x + b1*x1 + b2*x2 - a1*y1 - a2*y2)/a0;
+          x2 = x1;
+          x1 = x;
+          y2 = y1;
+          y1 = y;
+
+          if (n < warmup)
+            continue;
+
+          table[i][n - warmup] = y;
+          sum += y;
+          sum2 += y*y;
+        }
+
+      double mean = sum/size;
+      double std_dev = sqrt(sum2/size - mean*mean);
+      if (std_dev <= 0)
+        continue;
+      for (unsigned int n = 0; n < size; n++)
+        table[i][n] = (table[i][n] - mean)*sigma[i]/std_dev;
+    }
+
+  gsl_rng_free(rng);
+}
+
+void WindField::GetWind(double t, const double* pos, double* wind) const
+{
+  wind[0] = steady[0];
+  wind[1] = steady[1];
+  wind[2] = steady[2];
+
+  for (unsigned int i = 0; i < gusts.size(); i++)
+    {
+      const wind_gust_t &g = gusts[i];
+      if ((t < g.start) || (t > g.start + g.duration))
+        continue;
+      double f = 0.5*(1 - cos(2*M_PI*(t - g.start)/g.duration));
+      wind[0] += f*g.amplitude[0];
+      wind[1] += f*g.amplitude[1];
+      wind[2] += f*g.amplitude[2];
+    }
+
+  unsigned int size = table[0].size();
+  if (size == 0)
+    return;
+
+  // position in the frozen turbulence, wrapped to the table
+  double xi = (dir[0]*pos[0] + dir[1]*pos[1] - advection*t)/dx;
+  xi = fmod(xi, (double)size);
+  if (xi < 0)
+    xi += size;
+  unsigned int n0 = (unsigned int)xi;
+  if (n0 >= size)
+    n0 = 0;
+  unsigned int n1 = (n0 + 1 < size) ? n0 + 1 : 0;
+  double f = xi - n0;
+
+  double u = table[0][n0] + f*(table[0][n1] - table[0][n0]);
+  double v = table[1][n0] + f*(table[1][n1] - table[1][n0]);
+  double w = table[2][n0] + f*(table[2][n1] - table[2][n0]);
+
+  wind[0] += dir[0]*u - dir[1]*v;
+  wind[1] += dir[1]*u + dir[0]*v;
+  wind[2] += w;
+}
+
+int WindField::WriteConfiguration(FILE* file) const
+{
+  bool ok = WriteBinary(file, steady) && WriteBinary(file, gusts) &&
+    WriteBinary(file, min_advection) && WriteBinary(file, dx) &&
+    WriteBinary(file, table[0]) && WriteBinary(file, table[1]) &&
+    WriteBinary(file, table[2]);
+
+  return ok ? 0 : -1;
+}
+
+int WindField::ReadConfiguration(FILE* file)
+{
+  bool ok = ReadBinary(file, steady) && ReadBinary(file, gusts) &&
+    ReadBinary(file, min_advection) && ReadBinary(file, dx) &&
+    ReadBinary(file, table[0]) && ReadBinary(file, table[1]) &&
+    ReadBinary(file, table[2]);
+
+  UpdateDirection();
+
+  return ok ? 0 : -1;
+}
+
+void WindField::UpdateDirection()
+{
+  double speed = sqrt(steady[0]*steady[0] + steady[1]*steady[1]);
+  if (speed > 1e-6)
+    {
+      dir[0] = steady[0]/speed;
+      dir[1] = steady[1]/speed;
+    }
+  else
+    {
+      dir[0] = 1;
+      dir[1] = 0;
+    }
+
+  advection = (speed > min_advection) ? speed : min_advection;
+}
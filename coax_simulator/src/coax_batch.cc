@@ -0,0 +1,168 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <ros/ros.h>
+
+#include "CoaXBatch.h"
+#include "CoaXParams.h"
+
+// The coax_ros_control controller flown by batch/vehicles CoaX per
+// trajectory type TRAJECTORY_SPIRAL to TRAJECTORY_STEP for batch/duration,
+// once in double and once in float from the same starts. The start poses
+// are offset at random, uniformly within batch/offset (m) and
+// batch/yaw_offset (rad). The gains are read under control/ with
+// LoadControlParams, as in coax_ros_control, and with
+// control/inner_loop/enabled the attitude loop runs at
+// control/inner_loop/rate between the position steps.
+//
+// Writes to <output> and stdout one line per type: the time per vehicle and
+// integration step in double and float, the largest position and roll or
+// pitch difference between them over the flight, and the tracking error of
+// each, root mean square over the vehicles and largest. Yaw is left out of
+// the comparison: off the reference the heading loop can go into a limit
+// cycle of several rad/s, in CoaXModel as well, where the two part ways.
+
+template <class T>
+void tracking_error(const CoaXBatch<T> &batch, double &rms, double &max)
+{
+  rms = 0;
+  max = 0;
+  unsigned int n = batch.GetVehicles();
+  for (unsigned int k = 0; k < n; k++)
+    {
+      double r, m;
+      batch.GetTrackingError(k, r, m);
+      rms += r*r/n;
+      max = (m > max) ? m : max;
+    }
+  rms = sqrt(rms);
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "coax_batch");
+  ros::NodeHandle n("~");
+
+  CoaXModel model;
+  load_model_params(n, &model);
+
+  control_params_t gains;
+  LoadControlParams(n, "control/", gains);
+  attitude_params_t attitude_gains;
+  LoadAttitudeParams(n, "control/inner_loop/", attitude_gains);
+  bool inner_loop;
+  double inner_rate;
+  n.param("control/inner_loop/enabled", inner_loop, false);
+  n.param("control/inner_loop/rate", inner_rate, 200.0);
+  inner_loop = inner_loop && (inner_rate > 0);
+
+  int vehicles, seed;
+  double duration, time_step, control_period, offset, yaw_offset;
+  std::string output;
+  n.param("batch/vehicles", vehicles, 64);
+  n.param("batch/duration", duration, 20.0);
+  n.param("batch/time_step", time_step, 1e-3);
+  n.param("batch/control_period", control_period, 0.01);
+  n.param("batch/offset", offset, 0.1);
+  n.param("batch/yaw_offset", yaw_offset, 0.1);
+  n.param("batch/seed", seed, 1);
+  n.param("output", output, std::string("coax_batch.txt"));
+  vehicles = (vehicles > 0) ? vehicles : 1;
+
+  CoaXBatch<double> batch_double;
+  CoaXBatch<float> batch_float;
+  batch_double.SetModel(&model);
+  batch_float.SetModel(&model);
+  batch_double.SetGains(gains);
+  batch_float.SetGains(gains);
+  batch_double.SetTimeStep(time_step, control_period);
+  batch_float.SetTimeStep(time_step, control_period);
+  batch_double.SetInnerLoop(inner_loop, attitude_gains, 1/inner_rate);
+  batch_float.SetInnerLoop(inner_loop, attitude_gains, 1/inner_rate);
+
+  int steps = (int)floor(control_period/time_step + 0.5);
+  steps = (steps > 1) ? steps : 1;
+  int updates = (int)ceil(duration/(steps*time_step));
+
+  FILE* report = fopen(output.c_str(), "w");
+  if (!report)
+    {
+      ROS_WARN("Cannot write the report %s", output.c_str());
+    }
+
+  char line[512];
+  snprintf(line, sizeof(line), "# %d vehicles, %.1f s, step %g s, control period %g s, inner loop %g Hz (0: off)\n"
+           "# type  ns/step double  float  speedup  max diff position (m)  roll/pitch (rad)"
+           "  tracking rms/max double  float (m)\n",
+           vehicles, updates*steps*time_step, time_step, steps*time_step,
+           inner_loop ? inner_rate : 0.0);
+  fputs(line, stdout);
+  if (report)
+    fputs(line, report);
+
+  srand(seed);
+  for (int type = TRAJECTORY_SPIRAL; type <= TRAJECTORY_STEP; type++)
+    {
+      double start = batch_double.GetTime();
+      batch_double.SetVehicles(vehicles);
+      batch_float.SetVehicles(vehicles);
+      for (int k = 0; k < vehicles; k++)
+        {
+          double pose_offset[4];
+          for (int i = 0; i < 4; i++)
+            pose_offset[i] = ((i < 3) ? offset : yaw_offset)*(2.0*rand()/RAND_MAX - 1);
+          batch_double.SetTrajectory(k, type, start, pose_offset);
+          batch_float.SetTrajectory(k, type, start, pose_offset);
+        }
+
+      ros::WallDuration time_double, time_float;
+      double position_difference = 0;
+      double tilt_difference = 0;
+      for (int u = 0; u < updates; u++)
+        {
+          ros::WallTime t = ros::WallTime::now();
+          batch_double.Update();
+          time_double += ros::WallTime::now() - t;
+          t = ros::WallTime::now();
+          batch_float.Update();
+          time_float += ros::WallTime::now() - t;
+
+          for (int k = 0; k < vehicles; k++)
+            {
+              double a[DIMENSION], b[DIMENSION];
+              batch_double.GetState(k, a);
+              batch_float.GetState(k, b);
+              double d = 0;
+              for (int i = 0; i < 3; i++)
+                d += (a[i] - b[i])*(a[i] - b[i]);
+              d = sqrt(d);
+              position_difference = ((d > position_difference) || (d != d)) ? d : position_difference;
+              for (int i = 6; i < 8; i++)
+                {
+                  d = fabs(a[i] - b[i]);
+                  tilt_difference = ((d > tilt_difference) || (d != d)) ? d : tilt_difference;
+                }
+            }
+        }
+
+      double ns_double = time_double.toSec()/((double)updates*steps*vehicles)*1e9;
+      double ns_float = time_float.toSec()/((double)updates*steps*vehicles)*1e9;
+      double rms_double, max_double, rms_float, max_float;
+      tracking_error(batch_double, rms_double, max_double);
+      tracking_error(batch_float, rms_float, max_float);
+
+      snprintf(line, sizeof(line), "%6d  %14.1f  %6.1f  %7.2f  %23.2e  %16.2e  %10.4f/%.4f  %.4f/%.4f\n",
+               type, ns_double, ns_float, (ns_float > 0) ? ns_double/ns_float : 0,
+               position_difference, tilt_difference,
+               rms_double, max_double, rms_float, max_float);
+      fputs(line, stdout);
+      if (report)
+        fputs(line, report);
+    }
+
+  if (report)
+    fclose(report);
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+#include "CoaXParams.h"
+#include "CoaXTrimMap.h"
+
+// Flight envelope of the model: trims over the grid envelope/<condition>
+// = [start stop size], solved on all cores. Writes <output>.env and a
+// summary to <output>.txt, matlab/plot_envelope.m plots the grid.
+//
+// <output>.env, native byte order:
+//   "CXE1"
+//   for forward, lateral, climb, yaw rate: double start, double step,
+//   uint32 size
+//   uint32 n, the number of points, the yaw rate varying fastest
+//   n uint8 status: ENVELOPE_*
+//   n times 8 float32: motor commands up and lower, servos 1 and 2, roll,
+//   pitch, motor margin, servo margin
+// The margins are the distance of the closest input to its limit, negative
+// if it is beyond.
+
+enum
+{
+  ENVELOPE_NO_TRIM = 0,
+  ENVELOPE_SATURATED,
+  ENVELOPE_FEASIBLE
+};
+
+static const char envelope_magic[4] = {'C', 'X', 'E', '1'};
+
+void margins(const trim_t &trim, double &motor, double &servo)
+{
+  motor = 1;
+  servo = 1;
+  for (int i = 0; i < 2; i++)
+    {
+      motor = (trim.motor[i] < motor) ? trim.motor[i] : motor;
+      motor = (1 - trim.motor[i] < motor) ? 1 - trim.motor[i] : motor;
+      servo = (1 - fabs(trim.servo[i]) < servo) ? 1 - fabs(trim.servo[i]) : servo;
+    }
+}
+
+unsigned char status(const trim_t &trim)
+{
+  if (!trim.converged)
+    return ENVELOPE_NO_TRIM;
+
+  return trim.feasible ? ENVELOPE_FEASIBLE : ENVELOPE_SATURATED;
+}
+
+int write_envelope(const std::string &filename, const CoaXTrimMap &map)
+{
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file)
+    return -1;
+
+  bool ok = (fwrite(envelope_magic, sizeof(envelope_magic), 1, file) == 1);
+  for (int a = 0; a < TRIM_AXES; a++)
+    {
+      const trim_axis_t &axis = map.GetAxis(a);
+      ok = ok && (fwrite(&axis.start, sizeof(double), 1, file) == 1) &&
+        (fwrite(&axis.step, sizeof(double), 1, file) == 1) &&
+        (fwrite(&axis.size, sizeof(unsigned int), 1, file) == 1);
+    }
+
+  unsigned int n = map.GetSize();
+  ok = ok && (fwrite(&n, sizeof(n), 1, file) == 1);
+
+  std::vector<unsigned char> states(n);
+  std::vector<float> values(8*n);
+  for (unsigned int i = 0; i < n; i++)
+    {
+      const trim_t &trim = map.GetTrim(i);
+      double motor, servo;
+      margins(trim, motor, servo);
+
+      states[i] = status(trim);
+      float* v = &values[8*i];
+      v[0] = trim.motor[0];
+      v[1] = trim.motor[1];
+      v[2] = trim.servo[0];
+      v[3] = trim.servo[1];
+      v[4] = trim.roll;
+      v[5] = trim.pitch;
+      v[6] = motor;
+      v[7] = servo;
+    }
+  ok = ok && (fwrite(&states[0], 1, n, file) == n) &&
+    (fwrite(&values[0], sizeof(float), 8*n, file) == 8*n);
+
+  if (fclose(file) != 0)
+    ok = false;
+
+  return ok ? 0 : -1;
+}
+
+// index of the sample closest to 0
+unsigned int zero_index(const trim_axis_t &axis)
+{
+  if ((axis.size < 2) || (axis.step == 0))
+    return 0;
+
+  double u = floor(-axis.start/axis.step + 0.5);
+  u = (u > 0) ? u : 0;
+  u = (u < axis.size - 1) ? u : axis.size - 1;
+
+  return (unsigned int)u;
+}
+
+void write_summary(FILE* file, const CoaXTrimMap &map)
+{
+  const char* axis_names[TRIM_AXES] = {"forward speed", "lateral speed",
+                                       "climb rate", "yaw rate"};
+  const char* axis_units[TRIM_AXES] = {"m/s", "m/s", "m/s", "rad/s"};
+
+  unsigned int n = map.GetSize();
+  unsigned int count[3] = {0, 0, 0};
+  double largest[TRIM_AXES];
+  for (int a = 0; a < TRIM_AXES; a++)
+    largest[a] = 0;
+
+  for (unsigned int i = 0; i < n; i++)
+    {
+      const trim_t &trim = map.GetTrim(i);
+      count[status(trim)]++;
+      if (!trim.feasible)
+        continue;
+
+      trim_condition_t c;
+      map.GetCondition(i, c);
+      double value[TRIM_AXES] = {c.forward, c.lateral, c.climb, c.yaw_rate};
+      for (int a = 0; a < TRIM_AXES; a++)
+        largest[a] = (fabs(value[a]) > largest[a]) ? fabs(value[a]) : largest[a];
+    }
+
+  fprintf(file, "%u trim conditions: %u feasible, %u with saturated inputs, %u without trim\n",
+          n, count[ENVELOPE_FEASIBLE], count[ENVELOPE_SATURATED], count[ENVELOPE_NO_TRIM]);
+
+  // walk out from the point closest to hover along each axis
+  unsigned int center[TRIM_AXES];
+  unsigned int stride[TRIM_AXES];
+  unsigned int s = 1;
+  for (int a = TRIM_AXES - 1; a >= 0; a--)
+    {
+      center[a] = zero_index(map.GetAxis(a));
+      stride[a] = s;
+      s *= map.GetAxis(a).size;
+    }
+  unsigned int c = 0;
+  for (int a = 0; a < TRIM_AXES; a++)
+    c += center[a]*stride[a];
+
+  const trim_t &hover = map.GetTrim(c);
+  double motor, servo;
+  margins(hover, motor, servo);
+  fprintf(file, "closest to hover: motors %.4f %.4f, servos %.4f %.4f, "
+          "motor margin %.4f, servo margin %.4f\n",
+          hover.motor[0], hover.motor[1], hover.servo[0], hover.servo[1], motor, servo);
+  if (!hover.feasible)
+    return;
+
+  fprintf(file, "feasible from hover with the other conditions closest to 0:\n");
+  for (int a = 0; a < TRIM_AXES; a++)
+    {
+      const trim_axis_t &axis = map.GetAxis(a);
+      unsigned int low = center[a];
+      while ((low > 0) && map.GetTrim(c - (center[a] - low + 1)*stride[a]).feasible)
+        low--;
+      unsigned int high = center[a];
+      while ((high + 1 < axis.size) && map.GetTrim(c + (high + 1 - center[a])*stride[a]).feasible)
+        high++;
+
+      fprintf(file, "  %-13s %8.3f to %8.3f %s%s\n", axis_names[a],
+              axis.start + low*axis.step, axis.start + high*axis.step, axis_units[a],
+              ((low == 0) || (high + 1 == axis.size)) ? " (grid limit)" : "");
+    }
+
+  fprintf(file, "largest feasible anywhere:\n");
+  for (int a = 0; a < TRIM_AXES; a++)
+    fprintf(file, "  %-13s %8.3f %s\n", axis_names[a], largest[a], axis_units[a]);
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "coax_envelope");
+  ros::NodeHandle n("~");
+
+  CoaXModel model;
+  load_model_params(n, &model);
+
+  CoaXTrim trim;
+  trim.SetModel(&model);
+
+  CoaXTrimMap map;
+  load_trim_axes(n, "envelope", map);
+
+  int threads;
+  n.param("threads", threads, (int)sysconf(_SC_NPROCESSORS_ONLN));
+  std::string output;
+  n.param("output", output, std::string("coax_envelope"));
+
+  ros::WallTime start = ros::WallTime::now();
+  map.Build(trim, (threads > 0) ? threads : 1);
+  ROS_INFO("%s: %u trim conditions on %d threads in %.1f s",
+           ros::this_node::getName().c_str(), map.GetSize(), threads,
+           (ros::WallTime::now() - start).toSec());
+
+  if (write_envelope(output + ".env", map) != 0)
+    {
+      ROS_ERROR("Cannot write the envelope %s.env", output.c_str());
+      return -1;
+    }
+
+  FILE* summary = fopen((output + ".txt").c_str(), "w");
+  if (summary)
+    {
+      write_summary(summary, map);
+      fclose(summary);
+    }
+  write_summary(stdout, map);
+
+  return 0;
+}
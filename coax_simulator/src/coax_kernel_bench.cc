@@ -0,0 +1,176 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "CoaXDynamics.h"
+#include "coax_dynamics/CoaXControl.h"
+
+// Time per evaluation of the dynamics and control kernels, in the math
+// mode the package is built with (COAX_FAST_MATH or not, see the
+// CMakeLists). Each loop is timed repeats times, the fastest counts. The
+// inputs move a little at every evaluation so that nothing is hoisted out
+// of the loops. Does not use ROS.
+
+// nominal CoaX 56, as in coax_simulator/config/coax_parameters.yaml
+void set_model(CoaXModel &model)
+{
+  model.SetMass(0.302);
+  model.SetInertia(1.837e-3, 1.837e-3, 2.7786e-4);
+  model.SetRotorOffset(0.165, 0.103);
+  model.SetRotorLinkageFactor(0.6130, 0.5176);
+  model.SetRotorSpringConstant(0.0542, 0.2139);
+  model.SetRotorThrustFactor(2.2607e-5, 3.1531e-5);
+  model.SetRotorMomentFactor(9.9708e-7, 8.9737e-7);
+  model.SetUpperRotorFollowingTime(1.6);
+  model.SetMotorFollowingTime(0.185, 0.115);
+  model.SetUpperRotorSpeedConversion(421.3723, -0.2555);
+  model.SetLowerRotorSpeedConversion(437.7036, -2.9047);
+  model.SetUpperPhaseLag(-0.001282, 0.1789);
+  model.SetLowerPhaseLag(0.001282, -0.0094);
+  model.SetMaximumSwashPlateAngle(0.2618);
+}
+
+double seconds(clock_t start)
+{
+  return (double)(clock() - start)/CLOCKS_PER_SEC;
+}
+
+void report(const char* name, double best, int evaluations)
+{
+  printf("%-24s %8.1f ns/eval\n", name, best/evaluations*1e9);
+}
+
+template <class T>
+double control_law(const model_params_t &param, const control_params_t &gains, int evaluations)
+{
+  T state[DIMENSION] = {T(0.1), T(-0.05), T(0.95), T(0.2), T(-0.1), T(0.05),
+                        T(0.05), T(-0.08), T(0.3), T(0.2), T(-0.1), T(0.3),
+                        T(230), T(240), T(0.05), T(-0.04), T(0.9975)};
+  T reference[REFERENCE_DIMENSION] = {0, 0, 1, 0, 0, 0, 0, 0, 0, T(0.2), T(0.5)};
+  T control[4];
+  T sum = 0;
+
+  clock_t start = clock();
+  for (int i = 0; i < evaluations; i++)
+    {
+      state[8] = T(0.3) + T(1e-7)*T(i & 1023);
+      T R[3][3];
+      EulerToRotation(state[6], state[7], state[8], R);
+      ControlLaw(state, R, reference, param, gains, control);
+      sum += control[0] + control[2];
+    }
+  double time = seconds(start);
+
+  if (sum != sum)
+    fprintf(stderr, "NaN in the control law\n");
+  return time;
+}
+
+int main(int argc, char** argv)
+{
+  int evaluations = (argc > 1) ? atoi(argv[1]) : 1000000;
+  int repeats = (argc > 2) ? atoi(argv[2]) : 5;
+  if ((evaluations < 1) || (repeats < 1))
+    {
+      fprintf(stderr, "usage: %s [evaluations] [repeats]\n", argv[0]);
+      return -1;
+    }
+
+  CoaXModel model;
+  set_model(model);
+  const model_params_t* param = model.GetModelParams();
+  double theta[MODEL_PARAMETERS];
+  model.GetParameters(theta);
+
+  control_params_t gains;
+  gains.Kp_Fx = 0.7;
+  gains.Kp_Fy = 0.7;
+  gains.Kd_Fx = 0.4;
+  gains.Kd_Fy = 0.4;
+  gains.Kp_Fz = 6.04;
+  gains.Kd_Fz = 3.02;
+  gains.Kp_Mz = 0.013893;
+  gains.Kd_Mz = 0.00166716;
+  gains.Kpq_roll = -0.04;
+  gains.Kpq_pitch = 0.04;
+
+#ifdef COAX_FAST_MATH
+  printf("COAX_FAST_MATH, %d evaluations, best of %d\n", evaluations, repeats);
+#else
+  printf("libm, %d evaluations, best of %d\n", evaluations, repeats);
+#endif
+
+  double sum = 0;
+  double best;
+
+  // equations of motion at a hover with some tilt and rates
+  double state[ODE_DIMENSION] = {0.1, 0.2, 1.0, 0.3, -0.2, 0.1,
+                                 0.99, 0.05, -0.08, 0.02,
+                                 0.3, -0.2, 0.1, 230, 240,
+                                 0.05, -0.04, 0.9975};
+  double u[4] = {0.55, 0.56, 0.2, -0.1};
+  double xdot[ODE_DIMENSION];
+  double acc[3];
+  best = HUGE_VAL;
+  for (int k = 0; k < repeats; k++)
+    {
+      clock_t start = clock();
+      for (int i = 0; i < evaluations; i++)
+        {
+          state[10] = 0.3 + 1e-7*(i & 1023);
+          CoaXDerivatives(0.0, state, xdot, theta, u, param, acc);
+          sum += xdot[12];
+        }
+      double time = seconds(start);
+      best = (time < best) ? time : best;
+    }
+  report("CoaXDerivatives", best, evaluations);
+
+  // thrust directions and attitude of the controller
+  best = HUGE_VAL;
+  for (int k = 0; k < repeats; k++)
+    {
+      clock_t start = clock();
+      for (int i = 0; i < evaluations; i++)
+        {
+          double d = 1e-9*(i & 1023);
+          double z_bar[3] = {0.05 + d, -0.04, 0.9975};
+          double z_Tup[3];
+          UpperThrustDirection(z_bar, 0.613, 0.1789 - 0.001282*230, z_Tup);
+          double z_Tlo[3] = {0.03, -0.02 + d, 0.99935};
+          double servo[2];
+          LowerThrustServos(z_Tlo, 0.5176, 0.001282*240 - 0.0094, 0.2618, servo);
+          double q[4] = {0.99, 0.05, -0.08, 0.02 + d};
+          double roll, pitch, yaw;
+          QuaternionToEuler(q, roll, pitch, yaw);
+          double R[3][3];
+          EulerToRotation(roll, pitch, yaw, R);
+          sum += z_Tup[0] + servo[0] + R[0][1];
+        }
+      double time = seconds(start);
+      best = (time < best) ? time : best;
+    }
+  report("thrust and attitude", best, evaluations);
+
+  best = HUGE_VAL;
+  for (int k = 0; k < repeats; k++)
+    {
+      double time = control_law<double>(*param, gains, evaluations);
+      best = (time < best) ? time : best;
+    }
+  report("ControlLaw double", best, evaluations);
+
+  best = HUGE_VAL;
+  for (int k = 0; k < repeats; k++)
+    {
+      double time = control_law<float>(*param, gains, evaluations);
+      best = (time < best) ? time : best;
+    }
+  report("ControlLaw float", best, evaluations);
+
+  if (sum != sum)
+    fprintf(stderr, "NaN in the kernels\n");
+
+  return 0;
+}
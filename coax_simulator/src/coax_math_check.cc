@@ -0,0 +1,106 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+// the polynomials are checked whatever the package builds with
+#ifndef COAX_FAST_MATH
+#define COAX_FAST_MATH
+#endif
+#include "coax_dynamics/CoaXMath.h"
+
+// Error sweep of the COAX_FAST_MATH functions of coax_dynamics/CoaXMath.h
+// against long double libm, over the domains of the table there. Fails
+// when an error is above the bound of the table, does not use ROS.
+
+typedef struct
+{
+  const char* name;
+  double abs_bound;
+  double abs_error;
+} sweep_t;
+
+// uniform in [a b]
+double uniform(double a, double b)
+{
+  return a + (b - a)*rand()/RAND_MAX;
+}
+
+// +-10^[-30 30], 0 now and then
+double magnitude()
+{
+  if (rand() % 64 == 0)
+    return 0;
+  double v = pow(10.0, uniform(-30, 30));
+  return (rand() & 1) ? -v : v;
+}
+
+void record(sweep_t &sweep, double value, long double reference)
+{
+  double e = (double)fabsl((long double)value - reference);
+  sweep.abs_error = ((e > sweep.abs_error) || (e != e)) ? e : sweep.abs_error;
+}
+
+int main(int argc, char** argv)
+{
+  int samples = (argc > 1) ? atoi(argv[1]) : 1000000;
+  if (samples < 1)
+    {
+      fprintf(stderr, "usage: %s [samples]\n", argv[0]);
+      return -1;
+    }
+
+  sweep_t sweeps[] = {
+    {"sin", 2.7e-9, 0},
+    {"cos", 2.7e-9, 0},
+    {"asin", 5.1e-9, 0},
+    {"acos", 5.1e-9, 0},
+    {"atan2", 8.1e-9, 0},
+    {"sin float", 9.8e-8, 0},
+    {"cos float", 9.8e-8, 0},
+    {"asin float", 1.8e-7, 0},
+    {"acos float", 3.2e-7, 0},
+    {"atan2 float", 2.9e-7, 0}
+  };
+  int count = sizeof(sweeps)/sizeof(sweeps[0]);
+
+  srand(1);
+  for (int i = 0; i <= samples; i++)
+    {
+      // the ends of the domains, then at random; angles near zero as well
+      // as across the range
+      double a = (i == 0) ? 1e5 : ((i % 2) ? uniform(-1e5, 1e5) : uniform(-4, 4));
+      double s = (i == 0) ? 1 : uniform(-1, 1);
+      double y = magnitude();
+      double x = magnitude();
+      float af = (i == 0) ? 8e3f : (float)((i % 2) ? uniform(-8e3, 8e3) : uniform(-4, 4));
+      float sf = (float)s;
+      float yf = (float)y;
+      float xf = (float)x;
+
+      record(sweeps[0], coax_math::sin(a), sinl(a));
+      record(sweeps[1], coax_math::cos(a), cosl(a));
+      record(sweeps[2], coax_math::asin(s), asinl(s));
+      record(sweeps[3], coax_math::acos(s), acosl(s));
+      record(sweeps[4], coax_math::atan2(y, x), atan2l(y, x));
+      record(sweeps[5], coax_math::sin(af), sinl(af));
+      record(sweeps[6], coax_math::cos(af), cosl(af));
+      record(sweeps[7], coax_math::asin(sf), asinl(sf));
+      record(sweeps[8], coax_math::acos(sf), acosl(sf));
+      record(sweeps[9], coax_math::atan2(yf, xf), atan2l(yf, xf));
+    }
+
+  bool passed = true;
+  printf("%d samples per function\n", samples);
+  printf("function      abs error  bound\n");
+  for (int i = 0; i < count; i++)
+    {
+      const sweep_t &sweep = sweeps[i];
+      bool ok = sweep.abs_error <= sweep.abs_bound;
+      printf("%-12s  %.2e   %.2e  %s\n", sweep.name, sweep.abs_error,
+             sweep.abs_bound, ok ? "" : "FAILED");
+      passed = passed && ok;
+    }
+  printf("%s\n", passed ? "PASSED" : "FAILED");
+
+  return passed ? 0 : 1;
+}
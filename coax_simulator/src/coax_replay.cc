@@ -0,0 +1,146 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "CoaXSimulator.h"
+#include "CoaXRadio.h"
+#include "CoaXJournal.h"
+
+// Reruns a journal written by coax_simulator without ROS and as fast as
+// possible. The events are scheduled in the same order as coax_simulator
+// does, so that the model is integrated between the same points in time.
+
+CoaXSimulator simulator;
+CoaXRadio radio(simulator.GetModelPtr());
+
+// odometry delivery only splits the integration
+void no_event(double time, void* data)
+{
+}
+
+// telemetry delivery frees the slots of the states that arrived, so that
+// the queue fills up and drops states as in coax_simulator
+void state_deliver(double time, void* data)
+{
+  while (radio.ReceiveState(time) >= 0)
+    continue;
+}
+
+void command_apply(double time, void* data)
+{
+  radio.ApplyCommand(time);
+}
+
+void onboard_update(double time, void* data)
+{
+  simulator.GetModelPtr()->UpdateOnboard();
+}
+
+void state_publish(double time, void* data)
+{
+  unsigned int slot;
+  double arrival = radio.SendState(time, slot);
+
+  if (arrival >= 0)
+    simulator.ScheduleEvent(arrival, state_deliver, NULL);
+}
+
+void apply_entry(const journal_entry_t &entry)
+{
+  switch (entry.type)
+    {
+    case JOURNAL_RESET:
+      simulator.ResetSimulation();
+      radio.Reset();
+      break;
+    case JOURNAL_RAW_COMMAND:
+      radio.SendRawCommand(entry.time, entry.value[0], entry.value[1],
+                           entry.value[2], entry.value[3]);
+      break;
+    case JOURNAL_CONTROL:
+      radio.SendControl(entry.time, entry.value[0], entry.value[1],
+                        entry.value[2], entry.value[3]);
+      break;
+    case JOURNAL_NAV_STATE:
+      radio.ReachNavState(entry.time, entry.mode);
+      break;
+    case JOURNAL_TRIM:
+      radio.SetTrim(entry.time, entry.mode, entry.value[0], entry.value[1]);
+      break;
+    case JOURNAL_TIMEOUT:
+      radio.SetControlTimeout(entry.time, entry.value[0]);
+      break;
+    default:
+      break;
+    }
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+    {
+      fprintf(stderr, "usage: %s journal [trace]\n", argv[0]);
+      return -1;
+    }
+
+  CoaXJournal journal;
+  journal_rates_t rates;
+  if (journal.Open(argv[1], simulator, radio, rates) != 0)
+    {
+      fprintf(stderr, "Cannot read the journal %s\n", argv[1]);
+      return -1;
+    }
+
+  FILE* trace = NULL;
+  if (argc > 2)
+    {
+      trace = fopen(argv[2], "w");
+      if (!trace)
+        {
+          fprintf(stderr, "Cannot write the trace %s\n", argv[2]);
+          return -1;
+        }
+    }
+
+  if (rates.odometry > 0)
+    simulator.AddPeriodicEvent(1.0/rates.odometry, 0, no_event, NULL);
+  if (rates.command > 0)
+    simulator.AddPeriodicEvent(1.0/rates.command, 0, command_apply, NULL);
+  if (rates.onboard > 0)
+    simulator.AddPeriodicEvent(1.0/rates.onboard, 0, onboard_update, NULL);
+  if (rates.state > 0)
+    simulator.AddPeriodicEvent(1.0/rates.state, 0, state_publish, NULL);
+
+  clock_t start = clock();
+
+  // inputs of tick n arrived after n updates, a journal that was not
+  // closed ends with its last input
+  journal_entry_t entry;
+  bool more = journal.Next(entry);
+  while (more)
+    {
+      while (more && (entry.type != JOURNAL_END) &&
+             (entry.tick <= simulator.GetTick()))
+        {
+          apply_entry(entry);
+          more = journal.Next(entry);
+        }
+
+      if (!more || ((entry.type == JOURNAL_END) &&
+                    (entry.tick <= simulator.GetTick())))
+        break;
+
+      simulator.Update();
+      if (trace)
+        simulator.PrintState(trace);
+    }
+
+  double cpu = (double)(clock() - start)/CLOCKS_PER_SEC;
+  fprintf(stderr, "Replayed %lu ticks (%.2f s simulated) in %.2f s\n",
+          simulator.GetTick(), simulator.GetSimulationTime(), cpu);
+
+  if (trace)
+    fclose(trace);
+
+  return 0;
+}
@@ -3,88 +3,191 @@
 #include <std_msgs/Empty.h>
 
 #include "CoaXSimulator.h"
+#include "CoaXJournal.h"
+#include "CoaXParams.h"
 #include "ROSCoaX.h"
 
 CoaXSimulator simulator;
+ROSCoaX *coax_ptr = NULL;
+bool use_sim_time;
+CoaXJournal journal;
 
 void reset(const std_msgs::Empty::ConstPtr &msg)
 {
   ROS_INFO("%s: resetting simulation", ros::this_node::getName().c_str());
+  journal.Record(JOURNAL_RESET, simulator.GetSimulationTime(), 0, NULL);
   simulator.ResetSimulation();
+  coax_ptr->Reset();
 }
 
-void load_model_params(ros::NodeHandle &n)
+// Simulator events, data is the ROSCoaX object
+void odometry_publish(double time, void* data)
+{
+  ((ROSCoaX*)data)->PublishOdometry(time, use_sim_time ? ros::Time(time) : ros::Time::now());
+}
+
+void command_apply(double time, void* data)
+{
+  ((ROSCoaX*)data)->ApplyCommand(time);
+}
+
+void onboard_update(double time, void* data)
+{
+  simulator.GetModelPtr()->UpdateOnboard();
+}
+
+void state_deliver(double time, void* data)
+{
+  ((ROSCoaX*)data)->PublishState(time);
+}
+
+void state_publish(double time, void* data)
+{
+  ROSCoaX *coax = (ROSCoaX*)data;
+  double arrival = coax->SampleState(time, use_sim_time ? ros::Time(time) : ros::Time::now());
+
+  if (arrival >= 0)
+    simulator.ScheduleEvent(arrival, state_deliver, data);
+}
+
+void load_wind_params(ros::NodeHandle &n)
+{
+  WindField *wind = simulator.GetWindFieldPtr();
+
+  double wx, wy, wz;
+  n.param("wind/steady/x", wx, 0.0);
+  n.param("wind/steady/y", wy, 0.0);
+  n.param("wind/steady/z", wz, 0.0);
+  wind->SetSteady(wx, wy, wz);
+
+  // gusts: list of [start duration x y z]
+  XmlRpc::XmlRpcValue gusts;
+  if (n.getParam("wind/gusts", gusts) &&
+      (gusts.getType() == XmlRpc::XmlRpcValue::TypeArray))
+    {
+      for (int i = 0; i < gusts.size(); i++)
+        {
+          if ((gusts[i].getType() != XmlRpc::XmlRpcValue::TypeArray) ||
+              (gusts[i].size() != 5))
+            {
+              ROS_WARN("Ignoring wind gust %d, expected [start duration x y z]", i);
+              continue;
+            }
+          wind->AddGust(xmlrpc_to_double(gusts[i][0]), xmlrpc_to_double(gusts[i][1]),
+                        xmlrpc_to_double(gusts[i][2]), xmlrpc_to_double(gusts[i][3]),
+                        xmlrpc_to_double(gusts[i][4]));
+        }
+    }
+
+  double sigma[3], length[3];
+  n.param("wind/turbulence/sigma/u", sigma[0], 0.0);
+  n.param("wind/turbulence/sigma/v", sigma[1], 0.0);
+  n.param("wind/turbulence/sigma/w", sigma[2], 0.0);
+  n.param("wind/turbulence/length/u", length[0], 1.0);
+  n.param("wind/turbulence/length/v", length[1], 1.0);
+  n.param("wind/turbulence/length/w", length[2], 1.0);
+
+  double resolution, min_advection;
+  int size, seed;
+  n.param("wind/turbulence/resolution", resolution, 0.05);
+  n.param("wind/turbulence/size", size, 0);
+  n.param("wind/turbulence/seed", seed, 0);
+  n.param("wind/turbulence/min_advection", min_advection, 0.5);
+  if (size > 0)
+    wind->SetTurbulence(sigma, length, resolution, size, seed, min_advection);
+
+  return;
+}
+
+void load_proximity_params(ros::NodeHandle &n)
+{
+  ProximityTables *proximity = simulator.GetProximityTablesPtr();
+
+  double rotor_radius;
+  n.param("proximity/rotor_radius", rotor_radius, 0.17);
+  proximity->SetRotorRadius(rotor_radius);
+
+  std::string tables;
+  n.param("proximity/tables", tables, std::string(""));
+  if ((tables != "") && (proximity->Load(tables) != 0))
+    ROS_WARN("Failed to load proximity tables from %s, flying without ground and wall effect",
+             tables.c_str());
+
+  // walls: list of [x y nx ny], a point on the wall and the normal towards
+  // the flight space
+  XmlRpc::XmlRpcValue walls;
+  if (n.getParam("proximity/walls", walls) &&
+      (walls.getType() == XmlRpc::XmlRpcValue::TypeArray))
+    {
+      for (int i = 0; i < walls.size(); i++)
+        {
+          if ((walls[i].getType() != XmlRpc::XmlRpcValue::TypeArray) ||
+              (walls[i].size() != 4))
+            {
+              ROS_WARN("Ignoring wall %d, expected [x y nx ny]", i);
+              continue;
+            }
+          proximity->AddWall(xmlrpc_to_double(walls[i][0]), xmlrpc_to_double(walls[i][1]),
+                             xmlrpc_to_double(walls[i][2]), xmlrpc_to_double(walls[i][3]));
+        }
+    }
+
+  return;
+}
+
+// Trim map over trim/<condition> = [start stop size], cached in the file
+// trim/map and rebuilt when the model parameters or the axes change. With
+// init/trim the vehicle starts in the hover trim instead of at
+// init/Omega_*.
+void load_trim_params(ros::NodeHandle &n)
 {
   CoaXModel *model = simulator.GetModelPtr();
 
-  double m;
-  n.getParam("mass", m);
-  model->SetMass(m);
-
-  double Ixx, Iyy, Izz;
-  n.getParam("inertia/Ixx", Ixx);
-  n.getParam("inertia/Iyy", Iyy);
-  n.getParam("inertia/Izz", Izz);
-  model->SetInertia(Ixx, Iyy, Izz);
-
-  double d_up, d_lo;
-  n.getParam("offset/upper", d_up);
-  n.getParam("offset/lower", d_lo);
-  model->SetRotorOffset(d_up, d_lo);
-
-  double l_up, l_lo;
-  n.getParam("linkage_factor/upper", l_up);
-  n.getParam("linkage_factor/lower", l_lo);
-  model->SetRotorLinkageFactor(l_up, l_lo);
-
-  double k_springup, k_springlo;
-  n.getParam("spring_constant/upper", k_springup);
-  n.getParam("spring_constant/lower", k_springlo);
-  model->SetRotorSpringConstant(k_springup, k_springlo);
-
-  double k_Tup, k_Tlo;
-  n.getParam("thrust_factor/upper", k_Tup);
-  n.getParam("thrust_factor/lower", k_Tlo);
-  model->SetRotorThrustFactor(k_Tup, k_Tlo);
-
-  double k_Mup, k_Mlo;
-  n.getParam("moment_factor/upper", k_Mup);
-  n.getParam("moment_factor/lower", k_Mlo);
-  model->SetRotorMomentFactor(k_Mup, k_Mlo);
-
-  double Tf_up;
-  n.getParam("following_time/bar", Tf_up);
-  model->SetUpperRotorFollowingTime(Tf_up);
-
-  double Tf_motup, Tf_motlo;
-  n.getParam("following_time/motors/upper", Tf_motup);
-  n.getParam("following_time/motors/lower", Tf_motlo);
-  model->SetMotorFollowingTime(Tf_motup, Tf_motlo);
-
-  double rs_mup, rs_bup;
-  n.getParam("speed_conversion/slope/upper", rs_mup);
-  n.getParam("speed_conversion/offset/upper", rs_bup);
-  model->SetUpperRotorSpeedConversion(rs_mup, rs_bup);
-
-  double rs_mlo, rs_blo;
-  n.getParam("speed_conversion/slope/lower", rs_mlo);
-  n.getParam("speed_conversion/offset/lower", rs_blo);
-  model->SetLowerRotorSpeedConversion(rs_mlo, rs_blo);
-	
-  double zeta_mup, zeta_bup;
-  n.getParam("phase_lag/slope/upper", zeta_mup);
-  n.getParam("phase_lag/offset/upper", zeta_bup);
-  model->SetUpperPhaseLag(zeta_mup, zeta_bup);
-	
-  double zeta_mlo, zeta_blo;
-  n.getParam("phase_lag/slope/lower", zeta_mlo);
-  n.getParam("phase_lag/offset/lower", zeta_blo);
-  model->SetLowerPhaseLag(zeta_mlo, zeta_blo);
-
-  double max_SPangle;
-  n.getParam("max_swashplate_angle", max_SPangle);
-  model->SetMaximumSwashPlateAngle(max_SPangle);
-  
+  CoaXTrim trim;
+  trim.SetModel(model);
+
+  CoaXTrimMap trim_map;
+  std::string map_file;
+  n.param("trim/map", map_file, std::string(""));
+  CoaXTrimMap grid;
+  load_trim_axes(n, "trim", grid);
+  if ((map_file != "") &&
+      ((trim_map.Load(map_file) != 0) || !trim_map.Matches(trim, grid)))
+    {
+      trim_map = grid;
+
+      unsigned int feasible = trim_map.Build(trim);
+      ROS_INFO("%s: trim map with %u of %u points feasible",
+               ros::this_node::getName().c_str(), feasible, trim_map.GetSize());
+      if (trim_map.Save(map_file) != 0)
+        ROS_WARN("Cannot write the trim map %s", map_file.c_str());
+    }
+
+  bool init_trim;
+  n.param("init/trim", init_trim, false);
+  if (!init_trim)
+    return;
+
+  trim_condition_t hover = {0, 0, 0, 0};
+  trim_t t;
+  if (trim_map.Matches(trim))
+    trim_map.Interpolate(hover, t);
+  else
+    {
+      trim.InitialGuess(t);
+      trim.Solve(hover, t);
+    }
+
+  if (!t.converged)
+    {
+      ROS_WARN("No hover trim found, starting from init/Omega_*");
+      return;
+    }
+
+  model->SetInitialRotation(t.roll, t.pitch, 0);
+  model->SetInitialRotorSpeeds(t.rotors[0], t.rotors[1]);
+  model->SetInitialStabilizerBar(t.bar[0], t.bar[1], t.bar[2]);
+
   return;
 }
 
@@ -93,17 +196,19 @@ int main(int argc, char** argv)
   ros::init(argc, argv, "coax_simulator");
   ros::NodeHandle n("~");
 
-  bool use_sim_time;
   n.param("use_sim_time", use_sim_time, true);
 
   if (use_sim_time)
     n.setParam("/use_sim_time", true);
 
   // Need to load model params before instantiating ROSCoaX object
-  load_model_params(n);
+  load_model_params(n, simulator.GetModelPtr());
+  load_wind_params(n);
+  load_proximity_params(n);
 
   std::string name("coax");
   ROSCoaX coax(simulator.GetModelPtr(), n, name);
+  coax_ptr = &coax;
 
   std::string frame_id;
   n.param("frame_id", frame_id, std::string("coax"));
@@ -124,6 +229,8 @@ int main(int argc, char** argv)
 
   simulator.GetModelPtr()->SetInitialStabilizerBar(0, 0, 1);
 
+  load_trim_params(n);
+
   int speedup;
   n.param("speedup",speedup,1);
   if (speedup < 1)
@@ -132,6 +239,45 @@ int main(int argc, char** argv)
       return -1;
     }
 
+  // Events run at their own rates in between the loop steps, the model is
+  // integrated exactly up to each of them
+  if (coax.GetOdometryRate() > 0)
+    simulator.AddPeriodicEvent(1.0/coax.GetOdometryRate(), 0, odometry_publish, &coax);
+  if (coax.GetCommandRate() > 0)
+    simulator.AddPeriodicEvent(1.0/coax.GetCommandRate(), 0, command_apply, &coax);
+  double onboard_rate;
+  n.param("rates/onboard", onboard_rate, 100.0);
+  if (onboard_rate > 0)
+    simulator.AddPeriodicEvent(1.0/onboard_rate, 0, onboard_update, NULL);
+  if (coax.GetStateRate() > 0)
+    simulator.AddPeriodicEvent(1.0/coax.GetStateRate(), 0, state_publish, &coax);
+
+  // Inputs are journaled by the tick they arrive at, coax_replay reruns
+  // the journal without ROS. The trace has the model state after every
+  // tick, like coax_replay prints it.
+  std::string journal_file, trace_file;
+  n.param("journal", journal_file, std::string(""));
+  n.param("trace", trace_file, std::string(""));
+  if (journal_file != "")
+    {
+      journal_rates_t rates;
+      rates.odometry = coax.GetOdometryRate();
+      rates.command = coax.GetCommandRate();
+      rates.onboard = onboard_rate;
+      rates.state = coax.GetStateRate();
+      if (journal.Create(journal_file, simulator, *coax.GetRadioPtr(), rates) == 0)
+        coax.GetRadioPtr()->SetJournal(&journal);
+      else
+        ROS_WARN("Cannot write the journal %s", journal_file.c_str());
+    }
+  FILE* trace = NULL;
+  if (trace_file != "")
+    {
+      trace = fopen(trace_file.c_str(), "w");
+      if (!trace)
+        ROS_WARN("Cannot write the trace %s", trace_file.c_str());
+    }
+
   ros::WallRate r(speedup*100);
 
   ros::Subscriber sub = n.subscribe("reset", 10, reset);
@@ -142,6 +288,8 @@ int main(int argc, char** argv)
   while (n.ok())
     {
       simulator.Update();
+      if (trace)
+        simulator.PrintState(trace);
 
       if (use_sim_time)
         {
@@ -149,12 +297,15 @@ int main(int argc, char** argv)
           clock_pub.publish(msgc);
         }
 
+      journal.SetTick(simulator.GetTick());
       ros::spinOnce();
 
-      simulator.GetModelPtr()->SendCommand();
-
       r.sleep();
     }
 
+  journal.Close();
+  if (trace)
+    fclose(trace);
+
   return 0;
 }
@@ -0,0 +1,102 @@
+#include <cstdio>
+
+#include <ros/ros.h>
+
+#include "CoaXCollocation.h"
+#include "CoaXParams.h"
+
+// Time- or energy-optimal transfer between the steady flight conditions
+// trajectory/start and trajectory/goal, written as a reference table that
+// coax_ros_control follows with the trajectory type TRAJECTORY_TABLE.
+//
+// <output>, text: two comment lines starting with '#', then one line
+// "time x y z vx vy vz ax ay az yaw yaw_rate" every sample_time from 0.
+// <output>.nodes holds the collocation nodes, one line per node with
+// the ODE_DIMENSION states and the motor commands and servos.
+
+int write_nodes(const std::string &filename, const CoaXCollocation &collocation)
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file)
+    return -1;
+
+  double h = collocation.GetDuration()/(collocation.GetNodes() - 1);
+  for (unsigned int k = 0; k < collocation.GetNodes(); k++)
+    {
+      double state[ODE_DIMENSION];
+      double inputs[4];
+      collocation.GetNode(k, state, inputs);
+
+      fprintf(file, "%.4f", k*h);
+      for (int i = 0; i < ODE_DIMENSION; i++)
+        fprintf(file, " %.6f", state[i]);
+      for (int i = 0; i < 4; i++)
+        fprintf(file, " %.6f", inputs[i]);
+      fprintf(file, "\n");
+    }
+
+  if (fclose(file) != 0)
+    return -1;
+
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ros::init(argc, argv, "coax_trajectory");
+  ros::NodeHandle n("~");
+
+  CoaXModel model;
+  load_model_params(n, &model);
+
+  collocation_boundary_t start, goal;
+  load_collocation_boundary(n, "trajectory/start", start);
+  load_collocation_boundary(n, "trajectory/goal", goal);
+
+  std::string objective, output;
+  double duration, min_altitude, sample_time, tolerance;
+  int nodes, max_iterations;
+  n.param("trajectory/objective", objective, std::string("time"));
+  n.param("trajectory/duration", duration, 5.0);
+  n.param("trajectory/nodes", nodes, 41);
+  n.param("trajectory/min_altitude", min_altitude, 0.3);
+  n.param("trajectory/tolerance", tolerance, 1e-6);
+  n.param("trajectory/max_iterations", max_iterations, 5000);
+  n.param("trajectory/sample_time", sample_time, 0.01);
+  n.param("output", output, std::string("coax_trajectory.txt"));
+
+  if ((objective != "time") && (objective != "energy"))
+    {
+      ROS_ERROR("Unknown trajectory objective %s, time or energy", objective.c_str());
+      return -1;
+    }
+
+  CoaXCollocation collocation;
+  collocation.SetModel(&model);
+  collocation.SetNodes((nodes > 2) ? nodes : 2);
+  collocation.SetObjective((objective == "time") ? COLLOCATION_TIME : COLLOCATION_ENERGY,
+                           duration);
+  collocation.SetMinimumAltitude(min_altitude);
+  collocation.SetTolerance(tolerance, max_iterations);
+
+  ros::WallTime solve_start = ros::WallTime::now();
+  int result = collocation.Solve(start, goal);
+  ROS_INFO("%s: %s-optimal transfer over %.3f s, %u nodes, %d iterations in %.1f s, "
+           "constraint violation %.2e", ros::this_node::getName().c_str(), objective.c_str(),
+           collocation.GetDuration(), collocation.GetNodes(), collocation.GetIterations(),
+           (ros::WallTime::now() - solve_start).toSec(), collocation.GetViolation());
+  if (result != 0)
+    {
+      ROS_ERROR("The collocation did not meet the constraints, no table written");
+      return -1;
+    }
+
+  if ((collocation.SaveTable(output, sample_time) != 0) ||
+      (write_nodes(output + ".nodes", collocation) != 0))
+    {
+      ROS_ERROR("Cannot write the trajectory %s", output.c_str());
+      return -1;
+    }
+
+  return 0;
+}
@@ -2,8 +2,7 @@
 COAX56 = 1;
 if (COAX56)
     pid = nav_msgs_Odometry('connect','subscriber','odom56','odom56');
-    iid = geometry_msgs_Quaternion('connect','subscriber','coax_info56','coax_info56');
-    imuid = geometry_msgs_Quaternion('connect','subscriber','coax_imu56','coax_imu56');
+    sid = nav_msgs_Odometry('connect','subscriber','coax_state56','coax_state56');
     mid = std_msgs_Bool('connect','publisher','nav_mode56','nav_mode56');
     cid = geometry_msgs_Quaternion('connect','publisher','raw_control56','raw_control56');
     cmid = geometry_msgs_Quaternion('connect','subscriber','control_mode56','control_mode56');
@@ -11,7 +10,7 @@ if (COAX56)
     pitch_trim = 0.0921;
 else
     pid = nav_msgs_Odometry('connect','subscriber','odom57','odom57');
-    iid = geometry_msgs_Quaternion('connect','subscriber','coax_info57','coax_info57');
+    sid = nav_msgs_Odometry('connect','subscriber','coax_state57','coax_state57');
     mid = std_msgs_Bool('connect','publisher','nav_mode57','nav_mode57');
     cid = geometry_msgs_Quaternion('connect','publisher','raw_control57','raw_control57');
     cmid = geometry_msgs_Quaternion('connect','subscriber','control_mode57','control_mode57');
@@ -122,10 +121,11 @@ if (~isempty(mode) && (int8(mode.x)~=last_ctrl_mode_request))
             if (CONTROL_MODE == CONTROL_LANDED)
                 % make sure CoaX is in NAV_RAW_MODE
                 % necessary to allow control inputs
-                info = geometry_msgs_Quaternion('read',iid,1);
-                while (isempty(info))
-                    info = geometry_msgs_Quaternion('read',iid,1);
+                coax_state = nav_msgs_Odometry('read',sid,1);
+                while (isempty(coax_state))
+                    coax_state = nav_msgs_Odometry('read',sid,1);
                 end
+                info = coax_state.pose.pose.position; % [nav_mode battery 0]
                 
                 if ((0.8817*info.y + 1.5299) > 11)
                     if (info.x < 5)
@@ -188,8 +188,9 @@ if (~isempty(mode) && (int8(mode.x)~=last_ctrl_mode_request))
 end
 
 %% Low power and Communication loss detection
-info = geometry_msgs_Quaternion('read',iid,1);
-if (~isempty(info)) % if empty catch it the next time
+coax_state = nav_msgs_Odometry('read',sid,1);
+if (~isempty(coax_state)) % if empty catch it the next time
+    info = coax_state.pose.pose.position; % [nav_mode battery 0]
     if (((0.8817*info.y + 1.5299) < 10.80) && ~LOW_POWER_DETECTED)
         LOW_POWER_DETECTED = 1;
         fprintf('Battery Low!!! (%fV) Landing initialized \n',0.8817*info.y + 1.5299);
@@ -224,8 +225,8 @@ roll = atan2(Rb2w(3,2),Rb2w(3,3));
 pitch = asin(-Rb2w(3,1));
 yaw = atan2(Rb2w(2,1),Rb2w(1,1));
 
-imu = geometry_msgs_Quaternion('read',imuid,1);
-if (~isempty(imu))
+if (~isempty(coax_state))
+    imu = coax_state.twist.twist.angular;
     imu_p = imu.x;
     imu_q = imu.y;
     imu_r = imu.z;
@@ -651,8 +652,7 @@ end
 %%%%%%%%%
 
 nav_msgs_Odometry('disconnect',pid);
-geometry_msgs_Quaternion('disconnect',iid);
-geometry_msgs_Quaternion('disconnect',imuid);
+nav_msgs_Odometry('disconnect',sid);
 std_msgs_Bool('disconnect',mid);
 geometry_msgs_Quaternion('disconnect',cid);
 geometry_msgs_Quaternion('disconnect',cmid);
@@ -0,0 +1,69 @@
+%=================================
+%%% Trace of control_function
+%=================================
+
+% Writes control_function inputs and outputs for random flight states to
+% ../coax_ros_control/test/control_trace.txt, checked against the C++
+% ControlLaw by coax_ros_control/bin/coax_control_trace. Uses the nominal
+% parameters of parameter.m and the gains of control_parameter.m, the
+% identified nlgr_vel_ocf parameters are not needed.
+%
+% Line 1: m l_up l_lo k_Tup k_Tlo k_Mup k_Mlo rs_mup rs_bup rs_mlo rs_blo
+%         zeta_mup zeta_bup zeta_mlo zeta_blo max_SPangle
+% Line 2: Kp_Fx Kp_Fy Kd_Fx Kd_Fy Kpq_pitch Kpq_roll Kp_Fz Kd_Fz Kp_Mz Kd_Mz
+% Then one line per call: state (17), Rb2w row by row (9), trajectory (11),
+% motor_up motor_lo servo1 servo2
+
+run parameter
+run control_parameter
+% used by the LQR path only, which is commented out in control_function
+contr_param.K_lqr = [];
+contr_param.T_inv_lqr = [];
+contr_param.W_lqr = [];
+
+SAMPLES = 500;
+rand('state',1);
+
+fid = fopen('../coax_ros_control/test/control_trace.txt','w');
+fprintf(fid,'%.17g ',[m l_up l_lo k_Tup k_Tlo k_Mup k_Mlo rs_mup rs_bup rs_mlo rs_blo ...
+    zeta_mup zeta_bup zeta_mlo zeta_blo max_SPangle]);
+fprintf(fid,'\n');
+% heave and yaw gains as set in control_function
+fprintf(fid,'%.17g ',[K_p(1,1) K_p(2,2) K_v(1,1) K_v(2,2) K_pq(1,1) K_pq(2,2) ...
+    20*m 10*m 50*Izz 6*Izz]);
+fprintf(fid,'\n');
+
+for i = 1:SAMPLES
+    u = @(a,b) a + (b-a)*rand;
+    if (i <= 10)
+        % hover, the bar and the swashplate upright
+        roll = 0; pitch = 0; yaw = u(-pi,pi);
+        pqr = [0 0 0];
+        e = zeros(1,6);
+        z_bar = [0 0 1];
+        psi_T = yaw; psidot_T = 0;
+    else
+        roll = u(-0.2,0.2); pitch = u(-0.2,0.2); yaw = u(-pi,pi);
+        pqr = [u(-1,1) u(-1,1) u(-1,1)];
+        e = [u(-0.2,0.2) u(-0.2,0.2) u(-0.2,0.2) u(-0.3,0.3) u(-0.3,0.3) u(-0.3,0.3)];
+        tilt = u(0,0.1); dir = u(-pi,pi);
+        z_bar = [sin(tilt)*cos(dir) sin(tilt)*sin(dir) cos(tilt)];
+        % across the +-pi wrap as well
+        psi_T = yaw + u(-0.3,0.3) + 2*pi*round(u(-1,1));
+        psidot_T = u(-1,1);
+    end
+    Rb2w = [cos(yaw)*cos(pitch) cos(yaw)*sin(pitch)*sin(roll)-sin(yaw)*cos(roll) cos(yaw)*sin(pitch)*cos(roll)+sin(yaw)*sin(roll);
+            sin(yaw)*cos(pitch) sin(yaw)*sin(pitch)*sin(roll)+cos(yaw)*cos(roll) sin(yaw)*sin(pitch)*cos(roll)-cos(yaw)*sin(roll);
+            -sin(pitch) cos(pitch)*sin(roll) cos(pitch)*cos(roll)];
+    state = [e roll pitch yaw pqr u(200,260) u(200,260) z_bar]';
+    trajectory = [0 0 0 0 0 0 0 0 0 psi_T psidot_T]';
+
+    [motor_up, motor_lo, servo1, servo2] = control_function(state, Rb2w, trajectory, zeros(4,1), 0.01, param, contr_param);
+    out = [motor_up motor_lo servo1 servo2];
+    if (any(imag(out) ~= 0))
+        continue;
+    end
+    fprintf(fid,'%.17g ',[state' reshape(Rb2w',1,9) trajectory' out]);
+    fprintf(fid,'\n');
+end
+fclose(fid);
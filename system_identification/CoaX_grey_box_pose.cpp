@@ -22,12 +22,18 @@
       4) Specify the output equations in COMPUTE_Y below.
       5) Build the MEX file using
             >> mex mymodel.c
+
+   This file is C++ to share the rotor and stabilizer bar kernels with the
+   simulator and the controller, build it with
+            >> mex -I../coax_dynamics/include CoaX_grey_box_pose.cpp
 */
 
 /* Include libraries. */
 #include "mex.h"
 #include "math.h"
 
+#include "coax_dynamics/CoaXKernels.h"
+
 /* Specify the number of outputs here. */
 #define NY 6
 
@@ -68,16 +74,10 @@ void compute_dx(
     double Ixx         = *(p[2]);
     double Iyy         = *(p[3]);
     double Izz         = *(p[4]);
-    double d_up        = *(p[5]);
-    double d_lo        = *(p[6]);
-    double k_springup  = *(p[7]);
-    double k_springlo  = *(p[8]);
     double l_up        = *(p[9]);
     double l_lo        = *(p[10]);
     double k_Tup       = *(p[11]);
     double k_Tlo       = *(p[12]);
-    double k_Mup       = *(p[13]);
-    double k_Mlo       = *(p[14]);
     double Tf_motup    = *(p[15]);
     double Tf_motlo    = *(p[16]);
     double Tf_up       = *(p[17]);
@@ -97,118 +97,57 @@ void compute_dx(
     x[15] = z_bary/norm_z_bar;
     x[16] = z_barz/norm_z_bar;
 
-    // Upper thrust vector direction
-    double z_Tupz = cos(l_up*acos(z_barz));
-    double z_Tup_p[3] = {0,0,1};
-    if (z_Tupz < 1){
-      double temp = sqrt((1-z_Tupz*z_Tupz)/(z_barx*z_barx + z_bary*z_bary));
-        z_Tup_p[0] = z_barx*temp;
-        z_Tup_p[1] = z_bary*temp;
-        z_Tup_p[2] = z_Tupz;
-    }
-    double zeta = zeta_mup*Omega_up + zeta_bup;
+    // Identified parameters as PARAM_*, p[1] is g
+    double theta[MODEL_PARAMETERS];
+    theta[PARAM_MASS] = m;
+    for (i = PARAM_IXX; i < MODEL_PARAMETERS; i++)
+      theta[i] = *(p[i+1]);
+
+    // Thrust vector directions
+    double z_bar[3] = {z_barx, z_bary, z_barz};
     double z_Tup[3];
-    z_Tup[0] = cos(zeta)*z_Tup_p[0] - sin(zeta)*z_Tup_p[1];
-    z_Tup[1] = sin(zeta)*z_Tup_p[0] + cos(zeta)*z_Tup_p[1];
-    z_Tup[2] = z_Tup_p[2];
+    UpperThrustDirection(z_bar, l_up, zeta_mup*Omega_up + zeta_bup, z_Tup);
 
-    // Lower thrust vector direction
-    double a_SP = u_serv1*max_SPangle;
-    double b_SP = u_serv2*max_SPangle;
     double z_SP[3];
-    z_SP[0] = sin(b_SP);
-    z_SP[1] = -sin(a_SP)*cos(b_SP);
-    z_SP[2] = cos(a_SP)*cos(b_SP);
-    double z_Tloz = cos(l_lo*acos(z_SP[2]));
-    double z_Tlo_p[3] = {0,0,1};
-    if (z_Tloz < 1){
-      double temp = sqrt((1-z_Tloz*z_Tloz)/(z_SP[0]*z_SP[0] + z_SP[1]*z_SP[1]));
-        z_Tlo_p[0] = z_SP[0]*temp;
-        z_Tlo_p[1] = z_SP[1]*temp;
-        z_Tlo_p[2] = z_Tloz;
-    }
-    zeta = zeta_mlo*Omega_lo + zeta_blo;
     double z_Tlo[3];
-    z_Tlo[0] = cos(zeta)*z_Tlo_p[0] + sin(zeta)*z_Tlo_p[1];
-    z_Tlo[1] = -sin(zeta)*z_Tlo_p[0] + cos(zeta)*z_Tlo_p[1];
-    z_Tlo[2] = z_Tlo_p[2];
+    SwashPlateDirection(u_serv1, u_serv2, max_SPangle, z_SP);
+    LowerThrustDirection(z_SP, l_lo, zeta_mlo*Omega_lo + zeta_blo, z_Tlo);
 
     // Coordinate transformation body to world coordinates
-    double c_r = cos(roll);
-    double s_r = sin(roll);
-    double c_p = cos(pitch);
-    double s_p = sin(pitch);
-    double c_y = cos(yaw);
-    double s_y = sin(yaw);
-
-    double Rb2w0[3];
-    Rb2w0[0] = c_p*c_y; // first row of Rb2w
-    Rb2w0[1] = s_r*s_p*c_y - c_r*s_y;
-    Rb2w0[2] = c_r*s_p*c_y + s_r*s_y;
-
-    double Rb2w1[3];
-    Rb2w1[0] = c_p*s_y; // second row of Rb2w
-    Rb2w1[1] = s_r*s_p*s_y + c_r*c_y;
-    Rb2w1[2] = c_r*s_p*s_y - s_r*c_y;
-
-    double Rb2w2[3];
-    Rb2w2[0] = -s_p; // third row of Rb2w
-    Rb2w2[1] = s_r*c_p;
-    Rb2w2[2] = c_r*c_p;
-
-    // Flapping Moments
-    double cp[3];
-    cp[0] = -z_Tup[1]; // z_b x z_Tup
-    cp[1] = z_Tup[0];
-    cp[2] = 0;
-    double norm_cp = sqrt(cp[0]*cp[0] + cp[1]*cp[1] + cp[2]*cp[2]);
-    double M_flapup[3] = {0,0,0};
-    if (fabs(norm_cp) > 1e-6){
-        M_flapup[0] = 2*k_springup*cp[0]/norm_cp*acos(z_Tup[2]);
-        M_flapup[1] = 2*k_springup*cp[1]/norm_cp*acos(z_Tup[2]);
-        M_flapup[2] = 2*k_springup*cp[2]/norm_cp*acos(z_Tup[2]);
-    }
+    double Rb2w[3][3];
+    EulerToRotation(roll, pitch, yaw, Rb2w);
 
-    cp[0] = -z_Tlo[1]; // z_b x z_Tlo
-    cp[1] = z_Tlo[0];
-    cp[2] = 0;
-    norm_cp = sqrt(cp[0]*cp[0] + cp[1]*cp[1] + cp[2]*cp[2]);
-    double M_flaplo[3] = {0,0,0};
-    if (fabs(norm_cp) > 1e-6){
-        M_flaplo[0] = 2*k_springlo*cp[0]/norm_cp*acos(z_Tlo[2]);
-        M_flaplo[1] = 2*k_springlo*cp[1]/norm_cp*acos(z_Tlo[2]);
-        M_flaplo[2] = 2*k_springlo*cp[2]/norm_cp*acos(z_Tlo[2]);
-    }
-
-    // Thrust magnitudes
-    double T_up = k_Tup*Omega_up*Omega_up;
-    double T_lo = k_Tlo*Omega_lo*Omega_lo;
+    // Summarized Forces and Moments
+    double F_thrust[3];
+    double M_rotors[3];
+    RotorForcesMoments(theta, RotorThrust(k_Tup, Omega_up), RotorThrust(k_Tlo, Omega_lo),
+                       Omega_up, Omega_lo, z_Tup, z_Tlo, F_thrust, M_rotors);
 
-    // Summarized Forces
     double Fx = 0;
     double Fy = 0;
     double Fz = 0;
 
     for(i=0; i<3; i++){
-      Fx += Rb2w0[i]*(T_up*z_Tup[i] + T_lo*z_Tlo[i]);
-      Fy += Rb2w1[i]*(T_up*z_Tup[i] + T_lo*z_Tlo[i]);
-      Fz += Rb2w2[i]*(T_up*z_Tup[i] + T_lo*z_Tlo[i]);
+      Fx += Rb2w[0][i]*F_thrust[i];
+      Fy += Rb2w[1][i]*F_thrust[i];
+      Fz += Rb2w[2][i]*F_thrust[i];
     }
     Fz -= m*g;
 
-    // Summarized Moments
-    double Mx =
-      wq*wr*(Iyy-Izz) - T_up*z_Tup[1]*d_up - T_lo*z_Tlo[1]*d_lo + M_flapup[0] + M_flaplo[0];
-    double My =
-      wp*wr*(Izz-Ixx) + T_up*z_Tup[0]*d_up + T_lo*z_Tlo[0]*d_lo + M_flapup[1] + M_flaplo[1];
-    double Mz =
-      wp*wq*(Ixx-Iyy) - k_Mup*Omega_up*Omega_up + k_Mlo*Omega_lo*Omega_lo;
+    double Mx = wq*wr*(Iyy-Izz) + M_rotors[0];
+    double My = wp*wr*(Izz-Ixx) + M_rotors[1];
+    double Mz = wp*wq*(Ixx-Iyy) + M_rotors[2];
 
     // State derivatives
     double xddot = 1.0/m*Fx;
     double yddot = 1.0/m*Fy;
     double zddot = 1.0/m*Fz;
 
+    double c_r = cos(roll);
+    double s_r = sin(roll);
+    double c_p = cos(pitch);
+    double s_p = sin(pitch);
+
     double rolldot  = wp + wq*s_r*s_p/c_p + wr*c_r*s_p/c_p;
     double pitchdot = wq*c_r - wr*s_r;
     double yawdot   = wq*s_r/c_p + wr*c_r/c_p;
@@ -222,18 +161,9 @@ void compute_dx(
     double Omega_updot  = 1/Tf_motup*(Omega_up_des - Omega_up);
     double Omega_lodot  = 1/Tf_motlo*(Omega_lo_des - Omega_lo);
 
-    double b_z_bardotz = 1/Tf_up*acos(z_barz)*sqrt(z_barx*z_barx + z_bary*z_bary);
-    double b_z_bardot[3] = {0,0,0};
-    if (fabs(b_z_bardotz) > 1e-6){
-      double temp          = z_barz*b_z_bardotz/(z_barx*z_barx + z_bary*z_bary);
-        b_z_bardot[0] = -z_barx*temp;
-        b_z_bardot[1] = -z_bary*temp;
-        b_z_bardot[2] = b_z_bardotz;
-    }
-
-    double z_barxdot = b_z_bardot[0] - wq*z_barz + wr*z_bary;
-    double z_barydot = b_z_bardot[1] - wr*z_barx + wp*z_barz;
-    double z_barzdot = b_z_bardot[2] - wp*z_bary + wq*z_barx;
+    double omega[3] = {wp, wq, wr};
+    double z_bardot[3];
+    StabilizerBarDerivative(z_bar, Tf_up, omega, z_bardot);
 
     dx[0]  = x[3];
     dx[1]  = x[4];
@@ -249,9 +179,9 @@ void compute_dx(
     dx[11] = rdot;
     dx[12] = Omega_updot;
     dx[13] = Omega_lodot;
-    dx[14] = z_barxdot;
-    dx[15] = z_barydot;
-    dx[16] = z_barzdot;
+    dx[14] = z_bardot[0];
+    dx[15] = z_bardot[1];
+    dx[16] = z_bardot[2];
 
 }
 
@@ -315,7 +245,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
     x = mxGetPr(prhs[1]);  /* States at time t. */
     u = mxGetPr(prhs[2]);  /* Inputs at time t. */
 
-    p = mxCalloc(np, sizeof(double*));
+    p = (double**)mxCalloc(np, sizeof(double*));
     for (i = 0; i < np; i++) {
         p[i] = mxGetPr(prhs[3+i]); /* Parameter arrays. */
     }